@@ -0,0 +1,250 @@
+#ifndef Moca_assembly_alloc_profile
+#define Moca_assembly_alloc_profile
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <malloc.h>
+
+/* Opt-in allocation accounting.
+ * Build with `-DMASM_ALLOC_PROFILE` (`make alloc-profile`) and every `operator new`/`malloc` the assembler
+ * does gets counted against the phase it happened in and the source lines being assembled at the time.
+ * Phases are the categories of the `MASM_TRACE_SPAN`s (see `asm_trace.hpp`), so no extra instrumentation is needed.
+ * Without `MASM_ALLOC_PROFILE` none of the hooks exist and every `MASM_ALLOC_*` macro compiles to nothing.
+ * */
+#ifdef MASM_ALLOC_PROFILE
+namespace masm_alloc
+{
+
+/* Allocations are bucketed by source line; each bucket covers `line_range` lines. */
+constexpr ut_DWORD line_range = 64;
+constexpr ut_DWORD max_line_buckets = 4096;
+constexpr ut_BYTE max_phases = 16;
+
+enum class AllocKind
+{
+    AK_new,     // `operator new`/`operator new[]`
+    AK_malloc   // `malloc`/`calloc`/`realloc`
+};
+
+/* `peak` is the highest amount of live (allocated, not yet freed) memory in the whole process
+ * seen while allocating in this phase/line range; a block is often freed somewhere else than it was allocated.
+ * */
+struct alloc_counters
+{
+    std::atomic<ut_LLBYTE>  count{0};
+    std::atomic<ut_LLBYTE>  bytes{0};
+    std::atomic<nt_LLBYTE>  peak{0};
+
+    void add(ut_LSIZE size, nt_LLBYTE live)
+    {
+        count.fetch_add(1, std::memory_order_relaxed);
+        bytes.fetch_add(size, std::memory_order_relaxed);
+
+        nt_LLBYTE old_peak = peak.load(std::memory_order_relaxed);
+        while(live > old_peak && !peak.compare_exchange_weak(old_peak, live, std::memory_order_relaxed));
+    }
+};
+
+/* Everything here is constant-initialized, so it is safe to use from allocations made before `main`. */
+struct alloc_profile
+{
+    alloc_counters          total;
+    std::atomic<nt_LLBYTE>  live{0};
+    alloc_counters          by_kind[2];
+
+    /* `phase_names[0]` is everything that happens outside of a span. */
+    const nt_BYTE           *phase_names[max_phases] = {"(none)"};
+    ut_BYTE                 amnt_of_phases = 1;
+    alloc_counters          by_phase[max_phases];
+    std::mutex              phase_lock;
+
+    alloc_counters          by_lines[max_line_buckets];
+    std::atomic<ut_DWORD>   last_line{0};
+    std::atomic<ut_LLBYTE>  source_bytes{0};
+};
+
+inline alloc_profile profile;
+
+/* What the calling thread is doing right now. Set by the trace spans and the parser. */
+inline thread_local ut_BYTE current_phase = 0;
+inline thread_local ut_DWORD current_line = 0;
+
+inline ut_BYTE phase_index(const nt_BYTE *name)
+{
+    for(ut_BYTE i = 0; i < profile.amnt_of_phases; i++)
+        if(profile.phase_names[i] == name || strcmp(profile.phase_names[i], name) == 0) return i;
+
+    std::lock_guard<std::mutex> guard(profile.phase_lock);
+    for(ut_BYTE i = 0; i < profile.amnt_of_phases; i++)
+        if(strcmp(profile.phase_names[i], name) == 0) return i;
+
+    if(profile.amnt_of_phases == max_phases) return 0;
+    profile.phase_names[profile.amnt_of_phases] = name;
+    return profile.amnt_of_phases++;
+}
+
+/* Scoped phase; allocations made until it goes out of scope are charged to `name`. */
+class phase_scope
+{
+private:
+    ut_BYTE previous_phase;
+
+public:
+    phase_scope(const nt_BYTE *name)
+    {
+        previous_phase = current_phase;
+        current_phase = phase_index(name);
+    }
+
+    ~phase_scope()
+    { current_phase = previous_phase; }
+};
+
+inline void on_alloc(AllocKind kind, void *ptr, ut_LSIZE size)
+{
+    if(!ptr) return;
+
+    ut_LSIZE usable = malloc_usable_size(ptr);
+    ut_DWORD bucket = current_line / line_range;
+    if(bucket >= max_line_buckets) bucket = max_line_buckets - 1;
+
+    nt_LLBYTE live = profile.live.fetch_add(usable, std::memory_order_relaxed) + usable;
+
+    profile.total.add(size, live);
+    profile.by_kind[(ut_BYTE) kind].add(size, live);
+    profile.by_phase[current_phase].add(size, live);
+    profile.by_lines[bucket].add(size, live);
+}
+
+inline void on_free(void *ptr)
+{
+    if(!ptr) return;
+
+    profile.live.fetch_sub(malloc_usable_size(ptr), std::memory_order_relaxed);
+}
+
+inline void set_line(ut_DWORD line)
+{
+    current_line = line;
+    if(line > profile.last_line.load(std::memory_order_relaxed)) profile.last_line.store(line, std::memory_order_relaxed);
+}
+
+inline void add_source_bytes(ut_LSIZE bytes)
+{ profile.source_bytes.fetch_add(bytes, std::memory_order_relaxed); }
+
+inline void print_counters(const nt_BYTE *name, alloc_counters &counters, bool with_peak)
+{
+    if(counters.count.load() == 0) return;
+
+    MASM_report("\t%-24s %12llu allocs %14llu bytes",
+        name, counters.count.load(), counters.bytes.load());
+    if(with_peak) MASM_report(" %12lld peak live bytes", counters.peak.load());
+    MASM_report("\n");
+}
+
+/* Allocations per KB of assembled source; the number the regression gate (`--alloc-gate=N`) checks. */
+inline double allocs_per_KB()
+{
+    ut_LLBYTE source = profile.source_bytes.load();
+    return source ? (double) profile.total.count.load() / ((double) source / 1024.0) : 0.0;
+}
+
+inline void report()
+{
+    MASM_report("\n%s[ALLOCATION PROFILE]%s\n", yellow, white);
+    print_counters("total", profile.total, true);
+    print_counters("operator new", profile.by_kind[(ut_BYTE) AllocKind::AK_new], false);
+    print_counters("malloc/calloc/realloc", profile.by_kind[(ut_BYTE) AllocKind::AK_malloc], false);
+    MASM_report("\t%.2f allocations per KB of source (%llu source bytes)\n",
+        allocs_per_KB(), profile.source_bytes.load());
+
+    MASM_report("\n\tBy phase:\n");
+    for(ut_BYTE i = 0; i < profile.amnt_of_phases; i++)
+        print_counters(profile.phase_names[i], profile.by_phase[i], true);
+
+    MASM_report("\n\tBy source lines:\n");
+    ut_DWORD last_bucket = profile.last_line.load() / line_range;
+    for(ut_DWORD i = 0; i <= last_bucket && i < max_line_buckets; i++)
+    {
+        nt_BYTE range[32];
+        snprintf(range, sizeof(range), "lines %u-%u", i ? i * line_range : 1, (i + 1) * line_range - 1);
+        print_counters(range, profile.by_lines[i], true);
+    }
+}
+
+}
+
+#define MASM_ALLOC_PHASE(name)      masm_alloc::phase_scope MASM_ALLOC_CONCAT(masm_alloc_phase_, __LINE__)(name)
+#define MASM_ALLOC_AT_LINE(line)    masm_alloc::set_line(line)
+#define MASM_ALLOC_SOURCE(bytes)    masm_alloc::add_source_bytes(bytes)
+#define MASM_ALLOC_CONCAT_(a, b)    a##b
+#define MASM_ALLOC_CONCAT(a, b)     MASM_ALLOC_CONCAT_(a, b)
+
+/* The hooks themselves. `malloc` and friends are interposed over glibc's, so allocations made
+ * by the standard library on our behalf (`std::string`, `std::vector`, ...) are counted too.
+ * */
+extern "C"
+{
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t amount, size_t size);
+    void *__libc_realloc(void *ptr, size_t size);
+    void __libc_free(void *ptr);
+
+    void *malloc(size_t size) noexcept
+    {
+        void *ptr = __libc_malloc(size);
+        masm_alloc::on_alloc(masm_alloc::AllocKind::AK_malloc, ptr, size);
+        return ptr;
+    }
+
+    void *calloc(size_t amount, size_t size) noexcept
+    {
+        void *ptr = __libc_calloc(amount, size);
+        masm_alloc::on_alloc(masm_alloc::AllocKind::AK_malloc, ptr, amount * size);
+        return ptr;
+    }
+
+    /* A `realloc` counts as freeing the old block and allocating a new one. */
+    void *realloc(void *ptr, size_t size) noexcept
+    {
+        masm_alloc::on_free(ptr);
+        void *new_ptr = __libc_realloc(ptr, size);
+        masm_alloc::on_alloc(masm_alloc::AllocKind::AK_malloc, new_ptr, size);
+        return new_ptr;
+    }
+
+    void free(void *ptr) noexcept
+    {
+        masm_alloc::on_free(ptr);
+        __libc_free(ptr);
+    }
+}
+
+inline void *masm_counted_new(size_t size)
+{
+    void *ptr = __libc_malloc(size ? size : 1);
+    if(!ptr) throw std::bad_alloc();
+
+    masm_alloc::on_alloc(masm_alloc::AllocKind::AK_new, ptr, size);
+    return ptr;
+}
+
+inline void masm_counted_delete(void *ptr) noexcept
+{
+    masm_alloc::on_free(ptr);
+    __libc_free(ptr);
+}
+
+void *operator new(size_t size) { return masm_counted_new(size); }
+void *operator new[](size_t size) { return masm_counted_new(size); }
+void operator delete(void *ptr) noexcept { masm_counted_delete(ptr); }
+void operator delete[](void *ptr) noexcept { masm_counted_delete(ptr); }
+void operator delete(void *ptr, size_t) noexcept { masm_counted_delete(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { masm_counted_delete(ptr); }
+#else
+#define MASM_ALLOC_PHASE(name)
+#define MASM_ALLOC_AT_LINE(line)
+#define MASM_ALLOC_SOURCE(bytes)
+#endif
+
+#endif
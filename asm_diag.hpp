@@ -0,0 +1,298 @@
+#ifndef Moca_assembly_diag
+#define Moca_assembly_diag
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/* Lowest severity that gets compiled in at all (see `DiagSeverity`); `make debug` builds with 0.
+ * Anything below it expands to nothing, so a build without debug output has no I/O code for it.
+ * */
+#ifndef MASM_DIAG_LEVEL
+#define MASM_DIAG_LEVEL 1
+#endif
+
+namespace masm_diag
+{
+
+enum class DiagSeverity
+{
+    DS_debug,       // `[DEBUG]` lines; stdout
+    DS_report,      // `--ir-stats`, `-O`, `--link` and allocation reports; stderr
+    DS_warning,     // stderr
+    DS_error        // stderr, then the process exits; never compiled out
+};
+
+constexpr DiagSeverity min_severity = (DiagSeverity) MASM_DIAG_LEVEL;
+
+/* What `MASM_error` throws on a thread that can recover from it (see `set_recoverable`); caught by the parser, per statement. */
+struct recoverable_error
+{};
+
+/* What `MASM_error` throws on a thread that defers its errors (see `set_deferring`): the diagnostic, formatted but not
+ * written or counted. The lexer hands it to the parser in its token stream, and the parser `raise`s it once it gets there,
+ * so it comes out where and when it would have serially.
+ * */
+struct deferred_error
+{
+    std::string diagnostic;
+};
+
+/* Everything written while a file is being assembled; written out in one piece once it is done,
+ * so the output of files assembled at the same time does not interleave.
+ * */
+struct diag_buffer
+{
+    std::string out;
+    std::string err;
+};
+
+/* Every diagnostic is formatted into a buffer and only written once the buffer gets large, the assembler exits
+ * or a file is done, instead of being flushed line by line.
+ * */
+class MocaAsm_diag_sink
+{
+private:
+    static constexpr ut_LSIZE flush_bytes = 64 * 1024;
+
+    std::mutex                  lock;
+    struct diag_buffer          pending;
+
+    /* Buffers of the files being assembled, in the order they were opened. */
+    std::vector<struct diag_buffer *> open_files;
+
+    /* `--max-errors=`: how many errors a run reports before it stops. Errors past the first one can only be
+     * recovered from on a thread that can recover (the parser's; see `set_recoverable`).
+     * */
+    ut_DWORD                    error_limit = 1;
+    std::atomic<ut_DWORD>       amnt_of_errors = 0;
+
+    static bool &recoverable_of_thread()
+    {
+        static thread_local bool recoverable = false;
+        return recoverable;
+    }
+
+    static bool &deferring_of_thread()
+    {
+        static thread_local bool deferring = false;
+        return deferring;
+    }
+
+    /* The error a deferring thread is formatting; what `fail` throws. */
+    static std::string &deferred_of_thread()
+    {
+        static thread_local std::string deferred;
+        return deferred;
+    }
+
+    /* The file the calling thread is assembling, if any; anything else goes straight to `pending`. */
+    static struct diag_buffer *&file_of_thread()
+    {
+        static thread_local struct diag_buffer *file = nullptr;
+        return file;
+    }
+
+    static void append(std::string &into, const nt_BYTE *msg, va_list args)
+    {
+        nt_BYTE formatted[512];
+        va_list again;
+        va_copy(again, args);
+
+        nt_DWORD length = vsnprintf(formatted, sizeof(formatted), msg, args);
+        if(length < 0) length = 0;
+
+        if((ut_LSIZE) length < sizeof(formatted)) into.append(formatted, length);
+        else
+        {
+            ut_LSIZE at = into.size();
+            into.resize(at + length + 1);
+            vsnprintf(&into[at], length + 1, msg, again);
+            into.resize(at + length);
+        }
+
+        va_end(again);
+    }
+
+    void write_pending()
+    {
+        /* stdout first; the error that ends the assembler comes last. */
+        if(!pending.out.empty()) fwrite(pending.out.data(), sizeof(nt_BYTE), pending.out.size(), stdout);
+        fflush(stdout);
+        if(!pending.err.empty()) fwrite(pending.err.data(), sizeof(nt_BYTE), pending.err.size(), stderr);
+        fflush(stderr);
+
+        pending.out.clear();
+        pending.err.clear();
+    }
+
+    /* Write out everything there is (every open file first, in order) and exit. */
+    [[noreturn]] void write_all_and_exit()
+    {
+        lock.lock();
+
+        std::string out, err;
+        for(struct diag_buffer *file : open_files)
+        {
+            out += file->out;
+            err += file->err;
+            file->out.clear();
+            file->err.clear();
+        }
+        pending.out.insert(0, out);
+        pending.err.insert(0, err);
+
+        write_pending();
+        exit(EXIT_FAILURE);
+    }
+
+public:
+    void emit(DiagSeverity severity, const nt_BYTE *msg, ...)
+    {
+        va_list args;
+        va_start(args, msg);
+
+        if(severity == DiagSeverity::DS_error && deferring_of_thread())
+        {
+            append(deferred_of_thread(), msg, args);
+            va_end(args);
+            return;
+        }
+
+        std::lock_guard<std::mutex> guard(lock);
+        struct diag_buffer *into = file_of_thread() ? file_of_thread() : &pending;
+
+        append(severity == DiagSeverity::DS_debug ? into->out : into->err, msg, args);
+        va_end(args);
+
+        if(into == &pending && pending.out.size() + pending.err.size() >= flush_bytes) write_pending();
+    }
+
+    /* What `MASM_error` ends with. On a thread that can recover, with errors to spare, it throws `recoverable_error`;
+     * every frame it unwinds gets cleaned up as usual.
+     * */
+    [[noreturn]] void fail()
+    {
+        if(deferring_of_thread())
+        {
+            struct deferred_error error = {std::move(deferred_of_thread())};
+            deferred_of_thread().clear();
+            throw error;
+        }
+
+        ut_DWORD errors = ++amnt_of_errors;
+
+        if(recoverable_of_thread() && errors < error_limit) throw recoverable_error();
+        if(errors > 1)
+            emit(DiagSeverity::DS_error, "\n%s[ERRORS]%s\tStopping after %u errors (%s`--max-errors=%u`%s).\n",
+                red, white,
+                errors,
+                green, error_limit, white);
+
+        write_all_and_exit();
+    }
+
+    /* A `deferred_error` reaching the thread that would have run into it serially; reported and counted as if it just happened. */
+    [[noreturn]] void raise(const std::string &diagnostic)
+    {
+        emit(DiagSeverity::DS_error, "%s", diagnostic.c_str());
+        fail();
+    }
+
+    /* Exit if any error was recovered from; nothing after the parser can work with a program that has errors. */
+    void stop_on_errors()
+    {
+        ut_DWORD errors = amnt_of_errors.load();
+        if(errors == 0) return;
+
+        emit(DiagSeverity::DS_error, "\n%s[ERRORS]%s\t%u error(s); nothing was written.\n",
+            red, white,
+            errors);
+        write_all_and_exit();
+    }
+
+    void set_error_limit(ut_DWORD limit)
+    { error_limit = limit; }
+
+    ut_DWORD get_error_limit()
+    { return error_limit; }
+
+    /* Errors on the calling thread throw `recoverable_error` rather than end the run, as long as `--max-errors=`
+     * allows more than one; `false` takes it away again.
+     * */
+    void set_recoverable(bool recoverable)
+    { recoverable_of_thread() = recoverable && error_limit > 1; }
+
+    /* Errors on the calling thread throw `deferred_error` instead of being reported; for threads that lex ahead of the parser. */
+    void set_deferring(bool deferring)
+    { deferring_of_thread() = deferring; }
+
+    void flush()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        write_pending();
+    }
+
+    /* Give the calling thread its own buffer (see `file_scope`); closing it hands it on to be written. */
+    void open_file(struct diag_buffer *file)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        open_files.push_back(file);
+        file_of_thread() = file;
+    }
+
+    void close_file(struct diag_buffer *file)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        pending.out += file->out;
+        pending.err += file->err;
+        for(ut_LSIZE i = 0; i < open_files.size(); i++)
+            if(open_files[i] == file) { open_files.erase(open_files.begin() + i);break; }
+
+        if(file_of_thread() == file) file_of_thread() = nullptr;
+        write_pending();
+    }
+
+    ~MocaAsm_diag_sink()
+    {
+        write_pending();
+    }
+};
+
+/* One sink for the whole process. */
+inline MocaAsm_diag_sink sink;
+
+/* Scoped (RAII): diagnostics the calling thread writes while assembling one file. */
+class file_scope
+{
+private:
+    struct diag_buffer buffer;
+
+public:
+    file_scope()
+    { sink.open_file(&buffer); }
+
+    ~file_scope()
+    { sink.close_file(&buffer); }
+};
+
+}
+
+#define MASM_DIAG_EMIT(severity, msg, ...)                                  \
+{                                                                           \
+    if constexpr(severity >= masm_diag::min_severity)                       \
+        masm_diag::sink.emit(severity, nt_BYTE_CPTR msg, ##__VA_ARGS__);     \
+}
+
+#if MASM_DIAG_LEVEL <= 0
+#define MASM_debug(msg, ...)    MASM_DIAG_EMIT(masm_diag::DiagSeverity::DS_debug, msg, ##__VA_ARGS__)
+#else
+#define MASM_debug(msg, ...)
+#endif
+
+#define MASM_report(msg, ...)   MASM_DIAG_EMIT(masm_diag::DiagSeverity::DS_report, msg, ##__VA_ARGS__)
+
+#endif
@@ -0,0 +1,252 @@
+#ifndef Moca_assembly_elf
+#define Moca_assembly_elf
+#include <elf.h>
+#include <string>
+#include <vector>
+#include "assembler_backend/asm_ir.hpp"
+
+/* `-OF elf32`: an ELF32 relocatable object (`ET_REL`, `EM_386`), so units can be assembled on their own and linked later.
+ *
+ *      ELF header
+ *      contents of `.text`, `.init`, `.rodata`, `.data` (`.bss` only has a section header)
+ *      `.rel.text`, `.rel.data`, ...   (REL; the addend is already in place)
+ *      `.symtab`                       (one `STT_SECTION` symbol per section, then every label/variable as a global,
+ *                                       then every symbol that is used but not defined, as an undefined global)
+ *      `.strtab`, `.shstrtab`
+ *      section header table
+ *
+ * Every label/variable is exported; MocaAsm has no `global`/`extern`, a name that is not defined in the unit is expected from another one.
+ * */
+namespace masm_elf
+{
+
+using namespace masm_ir;
+
+class MocaAsm_elf_writer
+{
+private:
+    std::vector<ut_BYTE>    file;
+    std::string             strtab = std::string(1, '\0');
+    std::string             shstrtab = std::string(1, '\0');
+    std::vector<Elf32_Shdr> section_headers;
+
+    static ut_DWORD name_offset(std::string &table, std::string name)
+    {
+        ut_DWORD offset = (ut_DWORD) table.size();
+
+        table += name;
+        table += '\0';
+        return offset;
+    }
+
+    ut_DWORD append(const void *data, ut_LSIZE size)
+    {
+        while(file.size() % 4 != 0) file.push_back(0);
+
+        ut_DWORD offset = (ut_DWORD) file.size();
+        file.insert(file.end(), (const ut_BYTE *) data, (const ut_BYTE *) data + size);
+        return offset;
+    }
+
+    ut_WORD add_section(std::string name, ut_DWORD type, ut_DWORD flags, const void *data, ut_DWORD size, ut_DWORD alignment)
+    {
+        Elf32_Shdr header = {};
+
+        header.sh_name = name_offset(shstrtab, name);
+        header.sh_type = type;
+        header.sh_flags = flags;
+        header.sh_offset = type == SHT_NOBITS ? (ut_DWORD) file.size() : append(data, size);
+        header.sh_size = size;
+        header.sh_addralign = alignment;
+
+        section_headers.push_back(header);
+        return (ut_WORD) section_headers.size() - 1;
+    }
+
+    static ut_DWORD section_flags(ut_BYTE section)
+    {
+        switch((AsmSection) section)
+        {
+            case AsmSection::S_text:
+            case AsmSection::S_init: return SHF_ALLOC | SHF_EXECINSTR;break;
+            case AsmSection::S_rodata: return SHF_ALLOC;break;
+            default: break;
+        }
+
+        return SHF_ALLOC | SHF_WRITE;
+    }
+
+    static ut_BYTE relocation_type(struct ir_relocation &relocation)
+    {
+        bool relative = relocation.kind == FixupKind::FK_relative;
+
+        switch(relocation.size)
+        {
+            case 1: return relative ? R_386_PC8 : R_386_8;break;
+            case 2: return relative ? R_386_PC16 : R_386_16;break;
+            default: break;
+        }
+
+        return relative ? R_386_PC32 : R_386_32;
+    }
+
+public:
+    MocaAsm_elf_writer()
+    {}
+
+    void write(const nt_BYTE *filename, MocaAsm_ir &ir, std::array<struct section_object, amnt_of_sections> &objects, MocaAsm_symtab &symtab)
+    {
+        file.assign(sizeof(Elf32_Ehdr), 0);
+        section_headers.assign(1, Elf32_Shdr {});
+
+        /* A section gets a header if it has bytes or a label/variable in it. */
+        std::array<bool, amnt_of_sections> present = {};
+        std::vector<bool> referenced(symtab.amnt_of_symbols(), false);
+
+        for(ut_BYTE section = 0; section < amnt_of_sections; section++)
+        {
+            present[section] = ir.get_section((AsmSection) section).size != 0;
+
+            for(struct ir_relocation &relocation : objects[section].relocations)
+                if(relocation.symbol_id != no_symbol) referenced[relocation.symbol_id] = true;
+                else present[relocation.section] = true;
+        }
+
+        for(ut_DWORD id = 0; id < symtab.amnt_of_symbols(); id++)
+            if(symtab.get(id).kind != SymbolKind::SK_undefined && symtab.get(id).kind != SymbolKind::SK_removed) present[symtab.get(id).section] = true;
+
+        std::array<ut_WORD, amnt_of_sections> section_index = {};
+        for(ut_BYTE section = 0; section < amnt_of_sections; section++)
+        {
+            if(!present[section]) continue;
+
+            struct section_object &object = objects[section];
+            bool is_bss = section == (ut_BYTE) AsmSection::S_bss;
+
+            section_index[section] = add_section(section_names[section], is_bss ? SHT_NOBITS : SHT_PROGBITS, section_flags(section),
+                object.code.data(), is_bss ? ir.get_section(AsmSection::S_bss).size : (ut_DWORD) object.code.size(), ir.get_section((AsmSection) section).alignment);
+        }
+
+        /* Locals (the section symbols) have to come before every global. */
+        std::vector<Elf32_Sym> symbols(1, Elf32_Sym {});
+        std::array<ut_DWORD, amnt_of_sections> section_symbol = {};
+
+        for(ut_BYTE section = 0; section < amnt_of_sections; section++)
+        {
+            if(!present[section]) continue;
+
+            Elf32_Sym symbol = {};
+            symbol.st_info = ELF32_ST_INFO(STB_LOCAL, STT_SECTION);
+            symbol.st_shndx = section_index[section];
+
+            section_symbol[section] = (ut_DWORD) symbols.size();
+            symbols.push_back(symbol);
+        }
+
+        ut_DWORD first_global = (ut_DWORD) symbols.size();
+        std::vector<ut_DWORD> symbol_index(symtab.amnt_of_symbols(), 0);
+
+        for(ut_DWORD id = 0; id < symtab.amnt_of_symbols(); id++)
+        {
+            struct symbol_entry &entry = symtab.get(id);
+            if((entry.kind == SymbolKind::SK_undefined && !referenced[id]) || entry.kind == SymbolKind::SK_removed) continue;
+
+            Elf32_Sym symbol = {};
+            symbol.st_name = name_offset(strtab, entry.name);
+
+            if(entry.kind == SymbolKind::SK_undefined)
+            {
+                symbol.st_info = ELF32_ST_INFO(STB_GLOBAL, STT_NOTYPE);
+                symbol.st_shndx = SHN_UNDEF;
+            }
+            else
+            {
+                symbol.st_value = entry.value - ir.get_section((AsmSection) entry.section).base;
+                /* Every byte of a variable's values (`arr dbarr 1, 2, 3` is 3), not the width of one of them; `--link -SAN` passes it on. */
+                symbol.st_size = entry.kind == SymbolKind::SK_variable ? entry.size : 0;
+                symbol.st_info = ELF32_ST_INFO(STB_GLOBAL, entry.kind == SymbolKind::SK_variable ? STT_OBJECT : STT_NOTYPE);
+                symbol.st_shndx = section_index[entry.section];
+            }
+
+            symbol_index[id] = (ut_DWORD) symbols.size();
+            symbols.push_back(symbol);
+        }
+
+        /* `.symtab` follows the `.rel*` sections, which need its index. */
+        ut_WORD symtab_index = (ut_WORD) section_headers.size();
+        for(ut_BYTE section = 0; section < amnt_of_sections; section++)
+            if(!objects[section].relocations.empty()) symtab_index++;
+
+        for(ut_BYTE section = 0; section < amnt_of_sections; section++)
+        {
+            if(objects[section].relocations.empty()) continue;
+
+            std::vector<Elf32_Rel> relocations;
+            relocations.reserve(objects[section].relocations.size());
+
+            for(struct ir_relocation &relocation : objects[section].relocations)
+            {
+                ut_DWORD symbol = relocation.symbol_id != no_symbol ? symbol_index[relocation.symbol_id] : section_symbol[relocation.section];
+                relocations.push_back({relocation.offset, ELF32_R_INFO(symbol, relocation_type(relocation))});
+            }
+
+            ut_WORD index = add_section(std::string(".rel") + section_names[section], SHT_REL, 0,
+                relocations.data(), (ut_DWORD) (relocations.size() * sizeof(Elf32_Rel)), 4);
+            section_headers[index].sh_link = symtab_index;
+            section_headers[index].sh_info = section_index[section];
+            section_headers[index].sh_entsize = sizeof(Elf32_Rel);
+        }
+
+        add_section(".symtab", SHT_SYMTAB, 0, symbols.data(), (ut_DWORD) (symbols.size() * sizeof(Elf32_Sym)), 4);
+        section_headers[symtab_index].sh_link = symtab_index + 1;
+        section_headers[symtab_index].sh_info = first_global;
+        section_headers[symtab_index].sh_entsize = sizeof(Elf32_Sym);
+
+        add_section(".strtab", SHT_STRTAB, 0, strtab.data(), (ut_DWORD) strtab.size(), 1);
+
+        /* `.shstrtab` has to name itself before it gets written. */
+        ut_DWORD shstrtab_name = name_offset(shstrtab, ".shstrtab");
+        ut_WORD shstrtab_index = (ut_WORD) section_headers.size();
+        Elf32_Shdr header = {};
+        header.sh_name = shstrtab_name;
+        header.sh_type = SHT_STRTAB;
+        header.sh_offset = append(shstrtab.data(), shstrtab.size());
+        header.sh_size = (ut_DWORD) shstrtab.size();
+        header.sh_addralign = 1;
+        section_headers.push_back(header);
+
+        ut_DWORD section_headers_offset = append(section_headers.data(), section_headers.size() * sizeof(Elf32_Shdr));
+
+        Elf32_Ehdr elf_header = {};
+        memcpy(elf_header.e_ident, ELFMAG, SELFMAG);
+        elf_header.e_ident[EI_CLASS] = ELFCLASS32;
+        elf_header.e_ident[EI_DATA] = ELFDATA2LSB;
+        elf_header.e_ident[EI_VERSION] = EV_CURRENT;
+        elf_header.e_ident[EI_OSABI] = ELFOSABI_NONE;
+        elf_header.e_type = ET_REL;
+        elf_header.e_machine = EM_386;
+        elf_header.e_version = EV_CURRENT;
+        elf_header.e_shoff = section_headers_offset;
+        elf_header.e_ehsize = sizeof(Elf32_Ehdr);
+        elf_header.e_shentsize = sizeof(Elf32_Shdr);
+        elf_header.e_shnum = (ut_WORD) section_headers.size();
+        elf_header.e_shstrndx = shstrtab_index;
+        memcpy(file.data(), &elf_header, sizeof(elf_header));
+
+        FILE *out = fopen(filename, "wb");
+        MASM_assert(out,
+            "\n%s[FILE ERROR]%s\tThere was an error opening the object file `%s`.\n",
+            red, white,
+            filename)
+
+        fwrite(file.data(), sizeof(ut_BYTE), file.size(), out);
+        fclose(out);
+    }
+
+    ~MocaAsm_elf_writer()
+    {}
+};
+
+}
+
+#endif
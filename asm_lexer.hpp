@@ -1,26 +1,160 @@
 #ifndef Moca_assembly_lexer
 #define Moca_assembly_lexer
+#include <array>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "asm_tokens.hpp"
+#include "asm_lines.hpp"
+#include "assembler_backend/asm_pool.hpp"
 using namespace masm_tokens;
+using namespace masm_lines;
 
 namespace masm_lexer
 {
 
-/* Struct containing information about lexer state. */
+/* What the lexer makes of a byte; `char_classes` has the class of every byte. */
+enum class CharClass : ut_BYTE
+{
+	CC_space,		// ` `, `\t`, `\r`
+	CC_newline,		// whitespace as well, but it ends a comment; lines are only worked out when asked for (see `MocaAsm_line_index`)
+	CC_letter,		// `g`-`z`, `G`-`Z`
+	CC_hex_letter,	// `a`-`f`, `A`-`F`
+	CC_digit,
+	CC_underscore,
+	CC_dot,
+	CC_grammar,		// a token of its own (`grammar_of_char`)
+	CC_comment,		// `;`
+	CC_end,			// `\0`
+	CC_other,
+	CC_amount
+};
+
+constexpr std::array<CharClass, 256> make_char_classes()
+{
+	std::array<CharClass, 256> classes = {};
+
+	for(ut_WORD c = 0; c < 256; c++)
+	{
+		if(c == ' ' || c == '\t' || c == '\r') classes[c] = CharClass::CC_space;
+		else if(c == '\n') classes[c] = CharClass::CC_newline;
+		else if((c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F')) classes[c] = CharClass::CC_hex_letter;
+		else if((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) classes[c] = CharClass::CC_letter;
+		else if(c >= '0' && c <= '9') classes[c] = CharClass::CC_digit;
+		else if(c == '_') classes[c] = CharClass::CC_underscore;
+		else if(c == '.') classes[c] = CharClass::CC_dot;
+		else if(c == ';') classes[c] = CharClass::CC_comment;
+		else if(c == '\0') classes[c] = CharClass::CC_end;
+		else classes[c] = CharClass::CC_other;
+	}
+
+	const ut_BYTE grammar[] = {',', ':', '[', ']', '\'', '"', '$', '(', ')', '-', '+', '%'};
+	for(ut_BYTE c : grammar) classes[c] = CharClass::CC_grammar;
+
+	return classes;
+}
+
+constexpr std::array<CharClass, 256> char_classes = make_char_classes();
+
+/* The grammar token of every `CC_grammar` byte. */
+constexpr std::array<AsmGrammarTokens, 256> make_grammar_of_char()
+{
+	std::array<AsmGrammarTokens, 256> grammar = {};
+
+	grammar[','] = AsmGrammarTokens::GR_comma;
+	grammar[':'] = AsmGrammarTokens::GR_colon;
+	grammar['['] = AsmGrammarTokens::GR_lbrack;
+	grammar[']'] = AsmGrammarTokens::GR_rbrack;
+	grammar['\''] = AsmGrammarTokens::GR_singleQ;
+	grammar['"'] = AsmGrammarTokens::GR_doubleQ;
+	grammar['$'] = AsmGrammarTokens::GR_dollar;
+	grammar['('] = AsmGrammarTokens::GR_lpar;
+	grammar[')'] = AsmGrammarTokens::GR_rpar;
+	grammar['-'] = AsmGrammarTokens::GR_minus;
+	grammar['+'] = AsmGrammarTokens::GR_plus;
+	grammar['%'] = AsmGrammarTokens::GR_percent;
+
+	return grammar;
+}
+
+constexpr std::array<AsmGrammarTokens, 256> grammar_of_char = make_grammar_of_char();
+
+/* States of the lexer. From `LS_start`, the class of the first byte of a token picks the state (one lookup, one jump);
+ * a state that spans several bytes stays in itself for every byte that belongs to it, and goes back to `LS_start` at the first one that does not.
+ * */
+enum class LexState : ut_BYTE
+{
+	LS_start,
+	LS_whitespace,	// spaces and newlines
+	LS_identifier,	// a letter, then letters, digits and `_`
+	LS_number,		// a digit, then letters and digits; checked while it is lexed
+	LS_comment,		// up to the `\n` (or `\0`)
+	LS_dot,			// `.` or `.section`
+	LS_grammar,
+	LS_end,
+	LS_invalid,
+	LS_amount
+};
+
+constexpr std::array<std::array<LexState, (ut_BYTE) CharClass::CC_amount>, (ut_BYTE) LexState::LS_amount> make_lex_transitions()
+{
+	std::array<std::array<LexState, (ut_BYTE) CharClass::CC_amount>, (ut_BYTE) LexState::LS_amount> transitions = {};
+
+	auto set = [&transitions](LexState from, CharClass on, LexState to) {
+		transitions[(ut_BYTE) from][(ut_BYTE) on] = to;
+	};
+
+	/* Everything not set goes back to `LS_start` (0). */
+	set(LexState::LS_start, CharClass::CC_space, LexState::LS_whitespace);
+	set(LexState::LS_start, CharClass::CC_newline, LexState::LS_whitespace);
+	set(LexState::LS_start, CharClass::CC_letter, LexState::LS_identifier);
+	set(LexState::LS_start, CharClass::CC_hex_letter, LexState::LS_identifier);
+	set(LexState::LS_start, CharClass::CC_digit, LexState::LS_number);
+	set(LexState::LS_start, CharClass::CC_underscore, LexState::LS_invalid);
+	set(LexState::LS_start, CharClass::CC_dot, LexState::LS_dot);
+	set(LexState::LS_start, CharClass::CC_grammar, LexState::LS_grammar);
+	set(LexState::LS_start, CharClass::CC_comment, LexState::LS_comment);
+	set(LexState::LS_start, CharClass::CC_end, LexState::LS_end);
+	set(LexState::LS_start, CharClass::CC_other, LexState::LS_invalid);
+
+	set(LexState::LS_whitespace, CharClass::CC_space, LexState::LS_whitespace);
+	set(LexState::LS_whitespace, CharClass::CC_newline, LexState::LS_whitespace);
+
+	for(CharClass c : {CharClass::CC_letter, CharClass::CC_hex_letter, CharClass::CC_digit, CharClass::CC_underscore})
+		set(LexState::LS_identifier, c, LexState::LS_identifier);
+	for(CharClass c : {CharClass::CC_letter, CharClass::CC_hex_letter, CharClass::CC_digit})
+		set(LexState::LS_number, c, LexState::LS_number);
+
+	for(ut_BYTE c = 0; c < (ut_BYTE) CharClass::CC_amount; c++)
+		if(c != (ut_BYTE) CharClass::CC_newline && c != (ut_BYTE) CharClass::CC_end)
+			set(LexState::LS_comment, (CharClass) c, LexState::LS_comment);
+
+	return transitions;
+}
+
+constexpr std::array<std::array<LexState, (ut_BYTE) CharClass::CC_amount>, (ut_BYTE) LexState::LS_amount> lex_transitions = make_lex_transitions();
+
+/* Struct containing information about lexer state.
+ * The whole file is mapped into memory, and the mapping handed to `sources`; a chunk of it (parallel lexing) is a `lexer_state`
+ * over part of the same mapping.
+ * */
 struct lexer_state
 {
-	nt_BYTE		*asm_filename = nullptr;
-	FILE		*asm_code = nullptr;
-	ut_DWORD	filesize = 0;
-	ut_DWORD	index = 0;
-	ut_WORD		line = 0;
-	ut_BYTE		current_value = '\0';
-	ut_BYTE		*ascii_value;
+	nt_BYTE			*asm_filename = nullptr;
+	const ut_BYTE	*asm_code = nullptr;
+	ut_DWORD		base = 0;				// source position of the first byte of the file (see `MocaAsm_source_map`)
+	ut_LSIZE		filesize = 0;			// where lexing stops; the end of the chunk for a chunk
+	ut_LSIZE		index = 0;
+	ut_BYTE			current_value = '\0';
+	ut_BYTE			*ascii_value = nullptr;
 
 	lexer_state(nt_BYTE *filename)
 	{
-		asm_filename = new nt_BYTE[strlen(nt_BYTE_CPTR filename)];
-		memcpy(asm_filename, filename, strlen(nt_BYTE_CPTR filename));
+		asm_filename = new nt_BYTE[strlen(nt_BYTE_CPTR filename) + 1];
+		memcpy(asm_filename, filename, strlen(nt_BYTE_CPTR filename) + 1);
 
 		/* Make sure the file exists. */
 		MASM_assert(access(asm_filename, F_OK) == 0,
@@ -29,8 +163,8 @@ struct lexer_state
 			asm_filename)
 		
 		/* Open the source code file and get its contents. */
-		asm_code = fopen(asm_filename, "rb");
-		MASM_assert(asm_code,
+		nt_DWORD fd = open(asm_filename, O_RDONLY);
+		MASM_assert(fd >= 0,
 			"\n%s[FILE ERROR]%s\tThere was an error opening the files `%s`.\n",
 			red, white,
 			asm_filename)
@@ -38,38 +172,59 @@ struct lexer_state
 		index = 0;
 		
 		/* Get the filesize. */
-		fseek(asm_code, 0, SEEK_END);
-		filesize = (ut_DWORD) ftell(asm_code);
-		fseek(asm_code, 0, SEEK_SET);
+		struct stat info;
+		fstat(fd, &info);
+		filesize = (ut_LSIZE) info.st_size;
 
 		/* Make sure there is stuff in the file. */
 		MASM_assert(filesize > 1,
 			"\n%s[FILE ERROR]%s\tThe file `%s` is empty. Try writing some code.\n",
 			red, white,
 			asm_filename)
+
+		asm_code = ut_BYTE_CPTR mmap(nullptr, filesize, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		MASM_assert(asm_code != MAP_FAILED,
+			"\n%s[FILE ERROR]%s\tThere was an error mapping the file `%s`.\n",
+			red, white,
+			asm_filename)
+		base = sources.add(asm_code, filesize);
 		
-		line = 1;
-		index += fread(&current_value, sizeof(ut_BYTE), 1, asm_code);
+		MASM_ALLOC_SOURCE(filesize);
+
+		read();
+	}
+
+	/* `[begin, end)` of the file `file` is lexing. */
+	lexer_state(struct lexer_state *file, ut_LSIZE begin, ut_LSIZE end)
+	{
+		asm_filename = new nt_BYTE[strlen(nt_BYTE_CPTR file->asm_filename) + 1];
+		memcpy(asm_filename, file->asm_filename, strlen(nt_BYTE_CPTR file->asm_filename) + 1);
+
+		asm_code = file->asm_code;
+		base = file->base;
+		filesize = end;
+		index = begin;
+
+		read();
 	}
 
 	void read()
 	{
-		index += fread(&current_value, sizeof(ut_BYTE), 1, asm_code);
+		if(index < filesize) current_value = asm_code[index++];
 	}
 
 	void go_back()
 	{
 		/* Go back by 2 so we can reread the value we had before. */
 		index-=2;
-		fseek(asm_code, index, SEEK_SET);
 
 		read();
 	}
 
 	~lexer_state()
 	{
-		if(asm_filename) delete asm_filename;
-		if(asm_code) fclose(asm_code);
+		if(asm_filename) delete[] asm_filename;
 		if(ascii_value) free(ascii_value);
 
 		asm_filename = nullptr;
@@ -78,17 +233,143 @@ struct lexer_state
 	}
 };
 
+/* How a file gets lexed (`--lexer=`). */
+enum class LexerMode
+{
+	LM_serial,		// a token at a time, whenever the parser asks for one
+	LM_pipelined,	// on a thread of its own, ahead of the parser (see `MocaAsm_token_queue`)
+	LM_parallel,	// split into newline-aligned chunks, lexed on every core ahead of the parser (see `lexed_chunk`)
+	LM_auto			// parallel from `parallel_threshold` bytes on, pipelined from `pipeline_threshold` bytes on; serial on a single core
+};
+
+/* Below this, starting a thread costs more than lexing on the parser's thread saves. */
+constexpr ut_DWORD pipeline_threshold = 256 * 1024;
+
+/* Below this, there are too few chunks to keep more than one lexing thread busy. */
+constexpr ut_DWORD parallel_threshold = 4 * 1024 * 1024;
+
+/* Roughly how much of the file a chunk is; chunks end right after a `\n`. */
+constexpr ut_DWORD parallel_chunk_bytes = 1024 * 1024;
+
+/* A token lexed ahead of the parser, with what the parser would have asked the lexer about it right after.
+ * An error token (`token` is null) is an error the lexer ran into at `offset` (see `masm_diag::deferred_error`);
+ * `string_literal` is its diagnostic, raised once the parser asks for the token, and nothing follows it.
+ * */
+struct piped_token
+{
+	struct MocaAsm_TD	*token;
+	ut_LSIZE			offset;
+	std::string			string_literal;		// contents of the string following `incsrc`; the only place the parser reads one
+};
+
+/* A newline-aligned piece of the file, lexed on its own (parallel mode).
+ * The lexer has no state that carries across a `\n` (a comment ends at one), and tokens only carry their offset in the file,
+ * so every chunk lexes exactly as it would in the whole file.
+ * The one exception is the string following `incsrc`; a chunk never starts at a `"` (see `split_into_chunks`).
+ * */
+struct lexed_chunk
+{
+	ut_LSIZE						begin = 0;
+	ut_LSIZE						end = 0;
+	std::vector<struct piped_token>	tokens;
+	std::atomic<bool>				done{false};
+};
+
+/* Bounded single-producer/single-consumer ring of token batches, between the lexer's thread and the parser.
+ * `head`/`tail` only ever grow; `tail - head` batches are ready. Nothing is locked: each side only writes its own counter,
+ * and only sleeps (`std::atomic::wait`) when the ring is full/empty.
+ * */
+class MocaAsm_token_queue
+{
+private:
+	static constexpr ut_DWORD amnt_of_slots = 64;
+
+	std::vector<struct piped_token>	slots[amnt_of_slots];
+	std::atomic<ut_DWORD>			head{0};	// next batch the parser reads
+	std::atomic<ut_DWORD>			tail{0};	// next batch the lexer fills
+
+public:
+	static constexpr ut_DWORD batch_tokens = 1024;
+
+	MocaAsm_token_queue()
+	{}
+
+	/* Lexer side: the next slot to fill; waits while every slot is full. */
+	std::vector<struct piped_token> *begin_push()
+	{
+		ut_DWORD slot = tail.load(std::memory_order_relaxed);
+
+		for(ut_DWORD read = head.load(std::memory_order_acquire); slot - read == amnt_of_slots; read = head.load(std::memory_order_acquire))
+			head.wait(read, std::memory_order_acquire);
+
+		std::vector<struct piped_token> *batch = &slots[slot % amnt_of_slots];
+		batch->clear();
+		return batch;
+	}
+
+	void end_push()
+	{
+		tail.fetch_add(1, std::memory_order_release);
+		tail.notify_one();
+	}
+
+	/* Parser side: the oldest filled slot; waits while there is none. */
+	std::vector<struct piped_token> *begin_pop()
+	{
+		ut_DWORD slot = head.load(std::memory_order_relaxed);
+
+		for(ut_DWORD written = tail.load(std::memory_order_acquire); written == slot; written = tail.load(std::memory_order_acquire))
+			tail.wait(written, std::memory_order_acquire);
+
+		return &slots[slot % amnt_of_slots];
+	}
+
+	void end_pop()
+	{
+		head.fetch_add(1, std::memory_order_release);
+		head.notify_one();
+	}
+
+	~MocaAsm_token_queue()
+	{}
+};
+
 class MocaAsm_lexer
 {
 private:
 	struct lexer_state *lstate = nullptr;
 	MocaAsm_tokenizer *mtoken = nullptr;
 
+	/* Lexers for `incsrc` files share the tokenizer of the file including them. */
+	bool owns_tokenizer = true;
+
+	/* Pipelined mode; `lstate` belongs to `lexer_thread` until it has lexed the end of the file. */
+	std::thread *lexer_thread = nullptr;
+	MocaAsm_token_queue *queue = nullptr;
+	std::vector<struct piped_token> *batch = nullptr;
+	ut_DWORD batch_position = 0;
+	bool piped_EOF = false;
+	ut_LSIZE piped_offset = 0;
+	std::string piped_literal;
+
+	/* Parallel mode; `chunk_threads` lex `chunks` in order, at most `chunk_window` chunks ahead of the parser. */
+	std::vector<std::thread> chunk_threads;
+	struct lexed_chunk *chunks = nullptr;
+	ut_DWORD amnt_of_chunks = 0;
+	ut_DWORD chunk_window = 0;
+	std::atomic<ut_DWORD> next_chunk{0};
+	std::atomic<ut_DWORD> consumed_chunks{0};
+
+	/* Where the last token lexed starts. */
+	ut_LSIZE token_offset = 0;
+
 	void seek_forward()
 	{
-		if(lstate->index + 1 >= lstate->filesize)
+		if(lstate->index >= lstate->filesize)
 		{
+			/* Still step `index` past the end so `go_back` lands on the last byte. */
 			lstate->current_value = '\0';
+			lstate->index++;
 			return;
 		}
 
@@ -119,38 +400,66 @@ private:
 		return peek_data;
 	}
 
-	void get_ascii_value()
+	/* Where `current_value` is in the file. */
+	ut_LSIZE position()
+	{ return lstate->index - 1; }
+
+	LexState next_state(LexState state)
+	{ return lex_transitions[(ut_BYTE) state][(ut_BYTE) char_classes[lstate->current_value]]; }
+
+	/* Step over every byte that keeps the lexer in `state`; straight over the file, a lookup per byte. */
+	void scan(LexState state)
 	{
-		if(lstate->ascii_value) free(lstate->ascii_value);
-		lstate->ascii_value = ut_BYTE_PTR calloc(1, sizeof(*lstate->ascii_value));
-		ut_BYTE index = 0;
+		const std::array<LexState, (ut_BYTE) CharClass::CC_amount> &transitions = lex_transitions[(ut_BYTE) state];
+		ut_LSIZE at = position();
 
-		while(is_ascii_WE(lstate->current_value, '_') || is_number(lstate->current_value))
-		{
-			lstate->ascii_value[index] = lstate->current_value;
-			index++;
+		while(at < lstate->filesize && transitions[(ut_BYTE) char_classes[lstate->asm_code[at]]] == state)
+			at++;
 
-			lstate->ascii_value = ut_BYTE_PTR realloc(
-				lstate->ascii_value,
-				(index + 1) * sizeof(*lstate->ascii_value)
-			);
-			seek_forward();
+		jump_to(at);
+	}
+
+	/* Same as `seek_forward` up to `at`: past the end, `current_value` is `\0` and `index` one past the end. */
+	void jump_to(ut_LSIZE at)
+	{
+		if(at < lstate->filesize)
+		{
+			lstate->current_value = lstate->asm_code[at];
+			lstate->index = at + 1;
+			return;
 		}
+
+		lstate->current_value = '\0';
+		lstate->index = lstate->filesize + 1;
 	}
 
-	void skip_whitespace()
+	/* `[begin, end)` of the file, as the value of the token being lexed. */
+	ut_BYTE *take_value(ut_LSIZE begin, ut_LSIZE end)
 	{
-		while(lstate->current_value == ' ' || lstate->current_value == '\t')
-			seek_forward();
+		if(end > lstate->filesize) end = lstate->filesize;
+
+		lstate->ascii_value = ut_BYTE_PTR realloc(lstate->ascii_value, (end - begin + 1) * sizeof(*lstate->ascii_value));
+		memcpy(lstate->ascii_value, lstate->asm_code + begin, end - begin);
+		lstate->ascii_value[end - begin] = '\0';
+		return lstate->ascii_value;
 	}
 
-	void skip_newlines()
+	static bool is_hex_digit(ut_BYTE value)
+	{ return char_classes[value] == CharClass::CC_digit || char_classes[value] == CharClass::CC_hex_letter; }
+
+	/* Line of `current_value`, for an error message. */
+	ut_DWORD error_line()
+	{ return source_line(lstate->base + (ut_DWORD) position()); }
+
+	ut_DWORD error_column()
+	{ return sources.column_of(lstate->base + (ut_DWORD) position()); }
+
+	/* Lexer for `chunks[index]` of `file`. */
+	MocaAsm_lexer(struct lexed_chunk *chunks, ut_DWORD index, struct lexer_state *file, MocaAsm_tokenizer *tokenizer)
 	{
-		while(lstate->current_value == '\n')
-		{
-			lstate->line++;
-			seek_forward();
-		}
+		lstate = new struct lexer_state(file, chunks[index].begin, chunks[index].end);
+		mtoken = tokenizer;
+		owns_tokenizer = false;
 	}
 
 public:
@@ -160,143 +469,439 @@ public:
 		mtoken = new MocaAsm_tokenizer;
 	}
 
+	MocaAsm_lexer(nt_BYTE *filename, MocaAsm_tokenizer *tokenizer)
+	{
+		lstate = new struct lexer_state(filename);
+		mtoken = tokenizer;
+		owns_tokenizer = false;
+	}
+
 	MocaAsm_tokenizer *get_instance()
 	{ return mtoken; }
 
-	struct MocaAsm_TD *get_next_token()
+	const nt_BYTE *get_filename()
+	{ return lstate->asm_filename; }
+
+	/* Where the last token handed out starts in the file. */
+	ut_LSIZE get_offset()
+	{ return lexer_thread || chunks ? piped_offset : token_offset; }
+
+	/* Source position of the last token handed out (see `MocaAsm_source_map`). */
+	ut_DWORD get_position()
+	{ return lstate->base + (ut_DWORD) get_offset(); }
+
+	/* Line/column of the last token handed out; worked out from its position, for a diagnostic. */
+	ut_DWORD get_line()
+	{ return source_line(get_position()); }
+
+	ut_DWORD line_of(ut_LSIZE offset)
+	{ return source_line(lstate->base + (ut_DWORD) offset); }
+
+	ut_DWORD get_column()
+	{ return sources.column_of(get_position()); }
+
+	ut_LSIZE get_filesize()
+	{ return lstate->filesize; }
+
+private:
+	/* Read the raw contents of a string literal; invoked once the opening `"` has been tokenized.
+	 * The returned value is owned by the lexer and is overwritten by the next token.
+	 * */
+	ut_BYTE *read_string_literal()
 	{
-		redo:
-		if(lstate->current_value == ' ' || lstate->current_value == '\t')
-		{ skip_whitespace(); goto redo; }
-		
-		if(lstate->current_value == '\n')
-		{ skip_newlines(); goto redo; }
+		ut_LSIZE begin = position();
 
-		if(is_ascii(lstate->current_value))
+		while(lstate->current_value != '"')
 		{
-			get_ascii_value();
-			return mtoken->create_new_token_alone(lstate->ascii_value, lstate->line);	
+			MASM_assert(lstate->current_value != '\n' && lstate->current_value != '\0',
+				"\n%s[INVALID SYNTAX, LINE %d]%s\tMissing closing %s`\"`%s on string (column %d).\n",
+				red, error_line(), white,
+				green, white,
+				error_column())
+
+			seek_forward();
 		}
 
-		if(is_number(lstate->current_value))
-		{
-			if(lstate->ascii_value) delete lstate->ascii_value;
-			lstate->ascii_value = (ut_BYTE *) calloc(1, sizeof(*lstate->ascii_value));
-			lstate->ascii_value[0] = lstate->current_value;
+		take_value(begin, position());
 
-			seek_forward();
-			ut_BYTE length = 1;
-			bool is_hex = false;
-			bool needs_to_be_hex = false;
+		/* Skip the closing `"`. */
+		seek_forward();
+		return lstate->ascii_value;
+	}
 
-			while(!(lstate->current_value == ' ' || lstate->current_value == '\t' || lstate->current_value == '\n' || lstate->current_value == '\0'))
-			{
-				lstate->ascii_value = (ut_BYTE *) realloc(
-					lstate->ascii_value,
-					(length + 1) * sizeof(*lstate->ascii_value)
-				);
-				
-				lstate->ascii_value[length] = lstate->current_value;
-				length++;
+	/* Values end at anything that can not be part of a decimal/hexadecimal value (whitespace, `,`, `]`, `+`, ...). */
+	struct MocaAsm_TD *lex_number()
+	{
+		ut_LSIZE begin = position();
+		bool is_hex = false;
+		bool needs_to_be_hex = false;
 
-				if(lstate->current_value == 'x' || lstate->current_value == 'h')
+		seek_forward();
+		while(next_state(LexState::LS_number) == LexState::LS_number)
+		{
+			if(lstate->current_value == 'x' || lstate->current_value == 'h')
+			{
+				if(lstate->current_value == 'x')
 				{
-					if(lstate->current_value == 'x')
-					{
-						/* Make sure there are values residing after `0x`. */
-						MASM_assert(is_number(peek()) || is_hex(peek()),
-							"\n%s[INVALID HEXADECIMAL]%s\tThere was a hexadecimal value found on line %d, but it is invalid.\n",
-							red, white,
-							lstate->line)
-						
-						/* Make sure the first value in `lstate->ascii_value` is `0`. */
-						MASM_assert(lstate->ascii_value[0] == '0',
-							"\n%s[INVALID HEXADECIMAL]%s\tOn line %d, the hexadecimal value started with %s`%s`%s instead of %s`0x`%s.\n",
-							red, white,
-							lstate->line, 
-							yellow, lstate->ascii_value, white,
-							green, white)
-					}
+					take_value(begin, position() + 1);
+
+					/* Make sure there are values residing after `0x`. */
+					MASM_assert(is_hex_digit(peek()),
+						"\n%s[INVALID HEXADECIMAL]%s\tThere was a hexadecimal value found on line %d, but it is invalid.\n",
+						red, white,
+						error_line())
 					
-					is_hex = true;
-					seek_forward();
-					continue;
+					/* Make sure the first value in `lstate->ascii_value` is `0`. */
+					MASM_assert(lstate->ascii_value[0] == '0',
+						"\n%s[INVALID HEXADECIMAL]%s\tOn line %d, the hexadecimal value started with %s`%s`%s instead of %s`0x`%s.\n",
+						red, white,
+						error_line(), 
+						yellow, lstate->ascii_value, white,
+						green, white)
 				}
+				
+				is_hex = true;
+				seek_forward();
+				continue;
+			}
 
-				if(!is_number(lstate->current_value))
-					MASM_assert(is_hex(lstate->current_value),
+			if(char_classes[lstate->current_value] != CharClass::CC_digit)
+			{
+				MASM_assert(is_hex_digit(lstate->current_value),
 					"\n%s[INVALID HEXADECIMAL VALUE]%s\tOn line %d, the value %s`%c`%s is not a hexadecimal value. Hex values are %s0-9, A-F%s.\n",
 					red, white,
-					lstate->line, 
+					error_line(), 
 					yellow, lstate->current_value, white,
 					green, white)
 
-				if(!is_number(lstate->current_value) && is_hex(lstate->current_value))
-					needs_to_be_hex = true;
-				
-				seek_forward();
+				needs_to_be_hex = true;
 			}
 			
-			if(needs_to_be_hex && !is_hex)
-				MASM_error("\n%s[INVALID HEXADECIMAL]%s\tOn line %d, the hexadecimal value %s`%s`%s is missing an %s`h`%s at the end or %s`0x`%s at the beginning signifying it's a hexadecimal value.\n",
-					red, white,
-					lstate->line, 
-					yellow, lstate->ascii_value, white,
-					green, white,
-					green, white)
-			
-			if(is_hex) return mtoken->new_token<AsmCommonTokens> (AsmCommonTokens::CM_imm_hex, lstate->ascii_value);
-			else return mtoken->new_token<AsmCommonTokens> (AsmCommonTokens::CM_imm_dec, lstate->ascii_value);
+			seek_forward();
 		}
 
-		switch(lstate->current_value)
+		take_value(begin, position());
+		
+		if(needs_to_be_hex && !is_hex)
+			MASM_error("\n%s[INVALID HEXADECIMAL]%s\tOn line %d, the hexadecimal value %s`%s`%s is missing an %s`h`%s at the end or %s`0x`%s at the beginning signifying it's a hexadecimal value.\n",
+				red, white,
+				error_line(), 
+				yellow, lstate->ascii_value, white,
+				green, white,
+				green, white)
+		
+		if(is_hex) return mtoken->new_token<AsmCommonTokens> (AsmCommonTokens::CM_imm_hex, lstate->ascii_value);
+		return mtoken->new_token<AsmCommonTokens> (AsmCommonTokens::CM_imm_dec, lstate->ascii_value);
+	}
+
+	/* The first byte of a token picks its state through `lex_transitions`; see `LexState`. */
+	struct MocaAsm_TD *lex_token()
+	{
+		while(true)
 		{
-			case '[': seek_forward();return mtoken->new_token<AsmGrammarTokens> (AsmGrammarTokens::GR_lbrack, ut_BYTE_PTR "[");break;
-			case ']': seek_forward();return mtoken->new_token<AsmGrammarTokens> (AsmGrammarTokens::GR_rbrack, ut_BYTE_PTR "]");break;
-			case ':': seek_forward();return mtoken->new_token<AsmGrammarTokens> (AsmGrammarTokens::GR_colon, ut_BYTE_PTR ":");break;
-			case ',': seek_forward();return mtoken->new_token<AsmGrammarTokens> (AsmGrammarTokens::GR_comma, ut_BYTE_PTR ",");break;
-			case '.': seek_forward();return mtoken->new_token<AsmGrammarTokens> (AsmGrammarTokens::GR_dot, ut_BYTE_PTR ".");break;
-			case '$': seek_forward();return mtoken->new_token<AsmGrammarTokens> (AsmGrammarTokens::GR_dollar, ut_BYTE_PTR "$");break;
-			case '(': seek_forward();return mtoken->new_token<AsmGrammarTokens> (AsmGrammarTokens::GR_lpar, ut_BYTE_PTR "(");break;
-			case ')': seek_forward();return mtoken->new_token<AsmGrammarTokens> (AsmGrammarTokens::GR_rpar, ut_BYTE_PTR ")");break;
-			case '-': seek_forward();return mtoken->new_token<AsmGrammarTokens> (AsmGrammarTokens::GR_minus, ut_BYTE_PTR "-");break;
-			case '+': seek_forward();return mtoken->new_token<AsmGrammarTokens> (AsmGrammarTokens::GR_plus, ut_BYTE_PTR "+");break;
-			case '\'':seek_forward();return mtoken->new_token<AsmGrammarTokens> (AsmGrammarTokens::GR_singleQ, ut_BYTE_PTR "'");break;
-			case '"': seek_forward();return mtoken->new_token<AsmGrammarTokens> (AsmGrammarTokens::GR_doubleQ, ut_BYTE_PTR "\"");break;
-			case '%': seek_forward();return mtoken->new_token<AsmGrammarTokens> (AsmGrammarTokens::GR_percent, ut_BYTE_PTR "%");break;
-			case '\0':goto end;break;
-			case ';': {
-				while(lstate->current_value != '\n' && lstate->current_value != '\0')
-				{
+			token_offset = position();
+
+			switch(next_state(LexState::LS_start))
+			{
+				case LexState::LS_whitespace: scan(LexState::LS_whitespace);break;
+				case LexState::LS_identifier: {
+					scan(LexState::LS_identifier);
+					return mtoken->create_new_token_alone(take_value(token_offset, position()));
+				}
+				case LexState::LS_number: return lex_number();break;
+				case LexState::LS_grammar: {
+					AsmGrammarTokens token_id = grammar_of_char[lstate->current_value];
+
 					seek_forward();
-					printf("%c", lstate->current_value);
+					return grammar_token(token_id);
 				}
+				case LexState::LS_dot: {
+					seek_forward();
+					if(char_classes[lstate->current_value] != CharClass::CC_letter && char_classes[lstate->current_value] != CharClass::CC_hex_letter)
+						return grammar_token(AsmGrammarTokens::GR_dot);
 
-				seek_forward();
-				goto redo;
+					/* `.text`, `.data`, ...; the parser decides whether it is a section it knows. */
+					scan(LexState::LS_identifier);
+					return mtoken->new_token<AsmKeywordTokens> (AsmKeywordTokens::KW_section, take_value(token_offset, position()));
+				}
+				case LexState::LS_comment: {
+					scan(LexState::LS_comment);
+					MASM_debug("[DEBUG]\tComment: `%.*s`\n", (nt_DWORD) (position() - token_offset - 1), nt_BYTE_CPTR lstate->asm_code + token_offset + 1);
+
+					/* A `\0` ends the file, in a comment as well. */
+					if(lstate->current_value == '\n') seek_forward();
+					break;
+				}
+				case LexState::LS_end: return grammar_token(AsmGrammarTokens::GR_asm_EOF);break;
+				default: {
+					MASM_error("\n%s[INVALID SYNTAX, LINE %d]%s\tUnexpected character %s`%c`%s (column %d).\n",
+						red, error_line(), white,
+						yellow, lstate->current_value, white,
+						error_column())
+				}
+			}
+		}
+	}
+
+	/* Lex tokens into `into` until it has `max_tokens` of them, the way `get_next_token` would one at a time;
+	 * true once the end of the file, or an error, was lexed. `after_incsrc` carries over from one call to the next.
+	 * Runs on a thread that defers its errors: an error becomes an error token, left for the parser to raise.
+	 * */
+	bool lex_tokens(std::vector<struct piped_token> *into, ut_LSIZE max_tokens, bool &after_incsrc)
+	{
+		while(into->size() < max_tokens)
+		{
+			struct MocaAsm_TD *token = nullptr;
+			try
+			{
+				token = lex_token();
+				into->push_back({token, token_offset, std::string()});
+
+				/* `incsrc` reads the string following it straight from the lexer; read it now, while the lexer is still there. */
+				if(after_incsrc && token->token_type == TypeOfTokens::TT_grammar && token->token_id == (ut_BYTE) AsmGrammarTokens::GR_doubleQ)
+					into->back().string_literal = nt_BYTE_CPTR read_string_literal();
 			}
-			default: break;
+			catch(masm_diag::deferred_error &error)
+			{
+				/* A string that is never closed takes the place of its `"`: the parser would read it right after the `"`. */
+				if(token)
+				{
+					free_token(token);
+					into->pop_back();
+				}
+
+				into->push_back({nullptr, token_offset, std::move(error.diagnostic)});
+				return true;
+			}
+
+			after_incsrc = token->token_type == TypeOfTokens::TT_keyword && token->token_id == (ut_BYTE) AsmKeywordTokens::KW_incsrc;
+
+			if(token->token_type == TypeOfTokens::TT_grammar && token->token_id == (ut_BYTE) AsmGrammarTokens::GR_asm_EOF)
+				return true;
 		}
 
-		end:
-		return mtoken->new_token<AsmGrammarTokens> (AsmGrammarTokens::GR_asm_EOF, ut_BYTE_PTR "\0");
+		return false;
 	}
 
-	void get_and_tokenize_imm(struct MocaAsm_TD *tdata)
+	/* Body of `lexer_thread`: lex the whole file into batches. */
+	void lex_ahead()
 	{
-		delete tdata->token_value;
-		mtoken->delete_instance<struct MocaAsm_TD> (tdata);
-		
-		redo:
-		if(lstate->current_value == ' ' || lstate->current_value == '\t')
-		{ skip_whitespace(); goto redo; }
+		masm_trace::tracer.name_thread("lexer");
+		masm_diag::sink.set_deferring(true);
+		MASM_TRACE_SPAN("lexer", "lex_ahead", lstate->asm_filename);
 
-		MASM_assert(lstate->current_value != '\n',
-			"\n%s[UNEXPECTED NEWLINE]%s\tThere was an unexpected newline on line %d.\n",
-			red, white,
-			lstate->line)
-		
-		printf("%c", lstate->current_value);
+		bool after_incsrc = false;
+		bool lexed_EOF = false;
+
+		while(!lexed_EOF)
+		{
+			std::vector<struct piped_token> *filling = queue->begin_push();
+			lexed_EOF = lex_tokens(filling, MocaAsm_token_queue::batch_tokens, after_incsrc);
+			queue->end_push();
+		}
+	}
+
+	/* Index just past the next `c` in `[from, end)`; `end` if there is none. */
+	ut_LSIZE find_past(ut_BYTE c, ut_LSIZE from, ut_LSIZE end)
+	{
+		const void *found = memchr(lstate->asm_code + from, c, end - from);
+		return found ? (ut_LSIZE) (ut_BYTE_CPTR found - lstate->asm_code) + 1 : end;
+	}
+
+	/* Where every chunk of `[begin, end)` starts, followed by `end`. Chunks are about `parallel_chunk_bytes` and end right after a `\n`.
+	 * A chunk never starts at a `"` (past whitespace, empty lines and comments): it could be the string following an `incsrc`
+	 * at the end of the chunk before, which only the lexer that lexed the `incsrc` knows to read. The line of the `"` goes to that chunk instead.
+	 * */
+	std::vector<ut_LSIZE> split_into_chunks(ut_LSIZE begin, ut_LSIZE end)
+	{
+		const ut_BYTE *code = lstate->asm_code;
+		std::vector<ut_LSIZE> boundaries(1, begin);
+
+		while(end - boundaries.back() > parallel_chunk_bytes)
+		{
+			ut_LSIZE chunk_end = find_past('\n', boundaries.back() + parallel_chunk_bytes, end);
+
+			for(ut_LSIZE at = chunk_end; at < end;)
+			{
+				if(code[at] == ' ' || code[at] == '\t' || code[at] == '\r' || code[at] == '\n') at++;
+				else if(code[at] == ';') at = find_past('\n', at, end);
+				else if(code[at] == '"') chunk_end = at = find_past('\n', at, end);
+				else break;
+			}
+
+			if(chunk_end >= end) break;
+			boundaries.push_back(chunk_end);
+		}
+
+		boundaries.push_back(end);
+		return boundaries;
+	}
+
+	void lex_chunk(ut_DWORD index)
+	{
+		struct lexed_chunk &chunk = chunks[index];
+		MASM_TRACE_SPAN("lexer", "lex_chunk", lstate->asm_filename);
+
+		MocaAsm_lexer chunk_lexer(chunks, index, lstate, mtoken);
+		bool after_incsrc = false;
+		chunk_lexer.lex_tokens(&chunk.tokens, std::numeric_limits<ut_LSIZE>::max(), after_incsrc);
+
+		/* Running out of the chunk is not the end of the file, unless it is the last chunk; an error token stays. */
+		if(index + 1 < amnt_of_chunks && chunk.tokens.back().token)
+		{
+			free_token(chunk.tokens.back().token);
+			chunk.tokens.pop_back();
+		}
+
+		chunk.done.store(true, std::memory_order_release);
+		chunk.done.notify_all();
+	}
+
+	/* Body of every thread in `chunk_threads`: take the next chunk in order, as long as it is at most `chunk_window` chunks
+	 * ahead of the parser (so only that many chunks of tokens exist at once).
+	 * */
+	void lex_chunks()
+	{
+		masm_trace::tracer.name_thread("lexer");
+		masm_diag::sink.set_deferring(true);
+
+		for(ut_DWORD index = next_chunk++; index < amnt_of_chunks; index = next_chunk++)
+		{
+			for(ut_DWORD consumed = consumed_chunks.load(std::memory_order_acquire); index >= consumed + chunk_window; consumed = consumed_chunks.load(std::memory_order_acquire))
+				consumed_chunks.wait(consumed, std::memory_order_acquire);
+
+			lex_chunk(index);
+		}
+	}
+
+	/* The next batch of tokens lexed ahead of the parser: a batch of the queue, or the next chunk. */
+	void take_batch()
+	{
+		batch_position = 0;
+
+		if(lexer_thread)
+		{
+			batch = queue->begin_pop();
+			return;
+		}
+
+		struct lexed_chunk &chunk = chunks[consumed_chunks.load(std::memory_order_relaxed)];
+		chunk.done.wait(false, std::memory_order_acquire);
+
+		batch = &chunk.tokens;
+	}
+
+	void release_batch()
+	{
+		if(lexer_thread) queue->end_pop();
+		else
+		{
+			std::vector<struct piped_token>().swap(*batch);
+			consumed_chunks.fetch_add(1, std::memory_order_release);
+			consumed_chunks.notify_all();
+		}
+
+		batch = nullptr;
+	}
+
+public:
+	/* Lex the rest of the file ahead of the parser, on a thread of its own (`LM_pipelined`) or on every core (`LM_parallel`,
+	 * `amnt_of_threads` of 0 for one per core); every token is still handed out by `get_next_token`, in order.
+	 * `LM_auto` picks one by the size of the file (`pipeline_threshold`, `parallel_threshold`) and the amount of cores.
+	 * */
+	void start(LexerMode mode, ut_DWORD amnt_of_threads = 0)
+	{
+		if(mode == LexerMode::LM_serial || lexer_thread || chunks) return;
+		if(mode == LexerMode::LM_auto)
+		{
+			if(lstate->filesize < pipeline_threshold || std::thread::hardware_concurrency() < 2) return;
+
+			/* With two cores, one lexing thread next to the parser is all there is room for. */
+			mode = lstate->filesize >= parallel_threshold && std::thread::hardware_concurrency() > 2 ? LexerMode::LM_parallel : LexerMode::LM_pipelined;
+		}
+
+		if(mode == LexerMode::LM_pipelined)
+		{
+			queue = new MocaAsm_token_queue;
+			lexer_thread = new std::thread(&MocaAsm_lexer::lex_ahead, this);
+			return;
+		}
+
+		/* Whatever was lexed already stays out of the chunks; a `\0` ends the file for the serial lexer, so it ends the last chunk. */
+		std::vector<ut_LSIZE> boundaries = split_into_chunks(lstate->index - 1, find_past('\0', lstate->index - 1, lstate->filesize));
+
+		amnt_of_chunks = (ut_DWORD) boundaries.size() - 1;
+		chunks = new struct lexed_chunk[amnt_of_chunks];
+		for(ut_DWORD i = 0; i < amnt_of_chunks; i++)
+		{
+			chunks[i].begin = boundaries[i];
+			chunks[i].end = boundaries[i + 1];
+		}
+
+		ut_DWORD amnt_of_workers = masm_pool::workers_for(amnt_of_chunks, amnt_of_threads);
+		chunk_window = 4 * amnt_of_workers;
+
+		for(ut_DWORD worker = 0; worker < amnt_of_workers; worker++)
+			chunk_threads.emplace_back(&MocaAsm_lexer::lex_chunks, this);
+	}
+
+	bool is_pipelined()
+	{ return lexer_thread != nullptr || chunks != nullptr; }
+
+	/* Go on lexing at the start of the next line; how the parser recovers from an error (`--max-errors=`).
+	 * Only for the serial lexer.
+	 * */
+	void skip_line()
+	{
+		/* Same as skipping a comment; a `\0` still ends the file. */
+		scan(LexState::LS_comment);
+		if(lstate->current_value == '\n') seek_forward();
+	}
+
+	ut_BYTE *get_string_literal()
+	{
+		if(!is_pipelined()) return read_string_literal();
+
+		return ut_BYTE_PTR piped_literal.c_str();
+	}
+
+	struct MocaAsm_TD *get_next_token()
+	{
+		if(!is_pipelined())
+		{
+			struct MocaAsm_TD *token = lex_token();
+			mtoken->finish_token(token, [this]() { return get_line(); });
+			return token;
+		}
+
+		/* A chunk can be without tokens (nothing but comments). */
+		while(!batch || batch_position == batch->size())
+		{
+			if(batch) release_batch();
+
+			/* Past the end; the serial lexer keeps handing out `GR_asm_EOF` as well. */
+			if(piped_EOF) return grammar_token(AsmGrammarTokens::GR_asm_EOF);
+
+			take_batch();
+		}
+
+		struct piped_token &piped = (*batch)[batch_position++];
+		piped_offset = piped.offset;
+
+		/* Nothing was lexed past it, so there is nothing to hand out after it either. */
+		if(!piped.token)
+		{
+			piped_EOF = true;
+			masm_diag::sink.raise(piped.string_literal);
+		}
+
+		piped_literal.swap(piped.string_literal);
+
+		mtoken->finish_token(piped.token, [this]() { return get_line(); });
+		if(piped.token->token_type == TypeOfTokens::TT_grammar && piped.token->token_id == (ut_BYTE) AsmGrammarTokens::GR_asm_EOF)
+			piped_EOF = true;
+
+		return piped.token;
 	}
 
 	template<typename T>
@@ -310,8 +915,53 @@ public:
 
 	~MocaAsm_lexer()
 	{
+		if(lexer_thread)
+		{
+			/* The parser normally reads up to the end of the file; if it did not, let the lexer get there. */
+			while(!piped_EOF)
+			{
+				if(!batch || batch_position == batch->size())
+				{
+					if(batch) release_batch();
+					take_batch();
+				}
+
+				struct MocaAsm_TD *token = (*batch)[batch_position++].token;
+				piped_EOF = !token || (token->token_type == TypeOfTokens::TT_grammar && token->token_id == (ut_BYTE) AsmGrammarTokens::GR_asm_EOF);
+
+				if(token) free_token(token);
+			}
+			if(batch) release_batch();
+
+			lexer_thread->join();
+			delete lexer_thread;
+			delete queue;
+
+			lexer_thread = nullptr;
+			queue = nullptr;
+		}
+
+		if(chunks)
+		{
+			/* Let every thread run out of chunks: none get taken anymore, and none wait for the parser. */
+			next_chunk.store(amnt_of_chunks);
+			consumed_chunks.store(amnt_of_chunks, std::memory_order_release);
+			consumed_chunks.notify_all();
+
+			for(std::thread &chunk_thread : chunk_threads) chunk_thread.join();
+
+			/* Whatever the parser did not take (a chunk handed out entirely is empty by now). */
+			for(ut_DWORD i = 0; i < amnt_of_chunks; i++)
+				for(ut_LSIZE at = batch == &chunks[i].tokens ? batch_position : 0; at < chunks[i].tokens.size(); at++)
+					if(chunks[i].tokens[at].token) free_token(chunks[i].tokens[at].token);
+
+			delete[] chunks;
+			chunks = nullptr;
+			batch = nullptr;
+		}
+
 		if(lstate) delete lstate;
-		if(mtoken) delete mtoken;
+		if(mtoken && owns_tokenizer) delete mtoken;
 
 		lstate = nullptr;
 		mtoken = nullptr;
@@ -0,0 +1,201 @@
+#ifndef Moca_assembly_lines
+#define Moca_assembly_lines
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#include <sys/mman.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* Line/column of a byte offset in a source file, worked out only once a diagnostic or debug record asks for one.
+ *
+ * The lexer only keeps byte offsets. The first time a line is asked for, the newlines up to that offset get counted
+ * (16 bytes at a time with SSE2), and the count is kept as a cursor: a listing asks for the line of every record in order,
+ * so a file gets counted once, in one pass. An offset before the cursor starts from `blocks`, the amount of newlines
+ * before every `block_bytes` of the file, filled in on the way.
+ *
+ * Nothing past the lexer keeps a line either: statements, IR records and fixups carry a source position (`MocaAsm_source_map`),
+ * and only a diagnostic or a listing turns one into a line (`source_line`).
+ * */
+namespace masm_lines
+{
+
+constexpr ut_LSIZE block_bytes = 64 * 1024;
+
+/* Newlines in `[begin, end)`. */
+inline ut_LSIZE count_newlines(const ut_BYTE *begin, const ut_BYTE *end)
+{
+    ut_LSIZE amnt_of_newlines = 0;
+
+#if defined(__SSE2__)
+    const __m128i newline = _mm_set1_epi8('\n');
+
+    for(; end - begin >= 16; begin += 16)
+        amnt_of_newlines += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) begin), newline)));
+#endif
+
+    for(; begin < end; begin++)
+        if(*begin == '\n') amnt_of_newlines++;
+
+    return amnt_of_newlines;
+}
+
+class MocaAsm_line_index
+{
+private:
+    const ut_BYTE           *source = nullptr;
+    ut_LSIZE                size = 0;
+
+    /* `blocks[b]` is the amount of newlines before `b * block_bytes`; there is one for every block the cursor got to. */
+    std::vector<ut_LSIZE>   blocks;
+    ut_LSIZE                cursor = 0;
+    ut_LSIZE                newlines_before_cursor = 0;
+
+    void advance(ut_LSIZE to)
+    {
+        while(cursor < to)
+        {
+            ut_LSIZE block_end = (cursor / block_bytes + 1) * block_bytes;
+            ut_LSIZE end = block_end < to ? block_end : to;
+
+            newlines_before_cursor += count_newlines(source + cursor, source + end);
+            cursor = end;
+
+            if(cursor == block_end) blocks.push_back(newlines_before_cursor);
+        }
+    }
+
+public:
+    MocaAsm_line_index(const ut_BYTE *source, ut_LSIZE size)
+        : source(source), size(size), blocks(1, 0)
+    {}
+
+    /* Line `offset` is on, from 1. */
+    ut_LSIZE line_of(ut_LSIZE offset)
+    {
+        if(offset > size) offset = size;
+
+        if(offset >= cursor)
+        {
+            advance(offset);
+            return newlines_before_cursor + 1;
+        }
+
+        ut_LSIZE block = offset / block_bytes;
+        return blocks[block] + count_newlines(source + block * block_bytes, source + offset) + 1;
+    }
+
+    /* Column of `offset` in its line, in bytes, from 1. */
+    ut_LSIZE column_of(ut_LSIZE offset)
+    {
+        if(offset > size) offset = size;
+
+        ut_LSIZE line_start = offset;
+        while(line_start > 0 && source[line_start - 1] != '\n') line_start--;
+
+        return offset - line_start + 1;
+    }
+
+    ~MocaAsm_line_index()
+    {}
+};
+
+/* Every file of an assembly (the one given and whatever it `incsrc`s) gets a range of source positions, in the order the
+ * files are opened: a position is the `base` of its file plus a byte offset in it. One more position than the file has
+ * bytes is taken, so the end of the file (where `GR_asm_EOF` is) still belongs to it.
+ * The files stay mapped until `clear`; an included file is closed long before its records get encoded or listed.
+ * */
+class MocaAsm_source_map
+{
+private:
+    struct source_file
+    {
+        ut_DWORD                base;
+        const ut_BYTE           *source;
+        ut_LSIZE                size;
+        MocaAsm_line_index      *lines;
+    };
+
+    /* In order of `base`. */
+    std::vector<struct source_file> files;
+    ut_LLBYTE next_base = 0;
+
+    /* Encoder workers can report at the same time, and a line index moves its cursor. */
+    std::mutex lock;
+
+    struct source_file &file_of(ut_DWORD position)
+    {
+        auto after = std::upper_bound(files.begin(), files.end(), position,
+            [](ut_DWORD at, const struct source_file &file) { return at < file.base; });
+
+        return *(after - 1);
+    }
+
+public:
+    MocaAsm_source_map()
+    {}
+
+    /* `size` bytes mapped at `source`, unmapped by `clear`; returns the position of the first byte. */
+    ut_DWORD add(const ut_BYTE *source, ut_LSIZE size)
+    {
+        MASM_assert(next_base + size + 1 <= 0xFFFFFFFF,
+            "\n%s[FILE ERROR]%s\tThe files of one assembly can not take up more than 4 GB together.\n",
+            red, white)
+
+        std::lock_guard<std::mutex> guard(lock);
+        files.push_back({(ut_DWORD) next_base, source, size, new MocaAsm_line_index(source, size)});
+        next_base += size + 1;
+
+        return files.back().base;
+    }
+
+    /* Line `position` is on in its file, from 1; 0 if there are no files (a symbol the linker defined). */
+    ut_DWORD line_of(ut_DWORD position)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if(files.empty()) return 0;
+
+        struct source_file &file = file_of(position);
+
+        return (ut_DWORD) file.lines->line_of(position - file.base);
+    }
+
+    ut_DWORD column_of(ut_DWORD position)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if(files.empty()) return 0;
+
+        struct source_file &file = file_of(position);
+
+        return (ut_DWORD) file.lines->column_of(position - file.base);
+    }
+
+    /* The assembly is done; every position handed out is meaningless from here on. */
+    void clear()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        for(struct source_file &file : files)
+        {
+            delete file.lines;
+            munmap((void *) file.source, file.size);
+        }
+
+        files.clear();
+        next_base = 0;
+    }
+
+    ~MocaAsm_source_map()
+    { clear(); }
+};
+
+inline MocaAsm_source_map sources;
+
+/* Line of a source position; for diagnostics and listings only. */
+inline ut_DWORD source_line(ut_DWORD position)
+{ return sources.line_of(position); }
+
+}
+
+#endif
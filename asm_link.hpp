@@ -0,0 +1,500 @@
+#ifndef Moca_assembly_link
+#define Moca_assembly_link
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "assembler_backend/asm_ir.hpp"
+#include "asm_san.hpp"
+
+/* `masm --link`: links units assembled with `-OF elf32` into one flat image.
+ *
+ *      1. every unit is mapped and checked                             (one task per unit)
+ *      2. every unit's `.text`, `.init`, ... is given its address:     (serial, it is only a few additions)
+ *         all `.text`s in command line order starting at the base, then all `.init`s, `.rodata`s, `.data`s and `.bss`s,
+ *         each kind starting on a `section_alignment` boundary, like the sections of a single file
+ *      3. every global goes into a sharded hash map                    (one task per unit; a lock per shard)
+ *      4. every unit's sections are copied into the image and their    (one task per section of a unit; the ranges
+ *         relocations applied                                           do not overlap, so nothing is locked)
+ *
+ * The parallel steps run on the work-stealing pool in `asm_pool.hpp`.
+ * Defining a global in two units, or using one no unit defines, is an error.
+ * */
+namespace masm_link
+{
+
+using namespace masm_ir;
+using namespace masm_san;
+
+/* A global, once every section has its address. */
+struct linked_symbol
+{
+    ut_DWORD        address;
+    ut_DWORD        size;
+    ut_WORD         section;
+    bool            is_variable;
+    ut_DWORD        unit;           // index of the unit defining it
+};
+
+/* The map globals are resolved through; a name only ever locks the shard its hash falls into. */
+class MocaAsm_link_symbols
+{
+private:
+    static constexpr ut_DWORD amnt_of_shards = 64;
+
+    struct symbol_shard
+    {
+        std::mutex                                              lock;
+        std::unordered_map<std::string, struct linked_symbol>   symbols;
+    };
+
+    struct symbol_shard shards[amnt_of_shards];
+
+    struct symbol_shard &shard_of(const std::string &name)
+    { return shards[hash_name(name.c_str(), name.size()) & (amnt_of_shards - 1)]; }
+
+public:
+    MocaAsm_link_symbols()
+    {}
+
+    /* Returns the unit that already defines `name`, or `symbol.unit` if this is the first definition. */
+    ut_DWORD define(const std::string &name, struct linked_symbol symbol)
+    {
+        struct symbol_shard &shard = shard_of(name);
+        std::lock_guard<std::mutex> guard(shard.lock);
+
+        auto defined = shard.symbols.emplace(name, symbol);
+        return defined.first->second.unit;
+    }
+
+    /* Only called once every unit has defined its globals, so nothing is written while it looks. */
+    struct linked_symbol *find(const std::string &name)
+    {
+        struct symbol_shard &shard = shard_of(name);
+
+        auto symbol = shard.symbols.find(name);
+        return symbol == shard.symbols.end() ? nullptr : &symbol->second;
+    }
+
+    /* Every global, in no particular order. */
+    template<typename F>
+    void for_each(F &&visit)
+    {
+        for(struct symbol_shard &shard : shards)
+            for(auto &symbol : shard.symbols) visit(symbol.first, symbol.second);
+    }
+
+    ~MocaAsm_link_symbols()
+    {}
+};
+
+/* One `-OF elf32` object. */
+struct link_unit
+{
+    const nt_BYTE                                   *filename;
+    const ut_BYTE                                   *data = nullptr;
+    ut_LSIZE                                        data_size = 0;
+    const Elf32_Ehdr                                *header = nullptr;
+    const Elf32_Shdr                                *section_headers = nullptr;
+
+    /* Index of the unit's section header for each `AsmSection` (0 if it has none), and where it goes in the image. */
+    std::array<ut_WORD, amnt_of_sections>           section_index = {};
+    std::array<ut_DWORD, amnt_of_sections>          address = {};
+
+    ut_WORD                                         symtab_index = 0;
+};
+
+class MocaAsm_linker
+{
+private:
+    std::vector<struct link_unit *>                 units;
+    MocaAsm_link_symbols                            globals;
+    std::array<struct section_layout, amnt_of_sections> sections = {};
+    std::vector<ut_BYTE>                            image;
+    ut_DWORD                                        base;
+
+    std::atomic<ut_LLBYTE>                          amnt_of_relocations{0};
+
+    const Elf32_Shdr &section_header(struct link_unit *unit, ut_WORD index)
+    { return unit->section_headers[index]; }
+
+    const nt_BYTE *section_name(struct link_unit *unit, ut_WORD index)
+    {
+        const Elf32_Shdr &names = section_header(unit, unit->header->e_shstrndx);
+        return (const nt_BYTE *) (unit->data + names.sh_offset + section_header(unit, index).sh_name);
+    }
+
+    const Elf32_Sym *symbols_of(struct link_unit *unit, ut_DWORD &amnt_of_symbols)
+    {
+        const Elf32_Shdr &symtab = section_header(unit, unit->symtab_index);
+
+        amnt_of_symbols = symtab.sh_size / sizeof(Elf32_Sym);
+        return (const Elf32_Sym *) (unit->data + symtab.sh_offset);
+    }
+
+    const nt_BYTE *symbol_name(struct link_unit *unit, const Elf32_Sym &symbol)
+    {
+        const Elf32_Shdr &strtab = section_header(unit, section_header(unit, unit->symtab_index).sh_link);
+        return (const nt_BYTE *) (unit->data + strtab.sh_offset + symbol.st_name);
+    }
+
+    /* The `AsmSection` a section of a unit is linked into, `S_NONE` if it is not part of the image. */
+    AsmSection section_of(struct link_unit *unit, ut_WORD index)
+    {
+        for(ut_BYTE section = 0; section < amnt_of_sections; section++)
+            if(unit->section_index[section] == index && index != 0) return (AsmSection) section;
+
+        return AsmSection::S_NONE;
+    }
+
+    void load(struct link_unit *unit)
+    {
+        MASM_TRACE_SPAN("link", "load", unit->filename);
+
+        nt_DWORD fd = open(unit->filename, O_RDONLY);
+        MASM_assert(fd >= 0,
+            "\n%s[FILE ERROR]%s\tThere was an error opening the object file `%s`.\n",
+            red, white,
+            unit->filename)
+
+        struct stat info;
+        fstat(fd, &info);
+        unit->data_size = (ut_LSIZE) info.st_size;
+
+        MASM_assert(unit->data_size >= sizeof(Elf32_Ehdr),
+            "\n%s[LINK ERROR]%s\t`%s` is too small to be an object file.\n",
+            red, white,
+            unit->filename)
+
+        unit->data = ut_BYTE_CPTR mmap(nullptr, unit->data_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        MASM_assert(unit->data != MAP_FAILED,
+            "\n%s[FILE ERROR]%s\tThere was an error mapping the object file `%s`.\n",
+            red, white,
+            unit->filename)
+
+        unit->header = (const Elf32_Ehdr *) unit->data;
+        MASM_assert(memcmp(unit->header->e_ident, ELFMAG, SELFMAG) == 0 && unit->header->e_ident[EI_CLASS] == ELFCLASS32 &&
+            unit->header->e_ident[EI_DATA] == ELFDATA2LSB && unit->header->e_type == ET_REL && unit->header->e_machine == EM_386,
+            "\n%s[LINK ERROR]%s\t`%s` is not an ELF32 i386 relocatable object; assemble it with %s`-OF elf32`%s.\n",
+            red, white,
+            unit->filename,
+            green, white)
+
+        /* Make sure every table is inside of the file before handing out pointers into it. */
+        MASM_assert(unit->header->e_shentsize == sizeof(Elf32_Shdr) &&
+            unit->header->e_shoff + (ut_LSIZE) unit->header->e_shnum * sizeof(Elf32_Shdr) <= unit->data_size &&
+            unit->header->e_shstrndx < unit->header->e_shnum,
+            "\n%s[LINK ERROR]%s\tThe object file `%s` is truncated or corrupt.\n",
+            red, white,
+            unit->filename)
+
+        unit->section_headers = (const Elf32_Shdr *) (unit->data + unit->header->e_shoff);
+        for(ut_WORD index = 1; index < unit->header->e_shnum; index++)
+        {
+            const Elf32_Shdr &header = section_header(unit, index);
+
+            MASM_assert(header.sh_type == SHT_NOBITS || header.sh_offset + (ut_LSIZE) header.sh_size <= unit->data_size,
+                "\n%s[LINK ERROR]%s\tThe object file `%s` is truncated or corrupt.\n",
+                red, white,
+                unit->filename)
+
+            if(header.sh_type == SHT_SYMTAB) unit->symtab_index = index;
+            if(!(header.sh_flags & SHF_ALLOC)) continue;
+
+            ut_BYTE section = 0;
+            while(section < amnt_of_sections && strcmp(section_name(unit, index), section_names[section]) != 0) section++;
+
+            MASM_assert(section < amnt_of_sections,
+                "\n%s[LINK ERROR]%s\t`%s` has the section %s`%s`%s; only %s`.text`%s, %s`.init`%s, %s`.rodata`%s, %s`.data`%s and %s`.bss`%s can be linked.\n",
+                red, white,
+                unit->filename,
+                yellow, section_name(unit, index), white,
+                green, white, green, white, green, white, green, white, green, white)
+
+            unit->section_index[section] = index;
+        }
+
+        MASM_assert(unit->symtab_index != 0,
+            "\n%s[LINK ERROR]%s\t`%s` has no symbol table.\n",
+            red, white,
+            unit->filename)
+    }
+
+    /* Step 2; see the top of the file. */
+    void place_sections()
+    {
+        ut_DWORD address = base;
+
+        for(ut_BYTE section = 0; section < amnt_of_sections; section++)
+        {
+            if(section != (ut_BYTE) AsmSection::S_text)
+                address = (address + section_alignment - 1) & ~(section_alignment - 1);
+            sections[section].base = address;
+
+            for(struct link_unit *unit : units)
+            {
+                if(unit->section_index[section] == 0) continue;
+
+                const Elf32_Shdr &header = section_header(unit, unit->section_index[section]);
+                ut_DWORD alignment = header.sh_addralign > 1 ? header.sh_addralign : 1;
+
+                address = (address + alignment - 1) / alignment * alignment;
+                unit->address[section] = address;
+                address += header.sh_size;
+            }
+
+            sections[section].size = address - sections[section].base;
+        }
+
+        /* `.bss` comes last, so the image ends where the last initialized section does. */
+        ut_DWORD end = base;
+        for(ut_BYTE section = 0; section < (ut_BYTE) AsmSection::S_bss; section++)
+            if(sections[section].size != 0) end = sections[section].base + sections[section].size;
+
+        image.assign(end - base, 0);
+    }
+
+    /* Step 3. */
+    void define_globals(ut_DWORD unit_id)
+    {
+        struct link_unit *unit = units[unit_id];
+        MASM_TRACE_SPAN("link", "define_globals", unit->filename);
+
+        ut_DWORD amnt_of_symbols;
+        const Elf32_Sym *symbols = symbols_of(unit, amnt_of_symbols);
+
+        for(ut_DWORD i = 1; i < amnt_of_symbols; i++)
+        {
+            const Elf32_Sym &symbol = symbols[i];
+            if(ELF32_ST_BIND(symbol.st_info) == STB_LOCAL || symbol.st_shndx == SHN_UNDEF) continue;
+
+            AsmSection section = section_of(unit, symbol.st_shndx);
+            MASM_assert(section != AsmSection::S_NONE || symbol.st_shndx == SHN_ABS,
+                "\n%s[LINK ERROR]%s\t%s`%s`%s in `%s` is not defined in a section that can be linked.\n",
+                red, white,
+                yellow, symbol_name(unit, symbol), white,
+                unit->filename)
+
+            struct linked_symbol linked = {};
+            linked.address = section == AsmSection::S_NONE ? symbol.st_value : unit->address[(ut_BYTE) section] + symbol.st_value;
+            linked.size = symbol.st_size;
+            linked.section = section == AsmSection::S_NONE ? 0 : (ut_WORD) section;
+            linked.is_variable = ELF32_ST_TYPE(symbol.st_info) == STT_OBJECT;
+            linked.unit = unit_id;
+
+            ut_DWORD defined_by = globals.define(symbol_name(unit, symbol), linked);
+            MASM_assert(defined_by == unit_id,
+                "\n%s[LINK ERROR]%s\t%s`%s`%s is defined in both `%s` and `%s`.\n",
+                red, white,
+                yellow, symbol_name(unit, symbol), white,
+                units[defined_by]->filename, unit->filename)
+        }
+    }
+
+    /* Address of symbol `id` of `unit`. */
+    ut_DWORD symbol_address(struct link_unit *unit, const Elf32_Sym *symbols, ut_DWORD id)
+    {
+        const Elf32_Sym &symbol = symbols[id];
+
+        if(symbol.st_shndx == SHN_ABS) return symbol.st_value;
+        if(ELF32_ST_BIND(symbol.st_info) == STB_LOCAL)
+        {
+            AsmSection section = section_of(unit, symbol.st_shndx);
+            MASM_assert(section != AsmSection::S_NONE,
+                "\n%s[LINK ERROR]%s\t`%s` has a relocation against a section that is not linked.\n",
+                red, white,
+                unit->filename)
+
+            return unit->address[(ut_BYTE) section] + symbol.st_value;
+        }
+
+        struct linked_symbol *linked = globals.find(symbol_name(unit, symbol));
+        MASM_assert(linked,
+            "\n%s[LINK ERROR]%s\t%s`%s`%s is used in `%s`, but no unit defines it.\n",
+            red, white,
+            yellow, symbol_name(unit, symbol), white,
+            unit->filename)
+
+        return linked->address;
+    }
+
+    /* Step 4, for section `section` of `unit`: `[unit->address[section], + size)` of the image. */
+    void emit_section(struct link_unit *unit, ut_BYTE section)
+    {
+        MASM_TRACE_SPAN("link", "emit_section", unit->filename);
+
+        ut_WORD index = unit->section_index[section];
+        const Elf32_Shdr &header = section_header(unit, index);
+        ut_BYTE *out = image.data() + (unit->address[section] - base);
+
+        memcpy(out, unit->data + header.sh_offset, header.sh_size);
+
+        ut_DWORD amnt_of_symbols;
+        const Elf32_Sym *symbols = symbols_of(unit, amnt_of_symbols);
+        ut_LLBYTE applied = 0;
+
+        for(ut_WORD rel_index = 1; rel_index < unit->header->e_shnum; rel_index++)
+        {
+            const Elf32_Shdr &rel_header = section_header(unit, rel_index);
+            if(rel_header.sh_type != SHT_REL || rel_header.sh_info != index) continue;
+
+            MASM_assert(rel_header.sh_link == unit->symtab_index,
+                "\n%s[LINK ERROR]%s\tThe object file `%s` is truncated or corrupt.\n",
+                red, white,
+                unit->filename)
+
+            const Elf32_Rel *relocations = (const Elf32_Rel *) (unit->data + rel_header.sh_offset);
+            ut_DWORD amnt_of_relocations = rel_header.sh_size / sizeof(Elf32_Rel);
+
+            for(ut_DWORD i = 0; i < amnt_of_relocations; i++)
+            {
+                const Elf32_Rel &relocation = relocations[i];
+                ut_BYTE type = ELF32_R_TYPE(relocation.r_info);
+                ut_DWORD symbol = ELF32_R_SYM(relocation.r_info);
+
+                ut_BYTE size = 0;
+                bool relative = false;
+                switch(type)
+                {
+                    case R_386_8: size = 1;break;
+                    case R_386_16: size = 2;break;
+                    case R_386_32: size = 4;break;
+                    case R_386_PC8: size = 1;relative = true;break;
+                    case R_386_PC16: size = 2;relative = true;break;
+                    case R_386_PC32: size = 4;relative = true;break;
+                    default: break;
+                }
+
+                MASM_assert(size != 0 && relocation.r_offset + size <= header.sh_size && symbol < amnt_of_symbols,
+                    "\n%s[LINK ERROR]%s\t`%s` has a relocation (type %d at 0x%X in %s`%s`%s) that can not be applied.\n",
+                    red, white,
+                    unit->filename, type, relocation.r_offset,
+                    yellow, section_names[section], white)
+
+                /* REL: the addend is the value already in the field. */
+                nt_LLBYTE addend = 0;
+                switch(size)
+                {
+                    case 1: addend = (st_BYTE) out[relocation.r_offset];break;
+                    case 2: { st_WORD value; memcpy(&value, &out[relocation.r_offset], 2); addend = value; break; }
+                    default: { st_DWORD value; memcpy(&value, &out[relocation.r_offset], 4); addend = value; break; }
+                }
+
+                ut_DWORD place = unit->address[section] + relocation.r_offset;
+                nt_LLBYTE value = (nt_LLBYTE) symbol_address(unit, symbols, symbol) + addend - (relative ? (nt_LLBYTE) place : 0);
+
+                /* Absolute values may be signed or unsigned; relative ones are always signed. */
+                nt_LLBYTE low = -(1LL << (size * 8 - 1));
+                nt_LLBYTE high = relative ? (1LL << (size * 8 - 1)) - 1 : (1LL << (size * 8)) - 1;
+                MASM_assert(size == 4 || (value >= low && value <= high),
+                    "\n%s[LINK ERROR]%s\tThe value %lld does not fit in the %d-byte field at 0x%X (%s`%s`%s of `%s`).\n",
+                    red, white,
+                    value, size, place,
+                    yellow, section_names[section], white,
+                    unit->filename)
+
+                memcpy(&out[relocation.r_offset], &value, size);
+                applied++;
+            }
+        }
+
+        amnt_of_relocations += applied;
+    }
+
+public:
+    MocaAsm_linker(ut_DWORD base_address = 0)
+        : base(base_address)
+    {}
+
+    void add_unit(const nt_BYTE *filename)
+    {
+        struct link_unit *unit = new struct link_unit;
+
+        unit->filename = filename;
+        units.push_back(unit);
+    }
+
+    void link()
+    {
+        MASM_TRACE_SPAN("link", "link", "");
+
+        ut_DWORD amnt_of_units = (ut_DWORD) units.size();
+
+        run_parallel(amnt_of_units, workers_for(amnt_of_units), "load", [this](ut_DWORD i, ut_DWORD) { load(units[i]); });
+        place_sections();
+        run_parallel(amnt_of_units, workers_for(amnt_of_units), "define", [this](ut_DWORD i, ut_DWORD) { define_globals(i); });
+
+        /* `.bss` only has an address. */
+        std::vector<std::pair<ut_DWORD, ut_BYTE>> ranges;
+        for(ut_DWORD i = 0; i < units.size(); i++)
+            for(ut_BYTE section = 0; section < (ut_BYTE) AsmSection::S_bss; section++)
+                if(units[i]->section_index[section] != 0) ranges.push_back({i, section});
+
+        run_parallel((ut_DWORD) ranges.size(), workers_for((ut_DWORD) ranges.size()), "emit", [this, &ranges](ut_DWORD i, ut_DWORD) {
+            emit_section(units[ranges[i].first], ranges[i].second);
+        });
+    }
+
+    std::vector<ut_BYTE> &get_image()
+    { return image; }
+
+    /* `-SAN`; every global with its address in the image, in the order of the units defining them. */
+    void write_names(const nt_BYTE *filename)
+    {
+        std::vector<std::pair<const std::string *, struct linked_symbol *>> linked;
+        globals.for_each([&linked](const std::string &name, struct linked_symbol &symbol) { linked.push_back({&name, &symbol}); });
+
+        std::sort(linked.begin(), linked.end(), [](auto &a, auto &b) {
+            return a.second->unit != b.second->unit ? a.second->unit < b.second->unit : a.second->address < b.second->address;
+        });
+
+        MocaAsm_symtab symtab;
+        for(auto &symbol : linked)
+        {
+            ut_DWORD id = symtab.intern(symbol.first->c_str(), symbol.first->size());
+
+            symtab.define(id, symbol.second->is_variable ? SymbolKind::SK_variable : SymbolKind::SK_label, symbol.second->size, 0);
+            symtab.get(id).value = symbol.second->address;
+            symtab.get(id).section = symbol.second->section;
+        }
+
+        MocaAsm_san_writer san_writer;
+        san_writer.write(filename, symtab);
+    }
+
+    /* `--ir-stats`. */
+    void report()
+    {
+        ut_DWORD amnt_of_globals = 0;
+        globals.for_each([&amnt_of_globals](const std::string &, struct linked_symbol &) { amnt_of_globals++; });
+
+        MASM_report("\n%s[LINK]%s\n", yellow, white);
+        MASM_report("\t%-24s %12zu\n", "units", units.size());
+        MASM_report("\t%-24s %12u\n", "globals", amnt_of_globals);
+        MASM_report("\t%-24s %12llu\n", "relocations applied", amnt_of_relocations.load());
+        for(ut_BYTE section = 0; section < amnt_of_sections; section++)
+            if(sections[section].size != 0)
+                MASM_report("\t%-24s %12u bytes at 0x%X\n", section_names[section], sections[section].size, sections[section].base);
+    }
+
+    ~MocaAsm_linker()
+    {
+        for(struct link_unit *unit : units)
+        {
+            if(unit->data && unit->data != MAP_FAILED) munmap((void *) unit->data, unit->data_size);
+            delete unit;
+        }
+
+        units.clear();
+    }
+};
+
+}
+
+#endif
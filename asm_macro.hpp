@@ -0,0 +1,209 @@
+#ifndef Moca_assembly_macro
+#define Moca_assembly_macro
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/* `%macro name amnt_of_parameters` ... `%endmacro`; `%1`, `%2`, ... are the parameters.
+ *
+ *      %macro print_char 1
+ *          mov ah, 0x0E
+ *          mov al, %1
+ *          int 0x10
+ *      %endmacro
+ *
+ *      print_char 0x41
+ *
+ * A definition is kept as tokens, so an expansion is spliced straight into the parser's token stream; nothing gets re-lexed.
+ * Expansions whose arguments are all numbers/registers are cached by their arguments, and the parser remembers the IR
+ * records such an expansion produced, so expanding it again with the same arguments is a copy of those records.
+ * */
+namespace masm_macro
+{
+
+/* `parameter` is `n` for `%n`, 0 for a token used as is. */
+struct macro_token
+{
+    TypeOfTokens    token_type;
+    ut_BYTE         token_id;
+    ut_DWORD        symbol_id;
+    ut_BYTE         parameter;
+    std::string     value;
+};
+
+struct macro_definition
+{
+    const nt_BYTE                   *name;      // interned in the symbol table
+    ut_BYTE                         amnt_of_parameters;
+    ut_DWORD                        position;   // source position of the `%`
+    std::vector<struct macro_token> body;
+};
+
+/* The body of a macro with every `%n` replaced by the tokens of argument `n`.
+ * `tokens` point into `arguments` and the definition, so an expansion must not be moved once it has been built.
+ * */
+struct macro_expansion
+{
+    std::vector<std::vector<struct macro_token>>    arguments;
+    std::vector<struct MocaAsm_TD>                  tokens;
+    bool                                            cached = false;
+
+    /* IR records the first expansion produced; `no_statement` until the parser has seen one it can copy. */
+    ut_DWORD                                        ir_first = no_statement;
+    ut_DWORD                                        ir_count = 0;
+};
+
+class MocaAsm_macros
+{
+private:
+    /* Keyed by the symbol id of the macro's name. */
+    std::unordered_map<ut_DWORD, struct macro_definition *>     definitions;
+    std::unordered_map<std::string, struct macro_expansion *>   cache;
+
+    ut_DWORD    amnt_of_expansions = 0;
+    ut_DWORD    amnt_of_cache_hits = 0;
+    ut_DWORD    amnt_of_replays = 0;
+    ut_LLBYTE   tokens_spliced = 0;
+    ut_LLBYTE   records_replayed = 0;
+
+    /* Numbers and registers only; anything naming a label or `$` depends on where the expansion is. */
+    static bool is_constant(std::vector<struct macro_token> &argument)
+    {
+        for(struct macro_token &mtoken : argument)
+        {
+            if(mtoken.token_type == TypeOfTokens::TT_common || mtoken.token_type == TypeOfTokens::TT_register) continue;
+            if(mtoken.token_type == TypeOfTokens::TT_grammar &&
+                (mtoken.token_id == (ut_BYTE) AsmGrammarTokens::GR_plus || mtoken.token_id == (ut_BYTE) AsmGrammarTokens::GR_minus ||
+                 mtoken.token_id == (ut_BYTE) AsmGrammarTokens::GR_lbrack || mtoken.token_id == (ut_BYTE) AsmGrammarTokens::GR_rbrack))
+                continue;
+
+            return false;
+        }
+
+        return true;
+    }
+
+    static struct MocaAsm_TD token_of(struct macro_token &mtoken)
+    { return {mtoken.token_id, ut_BYTE_PTR mtoken.value.c_str(), mtoken.token_type, mtoken.symbol_id}; }
+
+public:
+    MocaAsm_macros()
+    {}
+
+    struct macro_definition *find(ut_DWORD symbol_id)
+    {
+        if(definitions.empty()) return nullptr;
+
+        auto definition = definitions.find(symbol_id);
+        return definition == definitions.end() ? nullptr : definition->second;
+    }
+
+    /* Takes `definition` over, even if it is a redefinition (`--max-errors=` carries on after one). */
+    void define(ut_DWORD symbol_id, struct macro_definition *definition)
+    {
+        if(find(symbol_id))
+        {
+            ut_DWORD position = definition->position;
+            const nt_BYTE *name = definition->name;
+            delete definition;
+
+            MASM_error("\n%s[MACRO ERROR, LINE %d]%s\tThe macro %s`%s`%s is already defined.\n",
+                red, masm_lines::source_line(position), white,
+                yellow, name, white)
+        }
+
+        definitions[symbol_id] = definition;
+    }
+
+    /* The expansion of `symbol_id` with `arguments`; hand it back with `release` once the parser is done with its tokens. */
+    struct macro_expansion *expand(ut_DWORD symbol_id, std::vector<std::vector<struct macro_token>> &arguments)
+    {
+        struct macro_definition *definition = definitions[symbol_id];
+        amnt_of_expansions++;
+
+        std::string key;
+        bool cacheable = true;
+        for(std::vector<struct macro_token> &argument : arguments)
+        {
+            if(!is_constant(argument)) { cacheable = false; break; }
+
+            for(struct macro_token &mtoken : argument) key += mtoken.value + '\x1F';
+            key += '\x1E';
+        }
+
+        if(cacheable)
+        {
+            key += std::to_string(symbol_id);
+
+            auto cached = cache.find(key);
+            if(cached != cache.end())
+            {
+                amnt_of_cache_hits++;
+                return cached->second;
+            }
+        }
+
+        struct macro_expansion *expansion = new struct macro_expansion;
+        expansion->arguments = std::move(arguments);
+
+        for(struct macro_token &mtoken : definition->body)
+        {
+            if(mtoken.parameter == 0)
+            {
+                expansion->tokens.push_back(token_of(mtoken));
+                continue;
+            }
+
+            for(struct macro_token &argument_token : expansion->arguments[mtoken.parameter - 1])
+                expansion->tokens.push_back(token_of(argument_token));
+        }
+
+        if(cacheable)
+        {
+            expansion->cached = true;
+            cache[key] = expansion;
+        }
+
+        return expansion;
+    }
+
+    void release(struct macro_expansion *expansion)
+    {
+        if(!expansion->cached) delete expansion;
+    }
+
+    void count_splice(struct macro_expansion *expansion)
+    { tokens_spliced += expansion->tokens.size(); }
+
+    void count_replay(struct macro_expansion *expansion)
+    {
+        amnt_of_replays++;
+        records_replayed += expansion->ir_count;
+    }
+
+    /* `--ir-stats`; only printed if the program defines macros. */
+    void report()
+    {
+        if(definitions.empty()) return;
+
+        MASM_report("\n%s[MACROS]%s\n", yellow, white);
+        MASM_report("\t%-24s %12zu\n", "definitions", definitions.size());
+        MASM_report("\t%-24s %12u\n", "expansions", amnt_of_expansions);
+        MASM_report("\t%-24s %12u\n", "cache hits", amnt_of_cache_hits);
+        MASM_report("\t%-24s %12u (%llu records copied)\n", "replayed from the IR", amnt_of_replays, records_replayed);
+        MASM_report("\t%-24s %12llu\n", "tokens spliced", tokens_spliced);
+    }
+
+    ~MocaAsm_macros()
+    {
+        for(auto &definition : definitions) delete definition.second;
+        for(auto &expansion : cache) delete expansion.second;
+
+        definitions.clear();
+        cache.clear();
+    }
+};
+
+}
+
+#endif
@@ -4,88 +4,950 @@
 #include "assembler_backend/asm_response.hpp"
 using namespace MocaAsm_assembler_response;
 
+#include "assembler_backend/asm_peephole.hpp"
+using namespace masm_peephole;
+
+#include "assembler_backend/asm_deadcode.hpp"
+using namespace masm_deadcode;
+
+#include "asm_macro.hpp"
+using namespace masm_macro;
+
 namespace masm_parser
 {
 
+/* A source file pulled in via `incsrc "file"`.
+ * The span lives as long as the file is being parsed, so every `incsrc` shows up in the trace.
+ * */
+struct include_frame
+{
+    MocaAsm_lexer           *lexer;
+    masm_trace::trace_span  span;
+
+    include_frame(MocaAsm_lexer *lex)
+        : lexer(lex), span("incsrc", "incsrc", lex->get_filename())
+    {}
+};
+
+/* A macro expansion being parsed; its tokens come before anything else. */
+struct macro_frame
+{
+    struct macro_expansion  *expansion;
+    ut_DWORD                position;
+    ut_DWORD                invocation;     // source position of the invocation; what the records and diagnostics of the expansion get
+
+    /* The token following the invocation; carried on with once the expansion runs out. */
+    struct MocaAsm_TD       *resume;
+    bool                    resume_borrowed;
+
+    /* First IR record of the expansion; `no_statement` if the records are not going to be memoized. */
+    ut_DWORD                ir_first;
+};
+
+template<AsmBitMode M>
 class MocaAsm_parser
 {
 private:
     MocaAsm_lexer *mlexer = nullptr;
     struct MocaAsm_TD *token = nullptr;
-    AssemblerAPI *asmAPI = nullptr;
+    AssemblerAPI<M> *asmAPI = nullptr;
+    MocaAsm_encoder<M> *encoder = nullptr;
     MocaAsm_tokenizer *masm_tokenizer;
 
+    MocaAsm_symtab *symtab = nullptr;
+
+    /* Every statement gets appended here; nothing is encoded until the whole program has been parsed. */
+    MocaAsm_ir *ir = nullptr;
+
+    /* Every section put together; what ends up in the output file. */
+    std::vector<ut_BYTE> image;
+
+    /* Every section on its own, with its relocations; relocatable output only. */
+    std::array<struct section_object, amnt_of_sections> objects;
+
+    /* IR index of the statement being parsed; what `$` refers to. */
+    ut_DWORD statement = 0;
+
+    /* Files included via `incsrc`; the innermost file is at the back. */
+    std::vector<struct include_frame *> includes;
+
+    MocaAsm_macros macros;
+
+    /* Expansions being parsed; the innermost is at the back. */
+    std::vector<struct macro_frame> macro_frames;
+
+    /* Expansions that ran out, waiting for the statement they ended in to be done before their IR records get memoized. */
+    std::vector<struct macro_frame> finished_frames;
+
+    /* `token` belongs to a macro expansion and must not be deleted. */
+    bool token_borrowed = false;
+
+    /* `--max-errors=`: the tokens that were expected when parsing started, and where the statement being parsed starts
+     * (the invocation, for a statement of a macro expansion); see `resynchronize`.
+     * */
+    token_mask expected_at_start = 0;
+    MocaAsm_lexer *statement_lexer = nullptr;
+    ut_LSIZE statement_offset = 0;
+
+    /* `name db ...`: the variable `data` defines once it knows how many bytes its values take up; `no_symbol` if there is none. */
+    ut_DWORD variable = no_symbol;
+    ut_DWORD variable_position = 0;
+
+    /* `-EFBP adasm`: drop whatever can not be reached from the entry point or `exports` before layout (see `MocaAsm_dead_code`). */
+    bool strip_dead_code = false;
+    const nt_BYTE *exports = nullptr;
+
+    MocaAsm_lexer *current_lexer()
+    { return includes.empty() ? mlexer : includes.back()->lexer; }
+
+    void delete_token()
+    {
+        if(!token) return;
+        if(token_borrowed)
+        {
+            token = nullptr;
+            token_borrowed = false;
+            return;
+        }
+
+        free_token(token);
+        token = nullptr;
+    }
+
     void next_token()
     {
-        token = mlexer->get_next_token();
+        delete_token();
+
+        if(!macro_frames.empty())
+        {
+            struct macro_frame &frame = macro_frames.back();
+
+            if(frame.position < frame.expansion->tokens.size())
+            {
+                token = &frame.expansion->tokens[frame.position++];
+                token_borrowed = true;
+                return;
+            }
+
+            token = frame.resume;
+            token_borrowed = frame.resume_borrowed;
+
+            if(frame.ir_first != no_statement) finished_frames.push_back(frame);
+            else macros.release(frame.expansion);
+
+            macro_frames.pop_back();
+            return;
+        }
+
+        redo:
+        {
+            /* No span per token; serial lexing shows up as part of `parse`, lexing ahead as `lex_ahead`/`lex_chunk`.
+             * What it allocates still counts towards the lexer.
+             * */
+            MASM_ALLOC_PHASE("lexer");
+            token = current_lexer()->get_next_token();
+        }
+        MASM_ALLOC_AT_LINE(current_lexer()->get_line());
+
+        /* End of an included file; carry on with the file that included it. */
+        if(is_EOF() && !includes.empty())
+        {
+            delete_token();
+
+            MocaAsm_lexer *included = includes.back()->lexer;
+            if(statement_lexer == included) statement_lexer = nullptr;
+            delete includes.back();
+            includes.pop_back();
+            delete included;
+            goto redo;
+        }
     }
 
-public:
-    MocaAsm_parser(MocaAsm_lexer *lex, MocaAsm_tokenizer *mtoken)
+    bool is_grammar(AsmGrammarTokens grammar)
     {
-        mlexer = lex;
-        masm_tokenizer = mtoken;
+        return token->token_type == TypeOfTokens::TT_grammar &&
+            token->token_id == (ut_BYTE) grammar;
+    }
 
-        /* Go ahead and get the first token. */
+    bool is_EOF()
+    { return is_grammar(AsmGrammarTokens::GR_asm_EOF); }
+
+    /* Source position of `token` (see `MocaAsm_source_map`); all a statement keeps of where it came from. */
+    ut_DWORD source_position()
+    { return macro_frames.empty() ? current_lexer()->get_position() : macro_frames.back().invocation; }
+
+    /* Line of `token`; only for a diagnostic. */
+    ut_DWORD line()
+    { return source_line(source_position()); }
+
+    /* `0x1F`, `1Fh` or `31`; the lexer already made sure the value is well formed. */
+    static nt_LLBYTE number_value(const nt_BYTE *value)
+    {
+        ut_LSIZE length = strlen(value);
+
+        if(length > 2 && value[0] == '0' && (value[1] == 'x' || value[1] == 'X')) return (nt_LLBYTE) strtoull(value + 2, nullptr, 16);
+        if(value[length - 1] == 'h' || value[length - 1] == 'H') return (nt_LLBYTE) strtoull(value, nullptr, 16);
+        return (nt_LLBYTE) strtoull(value, nullptr, 10);
+    }
+
+    /* `term (('+' | '-') term)*`, where `term` is a number, a label/variable or `$`.
+     * At most one label/variable can be used, and it can not be subtracted.
+     * Leaves `token` on whatever follows the value.
+     * */
+    void parse_value(struct instruction_operand &op)
+    {
+        nt_LLBYTE sign = 1;
+        op.value = 0;
+        op.symbol_id = no_symbol;
+        op.here = 0;
+
+        if(is_grammar(AsmGrammarTokens::GR_minus)) { sign = -1; next_token(); }
+
+        while(true)
+        {
+            if(token->token_type == TypeOfTokens::TT_common)
+                op.value += sign * number_value(nt_BYTE_CPTR token->token_value);
+            else if(is_grammar(AsmGrammarTokens::GR_dollar))
+                op.here += sign;
+            else if(token->token_type == TypeOfTokens::TT_keyword && token->token_id == (ut_BYTE) AsmKeywordTokens::KW_special)
+            {
+                MASM_assert(op.symbol_id == no_symbol && sign == 1,
+                    "\n%s[INVALID EXPRESSION, LINE %d]%s\tOnly one label/variable can be used in a value, and it can not be subtracted.\n",
+                    red, line(), white)
+
+                op.symbol_id = token->symbol_id;
+            }
+            else
+                MASM_error("\n%s[INVALID SYNTAX, LINE %d]%s\tExpected a value, but got %s`%s`%s.\n",
+                    red, line(), white,
+                    yellow, token->token_value, white)
+
+            next_token();
+
+            if(is_grammar(AsmGrammarTokens::GR_plus)) sign = 1;
+            else if(is_grammar(AsmGrammarTokens::GR_minus)) sign = -1;
+            else return;
+
+            next_token();
+        }
+    }
+
+    /* A register, `[value]` or a value. Leaves `token` on whatever follows the operand.
+     * `statement_position` is where the instruction is; `token` can be on the next line by the time an error is found.
+     * */
+    void parse_operand(struct instruction_operand &op, ut_DWORD statement_position)
+    {
+        if(token->token_type == TypeOfTokens::TT_register)
+        {
+            op.kind = OperandKind::OK_reg;
+            op.reg = (AsmRegisterTokens) token->token_id;
+            op.value = 0;
+            op.symbol_id = no_symbol;
+            op.here = 0;
+
+            next_token();
+            return;
+        }
+
+        if(is_grammar(AsmGrammarTokens::GR_lbrack))
+        {
+            next_token();
+            parse_value(op);
+
+            MASM_assert(is_grammar(AsmGrammarTokens::GR_rbrack),
+                "\n%s[INVALID SYNTAX, LINE %d]%s\tMissing %s`]`%s on memory reference.\n",
+                red, source_line(statement_position), white,
+                green, white)
+
+            op.kind = OperandKind::OK_mem;
+            next_token();
+            return;
+        }
+
+        parse_value(op);
+        op.kind = OperandKind::OK_imm;
+    }
+
+    /* `instruction [lval[, rval]]`; `token` is the instruction. */
+    void instruction()
+    {
+        struct InstructionData *idata = asmAPI->get_instruction_data();
+        ut_BYTE amnt_of_operands = asmAPI->operand_count(idata->instruction);
+
+        idata->position = source_position();
         next_token();
+
+        for(ut_BYTE i = 0; i < amnt_of_operands; i++)
+        {
+            if(i > 0)
+            {
+                MASM_assert(is_grammar(AsmGrammarTokens::GR_comma),
+                    "\n%s[INVALID SYNTAX, LINE %d]%s\t%s`%s`%s expects %d operands separated by %s`,`%s.\n",
+                    red, source_line(idata->position), white,
+                    yellow, idata->mnemonic, white,
+                    amnt_of_operands,
+                    green, white)
+                next_token();
+            }
+
+            parse_operand(idata->operands[i], idata->position);
+            idata->amnt_of_operands++;
+        }
+
+        asmAPI->validate_operands();
+        ir->add_instruction(*idata, statement);
     }
 
-    void start_assembler()
+    /* `db/dw/dd value[, value...]` (and the array versions); `token` is the datatype. */
+    void data()
     {
-        if(!asmAPI) asmAPI = new AssemblerAPI;
+        ut_BYTE size = 4;
+        switch(token->token_id)
+        {
+            case (ut_BYTE)AsmDataTypeTokens::DT_db:
+            case (ut_BYTE)AsmDataTypeTokens::DT_dbarr: size = 1;break;
+            case (ut_BYTE)AsmDataTypeTokens::DT_dw:
+            case (ut_BYTE)AsmDataTypeTokens::DT_dwarr: size = 2;break;
+            default: break;
+        }
 
-        asmAPI->assembler_check_in_new_instruction(token, masm_tokenizer);
+        /* `parse_value` leaves `token` on whatever follows the value, which can be the next statement. */
+        ut_DWORD data_position = source_position();
+        ut_DWORD bytes = 0;
+        next_token();
+        while(true)
+        {
+            struct instruction_operand value = {OperandKind::OK_imm, AsmRegisterTokens::R_ax, 0, no_symbol, 0};
+            parse_value(value);
+
+            if(is_constant(value)) asmAPI->validate_data(value.value, size, data_position);
+            ir->add_data(value, size, data_position, statement);
+            bytes += size;
+
+            if(!is_grammar(AsmGrammarTokens::GR_comma)) break;
+            next_token();
+        }
+
+        if(variable == no_symbol) return;
+
+        /* `arr dbarr 1, 2, 3` is 3 bytes, `w dw 0x1, 0x2` is 4. */
+        symtab->define(variable, SymbolKind::SK_variable, bytes, variable_position);
+        symtab->get(variable).section = (ut_WORD) ir->get_current_section();
+        variable = no_symbol;
     }
 
-    void parse()
+    /* `incsrc "file"`; `file` is relative to the file containing the `incsrc`. */
+    void include_source()
     {
-        switch(asmAPI->get_current_instruction())
+        next_token();
+        MASM_assert(token->token_type == TypeOfTokens::TT_grammar && token->token_id == (ut_BYTE) AsmGrammarTokens::GR_doubleQ,
+            "\n%s[INVALID SYNTAX, LINE %d]%s\t%s`incsrc`%s expects a file in quotes; %s`incsrc \"file.masm\"`%s.\n",
+            red, current_lexer()->get_line(), white,
+            yellow, white,
+            green, white)
+
+        std::string path = nt_BYTE_CPTR current_lexer()->get_string_literal();
+        std::string includer = current_lexer()->get_filename();
+
+        if(path[0] != '/' && includer.find('/') != std::string::npos)
+            path = includer.substr(0, includer.rfind('/') + 1) + path;
+
+        MASM_assert(includes.size() < 64,
+            "\n%s[INCSRC ERROR]%s\t%s`incsrc`%s nested too deep while including `%s`; is a file including itself?\n",
+            red, white,
+            yellow, white,
+            path.c_str())
+
+        MocaAsm_lexer *included = new MocaAsm_lexer(nt_BYTE_PTR path.c_str(), masm_tokenizer);
+        includes.push_back(new struct include_frame(included));
+    }
+
+    bool is_name(const nt_BYTE *name)
+    {
+        return token->token_type == TypeOfTokens::TT_keyword && token->token_id == (ut_BYTE) AsmKeywordTokens::KW_special &&
+            strcmp(symtab->name_of(token->symbol_id), name) == 0;
+    }
+
+    /* `%macro name amnt_of_parameters` ... `%endmacro`; `token` is the `%`. */
+    void define_macro()
+    {
+        ut_DWORD definition_position = source_position();
+
+        /* Nothing has been checked in for the body; registers are fine anywhere in it. */
+        token_mask expected = masm_tokenizer->get_tokens_to_expect();
+        masm_tokenizer->assign_tokens_to_expect((token_mask) ~0);
+        next_token();
+
+        MASM_assert(is_name("macro"),
+            "\n%s[INVALID SYNTAX, LINE %d]%s\tExpected %s`%%macro`%s, but got %s`%%%s`%s.\n",
+            red, source_line(definition_position), white,
+            green, white,
+            yellow, token->token_value, white)
+        next_token();
+
+        MASM_assert(token->token_type == TypeOfTokens::TT_keyword && token->token_id == (ut_BYTE) AsmKeywordTokens::KW_special,
+            "\n%s[INVALID SYNTAX, LINE %d]%s\t%s`%%macro`%s expects a name; %s`%%macro name 1`%s.\n",
+            red, source_line(definition_position), white,
+            yellow, white,
+            green, white)
+
+        ut_DWORD symbol_id = token->symbol_id;
+        struct macro_definition *definition = new struct macro_definition;
+        definition->name = symtab->name_of(symbol_id);
+        definition->position = definition_position;
+        next_token();
+
+        MASM_assert(token->token_type == TypeOfTokens::TT_common && number_value(nt_BYTE_CPTR token->token_value) <= 32,
+            "\n%s[INVALID SYNTAX, LINE %d]%s\t%s`%%macro %s`%s expects the amount of parameters (at most 32); %s`%%macro %s 1`%s.\n",
+            red, source_line(definition_position), white,
+            yellow, definition->name, white,
+            green, definition->name, white)
+        definition->amnt_of_parameters = (ut_BYTE) number_value(nt_BYTE_CPTR token->token_value);
+
+        while(true)
         {
-            case Instruction::Imov: {
-                std::cout << "Mov" << std::endl;
-                break;
+            next_token();
+            MASM_assert(!is_EOF(),
+                "\n%s[MACRO ERROR, LINE %d]%s\tThe macro %s`%s`%s is missing %s`%%endmacro`%s.\n",
+                red, source_line(definition_position), white,
+                yellow, definition->name, white,
+                green, white)
+
+            if(!is_grammar(AsmGrammarTokens::GR_percent))
+            {
+                definition->body.push_back({token->token_type, token->token_id, token->symbol_id, 0, nt_BYTE_CPTR token->token_value});
+                continue;
             }
-            case Instruction::SIdb: {
-                mlexer->get_and_tokenize_imm(token);
 
-                break;
+            next_token();
+            if(is_name("endmacro")) break;
+
+            MASM_assert(token->token_type == TypeOfTokens::TT_common &&
+                number_value(nt_BYTE_CPTR token->token_value) >= 1 && number_value(nt_BYTE_CPTR token->token_value) <= definition->amnt_of_parameters,
+                "\n%s[MACRO ERROR, LINE %d]%s\t%s`%%%s`%s is not a parameter of %s`%s`%s; it has %d.\n",
+                red, line(), white,
+                yellow, token->token_value, white,
+                yellow, definition->name, white,
+                definition->amnt_of_parameters)
+
+            definition->body.push_back({TypeOfTokens::TT_NONE, 0, no_symbol,
+                (ut_BYTE) number_value(nt_BYTE_CPTR token->token_value), ""});
+        }
+
+        /* Past `%endmacro` first, so a redefinition (`--max-errors=`) carries on after it. */
+        masm_tokenizer->assign_tokens_to_expect(expected);
+        next_token();
+        macros.define(symbol_id, definition);
+    }
+
+    /* A register, `[value]` or `term (('+' | '-') term)*`; the same shapes `parse_operand` accepts. */
+    void collect_argument(std::vector<struct macro_token> &argument)
+    {
+        auto take = [this, &argument]() {
+            MASM_assert(!is_EOF(),
+                "\n%s[MACRO ERROR, LINE %d]%s\tThe file ended in the middle of a macro argument.\n",
+                red, line(), white)
+
+            argument.push_back({token->token_type, token->token_id, token->symbol_id, 0, nt_BYTE_CPTR token->token_value});
+            next_token();
+        };
+
+        if(token->token_type == TypeOfTokens::TT_register) { take(); return; }
+
+        if(is_grammar(AsmGrammarTokens::GR_lbrack))
+        {
+            while(!is_grammar(AsmGrammarTokens::GR_rbrack)) take();
+            take();
+            return;
+        }
+
+        if(is_grammar(AsmGrammarTokens::GR_minus)) take();
+        take();
+
+        while(is_grammar(AsmGrammarTokens::GR_plus) || is_grammar(AsmGrammarTokens::GR_minus))
+        {
+            take();
+            take();
+        }
+    }
+
+    /* `name arg[, arg...]`; `token` is the name of a macro. */
+    void invoke_macro(struct macro_definition *definition)
+    {
+        MASM_TRACE_SPAN("macro", "expand", definition->name);
+
+        ut_DWORD symbol_id = token->symbol_id;
+        ut_DWORD invocation = source_position();
+
+        /* Arguments can be registers. */
+        token_mask expected = masm_tokenizer->get_tokens_to_expect();
+        masm_tokenizer->assign_tokens_to_expect((token_mask) ~0);
+        next_token();
+
+        std::vector<std::vector<struct macro_token>> arguments(definition->amnt_of_parameters);
+        for(ut_BYTE i = 0; i < definition->amnt_of_parameters; i++)
+        {
+            if(i > 0)
+            {
+                MASM_assert(is_grammar(AsmGrammarTokens::GR_comma),
+                    "\n%s[INVALID SYNTAX, LINE %d]%s\tThe macro %s`%s`%s expects %d arguments separated by %s`,`%s.\n",
+                    red, source_line(invocation), white,
+                    yellow, definition->name, white,
+                    definition->amnt_of_parameters,
+                    green, white)
+                next_token();
             }
-            case Instruction::SIdw: {
-                std::cout << "Writing DW (2-byte value)" << std::endl;
-                break;
+
+            collect_argument(arguments[i]);
+        }
+        masm_tokenizer->assign_tokens_to_expect(expected);
+
+        MASM_assert(macro_frames.size() < 64,
+            "\n%s[MACRO ERROR, LINE %d]%s\tMacros nested too deep while expanding %s`%s`%s; does it expand itself?\n",
+            red, source_line(invocation), white,
+            yellow, definition->name, white)
+
+        struct macro_expansion *expansion = macros.expand(symbol_id, arguments);
+        bool in_bss = ir->get_current_section() == AsmSection::S_bss;
+
+        if(expansion->ir_first != no_statement && !in_bss)
+        {
+            ir->replay(expansion->ir_first, expansion->ir_count, invocation);
+            macros.count_replay(expansion);
+            return;
+        }
+
+        if(expansion->tokens.empty())
+        {
+            macros.release(expansion);
+            return;
+        }
+
+        /* Only the first expansion of a cached set of arguments gets its records memoized; `.bss` records are only sizes. */
+        ut_DWORD ir_first = expansion->cached && !in_bss ? ir->amnt_of_instructions() : no_statement;
+
+        macro_frames.push_back({expansion, 0, invocation, token, token_borrowed, ir_first});
+        macros.count_splice(expansion);
+
+        token = nullptr;
+        token_borrowed = false;
+        next_token();
+    }
+
+    /* Called between statements, so every record of an expansion that ran out has been added by now. */
+    void memoize_expansions()
+    {
+        for(struct macro_frame &frame : finished_frames)
+        {
+            ut_DWORD ir_count = ir->amnt_of_instructions() - frame.ir_first;
+
+            if(frame.expansion->ir_first == no_statement && ir->is_replayable(frame.ir_first, ir_count))
+            {
+                frame.expansion->ir_first = frame.ir_first;
+                frame.expansion->ir_count = ir_count;
             }
-            case Instruction::SIdd: {
-                std::cout << "Writing DD (4-byte value)" << std::endl;
+        }
+
+        finished_frames.clear();
+    }
+
+    /* Whatever the checked in `token` starts. */
+    void statement_body()
+    {
+        switch(asmAPI->get_current_instruction())
+        {
+            case Instruction::SIvar_or_label: variable_or_label();break;
+            case Instruction::SIdb:
+            case Instruction::SIdw:
+            case Instruction::SIdd:
+            case Instruction::SIdbarr:
+            case Instruction::SIdwarr:
+            case Instruction::SIddarr: data();break;
+            case Instruction::INONE: {
+                MASM_warning("\n%s[UNSUPPORTED, LINE %d]%s\t%s`%s`%s is not supported yet; ignoring it.\n",
+                    yellow, line(), white,
+                    yellow, token->token_value, white)
+                next_token();
                 break;
             }
-            case Instruction::SIdbarr: {
-                std::cout << "Writing DB array (1-byte values)" << std::endl;
+            default: {
+                MASM_assert(ir->get_current_section() != AsmSection::S_bss,
+                    "\n%s[SECTION ERROR, LINE %d]%s\t%s`%s`%s can not go into %s`.bss`%s; it only holds uninitialized data.\n",
+                    red, line(), white,
+                    yellow, token->token_value, white,
+                    yellow, white)
+                instruction();
                 break;
             }
-            case Instruction::SIdwarr: {
-                std::cout << "Writing DW array (2-byte values)" << std::endl;
-                break;
+        }
+    }
+
+    /* `times count instruction/data` (or `pad count ...`); `pad 510 - $ db 0x0`.
+     * `count` can only use numbers and `$`, since it decides where everything after it goes.
+     * */
+    void repeat()
+    {
+        const nt_BYTE *directive = token->token_id == (ut_BYTE) AsmKeywordTokens::KW_pad ? "pad" : "times";
+        ut_DWORD repeat_position = source_position();
+        next_token();
+
+        struct instruction_operand count = {OperandKind::OK_imm, AsmRegisterTokens::R_ax, 0, no_symbol, 0};
+        parse_value(count);
+
+        MASM_assert(count.symbol_id == no_symbol,
+            "\n%s[INVALID REPEAT, LINE %d]%s\tThe count of %s`%s`%s can only use numbers and %s`$`%s.\n",
+            red, source_line(repeat_position), white,
+            yellow, directive, white,
+            green, white)
+
+        if(token->token_type == TypeOfTokens::TT_keyword || token->token_type == TypeOfTokens::TT_datatype)
+            asmAPI->assembler_check_in_new_instruction(token, masm_tokenizer);
+
+        MASM_assert((token->token_type == TypeOfTokens::TT_keyword || token->token_type == TypeOfTokens::TT_datatype) &&
+            asmAPI->get_current_instruction() != Instruction::SIvar_or_label && asmAPI->get_current_instruction() != Instruction::INONE,
+            "\n%s[INVALID REPEAT, LINE %d]%s\t%s`%s`%s expects an instruction or data to repeat; %s`%s 4 db 0x0`%s.\n",
+            red, source_line(repeat_position), white,
+            yellow, directive, white,
+            green, directive, white)
+
+        ut_DWORD repeat = ir->begin_repeat(count, repeat_position, statement);
+        statement_body();
+        ir->end_repeat(repeat);
+    }
+
+    /* `align boundary [, fill]`; NOPs up to the next multiple of `boundary`, or `fill` bytes (`align 4, 0x0` before a `dd` table).
+     * Like the count of `times`, both can only be numbers, since they decide where everything after them goes.
+     * */
+    void align()
+    {
+        ut_DWORD align_position = source_position();
+        next_token();
+
+        struct instruction_operand boundary = {OperandKind::OK_imm, AsmRegisterTokens::R_ax, 0, no_symbol, 0};
+        parse_value(boundary);
+
+        MASM_assert(boundary.symbol_id == no_symbol && boundary.here == 0 && boundary.value > 0 && boundary.value <= (nt_LLBYTE) max_alignment &&
+            (boundary.value & (boundary.value - 1)) == 0,
+            "\n%s[INVALID ALIGN, LINE %d]%s\t%s`align`%s expects a power of two up to %u; %s`align 16`%s.\n",
+            red, source_line(align_position), white,
+            yellow, white,
+            max_alignment,
+            green, white)
+
+        if(!is_grammar(AsmGrammarTokens::GR_comma))
+        {
+            ir->add_align((ut_DWORD) boundary.value, nullptr, align_position);
+            return;
+        }
+
+        next_token();
+        struct instruction_operand fill = {OperandKind::OK_imm, AsmRegisterTokens::R_ax, 0, no_symbol, 0};
+        parse_value(fill);
+
+        MASM_assert(fill.symbol_id == no_symbol && fill.here == 0 && fill.value >= 0 && fill.value <= 0xFF,
+            "\n%s[INVALID ALIGN, LINE %d]%s\tThe fill of %s`align`%s has to be a byte; %s`align 4, 0x0`%s.\n",
+            red, source_line(align_position), white,
+            yellow, white,
+            green, white)
+
+        ir->add_align((ut_DWORD) boundary.value, &fill, align_position);
+    }
+
+    /* `.text`, `.code`, `.init`, `.rodata`, `.data` or `.bss`. */
+    void section()
+    {
+        static const struct { const nt_BYTE *name; AsmSection section; } names[] = {
+            {".text", AsmSection::S_text}, {".code", AsmSection::S_text},
+            {".init", AsmSection::S_init},
+            {".rodata", AsmSection::S_rodata}, {".rodata1", AsmSection::S_rodata},
+            {".data", AsmSection::S_data}, {".data1", AsmSection::S_data},
+            {".bss", AsmSection::S_bss}
+        };
+
+        for(auto &entry : names)
+            if(strcmp(nt_BYTE_CPTR token->token_value, entry.name) == 0)
+            {
+                ir->switch_section(entry.section, source_position());
+                return;
             }
-            case Instruction::SIddarr: {
-                std::cout << "Writing DD array (4-byte values)" << std::endl;
-                break;
+
+        MASM_error("\n%s[SECTION ERROR, LINE %d]%s\t%s`%s`%s is not a section; expected one of %s.text .code .init .rodata .data .bss%s.\n",
+            red, line(), white,
+            yellow, token->token_value, white,
+            green, white)
+    }
+
+    /* `name:` is a label, `name db ...` is a variable.
+     * The token following the name is left for the parse loop.
+     * */
+    void variable_or_label()
+    {
+        ut_DWORD symbol_id = token->symbol_id;
+        const nt_BYTE *name = symtab->name_of(symbol_id);
+        ut_DWORD name_position = source_position();
+        next_token();
+
+        if(is_grammar(AsmGrammarTokens::GR_colon))
+        {
+            symtab->define(symbol_id, SymbolKind::SK_label, 0, name_position);
+            symtab->get(symbol_id).section = (ut_WORD) ir->get_current_section();
+            ir->add_label(symbol_id, name_position);
+            next_token();
+            return;
+        }
+
+        /* Defined by `data`, once its size is known. */
+        if(token->token_type == TypeOfTokens::TT_datatype)
+        {
+            variable = symbol_id;
+            variable_position = name_position;
+            ir->add_label(symbol_id, name_position);
+            return;
+        }
+
+        MASM_warning("\n%s[UNKNOWN INSTRUCTION, LINE %d]%s\t%s`%s`%s is not an instruction, label or variable; ignoring it.\n",
+            yellow, source_line(name_position), white,
+            yellow, name, white)
+    }
+
+    /* After an error (`--max-errors=`): drop whatever the statement was in the middle of, macro expansions included.
+     * The lexer is a token ahead of the statement (the token following the invocation, for an error inside a macro), and
+     * that token often starts the next line already; if so, parsing carries on with it. If it is still on the line of the
+     * statement, or the lexer failed on it, the rest of that line is skipped.
+     * */
+    void resynchronize()
+    {
+        struct MocaAsm_TD *lookahead = token;
+        bool lookahead_borrowed = token_borrowed;
+
+        if(!macro_frames.empty())
+        {
+            if(token && !token_borrowed) free_token(token);
+
+            lookahead = macro_frames.front().resume;
+            lookahead_borrowed = macro_frames.front().resume_borrowed;
+        }
+
+        for(struct macro_frame &frame : macro_frames)
+        {
+            if(&frame != &macro_frames.front() && !frame.resume_borrowed) free_token(frame.resume);
+            macros.release(frame.expansion);
+        }
+        macro_frames.clear();
+        finished_frames.clear();
+        variable = no_symbol;
+
+        token = nullptr;
+        token_borrowed = false;
+        masm_tokenizer->assign_tokens_to_expect(expected_at_start);
+
+        MocaAsm_lexer *lexer = current_lexer();
+        if(lookahead && (lexer != statement_lexer || lexer->get_line() != lexer->line_of(statement_offset)))
+        {
+            token = lookahead;
+            token_borrowed = lookahead_borrowed;
+            return;
+        }
+
+        if(lookahead && !lookahead_borrowed) free_token(lookahead);
+        lexer->skip_line();
+        next_token();
+    }
+
+    /* One statement (or `%macro` definition, macro invocation, `incsrc`, section or `align`), starting at `token`. */
+    void parse_statement()
+    {
+        if(macro_frames.empty())
+        {
+            statement_lexer = current_lexer();
+            statement_offset = statement_lexer->get_offset();
+        }
+
+        if(!finished_frames.empty()) memoize_expansions();
+
+        if(is_grammar(AsmGrammarTokens::GR_percent))
+        {
+            define_macro();
+            return;
+        }
+
+        /* Only keywords and datatypes start a new instruction.
+         * Operands are consumed by the instruction they belong to, so anything else here is left over from a statement.
+         * */
+        if(token->token_type != TypeOfTokens::TT_keyword && token->token_type != TypeOfTokens::TT_datatype)
+            MASM_error("\n%s[UNEXPECTED TOKEN, LINE %d]%s\t%s`%s`%s can not start a statement; is it left over from the one before it?\n",
+                red, line(), white,
+                yellow, token->token_value, white)
+
+        if(token->token_type == TypeOfTokens::TT_keyword && token->token_id == (ut_BYTE) AsmKeywordTokens::KW_special)
+        {
+            struct macro_definition *definition = macros.find(token->symbol_id);
+            if(definition)
+            {
+                invoke_macro(definition);
+                return;
             }
-            default: break;
         }
+
+        if(token->token_type == TypeOfTokens::TT_keyword && token->token_id == (ut_BYTE) AsmKeywordTokens::KW_incsrc)
+        {
+            MASM_assert(macro_frames.empty(),
+                "\n%s[MACRO ERROR, LINE %d]%s\t%s`incsrc`%s can not be used inside of a macro.\n",
+                red, line(), white,
+                yellow, white)
+
+            include_source();
+            next_token();
+            return;
+        }
+
+        if(token->token_type == TypeOfTokens::TT_keyword && token->token_id == (ut_BYTE) AsmKeywordTokens::KW_section)
+        {
+            section();
+            next_token();
+            return;
+        }
+
+        if(token->token_type == TypeOfTokens::TT_keyword && token->token_id == (ut_BYTE) AsmKeywordTokens::KW_align)
+        {
+            align();
+            return;
+        }
+
+        statement = ir->next_statement();
+
+        if(token->token_type == TypeOfTokens::TT_keyword &&
+            (token->token_id == (ut_BYTE) AsmKeywordTokens::KW_times || token->token_id == (ut_BYTE) AsmKeywordTokens::KW_pad))
+        {
+            repeat();
+            return;
+        }
+
+        asmAPI->assembler_check_in_new_instruction(token, masm_tokenizer);
+        statement_body();
+    }
+
+public:
+    MocaAsm_parser(MocaAsm_lexer *lex, MocaAsm_tokenizer *mtoken)
+    {
+        mlexer = lex;
+        masm_tokenizer = mtoken;
+        symtab = mtoken->get_symbol_table();
+
+        /* Go ahead and get the first token. */
+        next_token();
+    }
+
+    void start_assembler()
+    {
+        if(!asmAPI) asmAPI = new AssemblerAPI<M>;
+        if(!encoder) encoder = new MocaAsm_encoder<M>;
+        if(!ir) ir = new MocaAsm_ir;
+    }
+
+    /* `exported` (`--export=`) is a list of names, separated by commas, that are kept even if nothing uses them. */
+    void eliminate_dead_code(const nt_BYTE *exported)
+    {
+        strip_dead_code = true;
+        exports = exported;
+    }
+
+    /* `optimize`: run the `-O` peephole pass before layout.
+     * `relocatable`: leave every section on its own and turn references to labels into relocations (`get_objects`).
+     * `amnt_of_threads`: how many threads encode (0 for one per core).
+     * `check_determinism`: encode everything again on one thread and make sure the output is the same.
+     * */
+    void parse(bool optimize = false, bool relocatable = false, ut_DWORD amnt_of_threads = 0, bool check_determinism = false)
+    {
+        MASM_TRACE_SPAN("parser", "parse", current_lexer()->get_filename());
+
+        /* Every statement parses the same with or without `--max-errors=`; with it, an error unwinds back to here. */
+        expected_at_start = masm_tokenizer->get_tokens_to_expect();
+        masm_diag::sink.set_recoverable(true);
+
+        bool recovering = false;
+        while(recovering || !is_EOF())
+        {
+            try
+            {
+                if(!recovering) parse_statement();
+                else
+                {
+                    recovering = false;
+                    resynchronize();
+                }
+            }
+            catch(masm_diag::recoverable_error &)
+            { recovering = true; }
+        }
+
+        if(!finished_frames.empty()) memoize_expansions();
+
+        masm_diag::sink.set_recoverable(false);
+        masm_diag::sink.stop_on_errors();
+
+        if(optimize)
+        {
+            MASM_TRACE_SPAN("optimizer", "peephole");
+            MocaAsm_peephole<M> peephole(*ir, *encoder);
+
+            peephole.optimize();
+            peephole.report();
+        }
+
+        if(strip_dead_code)
+        {
+            MASM_TRACE_SPAN("optimizer", "dead_code");
+            MocaAsm_dead_code<M> dead_code(*ir, *encoder, *symtab);
+
+            dead_code.eliminate(exports);
+            dead_code.report();
+        }
+
+        {
+            MASM_TRACE_SPAN("layout", "layout");
+            ir->layout(*encoder, *symtab, relocatable);
+        }
+
+        MASM_TRACE_SPAN("encoder", "encode");
+        ir->encode<M>(image, *symtab, relocatable ? &objects : nullptr, amnt_of_threads);
+        if(check_determinism) ir->check_determinism<M>(image, *symtab, relocatable ? &objects : nullptr);
     }
 
+    MocaAsm_ir &get_ir()
+    { return *ir; }
+
+    MocaAsm_macros &get_macros()
+    { return macros; }
+
+    std::vector<ut_BYTE> &get_code()
+    { return image; }
+
+    std::array<struct section_object, amnt_of_sections> &get_objects()
+    { return objects; }
+
     ~MocaAsm_parser()
     {
-        if(mlexer) delete mlexer;
-        if(token->token_value) delete token->token_value;
-        if(token) delete token;
+        /* `mlexer` belongs to `masm_assembler`; only included files are ours to delete. */
+        for(struct include_frame *frame : includes)
+        {
+            delete frame->lexer;
+            delete frame;
+        }
+        includes.clear();
+
+        delete_token();
         if(asmAPI) delete asmAPI;
+        if(encoder) delete encoder;
+        if(ir) delete ir;
 
         mlexer = nullptr;
+        encoder = nullptr;
+        ir = nullptr;
         token = nullptr;
         asmAPI = nullptr;
 
-        std::cout << "\n[DEBUG]\tDeleted parser." << std::endl;
+        MASM_debug("\n[DEBUG]\tDeleted parser.\n");
     }
 };
 
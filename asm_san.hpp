@@ -0,0 +1,280 @@
+#ifndef Moca_assembly_san
+#define Moca_assembly_san
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "assembler_backend/asm_symbols.hpp"
+
+/* `-SAN` (Store All Names) symbol file.
+ *
+ * Meant to be `mmap`ed by MocaLink (or anything else) and queried in place, without parsing.
+ * All values are little-endian; every offset is from the start of the file.
+ *
+ *      san_header                      (32 bytes)
+ *      san_record[amnt_of_symbols]     (24 bytes each, sorted in the order the names were first seen)
+ *      ut_DWORD index[index_slots]     (open-addressing hash index; `record + 1`, 0 for an empty slot)
+ *      string pool                     (every name, NUL-terminated)
+ *
+ * A name is found by hashing it (`hash_name`, FNV-1a; the same hash the symbol table uses), starting at slot `hash & (index_slots - 1)` and
+ * probing linearly until the name's record or an empty slot is found. `index_slots` is a power of 2 and
+ * at least twice the amount of symbols, so a lookup touches a slot or two on average.
+ *
+ * The records follow the header. `checksum` is FNV-1a (`hash_name`) over every byte after the header, up to the end
+ * of the string pool, so `verify` catches a changed value or size, not only a file that does not hold together.
+ * */
+namespace masm_san
+{
+
+using namespace masm_symbols;
+
+constexpr ut_BYTE san_magic[4] = {'M', 'S', 'A', 'N'};
+constexpr ut_WORD san_version = 2;
+
+enum class SanSymbolKind
+{
+    SK_label,       // `name:`
+    SK_variable,    // `name db/dw/dd/dbarr/dwarr/ddarr ...`
+};
+
+struct san_header
+{
+    ut_BYTE         magic[4];
+    ut_WORD         version;
+    ut_WORD         header_size;    // where the records start
+    ut_DWORD        amnt_of_symbols;
+    ut_DWORD        checksum;
+    ut_DWORD        index_offset;
+    ut_DWORD        index_slots;
+    ut_DWORD        strings_offset;
+    ut_DWORD        strings_size;
+};
+
+struct san_record
+{
+    ut_DWORD        name_offset;    // offset of the name in the string pool
+    ut_DWORD        name_hash;      // `hash_name(name)`; lets lookups skip most string compares
+    ut_DWORD        value;          // address of the label/variable
+    ut_DWORD        size;           // size, in bytes, of a variable; 0 for labels
+    ut_WORD         name_length;
+    ut_WORD         section;
+    ut_BYTE         kind;           // `SanSymbolKind`
+    ut_BYTE         reserved[3];
+};
+
+static_assert(sizeof(struct san_header) == 32, "`san_header` must stay 32 bytes; bump `san_version` if the layout changes.");
+static_assert(sizeof(struct san_record) == 24, "`san_record` must stay 24 bytes; bump `san_version` if the layout changes.");
+
+class MocaAsm_san_writer
+{
+private:
+    static ut_DWORD align8(ut_DWORD value)
+    { return (value + 7) & ~7u; }
+
+public:
+    MocaAsm_san_writer()
+    {}
+
+    /* Every defined symbol in `symtab` gets a record, in id order.
+     * Names are already unique in the symbol table, so no record has to be checked against another.
+     * */
+    void write(const nt_BYTE *filename, MocaAsm_symtab &symtab)
+    {
+        std::vector<struct san_record> records;
+        std::vector<nt_BYTE> strings;
+
+        ut_DWORD index_slots = 16;
+        while(index_slots < symtab.amnt_of_symbols() * 2) index_slots <<= 1;
+        std::vector<ut_DWORD> index(index_slots, 0);
+
+        records.reserve(symtab.amnt_of_symbols());
+        for(ut_DWORD id = 0; id < symtab.amnt_of_symbols(); id++)
+        {
+            struct symbol_entry &symbol = symtab.get(id);
+            if(symbol.kind == SymbolKind::SK_undefined || symbol.kind == SymbolKind::SK_removed) continue;
+
+            struct san_record record = {};
+            record.name_offset = (ut_DWORD) strings.size();
+            record.name_hash = symbol.hash;
+            record.value = symbol.value;
+            record.size = symbol.size;
+            record.name_length = symbol.length;
+            record.section = symbol.section;
+            record.kind = (ut_BYTE) (symbol.kind == SymbolKind::SK_label ? SanSymbolKind::SK_label : SanSymbolKind::SK_variable);
+
+            strings.insert(strings.end(), symbol.name, symbol.name + symbol.length + 1);
+            records.push_back(record);
+
+            ut_DWORD slot = record.name_hash & (index_slots - 1);
+            while(index[slot] != 0) slot = (slot + 1) & (index_slots - 1);
+            index[slot] = (ut_DWORD) records.size();
+        }
+
+        struct san_header header = {};
+        memcpy(header.magic, san_magic, sizeof(san_magic));
+        header.version = san_version;
+        header.header_size = sizeof(struct san_header);
+        header.amnt_of_symbols = (ut_DWORD) records.size();
+        header.index_offset = align8(header.header_size + (ut_DWORD) (records.size() * sizeof(struct san_record)));
+        header.index_slots = index_slots;
+        header.strings_offset = align8(header.index_offset + index_slots * sizeof(ut_DWORD));
+        header.strings_size = (ut_DWORD) strings.size();
+
+        /* Everything after the header, as it ends up in the file (padding included); what `checksum` covers. */
+        std::vector<ut_BYTE> body(header.strings_offset + header.strings_size - header.header_size, 0);
+        if(!records.empty()) memcpy(&body[0], records.data(), records.size() * sizeof(struct san_record));
+        memcpy(&body[header.index_offset - header.header_size], index.data(), index.size() * sizeof(ut_DWORD));
+        if(!strings.empty()) memcpy(&body[header.strings_offset - header.header_size], strings.data(), strings.size());
+        header.checksum = hash_name(nt_BYTE_CPTR body.data(), body.size());
+
+        FILE *out = fopen(filename, "wb");
+        MASM_assert(out,
+            "\n%s[FILE ERROR]%s\tThere was an error opening the symbol file `%s`.\n",
+            red, white,
+            filename)
+
+        fwrite(&header, sizeof(header), 1, out);
+        fwrite(body.data(), 1, body.size(), out);
+        fclose(out);
+    }
+
+    ~MocaAsm_san_writer()
+    {}
+};
+
+/* Reader library; `mmap`s the file and answers lookups straight from the mapping. */
+class MocaAsm_san_reader
+{
+private:
+    const ut_BYTE               *data = nullptr;
+    ut_LSIZE                    data_size = 0;
+    const struct san_header     *header = nullptr;
+    const struct san_record     *records = nullptr;
+    const ut_DWORD              *index = nullptr;
+    const nt_BYTE               *strings = nullptr;
+
+public:
+    MocaAsm_san_reader(const nt_BYTE *filename)
+    {
+        nt_DWORD fd = open(filename, O_RDONLY);
+        MASM_assert(fd >= 0,
+            "\n%s[FILE ERROR]%s\tThere was an error opening the symbol file `%s`.\n",
+            red, white,
+            filename)
+
+        struct stat info;
+        fstat(fd, &info);
+        data_size = (ut_LSIZE) info.st_size;
+
+        MASM_assert(data_size >= sizeof(struct san_header),
+            "\n%s[SAN ERROR]%s\t`%s` is too small to be a symbol file.\n",
+            red, white,
+            filename)
+
+        data = ut_BYTE_CPTR mmap(nullptr, data_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        MASM_assert(data != MAP_FAILED,
+            "\n%s[FILE ERROR]%s\tThere was an error mapping the symbol file `%s`.\n",
+            red, white,
+            filename)
+
+        header = (const struct san_header *) data;
+        MASM_assert(memcmp(header->magic, san_magic, sizeof(san_magic)) == 0 && header->version == san_version,
+            "\n%s[SAN ERROR]%s\t`%s` is not a version %d symbol file.\n",
+            red, white,
+            filename, san_version)
+
+        /* Make sure every table is inside of the file before handing out pointers into it. */
+        MASM_assert(header->header_size >= sizeof(struct san_header) &&
+            header->header_size + (ut_LSIZE) header->amnt_of_symbols * sizeof(struct san_record) <= data_size &&
+            header->index_offset + (ut_LSIZE) header->index_slots * sizeof(ut_DWORD) <= data_size &&
+            header->strings_offset >= header->header_size && header->strings_offset + (ut_LSIZE) header->strings_size <= data_size &&
+            header->index_slots != 0 && (header->index_slots & (header->index_slots - 1)) == 0 &&
+            header->header_size % 8 == 0 && header->index_offset % 8 == 0,
+            "\n%s[SAN ERROR]%s\tThe symbol file `%s` is truncated or corrupt.\n",
+            red, white,
+            filename)
+
+        records = (const struct san_record *) (data + header->header_size);
+        index = (const ut_DWORD *) (data + header->index_offset);
+        strings = (const nt_BYTE *) (data + header->strings_offset);
+    }
+
+    ut_DWORD amnt_of_symbols()
+    { return header->amnt_of_symbols; }
+
+    const struct san_record *get_record(ut_DWORD i)
+    { return &records[i]; }
+
+    const nt_BYTE *name_of(const struct san_record *record)
+    { return &strings[record->name_offset]; }
+
+    /* O(1) lookup; returns `nullptr` if `name` is not in the file. */
+    const struct san_record *lookup(const nt_BYTE *name, ut_LSIZE length)
+    {
+        ut_DWORD hash = hash_name(name, length);
+        ut_DWORD slot = hash & (header->index_slots - 1);
+
+        for(ut_DWORD probes = 0; probes < header->index_slots && index[slot] != 0; probes++)
+        {
+            const struct san_record *record = &records[index[slot] - 1];
+            if(record->name_hash == hash && record->name_length == length &&
+                memcmp(&strings[record->name_offset], name, length) == 0)
+                return record;
+
+            slot = (slot + 1) & (header->index_slots - 1);
+        }
+
+        return nullptr;
+    }
+
+    const struct san_record *lookup(const nt_BYTE *name)
+    { return lookup(name, strlen(name)); }
+
+    /* Check everything a reader trusts: the checksum, names inside the pool and NUL-terminated, hashes matching the names,
+     * index slots pointing at records and every record reachable from the index.
+     * Returns `nullptr` if the file is fine, otherwise a description of the first problem found.
+     * */
+    const nt_BYTE *verify()
+    {
+        if(header->header_size != sizeof(struct san_header)) return "unexpected header size";
+        if(hash_name((const nt_BYTE *) data + header->header_size, header->strings_offset + header->strings_size - header->header_size) != header->checksum)
+            return "checksum does not match the records, index and names";
+        if(header->index_slots < header->amnt_of_symbols * 2) return "index has less than 2 slots per symbol";
+
+        ut_DWORD used_slots = 0;
+        for(ut_DWORD slot = 0; slot < header->index_slots; slot++)
+        {
+            if(index[slot] == 0) continue;
+            if(index[slot] > header->amnt_of_symbols) return "index slot points past the last record";
+            used_slots++;
+        }
+        if(used_slots != header->amnt_of_symbols) return "index does not have exactly one slot per record";
+
+        for(ut_DWORD i = 0; i < header->amnt_of_symbols; i++)
+        {
+            const struct san_record *record = &records[i];
+
+            if((ut_LSIZE) record->name_offset + record->name_length >= header->strings_size) return "name outside of the string pool";
+            if(strings[record->name_offset + record->name_length] != '\0') return "name is not NUL-terminated";
+            if(hash_name(name_of(record), record->name_length) != record->name_hash) return "name hash does not match the name";
+            if(record->kind > (ut_BYTE) SanSymbolKind::SK_variable) return "unknown symbol kind";
+            if(lookup(name_of(record), record->name_length) != record) return "record is not reachable through the index";
+        }
+
+        return nullptr;
+    }
+
+    ~MocaAsm_san_reader()
+    {
+        if(data) munmap((void *) data, data_size);
+
+        data = nullptr;
+        header = nullptr;
+    }
+};
+
+}
+
+#endif
@@ -1,5 +1,8 @@
 #ifndef Moca_assembly_tokens
 #define Moca_assembly_tokens
+#include <array>
+#include "assembler_backend/asm_symbols.hpp"
+using namespace masm_symbols;
 
 namespace masm_tokens
 {
@@ -73,6 +76,16 @@ enum class AsmKeywordTokens
     KW_incbin,
     KW_incsrc,
 
+    /* Repeating a statement; `pad` is another name for `times`. */
+    KW_pad,
+    KW_times,
+
+    /* `align boundary [, fill]`. */
+    KW_align,
+
+    /* `.text`, `.data`, ...; only ever produced by the lexer, the value is the section's name (with the `.`). */
+    KW_section,
+
     /* Label/variable name. */
     KW_special,
 
@@ -81,7 +94,7 @@ enum class AsmKeywordTokens
 };
 
 /* All keyword token values. */
-const nt_BYTE *keyword_token_values[] = {
+constexpr const nt_BYTE *keyword_token_values[] = {
     "mov", "movw", "movd", "movb",
     "or", "and", "xor", "nand", "nor", "shl", "shr",
     "clc", "cld", "cli", "sti", "cmc",
@@ -93,6 +106,9 @@ const nt_BYTE *keyword_token_values[] = {
     "lea", "lock", "lodsb", "lodsw",
     "jmp", "jne", "jge", "jle", "jz", "jc", "jg", "jl",
     "incbin", "incsrc",
+    "pad", "times",
+    "align",
+    0, // section
     0, // special
     "res"
 };
@@ -149,7 +165,7 @@ enum class AsmRegisterTokens
 };
 
 /* All register token values. */
-const nt_BYTE *register_token_values[] = {
+constexpr const nt_BYTE *register_token_values[] = {
     "ax", "ah", "al",
     "bx", "bh", "bl",
     "cx", "ch", "cl",
@@ -174,7 +190,7 @@ enum class AsmDataTypeTokens
 };
 
 /* All datatype token values. */
-const nt_BYTE *data_type_token_values[] = {
+constexpr const nt_BYTE *data_type_token_values[] = {
     "db", "dw", "dd",
     "dbarr", "dwarr", "ddarr"
 };
@@ -193,6 +209,59 @@ enum class TypeOfTokens
     TT_NONE
 };
 
+/* A keyword, datatype or register name; every other name is a label/variable name (`KW_special`). */
+struct reserved_name
+{
+    const nt_BYTE   *name = nullptr;
+    TypeOfTokens    token_type = TypeOfTokens::TT_NONE;
+    ut_BYTE         token_id = 0;
+};
+
+constexpr ut_DWORD amnt_of_reserved_slots = 256;
+
+constexpr bool names_equal(const nt_BYTE *a, const nt_BYTE *b)
+{
+    for(; *a && *a == *b; a++, b++);
+    return *a == *b;
+}
+
+/* Every reserved name, hashed into an open-addressed table at compile time, so telling a name apart takes a hash and (mostly) one compare.
+ * A name in more than one list keeps the first: keywords, then datatypes, then registers.
+ * */
+constexpr std::array<struct reserved_name, amnt_of_reserved_slots> make_reserved_names()
+{
+    std::array<struct reserved_name, amnt_of_reserved_slots> table = {};
+
+    auto add = [&table](const nt_BYTE *name, TypeOfTokens token_type, ut_BYTE token_id) {
+        ut_DWORD slot = hash_name(name) % amnt_of_reserved_slots;
+
+        for(; table[slot].name; slot = (slot + 1) % amnt_of_reserved_slots)
+            if(names_equal(table[slot].name, name)) return;
+
+        table[slot] = {name, token_type, token_id};
+    };
+
+    for(ut_BYTE i = 0; i < sizeof(keyword_token_values)/sizeof(keyword_token_values[0]); i++)
+        if(keyword_token_values[i]) add(keyword_token_values[i], TypeOfTokens::TT_keyword, i);
+    for(ut_BYTE i = 0; i < sizeof(data_type_token_values)/sizeof(data_type_token_values[0]); i++)
+        add(data_type_token_values[i], TypeOfTokens::TT_datatype, (ut_BYTE) AsmDataTypeTokens::DT_db + i);
+    for(ut_BYTE i = 0; i < sizeof(register_token_values)/sizeof(register_token_values[0]); i++)
+        add(register_token_values[i], TypeOfTokens::TT_register, i);
+
+    return table;
+}
+
+constexpr std::array<struct reserved_name, amnt_of_reserved_slots> reserved_names = make_reserved_names();
+
+/* `nullptr` for a label/variable name. */
+inline const struct reserved_name *find_reserved_name(const nt_BYTE *name)
+{
+    for(ut_DWORD slot = hash_name(name) % amnt_of_reserved_slots; reserved_names[slot].name; slot = (slot + 1) % amnt_of_reserved_slots)
+        if(strcmp(reserved_names[slot].name, name) == 0) return &reserved_names[slot];
+
+    return nullptr;
+}
+
 template<typename T>
 concept IsTokenEnum = requires {
     std::is_same<T, AsmKeywordTokens>::value ||
@@ -208,22 +277,63 @@ struct MocaAsm_TD
     ut_BYTE         token_id;
     ut_BYTE         *token_value;
     TypeOfTokens    token_type;
+
+    /* Id of the interned name for `KW_special`, `no_symbol` for every other token. */
+    ut_DWORD        symbol_id;
 };
 
-/* This gets filled out by the assembler.
- * This structure tells the tokenization program what Token(s) To Expect (TTE).
+/* A grammar token is the same wherever it is found, so the lexer hands out one of these instead of allocating it.
+ * In the order of `AsmGrammarTokens`; they are never written to, and `free_token` leaves them alone.
  * */
-struct MocaAsm_TTE
-{
-    TypeOfTokens    tokens_to_expect[5];
-    ut_BYTE         amnt_of_TTE;
+inline struct MocaAsm_TD grammar_tokens[] = {
+    {(ut_BYTE) AsmGrammarTokens::GR_comma,    ut_BYTE_PTR ",",  TypeOfTokens::TT_grammar, no_symbol},
+    {(ut_BYTE) AsmGrammarTokens::GR_colon,    ut_BYTE_PTR ":",  TypeOfTokens::TT_grammar, no_symbol},
+    {(ut_BYTE) AsmGrammarTokens::GR_dot,      ut_BYTE_PTR ".",  TypeOfTokens::TT_grammar, no_symbol},
+    {(ut_BYTE) AsmGrammarTokens::GR_lbrack,   ut_BYTE_PTR "[",  TypeOfTokens::TT_grammar, no_symbol},
+    {(ut_BYTE) AsmGrammarTokens::GR_rbrack,   ut_BYTE_PTR "]",  TypeOfTokens::TT_grammar, no_symbol},
+    {(ut_BYTE) AsmGrammarTokens::GR_singleQ,  ut_BYTE_PTR "'",  TypeOfTokens::TT_grammar, no_symbol},
+    {(ut_BYTE) AsmGrammarTokens::GR_doubleQ,  ut_BYTE_PTR "\"", TypeOfTokens::TT_grammar, no_symbol},
+    {(ut_BYTE) AsmGrammarTokens::GR_dollar,   ut_BYTE_PTR "$",  TypeOfTokens::TT_grammar, no_symbol},
+    {(ut_BYTE) AsmGrammarTokens::GR_lpar,     ut_BYTE_PTR "(",  TypeOfTokens::TT_grammar, no_symbol},
+    {(ut_BYTE) AsmGrammarTokens::GR_rpar,     ut_BYTE_PTR ")",  TypeOfTokens::TT_grammar, no_symbol},
+    {(ut_BYTE) AsmGrammarTokens::GR_minus,    ut_BYTE_PTR "-",  TypeOfTokens::TT_grammar, no_symbol},
+    {(ut_BYTE) AsmGrammarTokens::GR_plus,     ut_BYTE_PTR "+",  TypeOfTokens::TT_grammar, no_symbol},
+    {(ut_BYTE) AsmGrammarTokens::GR_percent,  ut_BYTE_PTR "%",  TypeOfTokens::TT_grammar, no_symbol},
+    {(ut_BYTE) AsmGrammarTokens::GR_asm_EOF,  ut_BYTE_PTR "",   TypeOfTokens::TT_grammar, no_symbol}
 };
 
+static_assert(sizeof(grammar_tokens)/sizeof(grammar_tokens[0]) == (ut_BYTE) AsmGrammarTokens::GR_asm_EOF + 1, "`grammar_tokens` needs every `AsmGrammarTokens`.");
+
+inline struct MocaAsm_TD *grammar_token(AsmGrammarTokens token_id)
+{ return &grammar_tokens[(ut_BYTE) token_id]; }
+
+/* Delete a token the lexer handed out. */
+inline void free_token(struct MocaAsm_TD *token)
+{
+    if(token >= grammar_tokens && token < grammar_tokens + sizeof(grammar_tokens)/sizeof(grammar_tokens[0])) return;
+
+    delete[] token->token_value;
+    delete token;
+}
+
+/* This gets filled out by the assembler.
+ * Tells the tokenization program what Token(s) To Expect (TTE); one bit per `TypeOfTokens`.
+ * */
+typedef ut_WORD token_mask;
+
+constexpr token_mask token_bit(TypeOfTokens type)
+{ return (token_mask) (1 << (ut_BYTE) type); }
+
+static_assert((ut_BYTE) TypeOfTokens::TT_NONE <= sizeof(token_mask) * 8, "`token_mask` needs a bit for every `TypeOfTokens`.");
+
 class MocaAsm_tokenizer
 {
 private:
-    /* This will be allocated when the assembler invokes the according method. */
-    struct MocaAsm_TTE *ttexp = nullptr;
+    /* Set by the assembler every time it checks in a new instruction. */
+    token_mask tokens_to_expect = 0;
+
+    /* Owned by the assembler; every `KW_special` gets interned here. */
+    MocaAsm_symtab *symtab = nullptr;
 
 public:
     MocaAsm_tokenizer()
@@ -241,8 +351,9 @@ public:
             token_value)
 
         token_data->token_id = (ut_BYTE) token_id;
-        token_data->token_value = new ut_BYTE[strlen(nt_BYTE_CPTR token_value)];
-        memcpy(token_data->token_value, token_value, strlen(nt_BYTE_CPTR token_value));
+        token_data->token_value = new ut_BYTE[strlen(nt_BYTE_CPTR token_value) + 1];
+        memcpy(token_data->token_value, token_value, strlen(nt_BYTE_CPTR token_value) + 1);
+        token_data->symbol_id = no_symbol;
 
         if(std::is_same<T, AsmKeywordTokens>::value) { token_data->token_type = TypeOfTokens::TT_keyword; return token_data; }
         if(std::is_same<T, AsmGrammarTokens>::value) { token_data->token_type = TypeOfTokens::TT_grammar; return token_data; }
@@ -253,69 +364,61 @@ public:
         return token_data;
     }
 
-    struct MocaAsm_TD *create_new_token_alone(ut_BYTE *token_value, ut_WORD line)
+    /* Everything that depends on the parser (the register check and interning names) is left to `finish_token`, done
+     * once the parser takes the token; tokens can be lexed ahead of the parser, on another thread.
+     * */
+    struct MocaAsm_TD *create_new_token_alone(ut_BYTE *token_value)
     {
-        ut_BYTE i = 0;
-        ut_BYTE i2 = 0;
-        ut_BYTE i3 = 0;
+        const struct reserved_name *reserved = find_reserved_name(nt_BYTE_CPTR token_value);
 
-        while(i < sizeof(keyword_token_values)/sizeof(keyword_token_values[0]))
-        {
-            if(keyword_token_values[i] == 0) { i++; continue; }
-            if(strcmp(nt_BYTE_CPTR token_value, keyword_token_values[i]) == 0)
-                goto keyword_found;
-            i++;
-        }
+        if(!reserved) return new_token<AsmKeywordTokens> (AsmKeywordTokens::KW_special, token_value);
 
-        /* Check if it's a datatype (db, dw, dd, dbarr, dwarr, ddarr). */
-        while(i2 < sizeof(data_type_token_values)/sizeof(data_type_token_values[0]))
+        switch(reserved->token_type)
         {
-            if(strcmp(nt_BYTE_CPTR token_value, data_type_token_values[i2]) == 0)
-                return new_token<AsmDataTypeTokens> ((AsmDataTypeTokens) (i2+0x32), token_value);
-            
-            i2++;
+            case TypeOfTokens::TT_datatype: return new_token<AsmDataTypeTokens> ((AsmDataTypeTokens) reserved->token_id, token_value);break;
+            case TypeOfTokens::TT_register: return new_token<AsmRegisterTokens> ((AsmRegisterTokens) reserved->token_id, token_value);break;
+            default: break;
         }
 
-        /* This function should never be invoked and have to tokenize a register, error if 
-         * `token_value` is a register.
+        return new_token<AsmKeywordTokens> ((AsmKeywordTokens) reserved->token_id, token_value);
+    }
+
+    /* What `create_new_token_alone` left out. `line` gives the line of the token; it is only worked out for an error. */
+    template<typename F>
+    void finish_token(struct MocaAsm_TD *token, F &&line)
+    {
+        /* Registers are only valid once the assembler has told us to expect one (i.e. after `mov`).
+         * Error if `token` is a register and the assembler is not expecting one.
          * */
-        while(i3 < sizeof(register_token_values)/sizeof(register_token_values[0]))
+        if(token->token_type == TypeOfTokens::TT_register && !is_expecting(TypeOfTokens::TT_register))
         {
-            MASM_assert(strcmp(nt_BYTE_CPTR token_value, register_token_values[i3]) != false,
-                "\n%s[INVALID SYNTAX, LINE %d]%s\tThere was a unwanted register (`%s`) found on line %d without any bit operation/mov instruction found.\n",
-                red, line, white,
-                token_value, line)
-            
-            i3++;
+            ut_DWORD at_line = line();
+            MASM_error("\n%s[INVALID SYNTAX, LINE %d]%s\tThere was a unwanted register (`%s`) found on line %d without any bit operation/mov instruction found.\n",
+                red, at_line, white,
+                token->token_value, at_line)
         }
-        
-        return new_token<AsmKeywordTokens> (AsmKeywordTokens::KW_special, token_value);
 
-        keyword_found:
-        return new_token<AsmKeywordTokens> ((AsmKeywordTokens) i, token_value);
+        if(token->token_type == TypeOfTokens::TT_keyword && token->token_id == (ut_BYTE) AsmKeywordTokens::KW_special && symtab)
+            token->symbol_id = symtab->intern(nt_BYTE_CPTR token->token_value);
     }
 
-    void assign_tokens_to_expect(TypeOfTokens TTE[5])
-    {
-        if(ttexp) delete ttexp;
-        ttexp = new struct MocaAsm_TTE;
+    void assign_tokens_to_expect(token_mask TTE)
+    { tokens_to_expect = TTE; }
 
-        for(ut_BYTE i = 0; i < 5; i++)
-        {
-            if(TTE[i] == TypeOfTokens::TT_NONE) { ttexp->amnt_of_TTE = i; break; }
-            ttexp->tokens_to_expect[i] = TTE[i];
-        }
-    }
+    void set_symbol_table(MocaAsm_symtab *table)
+    { symtab = table; }
+
+    MocaAsm_symtab *get_symbol_table()
+    { return symtab; }
 
-    struct MocaAsm_TTE *get_tte()
-    { return ttexp; }
+    bool is_expecting(TypeOfTokens type)
+    { return tokens_to_expect & token_bit(type); }
 
-    TypeOfTokens *get_assemblers_TTE()
-    { return ttexp->tokens_to_expect; }
+    token_mask get_tokens_to_expect()
+    { return tokens_to_expect; }
 
     template<typename T>
-        requires std::is_same<T, struct MocaAsm_TTE>::value ||
-            std::is_same<T, MocaAsm_tokenizer>::value ||
+        requires std::is_same<T, MocaAsm_tokenizer>::value ||
             std::is_same<T, struct MocaAsm_TD>::value
     void delete_instance(T *instance)
     {
@@ -325,11 +428,7 @@ public:
     }
 
     ~MocaAsm_tokenizer()
-    {
-        if(ttexp) delete ttexp;
-
-        ttexp = nullptr;
-    }
+    {}
 };
 
 }
@@ -0,0 +1,226 @@
+#ifndef Moca_assembly_trace
+#define Moca_assembly_trace
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "asm_alloc_profile.hpp"
+
+namespace masm_trace
+{
+
+/* A finished span.
+ * Written out as a Chrome/Perfetto trace-event "complete" event (`"ph": "X"`).
+ * `name` must outlive the tracer (string literals or argv); `detail` is copied.
+ * */
+struct trace_event
+{
+    const nt_BYTE   *category;
+    const nt_BYTE   *name;
+    std::string     detail;
+    ut_LLBYTE       start_ns;
+    ut_LLBYTE       duration_ns;
+};
+
+/* Every thread that records a span gets its own event buffer, and thus its own track in the viewer.
+ * Threads only ever append to their own buffer, so recording a span never takes a lock.
+ * */
+struct trace_thread
+{
+    ut_DWORD                    tid;
+    std::string                 name;
+    std::vector<trace_event>    events;
+};
+
+class MocaAsm_tracer
+{
+private:
+    bool                                    enabled = false;
+    std::string                             output_filename;
+    std::chrono::steady_clock::time_point   epoch;
+    std::mutex                              threads_lock;
+    std::vector<struct trace_thread *>      threads;
+
+    static void write_escaped(FILE *out, const nt_BYTE *value)
+    {
+        for(; *value; value++)
+        {
+            switch(*value)
+            {
+                case '"': fputs("\\\"", out);break;
+                case '\\': fputs("\\\\", out);break;
+                case '\n': fputs("\\n", out);break;
+                case '\t': fputs("\\t", out);break;
+                default: {
+                    if((ut_BYTE) *value < 0x20) fprintf(out, "\\u%04x", *value);
+                    else fputc(*value, out);
+                    break;
+                }
+            }
+        }
+    }
+
+public:
+    MocaAsm_tracer()
+    {}
+
+    /* `--trace=[file]`. Nothing is recorded unless this gets invoked. */
+    void enable(const nt_BYTE *filename)
+    {
+        output_filename = filename;
+        epoch = std::chrono::steady_clock::now();
+        enabled = true;
+    }
+
+    inline bool is_enabled()
+    { return enabled; }
+
+    ut_LLBYTE now()
+    {
+        return (ut_LLBYTE) std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - epoch
+        ).count();
+    }
+
+    struct trace_thread *this_thread()
+    {
+        thread_local struct trace_thread *tthread = nullptr;
+
+        if(!tthread)
+        {
+            std::lock_guard<std::mutex> guard(threads_lock);
+
+            tthread = new struct trace_thread;
+            tthread->tid = (ut_DWORD) threads.size() + 1;
+            tthread->name = tthread->tid == 1 ? std::string("masm") : "masm worker " + std::to_string(tthread->tid - 1);
+            threads.push_back(tthread);
+        }
+
+        return tthread;
+    }
+
+    /* Give the calling thread's track a readable name (i.e. the file a batch worker is assembling). */
+    void name_thread(const nt_BYTE *name)
+    {
+        if(!enabled) return;
+        this_thread()->name = name;
+    }
+
+    void record(struct trace_event &&event)
+    {
+        this_thread()->events.push_back(std::move(event));
+    }
+
+    /* Write every recorded span to `output_filename`.
+     * Must only be invoked once all threads that recorded spans have been joined.
+     * */
+    void write()
+    {
+        if(!enabled) return;
+
+        FILE *out = fopen(output_filename.c_str(), "wb");
+        MASM_assert(out,
+            "\n%s[FILE ERROR]%s\tThere was an error opening the trace file `%s`.\n",
+            red, white,
+            output_filename.c_str())
+
+        fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", out);
+
+        bool first = true;
+        for(struct trace_thread *tthread : threads)
+        {
+            fprintf(out, "%s{\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"name\":\"thread_name\",\"args\":{\"name\":\"",
+                first ? "" : ",\n", tthread->tid);
+            write_escaped(out, tthread->name.c_str());
+            fputs("\"}}", out);
+            first = false;
+
+            for(struct trace_event &event : tthread->events)
+            {
+                fprintf(out, ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"cat\":\"%s\",\"ts\":%llu.%03llu,\"dur\":%llu.%03llu,\"name\":\"",
+                    tthread->tid, event.category,
+                    event.start_ns / 1000, event.start_ns % 1000,
+                    event.duration_ns / 1000, event.duration_ns % 1000);
+                write_escaped(out, event.name);
+                if(!event.detail.empty())
+                {
+                    fputs("\",\"args\":{\"detail\":\"", out);
+                    write_escaped(out, event.detail.c_str());
+                    fputs("\"}}", out);
+                    continue;
+                }
+                fputs("\"}", out);
+            }
+        }
+
+        fputs("\n]}\n", out);
+        fclose(out);
+    }
+
+    ~MocaAsm_tracer()
+    {
+        for(struct trace_thread *tthread : threads)
+            delete tthread;
+
+        threads.clear();
+    }
+};
+
+/* One tracer for the whole process; spans from every thread end up in the same file. */
+inline MocaAsm_tracer tracer;
+
+/* Scoped (RAII) span: starts on construction and is recorded when it goes out of scope.
+ * When tracing is off, the constructor is a single branch and the destructor does nothing.
+ * */
+class trace_span
+{
+private:
+    const nt_BYTE   *category = nullptr;
+    const nt_BYTE   *name = nullptr;
+    const nt_BYTE   *detail = nullptr;
+    ut_LLBYTE       start_ns = 0;
+
+    #ifdef MASM_ALLOC_PROFILE
+    /* The span's category doubles as the allocation profiler's phase. */
+    masm_alloc::phase_scope alloc_phase;
+    #endif
+
+public:
+    trace_span(const nt_BYTE *cat, const nt_BYTE *span_name, const nt_BYTE *span_detail = nullptr)
+    #ifdef MASM_ALLOC_PROFILE
+        : alloc_phase(cat)
+    #endif
+    {
+        if(!tracer.is_enabled()) return;
+
+        category = cat;
+        name = span_name;
+        detail = span_detail;
+        start_ns = tracer.now();
+    }
+
+    trace_span(const trace_span &) = delete;
+    trace_span &operator=(const trace_span &) = delete;
+
+    ~trace_span()
+    {
+        if(!category) return;
+
+        tracer.record({category, name, detail ? detail : "", start_ns, tracer.now() - start_ns});
+    }
+};
+
+}
+
+/* `MASM_TRACE_SPAN("category", "name"[, "detail"])` opens a span lasting until the end of the enclosing scope.
+ * Building with `-DMASM_NO_TRACE` compiles every span out entirely.
+ * */
+#define MASM_TRACE_CONCAT_(a, b)    a##b
+#define MASM_TRACE_CONCAT(a, b)     MASM_TRACE_CONCAT_(a, b)
+#ifndef MASM_NO_TRACE
+#define MASM_TRACE_SPAN(cat, ...)   masm_trace::trace_span MASM_TRACE_CONCAT(masm_trace_span_, __LINE__)(cat, ##__VA_ARGS__)
+#else
+#define MASM_TRACE_SPAN(cat, ...)   MASM_ALLOC_PHASE(cat)
+#endif
+
+#endif
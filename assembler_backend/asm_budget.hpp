@@ -0,0 +1,164 @@
+#ifndef Moca_assembly_budget
+#define Moca_assembly_budget
+#include <string>
+#include <vector>
+#include "asm_ir.hpp"
+
+namespace masm_budget
+{
+
+using namespace masm_ir;
+
+/* `-EFBP mbr`: 510 bytes of code and data, followed by the `0xAA55` signature. */
+constexpr ut_DWORD mbr_size = 512;
+constexpr ut_DWORD mbr_signature_offset = 510;
+
+/* `--budget=name:bytes`. */
+struct label_budget
+{
+    ut_DWORD    symbol_id;
+    ut_DWORD    bytes;
+};
+
+/* `-EFBP mbr`/`ssboot`. Lists what every label/variable put into the image (counted by `MocaAsm_ir::encode` as it went,
+ * see `size_row`) and fails the build if one of them went over its `--budget=`, or an MBR does not fit its sector.
+ * */
+class MocaAsm_size_budget
+{
+private:
+    MocaAsm_ir                          &ir;
+    MocaAsm_symtab                      &symtab;
+    std::vector<struct label_budget>    budgets;
+
+    /* `name:bytes,name:bytes,...`. */
+    void parse_budgets(const nt_BYTE *list)
+    {
+        for(const nt_BYTE *name = list; name && *name;)
+        {
+            const nt_BYTE *colon = strchr(name, ':');
+            const nt_BYTE *end = strchr(name, ',');
+            if(!end) end = name + strlen(name);
+
+            MASM_assert(colon && colon < end && colon > name,
+                "\n%sArgument Error:%s\n\t`--budget=` expects %s`name:bytes`%s, separated by commas; got `%.*s`.\n",
+                red, white,
+                green, white,
+                (nt_DWORD) (end - name), name)
+
+            ut_DWORD id = symtab.find(name, colon - name);
+            MASM_assert(id != no_symbol && symtab.get(id).kind != SymbolKind::SK_undefined,
+                "\n%s[SIZE BUDGET]%s\t%s`%.*s`%s has a budget (%s`--budget=`%s), but is never defined.\n",
+                red, white,
+                yellow, (nt_DWORD) (colon - name), name, white,
+                green, white)
+
+            nt_BYTE *number_end = nullptr;
+            ut_DWORD bytes = (ut_DWORD) strtoul(colon + 1, &number_end, 0);
+            MASM_assert(number_end == end && number_end != colon + 1,
+                "\n%sArgument Error:%s\n\tThe budget of `%.*s` (`--budget=`) has to be a number of bytes.\n",
+                red, white,
+                (nt_DWORD) (colon - name), name)
+
+            budgets.push_back({id, bytes});
+            name = *end ? end + 1 : end;
+        }
+    }
+
+    /* `no_budget` if `symbol_id` has none. */
+    static constexpr ut_DWORD no_budget = 0xFFFFFFFF;
+
+    ut_DWORD budget_of(ut_DWORD symbol_id)
+    {
+        for(struct label_budget &budget : budgets)
+            if(budget.symbol_id == symbol_id) return budget.bytes;
+
+        return no_budget;
+    }
+
+    static ut_DWORD total_of(struct size_row &row)
+    { return row.code + row.data + row.padding; }
+
+public:
+    MocaAsm_size_budget(MocaAsm_ir &i, MocaAsm_symtab &s, const nt_BYTE *list)
+        : ir(i), symtab(s)
+    {
+        parse_budgets(list);
+    }
+
+    void report()
+    {
+        struct size_row total = {no_symbol, 0, false, 0, 0, 0};
+
+        MASM_report("\n%s[SIZE]%s\n", yellow, white);
+        MASM_report("\t%-24s %-8s %8s %8s %8s %8s %8s\n", "label", "section", "code", "data", "padding", "total", "budget");
+
+        for(struct size_row &row : ir.get_sizes())
+        {
+            if(row.symbol_id == no_symbol && total_of(row) == 0) continue;
+
+            std::string name = row.symbol_id == no_symbol ? std::string("(start of ") + section_names[row.section] + ")" : symtab.name_of(row.symbol_id);
+            ut_DWORD budget = row.symbol_id == no_symbol ? no_budget : budget_of(row.symbol_id);
+            bool over = budget != no_budget && total_of(row) > budget;
+
+            if(budget == no_budget)
+                MASM_report("\t%-24s %-8s %8u %8u %8u %8u %8s\n", name.c_str(), section_names[row.section],
+                    row.code, row.data, row.padding, total_of(row), "-")
+            else
+                MASM_report("\t%s%-24s%s %-8s %8u %8u %8u %8u %8u\n", over ? red : white, name.c_str(), white, section_names[row.section],
+                    row.code, row.data, row.padding, total_of(row), budget)
+
+            total.code += row.code;
+            total.data += row.data;
+            total.padding += row.padding;
+        }
+
+        MASM_report("\t%-24s %-8s %8u %8u %8u %8u\n", "total", "", total.code, total.data, total.padding, total_of(total));
+    }
+
+    /* Fail if a label went over its budget; with `mbr`, also if `image` does not fit a sector. Nothing has been written yet. */
+    void enforce(std::vector<ut_BYTE> *image, bool mbr)
+    {
+        ut_DWORD amnt_over = 0;
+
+        for(struct size_row &row : ir.get_sizes())
+        {
+            ut_DWORD budget = row.symbol_id == no_symbol ? no_budget : budget_of(row.symbol_id);
+            if(budget == no_budget || total_of(row) <= budget) continue;
+
+            MASM_warning("\n%s[SIZE BUDGET]%s\t%s`%s`%s is %u bytes, %u over its budget of %u.\n",
+                red, white,
+                yellow, symtab.name_of(row.symbol_id), white,
+                total_of(row), total_of(row) - budget, budget)
+            amnt_over++;
+        }
+
+        MASM_assert(amnt_over == 0,
+            "\n%s[SIZE BUDGET]%s\t%u label(s) went over their budget (%s`--budget=`%s); nothing was written.\n",
+            red, white,
+            amnt_over,
+            green, white)
+
+        if(!mbr || !image) return;
+
+        MASM_assert(image->size() <= mbr_size,
+            "\n%s[SIZE BUDGET]%s\tThe MBR is %zu bytes; it has room for %u bytes of code and data, followed by the %s`0xAA55`%s signature.\n",
+            red, white,
+            image->size(), mbr_signature_offset,
+            green, white)
+
+        if(image->size() != mbr_size || (*image)[mbr_signature_offset] != 0x55 || (*image)[mbr_signature_offset + 1] != 0xAA)
+            MASM_warning("\n%s[SIZE BUDGET]%s\tThe MBR does not end in the %s`0xAA55`%s signature at offset %u; %s`pad 510 - $ db 0x0`%s, %s`dw 0xAA55`%s.\n",
+                yellow, white,
+                green, white,
+                mbr_signature_offset,
+                green, white,
+                green, white)
+    }
+
+    ~MocaAsm_size_budget()
+    {}
+};
+
+}
+
+#endif
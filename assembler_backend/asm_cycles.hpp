@@ -0,0 +1,626 @@
+#ifndef Moca_assembly_cycles
+#define Moca_assembly_cycles
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+#include "asm_ir.hpp"
+
+namespace masm_cycles
+{
+
+using namespace masm_ir;
+
+/* Indexed by `Instruction`; what a record is called in a cycle table (`mov` for every mov, `jcc` for every conditional jump). */
+const nt_BYTE *cycle_table_names[] = {
+    nullptr,
+    "mov", "mov", "mov", "mov",
+    "or", "and", "nand", "nor", "xor", "shl", "shr",
+    "jmp", "jcc", "jcc", "jcc", "jcc", "jcc", "jcc", "jcc",
+    "div", "mul", "dec", "inc", "adc", "add", "sub",
+    "hlt", "int", "call",
+    "cli", "sti", "clc", "cld", "cmc",
+    "cmp", "cmpsb", "cwd",
+    "in", "out",
+    "lea", "lock", "lodsb", "lodsw"
+};
+
+/* Indexed by `Instruction`; for the listing. */
+const nt_BYTE *instruction_names[] = {
+    nullptr,
+    "mov", "movb", "movw", "movd",
+    "or", "and", "nand", "nor", "xor", "shl", "shr",
+    "jmp", "jne", "jg", "jl", "jge", "jle", "jc", "jz",
+    "div", "mul", "dec", "inc", "adc", "add", "sub",
+    "hlt", "int", "call",
+    "cli", "sti", "clc", "cld", "cmc",
+    "cmp", "cmpsb", "cwd",
+    "in", "out",
+    "lea", "lock", "lodsb", "lodsw"
+};
+
+/* One line of a cycle table; see `cycles/8086.cyc` for the format. */
+struct cycle_cost
+{
+    ut_WORD     base;
+    ut_WORD     per_bit;        // `Kn`: cycles per bit shifted
+    bool        plus_ea;        // `+ea`
+    bool        available;      // `-`: not on this CPU
+    ut_WORD     taken;          // branches: cycles when taken; `base` is the not taken time
+};
+
+/* `--cycles=`: the cycle costs of one CPU model, read from a data file (`cycles/[model].cyc`). */
+class MocaAsm_cycle_table
+{
+private:
+    std::string     model;
+    ut_WORD         ea = 0;
+
+    /* `instruction[.size] form` -> cost. */
+    std::unordered_map<std::string, struct cycle_cost> costs;
+
+    static ut_WORD parse_number(std::string &word, const nt_BYTE *filename, ut_DWORD line)
+    {
+        MASM_assert(!word.empty() && word.find_first_not_of("0123456789") == std::string::npos,
+            "\n%s[CYCLE TABLE ERROR, LINE %d]%s\t%s`%s`%s in %s`%s`%s is not a number of cycles.\n",
+            red, line, white,
+            yellow, word.c_str(), white,
+            yellow, filename, white)
+
+        return (ut_WORD) atoi(word.c_str());
+    }
+
+    /* `base[+ea][+Kn]` or `-`. */
+    static struct cycle_cost parse_cost(std::string word, const nt_BYTE *filename, ut_DWORD line)
+    {
+        struct cycle_cost cost = {0, 0, false, true, 0};
+        if(word == "-")
+        {
+            cost.available = false;
+            return cost;
+        }
+
+        std::stringstream terms(word);
+        std::string term;
+        bool first = true;
+
+        while(std::getline(terms, term, '+'))
+        {
+            if(first) cost.base = parse_number(term, filename, line);
+            else if(term == "ea") cost.plus_ea = true;
+            else if(!term.empty() && term.back() == 'n')
+            {
+                term.pop_back();
+                cost.per_bit = parse_number(term, filename, line);
+            }
+            else cost.base += parse_number(term, filename, line);
+
+            first = false;
+        }
+
+        return cost;
+    }
+
+public:
+    MocaAsm_cycle_table(const nt_BYTE *filename)
+    {
+        std::ifstream file(filename);
+        MASM_assert(file.is_open(),
+            "\n%s[FILE ERROR]%s\tThere was an error opening the cycle table `%s`.\n",
+            red, white,
+            filename)
+
+        std::string text;
+        ut_DWORD line = 0;
+
+        while(std::getline(file, text))
+        {
+            line++;
+            if(text.find('#') != std::string::npos) text.erase(text.find('#'));
+
+            std::stringstream words(text);
+            std::string name, form, cost, taken;
+            if(!(words >> name)) continue;
+
+            if(name == "model")
+            {
+                std::getline(words >> std::ws, model);
+                continue;
+            }
+
+            if(name == "ea")
+            {
+                words >> form;
+                ea = parse_number(form, filename, line);
+                continue;
+            }
+
+            MASM_assert(words >> form >> cost,
+                "\n%s[CYCLE TABLE ERROR, LINE %d]%s\t%s`%s`%s needs an operand form and a number of cycles (%s`mov reg,imm 4`%s).\n",
+                red, line, white,
+                yellow, name.c_str(), white,
+                green, white)
+
+            struct cycle_cost entry = parse_cost(cost, filename, line);
+            entry.taken = words >> taken ? parse_number(taken, filename, line) : entry.base;
+            costs[name + " " + form] = entry;
+        }
+
+        if(model.empty()) model = filename;
+    }
+
+    /* `name.size form`, then `name form`; each with `acc` read as `reg` and `1` as `imm` if there is no line for them. */
+    const struct cycle_cost *find(const nt_BYTE *name, ut_BYTE size, const std::string &form)
+    {
+        std::string forms[4] = {form, form, form, form};
+
+        for(ut_LSIZE at = 0; (at = forms[1].find("acc", at)) != std::string::npos;) forms[1].replace(at, 3, "reg");
+        if(forms[2] == "reg,1") forms[2] = "reg,imm";
+        forms[3] = forms[2] == "reg,imm" ? forms[2] : forms[1];
+
+        std::string sized = std::string(name) + "." + std::to_string(size * 8) + " ";
+        for(std::string &alternative : forms)
+        {
+            auto found = costs.find(sized + alternative);
+            if(found != costs.end()) return &found->second;
+
+            found = costs.find(std::string(name) + " " + alternative);
+            if(found != costs.end()) return &found->second;
+        }
+
+        return nullptr;
+    }
+
+    ut_WORD get_ea()
+    { return ea; }
+
+    const std::string &get_model()
+    { return model; }
+
+    ~MocaAsm_cycle_table()
+    {}
+};
+
+/* `--cycles=8086` is `cycles/8086.cyc`, next to the `bin/` the assembler is in (the tables it ships with), or else in the
+ * working directory. Only something with a `/` in it or ending in `.cyc` is a path to a table of your own, so a `cycles/`
+ * in the working directory never shadows the shipped tables and a model name can have a `.` in it.
+ * */
+inline std::string find_cycle_table(const nt_BYTE *model)
+{
+    ut_LSIZE model_length = strlen(model);
+    if(strchr(model, '/') || (model_length > 4 && strcmp(model + model_length - 4, ".cyc") == 0)) return model;
+
+    std::string relative = std::string("cycles/") + model + ".cyc";
+
+    nt_BYTE executable[4096];
+    nt_LSIZE length = readlink("/proc/self/exe", executable, sizeof(executable) - 1);
+    if(length > 0)
+    {
+        std::string path(executable, length);
+        path.erase(path.rfind('/') + 1);
+
+        std::string installed = path + "../" + relative;
+        if(access(installed.c_str(), R_OK) == 0) return installed;
+    }
+
+    if(access(relative.c_str(), R_OK) == 0) return relative;
+
+    MASM_error("\n%s[FILE ERROR]%s\tThere is no cycle table for %s`%s`%s (looked for %s`%s`%s next to the assembler's %s`bin/`%s and here).\n",
+        red, white,
+        yellow, model, white,
+        yellow, relative.c_str(), white,
+        yellow, white)
+}
+
+/* What a stretch of records (a label, a basic block, a loop) adds up to. */
+struct cycle_rollup
+{
+    ut_DWORD    first;          // index into `MocaAsm_cycle_estimator::entries`
+    ut_DWORD    last;           // inclusive
+    ut_DWORD    bytes;
+    ut_DWORD    amnt_of_instructions;
+    ut_LLBYTE   cycles;
+};
+
+/* `--cycles=[model]`. Every instruction, once laid out, gets the cycles `table` gives it and its size;
+ * they are summed per label, per basic block and per loop (a backward `jmp`/`jcc` and everything from its target to it).
+ * Costs are static: a backward conditional jump is counted taken (it is the loop going around again), a forward one not taken.
+ * */
+class MocaAsm_cycle_estimator
+{
+private:
+    MocaAsm_ir              &ir;
+    MocaAsm_symtab          &symtab;
+    MocaAsm_cycle_table     &table;
+
+    /* One per record that takes space, in the order it is laid out. */
+    struct cycle_entry
+    {
+        ut_DWORD    record;
+        ut_DWORD    address;
+        ut_DWORD    bytes;          // of every copy (`times`)
+        ut_LLBYTE   cycles;         // of every copy
+        ut_LLBYTE   copies;         // 1, or the `times` count
+        ut_DWORD    label;          // symbol id of the label it falls under; `no_symbol` before the first one
+        std::string form;
+        const nt_BYTE *note;        // for the listing
+        bool        is_instruction;
+        bool        is_branch;
+        bool        ends_block;
+        ut_DWORD    target;         // branches: address of the target
+    };
+
+    std::vector<struct cycle_entry>     entries;
+    std::vector<struct cycle_rollup>    labels;
+    std::vector<struct cycle_rollup>    blocks;
+    std::vector<struct cycle_rollup>    loops;
+
+    /* `(instruction form)` that are not in the table, or not on the CPU, with the source position each came from. */
+    std::vector<std::pair<std::string, ut_DWORD>> unknown;
+    std::vector<std::pair<std::string, ut_DWORD>> unavailable;
+
+    static OperandKind kind_of(struct ir_instruction &instr, ut_BYTE i)
+    { return (OperandKind) ((instr.kinds >> (i * 2)) & 3); }
+
+    static bool is_branch(Instruction instruction)
+    { return is_jmp_instr(instruction) || instruction == Instruction::Icall; }
+
+    /* The operands as the table names them (`reg,imm`); the encoding hints tell the short `acc` forms apart. */
+    std::string form_of(struct ir_instruction &instr)
+    {
+        Instruction instruction = (Instruction) instr.opcode;
+        ut_BYTE hints = instr.flags >> IRF_hint_shift;
+        std::string form;
+
+        for(ut_BYTE i = 0; i < 2 && kind_of(instr, i) != OperandKind::OK_none; i++)
+        {
+            const struct register_info &reg = register_table[instr.regs[i]];
+            if(i > 0) form += ",";
+
+            switch(kind_of(instr, i))
+            {
+                case OperandKind::OK_reg: {
+                    if(reg.rclass == RegisterClass::RC_segment) form += "sreg";
+                    else if(instruction == Instruction::Iin || instruction == Instruction::Iout)
+                        form += reg.encoding == 0 ? "acc" : "dx";
+                    else if(instruction == Instruction::Ishl || instruction == Instruction::Ishr) form += i == 1 ? "cl" : "reg";
+                    else if(reg.encoding == 0 && (hints & (EH_accumulator | EH_moffs))) form += "acc";
+                    else form += "reg";
+                    break;
+                }
+                case OperandKind::OK_imm: {
+                    if(is_branch(instruction)) form += "rel";
+                    else if((instruction == Instruction::Ishl || instruction == Instruction::Ishr) &&
+                        !(instr.flags & IRF_rval_expression) && instr.values[1] == 1) form += "1";
+                    else form += "imm";
+                    break;
+                }
+                default: form += "mem";break;
+            }
+        }
+
+        return form.empty() ? "-" : form;
+    }
+
+    /* Address a branch goes to; `$` was resolved by the layout. */
+    ut_DWORD target_of(struct ir_instruction &instr)
+    {
+        struct InstructionData idata;
+        ir.expand(instr, idata, true);
+
+        nt_LLBYTE target = idata.operands[0].value;
+        if(idata.operands[0].symbol_id != no_symbol) target += symtab.get(idata.operands[0].symbol_id).value;
+
+        return (ut_DWORD) target;
+    }
+
+    void cost_of(struct ir_instruction &instr, struct cycle_entry &entry)
+    {
+        Instruction instruction = (Instruction) instr.opcode;
+
+        entry.form = form_of(instr);
+        entry.is_branch = is_branch(instruction);
+        entry.ends_block = is_jmp_instr(instruction) || instruction == Instruction::Ihlt;
+        if(entry.is_branch) entry.target = target_of(instr);
+
+        const nt_BYTE *name = cycle_table_names[instr.opcode];
+        std::string described = entry.form == "-" ? std::string(name) : std::string(name) + " " + entry.form;
+        const struct cycle_cost *cost = table.find(name, instr.operand_size ? instr.operand_size : 2, entry.form);
+
+        if(!cost)
+        {
+            if(unknown.size() < 8) unknown.push_back({described, instr.position});
+            entry.note = "not in the table";
+            return;
+        }
+
+        if(!cost->available)
+        {
+            if(unavailable.size() < 8) unavailable.push_back({described, instr.position});
+            entry.note = "not on this CPU";
+            return;
+        }
+
+        ut_LLBYTE cycles = cost->base + (cost->plus_ea ? table.get_ea() : 0);
+        if(cost->per_bit)
+            cycles += (ut_LLBYTE) cost->per_bit * (kind_of(instr, 1) == OperandKind::OK_imm ? instr.values[1] & 0x1F : 1);
+
+        if(instruction != Instruction::Ijmp && is_jmp_instr(instruction))
+        {
+            bool taken = entry.target <= entry.address;
+
+            cycles = taken ? cost->taken : cost->base;
+            entry.note = taken ? "taken (loop)" : "not taken";
+        }
+
+        entry.cycles = cycles * entry.copies;
+    }
+
+    /* Every record that takes space, in the order the sections are laid out in. */
+    void collect()
+    {
+        std::vector<struct ir_instruction> &instructions = ir.get_instructions();
+        ut_DWORD label = no_symbol;
+
+        for(ut_BYTE section = 0; section < amnt_of_sections; section++)
+        {
+            ut_DWORD repeat_last = no_statement;
+            ut_LLBYTE copies = 1;
+
+            for(std::pair<ut_DWORD, ut_DWORD> &range : ir.get_section((AsmSection) section).ranges)
+                for(ut_DWORD i = range.first; i < range.second; i++)
+                {
+                    struct ir_instruction &instr = instructions[i];
+
+                    if(instr.opcode == (ut_BYTE) Instruction::SIvar_or_label)
+                    {
+                        label = instr.values[0];
+                        continue;
+                    }
+
+                    if(instr.opcode == (ut_BYTE) Instruction::SIrepeat)
+                    {
+                        struct InstructionData idata;
+                        ir.expand(instr, idata, true);
+
+                        nt_LLBYTE count = idata.operands[0].value;
+                        if(idata.operands[0].symbol_id != no_symbol) count += symtab.get(idata.operands[0].symbol_id).value;
+
+                        repeat_last = i + instr.values[1];
+                        copies = count > 0 ? (ut_LLBYTE) count : 0;
+                        continue;
+                    }
+
+                    if(instr.opcode == (ut_BYTE) Instruction::SIsection || (instr.flags & IRF_removed) || instr.length == 0)
+                    {
+                        if(i == repeat_last) copies = 1;
+                        continue;
+                    }
+
+                    struct cycle_entry entry = {};
+                    entry.record = i;
+                    entry.address = instr.address;
+                    entry.copies = copies;
+                    entry.bytes = (ut_DWORD) (instr.length * copies);
+                    entry.label = label;
+                    entry.is_instruction = instr.opcode < (ut_BYTE) Instruction::SIvar_or_label && !(instr.flags & IRF_raw_data);
+                    entry.note = "";
+
+                    if(entry.is_instruction) cost_of(instr, entry);
+                    entries.push_back(entry);
+
+                    if(i == repeat_last) copies = 1;
+                }
+        }
+    }
+
+    void add(struct cycle_rollup &rollup, ut_DWORD i)
+    {
+        rollup.last = i;
+        rollup.bytes += entries[i].bytes;
+        rollup.amnt_of_instructions += entries[i].is_instruction ? (ut_DWORD) entries[i].copies : 0;
+        rollup.cycles += entries[i].cycles;
+    }
+
+    void roll_up()
+    {
+        for(ut_DWORD i = 0; i < entries.size(); i++)
+        {
+            if(labels.empty() || entries[labels.back().first].label != entries[i].label)
+                labels.push_back({i, i, 0, 0, 0});
+            add(labels.back(), i);
+
+            /* A block starts at a label and after anything that jumps away or stops. */
+            if(blocks.empty() || entries[blocks.back().first].label != entries[i].label || entries[i - 1].ends_block)
+                blocks.push_back({i, i, 0, 0, 0});
+            add(blocks.back(), i);
+        }
+
+        /* A loop is a backward branch and everything from its target to it; costs are one time around.
+         * Entries are in address order, so each loop is a binary search and a difference of running totals.
+         * Several branches back to the same head are one loop, as far as the last of them.
+         * */
+        std::unordered_map<ut_DWORD, ut_DWORD> loop_of_head;
+
+        std::vector<struct cycle_rollup> totals(entries.size() + 1, {0, 0, 0, 0, 0});
+        for(ut_DWORD i = 0; i < entries.size(); i++)
+        {
+            totals[i + 1] = totals[i];
+            add(totals[i + 1], i);
+        }
+
+        for(ut_DWORD i = 0; i < entries.size(); i++)
+        {
+            struct cycle_entry &entry = entries[i];
+            if(!entry.is_branch || entry.target > entry.address || (Instruction) ir.get_instructions()[entry.record].opcode == Instruction::Icall)
+                continue;
+
+            auto head = std::lower_bound(entries.begin(), entries.begin() + i, entry.target,
+                [](const struct cycle_entry &e, ut_DWORD address) { return e.address < address; });
+            ut_DWORD first = (ut_DWORD) (head - entries.begin());
+            if(entries[first].address != entry.target) continue;
+
+            struct cycle_rollup loop = {first, i,
+                totals[i + 1].bytes - totals[first].bytes,
+                totals[i + 1].amnt_of_instructions - totals[first].amnt_of_instructions,
+                totals[i + 1].cycles - totals[first].cycles};
+
+            auto known = loop_of_head.find(first);
+            if(known != loop_of_head.end()) loops[known->second] = loop;
+            else
+            {
+                loop_of_head[first] = (ut_DWORD) loops.size();
+                loops.push_back(loop);
+            }
+        }
+    }
+
+    /* `name+0x10`: where a rollup starts. */
+    std::string where(struct cycle_rollup &rollup)
+    {
+        struct cycle_entry &start = entries[rollup.first];
+        std::string name = start.label == no_symbol ? "(start)" : symtab.name_of(start.label);
+        ut_DWORD label_address = start.label == no_symbol ? ir.get_section(AsmSection::S_text).base : symtab.get(start.label).value;
+
+        if(start.address != label_address)
+        {
+            nt_BYTE offset[16];
+            snprintf(offset, sizeof(offset), "+0x%X", start.address - label_address);
+            name += offset;
+        }
+
+        return name;
+    }
+
+    /* The instruction a rollup spends the most cycles on. */
+    ut_DWORD heaviest(struct cycle_rollup &rollup)
+    {
+        ut_DWORD heaviest = rollup.first;
+        for(ut_DWORD i = rollup.first; i <= rollup.last; i++)
+            if(entries[i].cycles > entries[heaviest].cycles) heaviest = i;
+
+        return heaviest;
+    }
+
+    /* `mov reg,imm`; `(data)`/`(align)` for anything that is not an instruction. */
+    std::string describe(ut_DWORD i)
+    {
+        struct ir_instruction &instr = ir.get_instructions()[entries[i].record];
+
+        if(instr.opcode == (ut_BYTE) Instruction::SIalign) return "(align)";
+        if(!entries[i].is_instruction) return "(data)";
+        return entries[i].form == "-" ? instruction_names[instr.opcode] : std::string(instruction_names[instr.opcode]) + " " + entries[i].form;
+    }
+
+public:
+    MocaAsm_cycle_estimator(MocaAsm_ir &i, MocaAsm_symtab &s, MocaAsm_cycle_table &t)
+        : ir(i), symtab(s), table(t)
+    {
+        collect();
+        roll_up();
+    }
+
+    /* Every record with its address, size and cycles, under the label it belongs to. */
+    void write_listing(const nt_BYTE *output_filename, const nt_BYTE *source)
+    {
+        FILE *out = fopen(output_filename, "w");
+        MASM_assert(out,
+            "\n%s[FILE ERROR]%s\tThere was an error opening the output file `%s`.\n",
+            red, white,
+            output_filename)
+
+        fprintf(out, "; %s: estimated cycles of every instruction in %s.\n", table.get_model().c_str(), source);
+        fprintf(out, "; Backward conditional jumps are counted taken, forward ones not taken.\n;\n");
+        fprintf(out, "; %-8s %6s %8s %6s  %s\n", "address", "bytes", "cycles", "line", "instruction");
+
+        ut_DWORD label = no_symbol;
+        for(ut_DWORD i = 0; i < entries.size(); i++)
+        {
+            struct cycle_entry &entry = entries[i];
+
+            if(entry.label != label)
+            {
+                label = entry.label;
+                fprintf(out, "%s:\n", symtab.name_of(label));
+            }
+
+            std::string note = entry.note;
+            if(entry.copies != 1) note += (note.empty() ? "" : ", ") + std::string("x") + std::to_string(entry.copies);
+
+            fprintf(out, "  %08X %6u %8llu %6u  ", entry.address, entry.bytes, entry.cycles, source_line(ir.get_instructions()[entry.record].position));
+            if(note.empty()) fprintf(out, "%s\n", describe(i).c_str());
+            else fprintf(out, "%-24s %s\n", describe(i).c_str(), note.c_str());
+        }
+
+        fclose(out);
+    }
+
+    /* Totals, then the labels, basic blocks and loops that take the most cycles. */
+    void report()
+    {
+        constexpr ut_DWORD amnt_shown = 16;
+        ut_LLBYTE cycles = 0;
+        ut_LLBYTE bytes = 0;
+        ut_LLBYTE amnt_of_instructions = 0;
+
+        for(struct cycle_rollup &label : labels)
+        {
+            cycles += label.cycles;
+            bytes += label.bytes;
+            amnt_of_instructions += label.amnt_of_instructions;
+        }
+
+        auto by_cycles = [](const struct cycle_rollup &a, const struct cycle_rollup &b) { return a.cycles > b.cycles; };
+
+        MASM_report("\n%s[CYCLES]%s\t%s\n", yellow, white, table.get_model().c_str());
+        MASM_report("\t%-24s %12llu\n", "instructions", amnt_of_instructions);
+        MASM_report("\t%-24s %12llu\n", "bytes", bytes);
+        MASM_report("\t%-24s %12llu (every instruction once)\n", "cycles", cycles);
+
+        for(std::pair<std::string, ut_DWORD> &instruction : unavailable)
+            MASM_report("\t%snot on this CPU%s          %s`%s`%s (line %u)\n", red, white, yellow, instruction.first.c_str(), white, source_line(instruction.second));
+        for(std::pair<std::string, ut_DWORD> &instruction : unknown)
+            MASM_report("\t%-24s %s`%s`%s (line %u); counted as 0\n", "not in the table", yellow, instruction.first.c_str(), white, source_line(instruction.second));
+
+        std::vector<struct cycle_rollup> sorted = labels;
+        std::stable_sort(sorted.begin(), sorted.end(), by_cycles);
+
+        MASM_report("\n\t%-32s %8s %8s %10s\n", "label", "bytes", "instrs", "cycles");
+        for(ut_DWORD i = 0; i < sorted.size() && i < amnt_shown; i++)
+            MASM_report("\t%-32s %8u %8u %10llu\n", where(sorted[i]).c_str(), sorted[i].bytes, sorted[i].amnt_of_instructions, sorted[i].cycles);
+
+        sorted = blocks;
+        std::stable_sort(sorted.begin(), sorted.end(), by_cycles);
+
+        MASM_report("\n\t%-32s %8s %8s %10s\n", "basic block", "bytes", "instrs", "cycles");
+        for(ut_DWORD i = 0; i < sorted.size() && i < amnt_shown; i++)
+            MASM_report("\t%-32s %8u %8u %10llu\n", where(sorted[i]).c_str(), sorted[i].bytes, sorted[i].amnt_of_instructions, sorted[i].cycles);
+
+        if(loops.empty()) return;
+
+        sorted = loops;
+        std::stable_sort(sorted.begin(), sorted.end(), by_cycles);
+
+        /* The most expensive loops, and what each spends the most on. */
+        MASM_report("\n\t%-32s %8s %8s %10s  %s\n", "loop", "bytes", "instrs", "cycles/it", "heaviest instruction");
+        for(ut_DWORD i = 0; i < sorted.size() && i < amnt_shown; i++)
+        {
+            ut_DWORD heaviest_entry = heaviest(sorted[i]);
+
+            MASM_report("\t%s%-32s%s %8u %8u %10llu  %s (%llu, line %u)\n",
+                i < 3 ? red : white, where(sorted[i]).c_str(), white,
+                sorted[i].bytes, sorted[i].amnt_of_instructions, sorted[i].cycles,
+                describe(heaviest_entry).c_str(), entries[heaviest_entry].cycles, source_line(ir.get_instructions()[entries[heaviest_entry].record].position));
+        }
+    }
+
+    ~MocaAsm_cycle_estimator()
+    {}
+};
+
+}
+
+#endif
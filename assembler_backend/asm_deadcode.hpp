@@ -0,0 +1,249 @@
+#ifndef Moca_assembly_deadcode
+#define Moca_assembly_deadcode
+#include <algorithm>
+#include <vector>
+#include "asm_ir.hpp"
+
+namespace masm_deadcode
+{
+
+using namespace masm_ir;
+
+/* `-EFBP adasm`. A boot stage pulls in a whole add-on library but only calls a few of its routines; everything that can not be
+ * reached from the entry point or an exported symbol is dropped before layout, so it takes no space in the output.
+ *
+ * The program is cut into regions: a label/variable and every record up to the next label/variable of the same section.
+ * What comes before the first label of a section is a region of its own. The first region of every section is a root
+ * (`.text`/`.init` start with the entry point; data is kept alike, so the start of a section never moves).
+ * A region reaches every region whose label it uses, and code (`.text`/`.init`) falls through into the next region of
+ * its section, unless it ends in a `jmp` or in `db 0xC3`/`0xCB`/`0xCF` (`ret`, `retf`, `iret`).
+ * Addresses written as numbers (`call 0x7E00`) can not be followed; what is only reached that way has to be exported.
+ * */
+struct code_region
+{
+    ut_DWORD    symbol_id;      // `no_symbol` for what comes before the first label of a section
+    ut_DWORD    position;       // source position of its first record
+    ut_BYTE     section;
+    bool        falls_through;  // into `next`
+    ut_DWORD    next;           // the region following it in its section; `no_statement` if there is none (yet)
+    ut_LLBYTE   bytes;          // what removing it saves, as measured before branches get widened
+};
+
+template<AsmBitMode M>
+class MocaAsm_dead_code
+{
+private:
+    MocaAsm_ir          &ir;
+    MocaAsm_encoder<M>  &encoder;
+    MocaAsm_symtab      &symtab;
+
+    std::vector<struct code_region>                 regions;
+    std::vector<ut_DWORD>                           region_of_record;
+    std::vector<ut_DWORD>                           region_of_symbol;
+    std::vector<ut_DWORD>                           first_regions;
+
+    /* `{from, to}`, sorted by `from` once every reference has been found. */
+    std::vector<std::pair<ut_DWORD, ut_DWORD>>      edges;
+    std::vector<bool>                               reachable;
+
+    ut_DWORD                                        amnt_removed = 0;
+    ut_LLBYTE                                       bytes_removed = 0;
+
+    static bool is_code(ut_BYTE section)
+    { return section == (ut_BYTE) AsmSection::S_text || section == (ut_BYTE) AsmSection::S_init; }
+
+    /* Does execution stop at the end of `instr` (it never falls into whatever comes after it)? */
+    bool ends_flow(struct ir_instruction &instr)
+    {
+        if(instr.opcode == (ut_BYTE) Instruction::Ijmp) return true;
+        if(!(instr.flags & IRF_raw_data) || instr.values[0] == no_data || instr.length == 0) return false;
+
+        ut_BYTE last = ir.raw_data(instr)[instr.length - 1];
+        return last == 0xC3 || last == 0xCB || last == 0xCF;
+    }
+
+    /* Anything but labels, section switches, `times` itself (its body is) and `align`, which only pads whatever comes before it. */
+    static bool is_statement(struct ir_instruction &instr)
+    {
+        return !(instr.flags & IRF_removed) && instr.opcode != (ut_BYTE) Instruction::SIvar_or_label && instr.opcode != (ut_BYTE) Instruction::SIsection &&
+            instr.opcode != (ut_BYTE) Instruction::SIrepeat && instr.opcode != (ut_BYTE) Instruction::SIalign;
+    }
+
+    /* Bytes `instr` encodes to at its shortest; `align` is left out, its padding depends on where it ends up. */
+    ut_LLBYTE measure(struct ir_instruction &instr)
+    {
+        struct InstructionData idata;
+
+        if(!is_statement(instr)) return 0;
+        if(instr.flags & IRF_raw_data) return instr.length;
+        if(instr.opcode >= (ut_BYTE) Instruction::SIvar_or_label) return instr.operand_size;
+
+        ir.expand(instr, idata, false);
+        return encoder.measure(idata);
+    }
+
+    ut_DWORD open_region(ut_DWORD symbol_id, ut_DWORD position, ut_BYTE section, ut_DWORD previous)
+    {
+        regions.push_back({symbol_id, position, section, is_code(section), no_statement, 0});
+        if(previous != no_statement) regions[previous].next = (ut_DWORD) regions.size() - 1;
+        else first_regions.push_back((ut_DWORD) regions.size() - 1);
+
+        return (ut_DWORD) regions.size() - 1;
+    }
+
+    /* Cut the program into regions, and find every region each region uses. */
+    void find_regions()
+    {
+        std::vector<struct ir_instruction> &instructions = ir.get_instructions();
+        std::array<ut_DWORD, amnt_of_sections> open;
+        struct InstructionData idata;
+
+        open.fill(no_statement);
+        region_of_record.assign(instructions.size(), no_statement);
+        region_of_symbol.assign(symtab.amnt_of_symbols(), no_statement);
+
+        ut_BYTE section = (ut_BYTE) AsmSection::S_text;
+        ut_DWORD repeat_end = 0;
+        ut_LLBYTE copies = 1;
+
+        for(ut_DWORD i = 0; i < instructions.size(); i++)
+        {
+            struct ir_instruction &instr = instructions[i];
+
+            if(i == repeat_end) copies = 1;
+            if(instr.opcode == (ut_BYTE) Instruction::SIsection) { section = (ut_BYTE) instr.values[0]; continue; }
+
+            if(instr.opcode == (ut_BYTE) Instruction::SIvar_or_label)
+            {
+                open[section] = open_region(instr.values[0], instr.position, section, open[section]);
+                region_of_symbol[instr.values[0]] = open[section];
+            }
+            else if(open[section] == no_statement)
+                open[section] = open_region(no_symbol, instr.position, section, no_statement);
+
+            struct code_region &region = regions[open[section]];
+            region_of_record[i] = open[section];
+
+            if(instr.opcode == (ut_BYTE) Instruction::SIrepeat)
+            {
+                /* A count using `$` is only known after layout; the body is counted once. */
+                repeat_end = i + 1 + instr.values[1];
+                copies = (instr.flags & IRF_lval_expression) || (nt_DWORD) instr.values[0] < 0 ? 1 : (nt_DWORD) instr.values[0];
+            }
+
+            region.bytes += measure(instr) * copies;
+            if(is_statement(instr)) region.falls_through = is_code(section) && !ends_flow(instr);
+
+            if(!(instr.flags & (IRF_lval_expression | IRF_rval_expression))) continue;
+
+            ir.expand(instr, idata, false);
+            for(ut_BYTE op = 0; op < 2; op++)
+                if(idata.operands[op].kind != OperandKind::OK_none && idata.operands[op].symbol_id != no_symbol)
+                    edges.push_back({open[section], idata.operands[op].symbol_id});
+        }
+
+        /* Until now `to` is a symbol; symbols that are not defined here (relocatable output) lead nowhere. */
+        ut_LSIZE kept = 0;
+        for(std::pair<ut_DWORD, ut_DWORD> &edge : edges)
+            if(region_of_symbol[edge.second] != no_statement) edges[kept++] = {edge.first, region_of_symbol[edge.second]};
+
+        edges.resize(kept);
+        std::sort(edges.begin(), edges.end());
+    }
+
+    void reach(ut_DWORD region, std::vector<ut_DWORD> &pending)
+    {
+        if(region == no_statement || reachable[region]) return;
+
+        reachable[region] = true;
+        pending.push_back(region);
+    }
+
+public:
+    MocaAsm_dead_code(MocaAsm_ir &i, MocaAsm_encoder<M> &e, MocaAsm_symtab &s)
+        : ir(i), encoder(e), symtab(s)
+    {}
+
+    /* `exports` is `--export=`: names, separated by commas, that stay no matter if anything uses them. */
+    void eliminate(const nt_BYTE *exports)
+    {
+        std::vector<ut_DWORD> pending;
+
+        find_regions();
+        reachable.assign(regions.size(), false);
+
+        for(ut_DWORD region : first_regions) reach(region, pending);
+
+        for(const nt_BYTE *name = exports; name && *name;)
+        {
+            const nt_BYTE *end = strchr(name, ',');
+            ut_LSIZE length = end ? (ut_LSIZE) (end - name) : strlen(name);
+            ut_DWORD id = length ? symtab.find(name, length) : no_symbol;
+
+            MASM_assert(id != no_symbol && region_of_symbol[id] != no_statement,
+                "\n%s[EXPORT ERROR]%s\t%s`%.*s`%s is exported (%s`--export=`%s), but never defined.\n",
+                red, white,
+                yellow, (nt_DWORD) length, name, white,
+                green, white)
+
+            reach(region_of_symbol[id], pending);
+            name = end ? end + 1 : end;
+        }
+
+        while(!pending.empty())
+        {
+            ut_DWORD region = pending.back();
+            pending.pop_back();
+
+            if(regions[region].falls_through) reach(regions[region].next, pending);
+
+            std::vector<std::pair<ut_DWORD, ut_DWORD>>::iterator edge = std::lower_bound(edges.begin(), edges.end(), std::make_pair(region, (ut_DWORD) 0));
+            for(; edge != edges.end() && edge->first == region; edge++) reach(edge->second, pending);
+        }
+
+        /* A removed record takes no space; raw data keeps its length until now, so it is cleared as well. */
+        std::vector<struct ir_instruction> &instructions = ir.get_instructions();
+        for(ut_DWORD i = 0; i < instructions.size(); i++)
+        {
+            if(region_of_record[i] == no_statement || reachable[region_of_record[i]]) continue;
+
+            struct ir_instruction &instr = instructions[i];
+            if(instr.opcode == (ut_BYTE) Instruction::SIvar_or_label) symtab.get(instr.values[0]).kind = SymbolKind::SK_removed;
+
+            instr.flags |= IRF_removed;
+            if(instr.flags & IRF_raw_data) instr.length = 0;
+        }
+
+        for(ut_DWORD region = 0; region < regions.size(); region++)
+        {
+            if(reachable[region]) continue;
+
+            amnt_removed++;
+            bytes_removed += regions[region].bytes;
+        }
+    }
+
+    /* Every region that got dropped, in source order. */
+    void report()
+    {
+        MASM_report("\n%s[DEAD CODE]%s\n", yellow, white);
+        MASM_report("\t%-32s %-8s %6s %12s\n", "removed", "section", "line", "bytes");
+
+        for(ut_DWORD region = 0; region < regions.size(); region++)
+        {
+            if(reachable[region]) continue;
+
+            MASM_report("\t%-32s %-8s %6u %12llu\n", symtab.name_of(regions[region].symbol_id), section_names[regions[region].section],
+                source_line(regions[region].position), regions[region].bytes);
+        }
+
+        MASM_report("\t%-32s %-8s %6s %12llu (%u of %zu regions)\n", "total", "", "", bytes_removed, amnt_removed, regions.size());
+    }
+
+    ~MocaAsm_dead_code()
+    {}
+};
+
+}
+
+#endif
@@ -0,0 +1,594 @@
+#ifndef Moca_assembly_encoder
+#define Moca_assembly_encoder
+#include <vector>
+#include "asm_mode.hpp"
+
+namespace masm_encoder
+{
+
+using namespace masm_mode;
+
+/* A value that depends on a label/variable whose address may not be known yet.
+ * Patched by `resolve_fixups` once every label has been defined.
+ * */
+enum class FixupKind
+{
+    FK_absolute,    // the symbol's address (+ addend)
+    FK_relative     // the symbol's address (+ addend), relative to the end of the fixup (jumps/calls)
+};
+
+struct encoder_fixup
+{
+    ut_DWORD    offset;
+    ut_DWORD    symbol_id;
+    nt_LLBYTE   addend;
+    ut_BYTE     size;
+    FixupKind   kind;
+    ut_DWORD    position;
+};
+
+/* `nops16[n - 1]`/`nops32[n - 1]` is the NOP that takes `n` bytes, or the shortest pair of them; what `align` pads code with.
+ * 16-bit mode sticks to what an 8086 runs (`mov si, si`, `lea si, [si + 0]`, `lea di, [di + 0]`);
+ * the `0F 1F` NOP only exists from the Pentium Pro on.
+ * */
+constexpr ut_BYTE longest_nop16 = 8;
+constexpr ut_BYTE longest_nop32 = 9;
+
+/* Longest NOP that is one instruction; `nops16` past 4 bytes are pairs. */
+constexpr ut_BYTE single_nop16 = 4;
+constexpr ut_BYTE single_nop32 = longest_nop32;
+
+constexpr ut_BYTE nops16[longest_nop16][longest_nop16] = {
+    {0x90},
+    {0x89, 0xF6},
+    {0x8D, 0x74, 0x00},
+    {0x8D, 0xB4, 0x00, 0x00},
+    {0x90, 0x8D, 0xB4, 0x00, 0x00},
+    {0x89, 0xF6, 0x8D, 0xBD, 0x00, 0x00},
+    {0x8D, 0x74, 0x00, 0x8D, 0xBD, 0x00, 0x00},
+    {0x8D, 0xB4, 0x00, 0x00, 0x8D, 0xBD, 0x00, 0x00}
+};
+
+constexpr ut_BYTE nops32[longest_nop32][longest_nop32] = {
+    {0x90},
+    {0x66, 0x90},
+    {0x0F, 0x1F, 0x00},
+    {0x0F, 0x1F, 0x40, 0x00},
+    {0x0F, 0x1F, 0x44, 0x00, 0x00},
+    {0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00},
+    {0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00},
+    {0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+    {0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00}
+};
+
+/* Turns validated instructions (see `AssemblerAPI<M>::validate_operands`) into machine code.
+ * Every mode-dependent choice (operand-size prefix, displacement size/form, `inc`/`dec` form, branch size)
+ * is an `if constexpr` on `mode_traits<M>`, so each mode's encoder has no runtime branches on the mode.
+ * */
+template<AsmBitMode M>
+class MocaAsm_encoder
+{
+private:
+    using traits = mode_traits<M>;
+
+    std::vector<ut_BYTE>                code;
+    std::vector<struct encoder_fixup>   fixups;
+    ut_DWORD                            origin = 0;
+
+    void emit(ut_LLBYTE value, ut_BYTE size)
+    {
+        for(ut_BYTE i = 0; i < size; i++)
+            code.push_back((value >> (i * 8)) & 0xFF);
+    }
+
+    void operand_prefix(ut_BYTE size)
+    {
+        if(traits::needs_operand_prefix(size)) emit(0x66, 1);
+    }
+
+    /* Emit an immediate/address; if it refers to a label/variable, leave a fixup for it. */
+    void emit_value(struct instruction_operand &op, ut_BYTE size, FixupKind kind, ut_DWORD position)
+    {
+        if(op.symbol_id != no_symbol)
+        {
+            fixups.push_back({(ut_DWORD) code.size(), op.symbol_id, op.value, size, kind, position});
+            emit(0, size);
+            return;
+        }
+
+        if(kind == FixupKind::FK_relative)
+        {
+            emit(op.value - (nt_LLBYTE) (current_address() + size), size);
+            return;
+        }
+
+        emit(op.value, size);
+    }
+
+    void modrm_register(ut_BYTE reg, ut_BYTE rm)
+    { emit(0xC0 | (reg << 3) | rm, 1); }
+
+    /* `[address]`. */
+    void modrm_absolute(ut_BYTE reg, struct instruction_operand &mem, ut_DWORD position)
+    {
+        if constexpr(traits::absolute_needs_sib)
+        {
+            emit(0x04 | (reg << 3), 1);
+            emit(0x25, 1);
+        }
+        else if constexpr(M == AsmBitMode::bit16) emit(0x06 | (reg << 3), 1);
+        else emit(0x05 | (reg << 3), 1);
+
+        emit_value(mem, traits::displacement_size, FixupKind::FK_absolute, position);
+    }
+
+    static ut_BYTE reg_encoding(struct instruction_operand &op)
+    { return register_table[(ut_BYTE) op.reg].encoding; }
+
+    static bool is_segment(struct instruction_operand &op)
+    { return op.kind == OperandKind::OK_reg && register_table[(ut_BYTE) op.reg].rclass == RegisterClass::RC_segment; }
+
+    void encode_mov(struct InstructionData &idata)
+    {
+        struct instruction_operand &lval = idata.operands[0];
+        struct instruction_operand &rval = idata.operands[1];
+        ut_BYTE w = idata.operand_size != 1;
+
+        if(is_segment(lval) || is_segment(rval))
+        {
+            struct instruction_operand &sreg = is_segment(lval) ? lval : rval;
+            struct instruction_operand &other = is_segment(lval) ? rval : lval;
+
+            if(other.kind == OperandKind::OK_reg && !is_segment(lval)) operand_prefix(2);
+            emit(is_segment(lval) ? 0x8E : 0x8C, 1);
+
+            if(other.kind == OperandKind::OK_mem) modrm_absolute(reg_encoding(sreg), other, idata.position);
+            else modrm_register(reg_encoding(sreg), reg_encoding(other));
+            return;
+        }
+
+        operand_prefix(idata.operand_size);
+
+        if(lval.kind == OperandKind::OK_reg)
+        {
+            switch(rval.kind)
+            {
+                case OperandKind::OK_reg: {
+                    emit(0x88 | w, 1);
+                    modrm_register(reg_encoding(rval), reg_encoding(lval));
+                    return;
+                }
+                case OperandKind::OK_imm: {
+                    emit((w ? 0xB8 : 0xB0) + reg_encoding(lval), 1);
+                    emit_value(rval, idata.operand_size, FixupKind::FK_absolute, idata.position);
+                    return;
+                }
+                default: {
+                    if(idata.hints & EH_moffs)
+                    {
+                        emit(0xA0 | w, 1);
+                        emit_value(rval, traits::displacement_size, FixupKind::FK_absolute, idata.position);
+                        return;
+                    }
+
+                    emit(0x8A | w, 1);
+                    modrm_absolute(reg_encoding(lval), rval, idata.position);
+                    return;
+                }
+            }
+        }
+
+        /* `[address]` lval. */
+        if(rval.kind == OperandKind::OK_reg)
+        {
+            if(idata.hints & EH_moffs)
+            {
+                emit(0xA2 | w, 1);
+                emit_value(lval, traits::displacement_size, FixupKind::FK_absolute, idata.position);
+                return;
+            }
+
+            emit(0x88 | w, 1);
+            modrm_absolute(reg_encoding(rval), lval, idata.position);
+            return;
+        }
+
+        emit(0xC6 | w, 1);
+        modrm_absolute(0, lval, idata.position);
+        emit_value(rval, idata.operand_size, FixupKind::FK_absolute, idata.position);
+    }
+
+    /* add/or/adc/and/sub/xor/cmp; `ext` is the operation's number in the ModRM reg field/opcode row. */
+    void encode_alu(struct InstructionData &idata, ut_BYTE ext)
+    {
+        struct instruction_operand &lval = idata.operands[0];
+        struct instruction_operand &rval = idata.operands[1];
+        ut_BYTE w = idata.operand_size != 1;
+
+        operand_prefix(idata.operand_size);
+
+        if(lval.kind == OperandKind::OK_mem)
+        {
+            emit((ext << 3) | w, 1);
+            modrm_absolute(reg_encoding(rval), lval, idata.position);
+            return;
+        }
+
+        switch(rval.kind)
+        {
+            case OperandKind::OK_reg: {
+                emit((ext << 3) | w, 1);
+                modrm_register(reg_encoding(rval), reg_encoding(lval));
+                return;
+            }
+            case OperandKind::OK_mem: {
+                emit((ext << 3) | 2 | w, 1);
+                modrm_absolute(reg_encoding(lval), rval, idata.position);
+                return;
+            }
+            default: {
+                if(idata.hints & EH_imm8)
+                {
+                    emit(0x83, 1);
+                    modrm_register(ext, reg_encoding(lval));
+                    emit(rval.value, 1);
+                    return;
+                }
+
+                if(idata.hints & EH_accumulator)
+                {
+                    emit((ext << 3) | 4 | w, 1);
+                    emit_value(rval, idata.operand_size, FixupKind::FK_absolute, idata.position);
+                    return;
+                }
+
+                emit(0x80 | w, 1);
+                modrm_register(ext, reg_encoding(lval));
+                emit_value(rval, idata.operand_size, FixupKind::FK_absolute, idata.position);
+                return;
+            }
+        }
+    }
+
+    /* `nand`/`nor` are `and`/`or` followed by a `not` of the lval. */
+    void encode_not(struct InstructionData &idata)
+    {
+        struct instruction_operand &lval = idata.operands[0];
+
+        operand_prefix(idata.operand_size);
+        emit(0xF6 | (idata.operand_size != 1), 1);
+
+        if(lval.kind == OperandKind::OK_mem) modrm_absolute(2, lval, idata.position);
+        else modrm_register(2, reg_encoding(lval));
+    }
+
+    /* See `MASM KW_shl` in `NOTE`: shifting a byte-sized lval is ignored (`validate_shift` warns about it). */
+    void encode_shift(struct InstructionData &idata, ut_BYTE ext)
+    {
+        struct instruction_operand &lval = idata.operands[0];
+        struct instruction_operand &rval = idata.operands[1];
+        ut_BYTE w = 1;
+
+        if(idata.operand_size == 1) return;
+
+        operand_prefix(idata.operand_size);
+
+        if(rval.kind == OperandKind::OK_reg)
+        {
+            emit(0xD2 | w, 1);
+            modrm_register(ext, reg_encoding(lval));
+            return;
+        }
+
+        if(rval.value == 1)
+        {
+            emit(0xD0 | w, 1);
+            modrm_register(ext, reg_encoding(lval));
+            return;
+        }
+
+        emit(0xC0 | w, 1);
+        modrm_register(ext, reg_encoding(lval));
+        emit(rval.value, 1);
+    }
+
+    /* `ext` is 0 for `inc`, 1 for `dec`. */
+    void encode_inc_dec(struct InstructionData &idata, ut_BYTE ext)
+    {
+        struct instruction_operand &lval = idata.operands[0];
+
+        if(idata.operand_size == 1)
+        {
+            emit(0xFE, 1);
+            modrm_register(ext, reg_encoding(lval));
+            return;
+        }
+
+        operand_prefix(idata.operand_size);
+
+        if constexpr(traits::has_short_inc_dec)
+            emit(0x40 + (ext << 3) + reg_encoding(lval), 1);
+        else
+        {
+            emit(0xFF, 1);
+            modrm_register(ext, reg_encoding(lval));
+        }
+    }
+
+    static ut_BYTE condition_of(Instruction instr)
+    {
+        switch(instr)
+        {
+            case Instruction::Ijc: return 0x2;break;
+            case Instruction::Ijz: return 0x4;break;
+            case Instruction::Ijne: return 0x5;break;
+            case Instruction::Ijl: return 0xC;break;
+            case Instruction::Ijge: return 0xD;break;
+            case Instruction::Ijle: return 0xE;break;
+            default: break;
+        }
+
+        return 0xF;   // jg
+    }
+
+    void encode_branch(struct InstructionData &idata)
+    {
+        /* Relaxed by `MocaAsm_ir::layout`: EB/7x rel8. */
+        if(idata.hints & EH_short_branch)
+        {
+            emit(idata.instruction == Instruction::Ijmp ? 0xEB : 0x70 | condition_of(idata.instruction), 1);
+            emit_value(idata.operands[0], 1, FixupKind::FK_relative, idata.position);
+            return;
+        }
+
+        switch(idata.instruction)
+        {
+            case Instruction::Ijmp: emit(0xE9, 1);break;
+            case Instruction::Icall: emit(0xE8, 1);break;
+            default: {
+                /* Near `jcc`: 0F 8x. */
+                ut_BYTE condition = condition_of(idata.instruction);
+
+                emit(0x0F, 1);
+                emit(0x80 | condition, 1);
+                break;
+            }
+        }
+
+        emit_value(idata.operands[0], traits::near_branch_size, FixupKind::FK_relative, idata.position);
+    }
+
+public:
+    /* `start` is the address the first byte ends up at. */
+    MocaAsm_encoder(ut_DWORD start = 0)
+    {
+        origin = start;
+    }
+
+    /* Start over at `start`, keeping the buffers' memory; one encoder goes through many chunks. */
+    void restart(ut_DWORD start)
+    {
+        code.clear();
+        fixups.clear();
+        origin = start;
+    }
+
+    ut_DWORD start_address()
+    { return origin; }
+
+    ut_DWORD current_address()
+    { return origin + (ut_DWORD) code.size(); }
+
+    void encode(struct InstructionData &idata)
+    {
+        struct instruction_operand &lval = idata.operands[0];
+        struct instruction_operand &rval = idata.operands[1];
+
+        switch(idata.instruction)
+        {
+            case Instruction::Imov:
+            case Instruction::Imovb:
+            case Instruction::Imovw:
+            case Instruction::Imovd: encode_mov(idata);break;
+            case Instruction::Iadd: encode_alu(idata, 0);break;
+            case Instruction::Ior: encode_alu(idata, 1);break;
+            case Instruction::Iadc: encode_alu(idata, 2);break;
+            case Instruction::Iand: encode_alu(idata, 4);break;
+            case Instruction::Isub: encode_alu(idata, 5);break;
+            case Instruction::Ixor: encode_alu(idata, 6);break;
+            case Instruction::Icmp: encode_alu(idata, 7);break;
+            case Instruction::Inand: encode_alu(idata, 4); encode_not(idata);break;
+            case Instruction::Inor: encode_alu(idata, 1); encode_not(idata);break;
+            case Instruction::Ishl: encode_shift(idata, 4);break;
+            case Instruction::Ishr: encode_shift(idata, 5);break;
+            case Instruction::Iinc: encode_inc_dec(idata, 0);break;
+            case Instruction::Idec: encode_inc_dec(idata, 1);break;
+            case Instruction::Imul:
+            case Instruction::Idiv: {
+                operand_prefix(idata.operand_size);
+                emit(0xF6 | (idata.operand_size != 1), 1);
+                modrm_register(idata.instruction == Instruction::Imul ? 4 : 6, reg_encoding(lval));
+                break;
+            }
+            case Instruction::Iint: emit(0xCD, 1); emit(lval.value, 1);break;
+            case Instruction::Iin:
+            case Instruction::Iout: {
+                struct instruction_operand &port = idata.instruction == Instruction::Iin ? rval : lval;
+                ut_BYTE opcode = idata.instruction == Instruction::Iin ? 0xE4 : 0xE6;
+
+                operand_prefix(idata.operand_size);
+                if(port.kind == OperandKind::OK_reg) opcode |= 0x08;
+                emit(opcode | (idata.operand_size != 1), 1);
+
+                if(port.kind == OperandKind::OK_imm) emit(port.value, 1);
+                break;
+            }
+            case Instruction::Ilea: {
+                operand_prefix(2);
+                emit(0x8D, 1);
+                modrm_absolute(reg_encoding(lval), rval, idata.position);
+                break;
+            }
+            case Instruction::Ijmp:
+            case Instruction::Ijne:
+            case Instruction::Ijg:
+            case Instruction::Ijl:
+            case Instruction::Ijge:
+            case Instruction::Ijle:
+            case Instruction::Ijc:
+            case Instruction::Ijz:
+            case Instruction::Icall: encode_branch(idata);break;
+            case Instruction::Ihlt: emit(0xF4, 1);break;
+            case Instruction::Icli: emit(0xFA, 1);break;
+            case Instruction::Isti: emit(0xFB, 1);break;
+            case Instruction::Iclc: emit(0xF8, 1);break;
+            case Instruction::Icld: emit(0xFC, 1);break;
+            case Instruction::Icmc: emit(0xF5, 1);break;
+            case Instruction::Icmpsb: emit(0xA6, 1);break;
+            case Instruction::Ilock: emit(0xF0, 1);break;
+            case Instruction::Ilodsb: emit(0xAC, 1);break;
+            case Instruction::Icwd: operand_prefix(2); emit(0x99, 1);break;
+            case Instruction::Ilodsw: operand_prefix(2); emit(0xAD, 1);break;
+            default: break;
+        }
+    }
+
+    /* Size, in bytes, `idata` encodes to; nothing is left behind in the code buffer. */
+    ut_BYTE measure(struct InstructionData &idata)
+    {
+        ut_LSIZE code_size = code.size();
+        ut_LSIZE amnt_of_fixups = fixups.size();
+
+        encode(idata);
+        ut_BYTE length = (ut_BYTE) (code.size() - code_size);
+
+        code.resize(code_size);
+        fixups.resize(amnt_of_fixups);
+        return length;
+    }
+
+    void emit_raw(const ut_BYTE *bytes, ut_LSIZE length)
+    { code.insert(code.end(), bytes, bytes + length); }
+
+    /* Emit the last `length` bytes `times` more times (`times`/`pad`).
+     * A single byte is one `memset`; anything longer is copied from what has already been filled, doubling every copy.
+     * */
+    void repeat_last(ut_LSIZE length, ut_LLBYTE times)
+    {
+        if(length == 0 || times == 0) return;
+
+        ut_LSIZE start = code.size() - length;
+        ut_LSIZE end = code.size() + length * times;
+
+        if(length == 1)
+        {
+            code.resize(end, code[start]);
+            return;
+        }
+
+        code.resize(end);
+        for(ut_LSIZE filled = length; start + filled < end;)
+        {
+            ut_LSIZE amount = filled < end - (start + filled) ? filled : end - (start + filled);
+
+            memcpy(&code[start + filled], &code[start], amount);
+            filled += amount;
+        }
+    }
+
+    /* `length` bytes of padding that falls through to whatever follows it (`align`): as few NOPs as possible,
+     * and anything that takes more than two NOP instructions gets jumped over instead (`jmp short`, then `0x90` up to 127 bytes).
+     * */
+    void emit_nops(ut_LSIZE length)
+    {
+        constexpr ut_BYTE longest = M == AsmBitMode::bit16 ? longest_nop16 : longest_nop32;
+        constexpr ut_BYTE single = M == AsmBitMode::bit16 ? single_nop16 : single_nop32;
+
+        while(length > 0)
+        {
+            if(length > 2 * single)
+            {
+                ut_LSIZE skipped = length - 2 > 0x7F ? 0x7F : length - 2;
+
+                emit(0xEB, 1);
+                emit(skipped, 1);
+                code.resize(code.size() + skipped, 0x90);
+                length -= 2 + skipped;
+                continue;
+            }
+
+            ut_BYTE amount = length > longest ? longest : (ut_BYTE) length;
+            if constexpr(M == AsmBitMode::bit16) emit_raw(nops16[amount - 1], amount);
+            else emit_raw(nops32[amount - 1], amount);
+            length -= amount;
+        }
+    }
+
+    /* `align boundary, fill`. */
+    void emit_fill(ut_LSIZE length, ut_BYTE fill)
+    { code.resize(code.size() + length, fill); }
+
+    /* db/dw/dd (and the array versions). */
+    void emit_data(struct instruction_operand &value, ut_BYTE size, ut_DWORD position)
+    {
+        emit_value(value, size, FixupKind::FK_absolute, position);
+    }
+
+    /* Patch every fixup now that every label/variable has an address. */
+    void resolve_fixups(MocaAsm_symtab &symtab)
+    {
+        for(struct encoder_fixup &fixup : fixups)
+        {
+            struct symbol_entry &symbol = symtab.get(fixup.symbol_id);
+
+            MASM_assert(symbol.kind != SymbolKind::SK_undefined,
+                "\n%s[UNDEFINED SYMBOL, LINE %d]%s\t%s`%s`%s is used, but never defined.\n",
+                red, source_line(fixup.position), white,
+                yellow, symbol.name, white)
+
+            nt_LLBYTE value = (nt_LLBYTE) symbol.value + fixup.addend;
+            if(fixup.kind == FixupKind::FK_relative)
+            {
+                value -= (nt_LLBYTE) (origin + fixup.offset + fixup.size);
+
+                /* rel16/rel32 wrap around with IP/EIP; only a rel8 can miss. */
+                MASM_assert(fixup.size != 1 || (value >= -0x80 && value <= 0x7F),
+                    "\n%s[OUT OF RANGE, LINE %d]%s\t%s`%s`%s can not be reached with a %d-byte displacement.\n",
+                    red, source_line(fixup.position), white,
+                    yellow, symbol.name, white,
+                    fixup.size)
+            }
+            else
+                MASM_assert(fixup.size >= 4 || value <= (nt_LLBYTE) ((1ULL << (fixup.size * 8)) - 1),
+                    "\n%s[VALUE TOO LARGE, LINE %d]%s\tThe address of %s`%s`%s does not fit in %d byte(s).\n",
+                    red, source_line(fixup.position), white,
+                    yellow, symbol.name, white,
+                    fixup.size)
+
+            for(ut_BYTE i = 0; i < fixup.size; i++)
+                code[fixup.offset + i] = (value >> (i * 8)) & 0xFF;
+        }
+
+        fixups.clear();
+    }
+
+    /* Relocatable output turns the fixups into relocations instead of resolving them (see `MocaAsm_ir::relocate`). */
+    std::vector<struct encoder_fixup> &get_fixups()
+    { return fixups; }
+
+    void patch(ut_DWORD offset, nt_LLBYTE value, ut_BYTE size)
+    {
+        for(ut_BYTE i = 0; i < size; i++)
+            code[offset + i] = (value >> (i * 8)) & 0xFF;
+    }
+
+    std::vector<ut_BYTE> &get_code()
+    { return code; }
+
+    ~MocaAsm_encoder()
+    {}
+};
+
+}
+
+#endif
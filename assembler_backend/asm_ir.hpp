@@ -0,0 +1,1113 @@
+#ifndef Moca_assembly_ir
+#define Moca_assembly_ir
+#include <array>
+#include <chrono>
+#include <vector>
+#include "asm_encoder.hpp"
+#include "asm_pool.hpp"
+
+namespace masm_ir
+{
+
+using namespace masm_encoder;
+using namespace masm_pool;
+
+/* `ir_instruction::flags`. */
+constexpr ut_BYTE IRF_lval_expression   = 1 << 0;   // `values[0]` is an index into `expressions`
+constexpr ut_BYTE IRF_rval_expression   = 1 << 1;   // `values[1]` is an index into `expressions`
+constexpr ut_BYTE IRF_raw_data          = 1 << 2;   // `length` bytes of `data_pool`, starting at `values[0]`
+constexpr ut_BYTE IRF_removed           = 1 << 3;   // dropped by `-O`; takes no space
+
+/* The upper 4 bits are the record's `EH_*` encoding hints. */
+constexpr ut_BYTE IRF_hint_shift        = 4;
+constexpr ut_BYTE IRF_short_branch      = EH_short_branch << IRF_hint_shift;   // `jmp`/`jcc` that reaches its target with a rel8
+
+constexpr ut_DWORD no_statement = 0xFFFFFFFF;
+
+/* `values[0]` of a raw data record in `.bss`; only its size is kept. */
+constexpr ut_DWORD no_data = 0xFFFFFFFF;
+
+/* See "Assembly Consists Of The Following Sections" in `NOTE`.
+ * Sections are placed in the image in this order, each starting on a `section_alignment` boundary.
+ * `.bss` is always last, so it never takes space in the output.
+ * */
+enum class AsmSection
+{
+    S_text,     // `.text`/`.code`
+    S_init,     // `.init`
+    S_rodata,   // `.rodata`/`.rodata1`
+    S_data,     // `.data`/`.data1`
+    S_bss,      // `.bss`
+    S_NONE
+};
+
+const nt_BYTE *section_names[] = {".text", ".init", ".rodata", ".data", ".bss"};
+
+constexpr ut_BYTE amnt_of_sections = (ut_BYTE) AsmSection::S_NONE;
+constexpr ut_DWORD section_alignment = 4;
+
+/* `operand_size` of an `SIalign`: written in the source, or put in front of a loop head by `--align-loops`. */
+constexpr ut_BYTE align_directive = 0;
+constexpr ut_BYTE align_loop_head = 1;
+
+/* Largest `align` boundary; the padding has to fit in `ir_instruction::length`. */
+constexpr ut_DWORD max_alignment = 0x8000;
+
+/* Records per encoding chunk; a chunk is cut short at the end of a section range and never cuts a `SIrepeat` body in two. */
+constexpr ut_DWORD chunk_records = 4096;
+
+/* A value in a section that the linker has to patch (relocatable output). */
+struct ir_relocation
+{
+    ut_DWORD    offset;         // from the start of the section
+    ut_DWORD    symbol_id;      // `no_symbol` if the value is relative to the start of `section` instead
+    ut_BYTE     section;
+    ut_BYTE     size;
+    FixupKind   kind;
+};
+
+/* One section of relocatable output. */
+struct section_object
+{
+    std::vector<ut_BYTE>                code;
+    std::vector<struct ir_relocation>   relocations;
+};
+
+struct section_layout
+{
+    ut_DWORD    base;
+    ut_DWORD    size;
+
+    /* Largest `align` boundary in the section (at least `section_alignment`); where its base goes, and its `sh_addralign`. */
+    ut_DWORD    alignment = section_alignment;
+
+    /* `[first, last)` record indexes belonging to the section, in source order. */
+    std::vector<std::pair<ut_DWORD, ut_DWORD>>  ranges;
+};
+
+/* Bytes a label/variable (and everything up to the next one of its section) put into the image, counted as they get encoded.
+ * `times`/`pad` of data and `align` count as padding; `times` of instructions is code.
+ * */
+struct size_row
+{
+    ut_DWORD    symbol_id;      // `no_symbol` for what comes before the first label of the section
+    ut_BYTE     section;
+    bool        continued;      // the first row of a chunk: whatever label was in effect where the chunk starts
+    ut_DWORD    code;
+    ut_DWORD    data;
+    ut_DWORD    padding;
+};
+
+/* Records `[first, last)` of `section`, encoded on their own into `[address, address + size)`. */
+struct encode_chunk
+{
+    ut_BYTE                             section;
+    ut_DWORD                            first;
+    ut_DWORD                            last;
+    ut_DWORD                            address;
+    ut_DWORD                            size;
+    std::vector<struct ir_relocation>   relocations;
+    std::vector<struct size_row>        sizes;
+};
+
+/* One statement of the program: an instruction, a label/variable or a run of data.
+ * Everything after the parser (layout, relaxation, encoding) is a linear sweep over a vector of these.
+ *
+ *      opcode          `Instruction`; `SIvar_or_label` defines the symbol `values[0]` at `address`,
+ *                      `SIdb`/`SIdw`/`SIdd` is data (`operand_size` bytes of `values[0]`, or raw with `IRF_raw_data`),
+ *                      `SIrepeat` repeats the `values[1]` records following it `values[0]` times,
+ *                      `SIalign` pads up to a multiple of `values[0]` with NOPs (or with `values[1]` if there is an rval)
+ *      kinds           `OperandKind` of the lval (bits 0-1) and rval (bits 2-3)
+ *      regs            `AsmRegisterTokens` of register operands
+ *      values          immediate value/address of each operand, or an expression id (see `flags`)
+ *      length          encoded size in bytes; decided by `MocaAsm_ir::layout`
+ *      address         decided by `MocaAsm_ir::layout`
+ *      position        where the statement came from; a source position (see `MocaAsm_source_map`)
+ * */
+struct ir_instruction
+{
+    ut_BYTE         opcode;
+    ut_BYTE         operand_size;
+    ut_BYTE         kinds;
+    ut_BYTE         flags;
+    ut_BYTE         regs[2];
+    ut_WORD         length;
+    ut_DWORD        values[2];
+    ut_DWORD        address;
+    ut_DWORD        position;
+};
+
+static_assert(sizeof(struct ir_instruction) == 24, "`ir_instruction` is meant to stay 24 bytes.");
+
+/* A value that is not known until layout: `symbol + addend + here * address of statement`. */
+struct ir_expression
+{
+    ut_DWORD        symbol_id;
+    ut_DWORD        statement;
+    nt_LLBYTE       addend;
+    nt_BYTE         here;
+};
+
+class MocaAsm_ir
+{
+private:
+    std::vector<struct ir_instruction>  instructions;
+    std::vector<struct ir_expression>   expressions;
+
+    /* Bytes of constant data (`db 0x10, 0x20`), already little-endian. */
+    std::vector<ut_BYTE>                data_pool;
+
+    /* Raw data is only appended to a run started by the same statement, so `$` always names the statement's first record. */
+    bool                                data_run_open = false;
+
+    AsmSection                          current_section = AsmSection::S_text;
+    std::array<struct section_layout, amnt_of_sections>    sections;
+
+    /* `--align-loops=boundary[,budget]`; 0 leaves loop heads where they are. */
+    ut_DWORD                            loop_alignment = 0;
+    ut_DWORD                            loop_budget = 0;
+    ut_DWORD                            amnt_of_loop_heads = 0;
+
+    /* `-EFBP mbr`/`ssboot`; see `count_sizes`. */
+    bool                                counting_sizes = false;
+    std::vector<struct size_row>        sizes;
+
+    /* `--ir-stats`; how the last `encode` went. */
+    ut_DWORD                            amnt_of_chunks = 0;
+    ut_DWORD                            amnt_of_workers = 0;
+    ut_DWORD                            amnt_of_steals = 0;
+    double                              encode_seconds = 0.0;
+
+    static bool is_expression(struct instruction_operand &op)
+    { return op.symbol_id != no_symbol || op.here != 0; }
+
+    ut_DWORD pack_value(struct instruction_operand &op, ut_DWORD statement)
+    {
+        if(!is_expression(op)) return (ut_DWORD) op.value;
+
+        expressions.push_back({op.symbol_id, op.here != 0 ? statement : no_statement, op.value, op.here});
+        return (ut_DWORD) expressions.size() - 1;
+    }
+
+    void unpack_operand(struct ir_instruction &instr, ut_BYTE i, struct instruction_operand &op, bool resolve_here)
+    {
+        op.kind = (OperandKind) ((instr.kinds >> (i * 2)) & 3);
+        op.reg = (AsmRegisterTokens) instr.regs[i];
+        op.symbol_id = no_symbol;
+        op.here = 0;
+
+        if(!(instr.flags & (i == 0 ? IRF_lval_expression : IRF_rval_expression)))
+        {
+            op.value = (nt_LLBYTE) (nt_DWORD) instr.values[i];
+            return;
+        }
+
+        struct ir_expression &expr = expressions[instr.values[i]];
+        op.value = expr.addend;
+        op.symbol_id = expr.symbol_id;
+        op.here = expr.here;
+
+        if(resolve_here && expr.here != 0)
+        {
+            op.value += expr.here * (nt_LLBYTE) instructions[expr.statement].address;
+            op.here = 0;
+        }
+    }
+
+    /* Value of an operand once every label has an address; what a branch's target is during relaxation. */
+    nt_LLBYTE evaluate(struct instruction_operand &op, MocaAsm_symtab &symtab)
+    {
+        nt_LLBYTE value = op.value;
+        if(op.symbol_id != no_symbol) value += symtab.get(op.symbol_id).value;
+
+        return value;
+    }
+
+    static bool is_data(struct ir_instruction &instr)
+    {
+        return instr.opcode == (ut_BYTE) Instruction::SIdb || instr.opcode == (ut_BYTE) Instruction::SIdw ||
+            instr.opcode == (ut_BYTE) Instruction::SIdd;
+    }
+
+    /* Labels, section switches and records dropped by `-O`. */
+    static bool takes_no_space(struct ir_instruction &instr)
+    {
+        return instr.opcode == (ut_BYTE) Instruction::SIvar_or_label || instr.opcode == (ut_BYTE) Instruction::SIsection ||
+            instr.opcode == (ut_BYTE) Instruction::SIrepeat || (instr.flags & IRF_removed);
+    }
+
+    /* How many times the body of the `SIrepeat` record `repeat` is emitted; `$` is the address of `repeat`. */
+    nt_LLBYTE repeat_count(struct ir_instruction &repeat)
+    {
+        struct instruction_operand count;
+        unpack_operand(repeat, 0, count, true);
+
+        return count.value;
+    }
+
+    ut_DWORD body_length(ut_DWORD repeat)
+    {
+        ut_DWORD length = 0;
+
+        for(ut_DWORD i = repeat + 1; i <= repeat + instructions[repeat].values[1]; i++)
+            if(!takes_no_space(instructions[i])) length += instructions[i].length;
+
+        return length;
+    }
+
+    /* Bytes the `SIalign` record `align` pads with at `address`. A loop head only gets them while `budget_left`
+     * (what is left of its section's `--align-loops` budget) can pay for them.
+     * */
+    static ut_DWORD padding(struct ir_instruction &align, ut_DWORD address, ut_DWORD &budget_left)
+    {
+        ut_DWORD padding = (align.values[0] - address % align.values[0]) % align.values[0];
+
+        if(align.operand_size != align_loop_head) return padding;
+        if(padding > budget_left) return 0;
+
+        budget_left -= padding;
+        return padding;
+    }
+
+    /* `--align-loops`: an `SIalign` in front of every label in `.text`/`.init` that a later `jmp`/`jcc` of the same section
+     * branches back to. Bodies of `times` are left alone, since every copy of them would need its own padding.
+     * Runs once, right before layout; every statement index (`$`) moves along with the records.
+     * */
+    void align_loop_heads(MocaAsm_symtab &symtab)
+    {
+        std::vector<ut_DWORD> label_record(symtab.amnt_of_symbols(), no_statement);
+        std::vector<bool> is_head(instructions.size(), false);
+        ut_BYTE section = (ut_BYTE) AsmSection::S_text;
+        ut_DWORD repeat_end = 0;
+
+        for(ut_DWORD i = 0; i < instructions.size(); i++)
+        {
+            struct ir_instruction &instr = instructions[i];
+
+            if(instr.opcode == (ut_BYTE) Instruction::SIsection) { section = (ut_BYTE) instr.values[0]; continue; }
+            if(instr.opcode == (ut_BYTE) Instruction::SIrepeat) { repeat_end = i + 1 + instr.values[1]; continue; }
+            if(i < repeat_end || (section != (ut_BYTE) AsmSection::S_text && section != (ut_BYTE) AsmSection::S_init)) continue;
+
+            if(instr.opcode == (ut_BYTE) Instruction::SIvar_or_label)
+            {
+                if(!(instr.flags & IRF_removed)) label_record[instr.values[0]] = i;
+                continue;
+            }
+
+            if(!can_be_short((Instruction) instr.opcode) || (instr.flags & IRF_removed) || !(instr.flags & IRF_lval_expression)) continue;
+
+            struct ir_expression &target = expressions[instr.values[0]];
+            if(target.symbol_id == no_symbol || target.here != 0 || label_record[target.symbol_id] == no_statement) continue;
+
+            if(symtab.get(target.symbol_id).section == section) is_head[label_record[target.symbol_id]] = true;
+        }
+
+        std::vector<struct ir_instruction> aligned;
+        std::vector<ut_DWORD> moved_to(instructions.size());
+        aligned.reserve(instructions.size());
+
+        for(ut_DWORD i = 0; i < instructions.size(); i++)
+        {
+            if(is_head[i] && !(i > 0 && instructions[i - 1].opcode == (ut_BYTE) Instruction::SIalign))
+            {
+                struct ir_instruction align = {};
+                struct section_layout &layout = sections[symtab.get(instructions[i].values[0]).section];
+
+                align.opcode = (ut_BYTE) Instruction::SIalign;
+                align.operand_size = align_loop_head;
+                align.kinds = (ut_BYTE) OperandKind::OK_imm;
+                align.values[0] = loop_alignment;
+                align.position = instructions[i].position;
+
+                aligned.push_back(align);
+                if(loop_alignment > layout.alignment) layout.alignment = loop_alignment;
+                amnt_of_loop_heads++;
+            }
+
+            moved_to[i] = (ut_DWORD) aligned.size();
+            aligned.push_back(instructions[i]);
+        }
+
+        for(struct ir_expression &expr : expressions)
+            if(expr.statement != no_statement) expr.statement = moved_to[expr.statement];
+
+        instructions.swap(aligned);
+    }
+
+    /* Can the body of `repeat` be copied byte for byte? Not if a copy's bytes depend on where it is (`$`, labels, relative branches). */
+    bool is_position_independent(ut_DWORD repeat)
+    {
+        for(ut_DWORD i = repeat + 1; i <= repeat + instructions[repeat].values[1]; i++)
+        {
+            struct ir_instruction &instr = instructions[i];
+
+            if(instr.flags & (IRF_lval_expression | IRF_rval_expression)) return false;
+            if(can_be_short((Instruction) instr.opcode) || instr.opcode == (ut_BYTE) Instruction::Icall) return false;
+        }
+
+        return true;
+    }
+
+    void find_section_ranges()
+    {
+        ut_BYTE section = (ut_BYTE) AsmSection::S_text;
+        ut_DWORD first = 0;
+
+        for(struct section_layout &layout : sections) layout.ranges.clear();
+
+        for(ut_DWORD i = 0; i <= instructions.size(); i++)
+        {
+            if(i < instructions.size() && instructions[i].opcode != (ut_BYTE) Instruction::SIsection) continue;
+
+            if(i > first) sections[section].ranges.push_back({first, i});
+            if(i == instructions.size()) break;
+
+            section = (ut_BYTE) instructions[i].values[0];
+            first = i + 1;
+        }
+    }
+
+    template<AsmBitMode M>
+    void encode_record(MocaAsm_encoder<M> &encoder, struct ir_instruction &instr)
+    {
+        struct InstructionData idata;
+
+        if(takes_no_space(instr)) return;
+
+        if(instr.flags & IRF_raw_data)
+        {
+            encoder.emit_raw(&data_pool[instr.values[0]], instr.length);
+            return;
+        }
+
+        if(instr.opcode == (ut_BYTE) Instruction::SIalign)
+        {
+            if((instr.kinds >> 2) & 3) encoder.emit_fill(instr.length, (ut_BYTE) instr.values[1]);
+            else encoder.emit_nops(instr.length);
+            return;
+        }
+
+        expand(instr, idata, true);
+
+        if(is_data(instr))
+            encoder.emit_data(idata.operands[0], idata.operand_size, idata.position);
+        else
+            encoder.encode(idata);
+    }
+
+    /* The body gets encoded once; if its bytes do not depend on where it is, the rest of the copies are a bulk fill,
+     * otherwise every copy is encoded at its own address.
+     * Returns the index of the last record of the body.
+     * */
+    template<AsmBitMode M>
+    ut_DWORD encode_repeat(MocaAsm_encoder<M> &encoder, ut_DWORD repeat)
+    {
+        ut_DWORD first = repeat + 1;
+        ut_DWORD last = repeat + instructions[repeat].values[1];
+        nt_LLBYTE count = repeat_count(instructions[repeat]);
+
+        if(count <= 0) return last;
+
+        for(ut_DWORD i = first; i <= last; i++) encode_record(encoder, instructions[i]);
+
+        ut_DWORD length = body_length(repeat);
+        if(is_position_independent(repeat))
+        {
+            encoder.repeat_last(length, count - 1);
+            return last;
+        }
+
+        /* `$` in the body refers to `repeat`, so it moves along with the copy. */
+        for(nt_LLBYTE copy = 1; copy < count; copy++)
+        {
+            for(ut_DWORD i = repeat; i <= last; i++) instructions[i].address += length;
+            for(ut_DWORD i = first; i <= last; i++) encode_record(encoder, instructions[i]);
+        }
+        for(ut_DWORD i = repeat; i <= last; i++) instructions[i].address -= length * (count - 1);
+
+        return last;
+    }
+
+    /* Add the `bytes` record `instr` encoded to (all copies, for an `SIrepeat`) to `row`. */
+    void account(struct size_row &row, ut_DWORD record, ut_DWORD bytes)
+    {
+        struct ir_instruction &instr = instructions[record];
+
+        if(instr.opcode == (ut_BYTE) Instruction::SIalign) row.padding += bytes;
+        else if(instr.opcode == (ut_BYTE) Instruction::SIrepeat)
+        {
+            bool of_data = instr.values[1] != 0 && (is_data(instructions[record + 1]) || (instructions[record + 1].flags & IRF_raw_data));
+            if(of_data) row.padding += bytes;
+            else row.code += bytes;
+        }
+        else if(is_data(instr)) row.data += bytes;
+        else row.code += bytes;
+    }
+
+    /* With `sizes`, every record's bytes are added to the row of the label they come under as they get encoded. */
+    template<AsmBitMode M>
+    void encode_range(MocaAsm_encoder<M> &encoder, ut_DWORD first, ut_DWORD last, std::vector<struct size_row> *sizes = nullptr)
+    {
+        if(sizes) sizes->push_back({no_symbol, 0, true, 0, 0, 0});
+
+        for(ut_DWORD i = first; i < last; i++)
+        {
+            ut_DWORD record = i;
+            ut_DWORD before = encoder.current_address();
+
+            if(instructions[i].opcode == (ut_BYTE) Instruction::SIrepeat)
+                i = encode_repeat(encoder, i);
+            else
+                encode_record(encoder, instructions[i]);
+
+            if(!sizes) continue;
+
+            if(instructions[record].opcode == (ut_BYTE) Instruction::SIvar_or_label && !(instructions[record].flags & IRF_removed))
+                sizes->push_back({instructions[record].values[0], 0, false, 0, 0, 0});
+            else account(sizes->back(), record, encoder.current_address() - before);
+        }
+    }
+
+    /* Put the rows of every chunk together: a chunk's `continued` row goes to the last label of its section before it. */
+    void merge_sizes(std::vector<struct encode_chunk> &chunks)
+    {
+        std::array<ut_DWORD, amnt_of_sections> current;
+        current.fill(no_statement);
+        sizes.clear();
+
+        for(struct encode_chunk &chunk : chunks)
+            for(struct size_row &row : chunk.sizes)
+            {
+                if(row.continued && current[chunk.section] != no_statement)
+                {
+                    struct size_row &into = sizes[current[chunk.section]];
+
+                    into.code += row.code;
+                    into.data += row.data;
+                    into.padding += row.padding;
+                    continue;
+                }
+
+                current[chunk.section] = (ut_DWORD) sizes.size();
+                sizes.push_back({row.symbol_id, chunk.section, false, row.code, row.data, row.padding});
+            }
+    }
+
+    template<AsmBitMode M>
+    void encode_section(MocaAsm_encoder<M> &encoder, ut_BYTE section)
+    {
+        for(std::pair<ut_DWORD, ut_DWORD> &range : sections[section].ranges)
+            encode_range(encoder, range.first, range.second);
+    }
+
+    /* Cut every initialized section into chunks of about `chunk_records` records, in address order. */
+    std::vector<struct encode_chunk> split_into_chunks()
+    {
+        std::vector<struct encode_chunk> chunks;
+
+        for(ut_BYTE section = 0; section < (ut_BYTE) AsmSection::S_bss; section++)
+        {
+            ut_LSIZE section_first = chunks.size();
+
+            for(std::pair<ut_DWORD, ut_DWORD> &range : sections[section].ranges)
+            {
+                ut_DWORD repeat_last = no_statement;
+                ut_DWORD first = range.first;
+
+                for(ut_DWORD i = range.first; i < range.second; i++)
+                {
+                    if(i - first >= chunk_records && (repeat_last == no_statement || i > repeat_last))
+                    {
+                        chunks.push_back({section, first, i, instructions[first].address, 0, {}, {}});
+                        first = i;
+                    }
+
+                    if(instructions[i].opcode == (ut_BYTE) Instruction::SIrepeat) repeat_last = i + instructions[i].values[1];
+                }
+
+                if(first < range.second) chunks.push_back({section, first, range.second, instructions[first].address, 0, {}, {}});
+            }
+
+            /* A chunk ends where the next one starts; the last one where its section does. */
+            for(ut_LSIZE i = section_first; i < chunks.size(); i++)
+                chunks[i].size = (i + 1 < chunks.size() ? chunks[i + 1].address : sections[section].base + sections[section].size) - chunks[i].address;
+        }
+
+        return chunks;
+    }
+
+    /* Relocatable output: every value depending on a label becomes relative to the start of the label's section
+     * (or to an undefined symbol), and gets a relocation. The addend stays in place (REL).
+     * A relative reference within its own section does not move with the section, so it is resolved right away.
+     * */
+    template<AsmBitMode M>
+    void relocate(MocaAsm_encoder<M> &encoder, ut_BYTE section, MocaAsm_symtab &symtab, std::vector<struct ir_relocation> &relocations)
+    {
+        /* The encoder may only hold a chunk of the section. */
+        ut_DWORD chunk_offset = encoder.start_address() - sections[section].base;
+
+        for(struct encoder_fixup &fixup : encoder.get_fixups())
+        {
+            struct symbol_entry &symbol = symtab.get(fixup.symbol_id);
+            struct ir_relocation relocation = {chunk_offset + fixup.offset, fixup.symbol_id, section, fixup.size, fixup.kind};
+            nt_LLBYTE value = fixup.addend;
+
+            if(symbol.kind != SymbolKind::SK_undefined)
+            {
+                value += (nt_LLBYTE) symbol.value - sections[symbol.section].base;
+
+                if(fixup.kind == FixupKind::FK_relative && symbol.section == section)
+                {
+                    value -= (nt_LLBYTE) (chunk_offset + fixup.offset + fixup.size);
+
+                    MASM_assert(fixup.size != 1 || (value >= -0x80 && value <= 0x7F),
+                        "\n%s[OUT OF RANGE, LINE %d]%s\t%s`%s`%s can not be reached with a %d-byte displacement.\n",
+                        red, source_line(fixup.position), white,
+                        yellow, symbol.name, white,
+                        fixup.size)
+
+                    encoder.patch(fixup.offset, value, fixup.size);
+                    continue;
+                }
+
+                relocation.symbol_id = no_symbol;
+                relocation.section = (ut_BYTE) symbol.section;
+            }
+
+            /* The CPU adds a displacement to the end of the field, the linker computes it from the start. */
+            if(fixup.kind == FixupKind::FK_relative) value -= fixup.size;
+
+            encoder.patch(fixup.offset, value, fixup.size);
+            relocations.push_back(relocation);
+        }
+
+        encoder.get_fixups().clear();
+    }
+
+    static bool can_be_short(Instruction instr)
+    {
+        switch(instr)
+        {
+            case Instruction::Ijmp:
+            case Instruction::Ijne:
+            case Instruction::Ijg:
+            case Instruction::Ijl:
+            case Instruction::Ijge:
+            case Instruction::Ijle:
+            case Instruction::Ijc:
+            case Instruction::Ijz: return true;break;
+            default: break;
+        }
+
+        return false;
+    }
+
+public:
+    MocaAsm_ir()
+    {}
+
+    /* Index the next record will get; what `$` refers to for the statement being parsed. */
+    ut_DWORD next_statement()
+    {
+        data_run_open = false;
+        return (ut_DWORD) instructions.size();
+    }
+
+    /* A validated instruction (`AssemblerAPI<M>::validate_operands`). */
+    void add_instruction(struct InstructionData &idata, ut_DWORD statement)
+    {
+        struct ir_instruction instr = {};
+
+        instr.opcode = (ut_BYTE) idata.instruction;
+        instr.operand_size = idata.operand_size;
+        instr.position = idata.position;
+
+        for(ut_BYTE i = 0; i < idata.amnt_of_operands; i++)
+        {
+            struct instruction_operand &op = idata.operands[i];
+
+            instr.kinds |= (ut_BYTE) op.kind << (i * 2);
+            instr.regs[i] = (ut_BYTE) op.reg;
+            if(is_expression(op)) instr.flags |= i == 0 ? IRF_lval_expression : IRF_rval_expression;
+            instr.values[i] = pack_value(op, statement);
+        }
+
+        if(can_be_short(idata.instruction)) instr.flags |= IRF_short_branch;
+
+        instructions.push_back(instr);
+    }
+
+    /* `name:`/`name db ...`; the symbol gets the address the record ends up at. */
+    void add_label(ut_DWORD symbol_id, ut_DWORD position)
+    {
+        struct ir_instruction instr = {};
+
+        instr.opcode = (ut_BYTE) Instruction::SIvar_or_label;
+        instr.values[0] = symbol_id;
+        instr.position = position;
+
+        instructions.push_back(instr);
+        data_run_open = false;
+    }
+
+    /* `times count ...`; every record added until `end_repeat` is the body. `$` in `count` is the start of the statement. */
+    ut_DWORD begin_repeat(struct instruction_operand &count, ut_DWORD position, ut_DWORD statement)
+    {
+        struct ir_instruction instr = {};
+
+        instr.opcode = (ut_BYTE) Instruction::SIrepeat;
+        instr.kinds = (ut_BYTE) OperandKind::OK_imm;
+        if(is_expression(count)) instr.flags = IRF_lval_expression;
+        instr.values[0] = pack_value(count, statement);
+        instr.position = position;
+
+        instructions.push_back(instr);
+        data_run_open = false;
+        return (ut_DWORD) instructions.size() - 1;
+    }
+
+    void end_repeat(ut_DWORD repeat)
+    {
+        instructions[repeat].values[1] = (ut_DWORD) instructions.size() - repeat - 1;
+        data_run_open = false;
+
+        /* Relaxation only looks at the first copy; the others could be out of rel8 range. */
+        for(ut_DWORD i = repeat + 1; i < instructions.size(); i++) instructions[i].flags &= ~IRF_short_branch;
+    }
+
+    /* `.text`, `.data`, ...; everything until the next switch goes into `section`. */
+    void switch_section(AsmSection section, ut_DWORD position)
+    {
+        struct ir_instruction instr = {};
+
+        instr.opcode = (ut_BYTE) Instruction::SIsection;
+        instr.values[0] = (ut_DWORD) section;
+        instr.position = position;
+
+        instructions.push_back(instr);
+        current_section = section;
+        data_run_open = false;
+    }
+
+    AsmSection get_current_section()
+    { return current_section; }
+
+    /* `align boundary [, fill]`; `boundary` is a power of two, the padding is decided by `layout`. */
+    void add_align(ut_DWORD boundary, struct instruction_operand *fill, ut_DWORD position)
+    {
+        struct ir_instruction instr = {};
+
+        instr.opcode = (ut_BYTE) Instruction::SIalign;
+        instr.operand_size = align_directive;
+        instr.kinds = (ut_BYTE) OperandKind::OK_imm | (fill ? (ut_BYTE) OperandKind::OK_imm << 2 : 0);
+        instr.values[0] = boundary;
+        instr.values[1] = fill ? (ut_DWORD) fill->value : 0;
+        instr.position = position;
+
+        instructions.push_back(instr);
+        data_run_open = false;
+
+        if(boundary > sections[(ut_BYTE) current_section].alignment) sections[(ut_BYTE) current_section].alignment = boundary;
+    }
+
+    /* Have `encode` count the bytes every label/variable contributes (`get_sizes`). */
+    void count_sizes()
+    { counting_sizes = true; }
+
+    /* Rows in section order, then address order. */
+    std::vector<struct size_row> &get_sizes()
+    { return sizes; }
+
+    /* `--align-loops=boundary[,budget]`: align every loop head to `boundary`, spending at most `budget` bytes of padding
+     * on them per section (`pad 510 - $` in a boot sector still has to come out positive).
+     * */
+    void align_loops(ut_DWORD boundary, ut_DWORD budget)
+    {
+        loop_alignment = boundary;
+        loop_budget = budget;
+    }
+
+    /* `bytes` of `.bss`; nothing but the size is stored. */
+    void reserve(ut_LLBYTE bytes, ut_DWORD position)
+    {
+        while(bytes > 0)
+        {
+            if(!data_run_open || instructions.back().length == 0xFFFF)
+            {
+                struct ir_instruction instr = {};
+
+                instr.opcode = (ut_BYTE) Instruction::SIdb;
+                instr.flags = IRF_raw_data;
+                instr.values[0] = no_data;
+                instr.position = position;
+
+                instructions.push_back(instr);
+                data_run_open = true;
+            }
+
+            ut_WORD amount = bytes > (ut_LLBYTE) (0xFFFF - instructions.back().length) ? 0xFFFF - instructions.back().length : (ut_WORD) bytes;
+            instructions.back().length += amount;
+            bytes -= amount;
+        }
+    }
+
+    /* One value of a db/dw/dd; constants are packed into runs of raw bytes. */
+    void add_data(struct instruction_operand &value, ut_BYTE size, ut_DWORD position, ut_DWORD statement)
+    {
+        if(current_section == AsmSection::S_bss)
+        {
+            if(is_expression(value) || value.value != 0)
+                MASM_warning("\n%s[SECTION WARNING, LINE %d]%s\t%s`.bss`%s can not hold initialized data; the value is ignored and only its size is reserved.\n",
+                    yellow, source_line(position), white,
+                    yellow, white)
+
+            reserve(size, position);
+            return;
+        }
+
+        if(is_expression(value))
+        {
+            struct ir_instruction instr = {};
+
+            instr.opcode = (ut_BYTE) (size == 1 ? Instruction::SIdb : size == 2 ? Instruction::SIdw : Instruction::SIdd);
+            instr.operand_size = size;
+            instr.kinds = (ut_BYTE) OperandKind::OK_imm;
+            instr.flags = IRF_lval_expression;
+            instr.values[0] = pack_value(value, statement);
+            instr.position = position;
+
+            instructions.push_back(instr);
+            data_run_open = false;
+            return;
+        }
+
+        if(!data_run_open || instructions.back().length + size > 0xFFFF)
+        {
+            struct ir_instruction instr = {};
+
+            instr.opcode = (ut_BYTE) Instruction::SIdb;
+            instr.flags = IRF_raw_data;
+            instr.values[0] = (ut_DWORD) data_pool.size();
+            instr.position = position;
+
+            instructions.push_back(instr);
+            data_run_open = true;
+        }
+
+        for(ut_BYTE i = 0; i < size; i++)
+            data_pool.push_back((value.value >> (i * 8)) & 0xFF);
+        instructions.back().length += size;
+    }
+
+    /* Everything the encoder needs to know about a record. `$` is resolved if the record has an address. */
+    void expand(struct ir_instruction &instr, struct InstructionData &idata, bool resolve_here)
+    {
+        idata.instruction = (Instruction) instr.opcode;
+        idata.position = instr.position;
+        idata.operand_size = instr.operand_size;
+        idata.hints = instr.flags >> IRF_hint_shift;
+        idata.amnt_of_operands = 0;
+
+        for(ut_BYTE i = 0; i < 2; i++)
+        {
+            unpack_operand(instr, i, idata.operands[i], resolve_here);
+            if(idata.operands[i].kind != OperandKind::OK_none) idata.amnt_of_operands++;
+        }
+    }
+
+    /* Give every record its length and address, every section its base and size and every label/variable its value.
+     * `jmp`/`jcc` start out as rel8 and are widened (never shrunk back) until every branch reaches its target,
+     * so the loop always ends; each round is one sweep over the records, and works out the padding of every `align` again.
+     * */
+    template<AsmBitMode M>
+    void layout(MocaAsm_encoder<M> &encoder, MocaAsm_symtab &symtab, bool relocatable = false)
+    {
+        struct InstructionData idata;
+
+        if(loop_alignment) align_loop_heads(symtab);
+        find_section_ranges();
+
+        for(struct ir_instruction &instr : instructions)
+        {
+            if(takes_no_space(instr) || (instr.flags & IRF_raw_data) || instr.opcode == (ut_BYTE) Instruction::SIalign) continue;
+            if(is_data(instr)) { instr.length = instr.operand_size; continue; }
+
+            expand(instr, idata, false);
+            instr.length = encoder.measure(idata);
+        }
+
+        bool changed = true;
+        while(changed)
+        {
+            changed = false;
+
+            ut_DWORD address = encoder.current_address();
+            for(ut_BYTE section = 0; section < amnt_of_sections; section++)
+            {
+                if(section != (ut_BYTE) AsmSection::S_text)
+                    address = (address + sections[section].alignment - 1) & ~(sections[section].alignment - 1);
+                sections[section].base = address;
+
+                /* Relocatable output only knows where a section is going to start down to its alignment. */
+                ut_DWORD origin = relocatable ? address : 0;
+                ut_DWORD budget_left = loop_budget;
+
+                /* Address following the body of the last `SIrepeat`, and the index of the body's last record. */
+                ut_DWORD repeat_address = 0;
+                ut_DWORD repeat_last = no_statement;
+
+                for(std::pair<ut_DWORD, ut_DWORD> &range : sections[section].ranges)
+                    for(ut_DWORD i = range.first; i < range.second; i++)
+                    {
+                        struct ir_instruction &instr = instructions[i];
+
+                        instr.address = address;
+                        if(instr.opcode == (ut_BYTE) Instruction::SIvar_or_label) symtab.get(instr.values[0]).value = address;
+                        if(instr.opcode == (ut_BYTE) Instruction::SIalign && !(instr.flags & IRF_removed)) instr.length = (ut_WORD) padding(instr, address - origin, budget_left);
+                        if(instr.opcode == (ut_BYTE) Instruction::SIrepeat)
+                        {
+                            nt_LLBYTE count = repeat_count(instr);
+
+                            repeat_last = i + instr.values[1];
+                            repeat_address = address + (ut_DWORD) (count > 0 ? count : 0) * body_length(i);
+                        }
+
+                        address += instr.length;
+                        if(i == repeat_last) address = repeat_address;
+                    }
+
+                sections[section].size = address - sections[section].base;
+            }
+
+            for(ut_BYTE section = 0; section < amnt_of_sections; section++)
+                for(std::pair<ut_DWORD, ut_DWORD> &range : sections[section].ranges)
+                    for(ut_DWORD i = range.first; i < range.second; i++)
+                    {
+                        struct ir_instruction &instr = instructions[i];
+                        if(!(instr.flags & IRF_short_branch)) continue;
+
+                        expand(instr, idata, true);
+                        nt_LLBYTE displacement = evaluate(idata.operands[0], symtab) - (nt_LLBYTE) (instr.address + instr.length);
+                        ut_DWORD target = idata.operands[0].symbol_id;
+
+                        /* In relocatable output the linker decides where every section goes, so only a branch within its own section can stay short. */
+                        if(displacement >= -0x80 && displacement <= 0x7F &&
+                            (target == no_symbol || (symtab.get(target).kind != SymbolKind::SK_undefined &&
+                                (!relocatable || symtab.get(target).section == section))))
+                            continue;
+
+                        instr.flags &= ~IRF_short_branch;
+                        idata.hints &= ~EH_short_branch;
+                        instr.length = encoder.measure(idata);
+                        changed = true;
+                    }
+        }
+
+        for(struct ir_instruction &instr : instructions)
+            MASM_assert(instr.opcode != (ut_BYTE) Instruction::SIrepeat || (instr.flags & IRF_removed) || repeat_count(instr) >= 0,
+                "\n%s[INVALID REPEAT, LINE %d]%s\tThe repeat count is %lld; it can not be negative.\n",
+                red, source_line(instr.position), white,
+                repeat_count(instr))
+    }
+
+    /* Encode every initialized section, once `layout` has run, straight into `image` (or, with `objects`, into each section's buffer).
+     * Every address is known by now, so no record depends on another one being encoded first: the sections are cut into chunks
+     * (`split_into_chunks`) that get encoded on a work-stealing pool, each one at its final offset.
+     * With `objects`, references to labels become relocations (see `relocate`).
+     * `amnt_of_threads` of 0 uses one thread per core.
+     * */
+    template<AsmBitMode M>
+    void encode(std::vector<ut_BYTE> &image, MocaAsm_symtab &symtab, std::array<struct section_object, amnt_of_sections> *objects = nullptr,
+        ut_DWORD amnt_of_threads = 0)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::vector<struct encode_chunk> chunks = split_into_chunks();
+
+        /* `.bss` is never encoded; the image ends where the last initialized section does. */
+        ut_DWORD origin = sections[(ut_BYTE) AsmSection::S_text].base;
+        ut_DWORD end = origin;
+        for(ut_BYTE section = 0; section < (ut_BYTE) AsmSection::S_bss; section++)
+        {
+            if(sections[section].size == 0) continue;
+
+            end = sections[section].base + sections[section].size;
+            if(objects) (*objects)[section].code.assign(sections[section].size, 0);
+        }
+        if(!objects) image.assign(end - origin, 0);
+
+        amnt_of_chunks = (ut_DWORD) chunks.size();
+        amnt_of_workers = workers_for(amnt_of_chunks, amnt_of_threads);
+
+        /* One encoder per worker, reused from chunk to chunk. */
+        std::vector<MocaAsm_encoder<M> *> encoders(amnt_of_workers, nullptr);
+        for(MocaAsm_encoder<M> *&encoder : encoders) encoder = new MocaAsm_encoder<M>;
+
+        amnt_of_steals = run_parallel(amnt_of_chunks, amnt_of_workers, "encoder", [&](ut_DWORD i, ut_DWORD worker) {
+            struct encode_chunk &chunk = chunks[i];
+            MocaAsm_encoder<M> &encoder = *encoders[worker];
+            MASM_TRACE_SPAN("encoder", "encode_chunk", section_names[chunk.section]);
+
+            encoder.restart(chunk.address);
+            encode_range(encoder, chunk.first, chunk.last, counting_sizes ? &chunk.sizes : nullptr);
+            if(objects) relocate(encoder, chunk.section, symtab, chunk.relocations);
+            else encoder.resolve_fixups(symtab);
+
+            std::vector<ut_BYTE> &code = encoder.get_code();
+            MASM_assert(code.size() == chunk.size,
+                "\n%s[ENCODER ERROR, LINE %d]%s\tThe records starting here encoded to %zu bytes, but layout gave them %u.\n",
+                red, source_line(instructions[chunk.first].position), white,
+                code.size(), chunk.size)
+
+            ut_BYTE *destination = objects ? &(*objects)[chunk.section].code[chunk.address - sections[chunk.section].base] : &image[chunk.address - origin];
+            if(!code.empty()) memcpy(destination, code.data(), code.size());
+        });
+
+        for(MocaAsm_encoder<M> *encoder : encoders) delete encoder;
+        if(counting_sizes) merge_sizes(chunks);
+
+        /* In chunk order, so the relocations come out the same no matter which worker encoded what. */
+        if(objects)
+            for(struct encode_chunk &chunk : chunks)
+            {
+                std::vector<struct ir_relocation> &relocations = (*objects)[chunk.section].relocations;
+                relocations.insert(relocations.end(), chunk.relocations.begin(), chunk.relocations.end());
+            }
+
+        encode_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    /* `--check-determinism`: encode every section again with a single encoder, in order, on this thread,
+     * and make sure the result is byte for byte (and relocation for relocation) what `encode` produced.
+     * */
+    template<AsmBitMode M>
+    void check_determinism(std::vector<ut_BYTE> &image, MocaAsm_symtab &symtab, std::array<struct section_object, amnt_of_sections> *objects = nullptr)
+    {
+        MASM_TRACE_SPAN("encoder", "check_determinism");
+
+        ut_DWORD origin = sections[(ut_BYTE) AsmSection::S_text].base;
+        std::vector<ut_BYTE> serial_image;
+
+        for(ut_BYTE section = 0; section < (ut_BYTE) AsmSection::S_bss; section++)
+        {
+            if(sections[section].size == 0) continue;
+
+            MocaAsm_encoder<M> encoder(sections[section].base);
+            std::vector<struct ir_relocation> relocations;
+
+            encode_section(encoder, section);
+            if(objects) relocate(encoder, section, symtab, relocations);
+            else encoder.resolve_fixups(symtab);
+
+            std::vector<ut_BYTE> &parallel = objects ? (*objects)[section].code : image;
+            ut_DWORD offset = objects ? 0 : sections[section].base - origin;
+            std::vector<ut_BYTE> &code = encoder.get_code();
+
+            ut_DWORD mismatch = 0;
+            while(mismatch < code.size() && offset + mismatch < parallel.size() && code[mismatch] == parallel[offset + mismatch]) mismatch++;
+
+            MASM_assert(mismatch == code.size() && offset + code.size() <= parallel.size(),
+                "\n%s[DETERMINISM ERROR]%s\tParallel and serial encoding differ at 0x%X (%s`%s`%s).\n",
+                red, white,
+                sections[section].base + mismatch,
+                yellow, section_names[section], white)
+
+            if(!objects) continue;
+
+            std::vector<struct ir_relocation> &parallel_relocations = (*objects)[section].relocations;
+            bool same = relocations.size() == parallel_relocations.size();
+            for(ut_LSIZE i = 0; same && i < relocations.size(); i++)
+                same = relocations[i].offset == parallel_relocations[i].offset && relocations[i].symbol_id == parallel_relocations[i].symbol_id &&
+                    relocations[i].section == parallel_relocations[i].section && relocations[i].size == parallel_relocations[i].size &&
+                    relocations[i].kind == parallel_relocations[i].kind;
+
+            MASM_assert(same,
+                "\n%s[DETERMINISM ERROR]%s\tParallel and serial encoding produced different relocations for %s`%s`%s.\n",
+                red, white,
+                yellow, section_names[section], white)
+        }
+    }
+
+    /* Can records `[first, first + count)` be copied somewhere else as they are? Not if they define a label,
+     * switch sections or use an expression (`$` or a label), since those depend on where they are.
+     * */
+    bool is_replayable(ut_DWORD first, ut_DWORD count)
+    {
+        for(ut_DWORD i = first; i < first + count; i++)
+        {
+            struct ir_instruction &instr = instructions[i];
+
+            if(instr.flags & (IRF_lval_expression | IRF_rval_expression)) return false;
+            if(instr.opcode == (ut_BYTE) Instruction::SIvar_or_label || instr.opcode == (ut_BYTE) Instruction::SIsection) return false;
+        }
+
+        return true;
+    }
+
+    /* Append a copy of records `[first, first + count)`; a memoized macro expansion. */
+    void replay(ut_DWORD first, ut_DWORD count, ut_DWORD position)
+    {
+        for(ut_DWORD i = first; i < first + count; i++)
+        {
+            struct ir_instruction instr = instructions[i];
+
+            instr.position = position;
+            instructions.push_back(instr);
+        }
+
+        data_run_open = false;
+    }
+
+    std::vector<struct ir_instruction> &get_instructions()
+    { return instructions; }
+
+    /* The bytes of an `IRF_raw_data` record outside of `.bss`. */
+    const ut_BYTE *raw_data(struct ir_instruction &instr)
+    { return &data_pool[instr.values[0]]; }
+
+    struct section_layout &get_section(AsmSection section)
+    { return sections[(ut_BYTE) section]; }
+
+    ut_DWORD amnt_of_instructions()
+    { return (ut_DWORD) instructions.size(); }
+
+    /* `--ir-stats`. */
+    void report()
+    {
+        ut_LSIZE instruction_bytes = instructions.capacity() * sizeof(struct ir_instruction);
+        ut_LSIZE expression_bytes = expressions.capacity() * sizeof(struct ir_expression);
+        ut_LSIZE total = instruction_bytes + expression_bytes + data_pool.capacity();
+
+        MASM_report("\n%s[IR]%s\n", yellow, white);
+        MASM_report("\t%-24s %12zu (%zu bytes each, %llu bytes reserved)\n", "records", instructions.size(), sizeof(struct ir_instruction), instruction_bytes);
+        MASM_report("\t%-24s %12zu (%zu bytes each, %llu bytes reserved)\n", "expressions", expressions.size(), sizeof(struct ir_expression), expression_bytes);
+        MASM_report("\t%-24s %12zu bytes (%zu bytes reserved)\n", "data pool", data_pool.size(), data_pool.capacity());
+        MASM_report("\t%-24s %12.2f bytes\n", "memory per record", instructions.empty() ? 0.0 : (double) total / instructions.size());
+
+        for(ut_BYTE section = 0; section < amnt_of_sections; section++)
+        {
+            if(sections[section].size == 0) continue;
+
+            MASM_report("\t%-24s %12u bytes at 0x%X%s\n", section_names[section], sections[section].size, sections[section].base,
+                section == (ut_BYTE) AsmSection::S_bss ? " (not in the image)" : "");
+        }
+
+        if(loop_alignment)
+        {
+            ut_LSIZE bytes = 0;
+            for(struct ir_instruction &instr : instructions)
+                if(instr.opcode == (ut_BYTE) Instruction::SIalign && instr.operand_size == align_loop_head) bytes += instr.length;
+
+            MASM_report("\t%-24s %12u (%llu bytes of padding, at most %u per section)\n", "aligned loop heads", amnt_of_loop_heads, bytes, loop_budget);
+        }
+
+        MASM_report("\t%-24s %12u (%u worker(s), %u stolen)\n", "encoding chunks", amnt_of_chunks, amnt_of_workers, amnt_of_steals);
+        MASM_report("\t%-24s %12.3f ms\n", "encoding time", encode_seconds * 1000.0);
+    }
+
+    ~MocaAsm_ir()
+    {}
+};
+
+}
+
+#endif
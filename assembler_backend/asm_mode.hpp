@@ -0,0 +1,72 @@
+#ifndef Moca_assembly_mode
+#define Moca_assembly_mode
+
+namespace masm_mode
+{
+
+/* `-AT bit16/bit32/bit64`.
+ * The mode is a template parameter of everything that validates or encodes an instruction
+ * (`AssemblerAPI<M>`, `MocaAsm_encoder<M>`, `MocaAsm_parser<M>`), so every decision depending on it is made at compile time.
+ * `main.cpp` picks the instantiation once.
+ * */
+enum class AsmBitMode
+{
+    bit16 = 16,
+    bit32 = 32,
+    bit64 = 64
+};
+
+template<AsmBitMode M>
+struct mode_traits
+{
+    /* Size of an operand when there is no operand-size prefix. 64-bit mode still defaults to 32-bit operands. */
+    static constexpr ut_BYTE default_operand_size = M == AsmBitMode::bit16 ? 2 : 4;
+
+    /* Size of an absolute memory displacement (`[0x7C00]`) and of a near relative jump/call. */
+    static constexpr ut_BYTE displacement_size = M == AsmBitMode::bit16 ? 2 : 4;
+    static constexpr ut_BYTE near_branch_size = M == AsmBitMode::bit16 ? 2 : 4;
+
+    /* Highest address a displacement can reach. 64-bit mode sign-extends a 32-bit displacement. */
+    static constexpr ut_LLBYTE max_address = M == AsmBitMode::bit16 ? 0xFFFF :
+        M == AsmBitMode::bit32 ? 0xFFFFFFFF : 0x7FFFFFFF;
+
+    /* 0x40-0x4F are REX prefixes in 64-bit mode, so the one byte `inc reg16`/`dec reg16` forms do not exist. */
+    static constexpr bool has_short_inc_dec = M != AsmBitMode::bit64;
+
+    /* 64-bit mode has no `[disp32]` ModRM form (it became RIP-relative); an absolute address needs a SIB byte. */
+    static constexpr bool absolute_needs_sib = M == AsmBitMode::bit64;
+
+    /* Does an operand of `size` bytes need the 0x66 operand-size prefix? */
+    static constexpr bool needs_operand_prefix(ut_BYTE size)
+    { return size != 1 && size != default_operand_size; }
+};
+
+enum class RegisterClass
+{
+    RC_general,
+    RC_segment,
+    RC_ip       // never encodable as an operand
+};
+
+struct register_info
+{
+    ut_BYTE         encoding;   // value placed in ModRM/opcode; see "Assembly Register Encodings" in `NOTE`
+    ut_BYTE         size;
+    RegisterClass   rclass;
+};
+
+/* Indexed by `AsmRegisterTokens`. */
+constexpr struct register_info register_table[] = {
+    {0, 2, RegisterClass::RC_general}, {4, 1, RegisterClass::RC_general}, {0, 1, RegisterClass::RC_general},  // ax, ah, al
+    {3, 2, RegisterClass::RC_general}, {7, 1, RegisterClass::RC_general}, {3, 1, RegisterClass::RC_general},  // bx, bh, bl
+    {1, 2, RegisterClass::RC_general}, {5, 1, RegisterClass::RC_general}, {1, 1, RegisterClass::RC_general},  // cx, ch, cl
+    {2, 2, RegisterClass::RC_general}, {6, 1, RegisterClass::RC_general}, {2, 1, RegisterClass::RC_general},  // dx, dh, dl
+    {0, 2, RegisterClass::RC_ip},      {4, 2, RegisterClass::RC_general}, {5, 2, RegisterClass::RC_general},  // ip, sp, bp
+    {6, 2, RegisterClass::RC_general}, {7, 2, RegisterClass::RC_general},                                     // si, di
+    {1, 2, RegisterClass::RC_segment}, {3, 2, RegisterClass::RC_segment}, {2, 2, RegisterClass::RC_segment},  // cs, ds, ss
+    {0, 2, RegisterClass::RC_segment}, {4, 2, RegisterClass::RC_segment}, {5, 2, RegisterClass::RC_segment}   // es, fs, gs
+};
+
+}
+
+#endif
@@ -0,0 +1,365 @@
+#ifndef Moca_assembly_peephole
+#define Moca_assembly_peephole
+#include <vector>
+#include "asm_ir.hpp"
+
+namespace masm_peephole
+{
+
+using namespace masm_ir;
+
+/* `-O`. Every rule rewrites one IR record in place; a rewrite is only kept if it encodes to fewer bytes. */
+enum class PeepholeRule
+{
+    PR_redundant_mov,   // `mov ax, ax`; `mov ax, bx` right after `mov ax, bx` or `mov bx, ax`
+    PR_xor_zero,        // `mov reg, 0` -> `xor reg, reg` (flags dead)
+    PR_inc_dec,         // `add reg, 1`/`sub reg, 1` -> `inc reg`/`dec reg` (flags dead)
+    PR_imm8,            // ALU with an immediate in -128..127 -> sign-extended imm8 form
+    PR_accumulator,     // ALU on al/ax with an immediate -> accumulator form
+    PR_moffs,           // `mov al/ax, [address]` and back -> A0-A3
+    PR_NONE
+};
+
+const nt_BYTE *peephole_rule_names[] = {
+    "redundant mov",
+    "mov reg, 0 -> xor",
+    "add/sub 1 -> inc/dec",
+    "sign-extended imm8",
+    "accumulator form",
+    "moffs mov"
+};
+
+/* What an instruction does to the status flags (CF, ZF, SF, OF, PF, AF). */
+enum class FlagEffect
+{
+    FE_none,    // leaves them alone
+    FE_writes,  // overwrites (or leaves undefined) all of them without reading any
+    FE_reads    // reads some of them, or can not be reasoned about (branches, `int`, data)
+};
+
+template<AsmBitMode M>
+class MocaAsm_peephole
+{
+private:
+    MocaAsm_ir          &ir;
+    MocaAsm_encoder<M>  &encoder;
+
+    ut_DWORD            applied[(ut_BYTE) PeepholeRule::PR_NONE] = {0};
+    ut_LLBYTE           bytes_saved[(ut_BYTE) PeepholeRule::PR_NONE] = {0};
+
+    /* `flags_live[i]`: can the flags left behind by record `i` be read before they are overwritten? */
+    std::vector<bool>   flags_live;
+
+    FlagEffect flag_effect(struct ir_instruction &instr)
+    {
+        if(instr.flags & IRF_removed) return FlagEffect::FE_none;
+        if(instr.flags & IRF_raw_data) return FlagEffect::FE_reads;
+
+        switch((Instruction) instr.opcode)
+        {
+            case Instruction::SIvar_or_label:
+            case Instruction::SIalign:
+            case Instruction::Imov:
+            case Instruction::Imovb:
+            case Instruction::Imovw:
+            case Instruction::Imovd:
+            case Instruction::Ilea:
+            case Instruction::Iin:
+            case Instruction::Iout:
+            case Instruction::Ilodsb:
+            case Instruction::Ilodsw:
+            case Instruction::Icld:
+            case Instruction::Icli:
+            case Instruction::Isti:
+            case Instruction::Icwd:
+            case Instruction::Iclc:     // only CF
+            case Instruction::Iinc:     // everything but CF
+            case Instruction::Idec: return FlagEffect::FE_none;break;
+            case Instruction::Iadd:
+            case Instruction::Isub:
+            case Instruction::Icmp:
+            case Instruction::Iand:
+            case Instruction::Ior:
+            case Instruction::Ixor:
+            case Instruction::Inand:
+            case Instruction::Inor:
+            case Instruction::Imul:
+            case Instruction::Idiv:
+            case Instruction::Icmpsb: return FlagEffect::FE_writes;break;
+            case Instruction::Ishl:
+            case Instruction::Ishr: {
+                /* Shifting by `cl` or 0 can leave the flags alone. */
+                bool by_constant = ((instr.kinds >> 2) & 3) == (ut_BYTE) OperandKind::OK_imm;
+                return by_constant && instr.values[1] != 0 && instr.operand_size != 1 ? FlagEffect::FE_writes : FlagEffect::FE_none;
+            }
+            default: break;
+        }
+
+        return FlagEffect::FE_reads;
+    }
+
+    /* One backwards sweep; falling off the end of the program counts as a read. */
+    void compute_flags_live()
+    {
+        std::vector<struct ir_instruction> &instructions = ir.get_instructions();
+        bool live = true;
+
+        flags_live.assign(instructions.size(), true);
+        for(ut_LSIZE i = instructions.size(); i-- > 0;)
+        {
+            flags_live[i] = live;
+
+            switch(flag_effect(instructions[i]))
+            {
+                case FlagEffect::FE_reads: live = true;break;
+                case FlagEffect::FE_writes: live = false;break;
+                default: break;
+            }
+        }
+    }
+
+    ut_BYTE length_of(struct ir_instruction &instr)
+    {
+        if(instr.flags & IRF_removed) return 0;
+
+        struct InstructionData idata;
+        ir.expand(instr, idata, false);
+        return encoder.measure(idata);
+    }
+
+    /* Keep `candidate` if it is shorter than `instr`. */
+    bool try_rewrite(PeepholeRule rule, struct ir_instruction &instr, struct ir_instruction &candidate)
+    {
+        ut_BYTE before = length_of(instr);
+        ut_BYTE after = length_of(candidate);
+        if(after >= before) return false;
+
+        instr = candidate;
+        applied[(ut_BYTE) rule]++;
+        bytes_saved[(ut_BYTE) rule] += before - after;
+        return true;
+    }
+
+    static OperandKind kind_of(struct ir_instruction &instr, ut_BYTE i)
+    { return (OperandKind) ((instr.kinds >> (i * 2)) & 3); }
+
+    static bool is_general(struct ir_instruction &instr, ut_BYTE i)
+    {
+        return kind_of(instr, i) == OperandKind::OK_reg &&
+            register_table[instr.regs[i]].rclass == RegisterClass::RC_general;
+    }
+
+    static bool is_constant(struct ir_instruction &instr, ut_BYTE i)
+    {
+        return kind_of(instr, i) == OperandKind::OK_imm &&
+            !(instr.flags & (i == 0 ? IRF_lval_expression : IRF_rval_expression));
+    }
+
+    static bool is_accumulator(struct ir_instruction &instr, ut_BYTE i)
+    {
+        return kind_of(instr, i) == OperandKind::OK_reg &&
+            (instr.regs[i] == (ut_BYTE) AsmRegisterTokens::R_al || instr.regs[i] == (ut_BYTE) AsmRegisterTokens::R_ax);
+    }
+
+    /* The constant rval as the CPU sees it: truncated to the operand size and sign-extended. */
+    static nt_LLBYTE signed_rval(struct ir_instruction &instr)
+    {
+        switch(instr.operand_size)
+        {
+            case 1: return (nt_BYTE) instr.values[1];break;
+            case 2: return (nt_WORD) instr.values[1];break;
+            default: break;
+        }
+
+        return (nt_DWORD) instr.values[1];
+    }
+
+    static bool is_mov(struct ir_instruction &instr)
+    {
+        return instr.opcode == (ut_BYTE) Instruction::Imov || instr.opcode == (ut_BYTE) Instruction::Imovb ||
+            instr.opcode == (ut_BYTE) Instruction::Imovw || instr.opcode == (ut_BYTE) Instruction::Imovd;
+    }
+
+    static bool is_alu(struct ir_instruction &instr)
+    {
+        switch((Instruction) instr.opcode)
+        {
+            case Instruction::Iadd:
+            case Instruction::Ior:
+            case Instruction::Iadc:
+            case Instruction::Iand:
+            case Instruction::Isub:
+            case Instruction::Ixor:
+            case Instruction::Icmp:
+            case Instruction::Inand:
+            case Instruction::Inor: return true;break;
+            default: break;
+        }
+
+        return false;
+    }
+
+    /* Moving into a register that already holds the value. Labels in between stop it, so nothing can jump past the first `mov`. */
+    void redundant_mov(struct ir_instruction &instr, struct ir_instruction *previous)
+    {
+        if(!is_mov(instr) || !is_general(instr, 0)) return;
+
+        bool redundant = is_general(instr, 1) && instr.regs[0] == instr.regs[1];
+
+        if(!redundant && previous && is_mov(*previous) && is_general(*previous, 0))
+        {
+            /* `mov a, b` twice, or `mov a, b` then `mov b, a`. */
+            if(is_general(instr, 1) && is_general(*previous, 1))
+                redundant = (previous->regs[0] == instr.regs[0] && previous->regs[1] == instr.regs[1]) ||
+                    (previous->regs[0] == instr.regs[1] && previous->regs[1] == instr.regs[0]);
+
+            /* `mov a, imm` twice. */
+            if(is_constant(instr, 1) && is_constant(*previous, 1))
+                redundant = previous->regs[0] == instr.regs[0] && previous->values[1] == instr.values[1];
+        }
+
+        if(!redundant) return;
+
+        struct ir_instruction candidate = instr;
+        candidate.flags |= IRF_removed;
+        candidate.length = 0;
+        try_rewrite(PeepholeRule::PR_redundant_mov, instr, candidate);
+    }
+
+    void xor_zero(struct ir_instruction &instr, bool flags_dead)
+    {
+        if(!flags_dead || !is_mov(instr) || !is_general(instr, 0) || !is_constant(instr, 1) || instr.values[1] != 0) return;
+
+        struct ir_instruction candidate = instr;
+        candidate.opcode = (ut_BYTE) Instruction::Ixor;
+        candidate.kinds = (ut_BYTE) OperandKind::OK_reg | ((ut_BYTE) OperandKind::OK_reg << 2);
+        candidate.regs[1] = instr.regs[0];
+        try_rewrite(PeepholeRule::PR_xor_zero, instr, candidate);
+    }
+
+    /* `inc`/`dec` leave CF alone, so every flag has to be dead. */
+    void inc_dec(struct ir_instruction &instr, bool flags_dead)
+    {
+        if(!flags_dead || !is_general(instr, 0) || !is_constant(instr, 1)) return;
+        if(instr.opcode != (ut_BYTE) Instruction::Iadd && instr.opcode != (ut_BYTE) Instruction::Isub) return;
+
+        nt_LLBYTE value = signed_rval(instr);
+        if(value != 1 && value != -1) return;
+
+        bool increment = (instr.opcode == (ut_BYTE) Instruction::Iadd) == (value == 1);
+
+        struct ir_instruction candidate = instr;
+        candidate.opcode = (ut_BYTE) (increment ? Instruction::Iinc : Instruction::Idec);
+        candidate.kinds = (ut_BYTE) OperandKind::OK_reg;
+        candidate.regs[1] = 0;
+        candidate.values[1] = 0;
+        try_rewrite(PeepholeRule::PR_inc_dec, instr, candidate);
+    }
+
+    void imm8(struct ir_instruction &instr)
+    {
+        if(!is_alu(instr) || !is_general(instr, 0) || !is_constant(instr, 1) || instr.operand_size == 1) return;
+
+        nt_LLBYTE value = signed_rval(instr);
+        if(value < -0x80 || value > 0x7F) return;
+
+        struct ir_instruction candidate = instr;
+        candidate.flags |= EH_imm8 << IRF_hint_shift;
+        try_rewrite(PeepholeRule::PR_imm8, instr, candidate);
+    }
+
+    void accumulator(struct ir_instruction &instr)
+    {
+        if(!is_alu(instr) || !is_accumulator(instr, 0) || kind_of(instr, 1) != OperandKind::OK_imm) return;
+
+        struct ir_instruction candidate = instr;
+        candidate.flags |= EH_accumulator << IRF_hint_shift;
+        try_rewrite(PeepholeRule::PR_accumulator, instr, candidate);
+    }
+
+    /* 64-bit mode's moffs takes a 64-bit address, which is never shorter. */
+    void moffs(struct ir_instruction &instr)
+    {
+        if constexpr(M == AsmBitMode::bit64) return;
+        if(!is_mov(instr)) return;
+        if(!(is_accumulator(instr, 0) && kind_of(instr, 1) == OperandKind::OK_mem) &&
+            !(kind_of(instr, 0) == OperandKind::OK_mem && is_accumulator(instr, 1)))
+            return;
+
+        struct ir_instruction candidate = instr;
+        candidate.flags |= EH_moffs << IRF_hint_shift;
+        try_rewrite(PeepholeRule::PR_moffs, instr, candidate);
+    }
+
+public:
+    MocaAsm_peephole(MocaAsm_ir &ir_, MocaAsm_encoder<M> &encoder_)
+        : ir(ir_), encoder(encoder_)
+    {}
+
+    void optimize()
+    {
+        std::vector<struct ir_instruction> &instructions = ir.get_instructions();
+        struct ir_instruction *previous = nullptr;
+
+        /* Index following the body of the last `times`; a copy of the body can be followed by another copy,
+         * so the flags are never dead inside of it, and no `mov` is redundant across either end of it.
+         * */
+        ut_LSIZE repeat_end = 0;
+
+        compute_flags_live();
+
+        for(ut_LSIZE i = 0; i < instructions.size(); i++)
+        {
+            struct ir_instruction &instr = instructions[i];
+
+            if(i == repeat_end) previous = nullptr;
+            if(instr.flags & (IRF_raw_data | IRF_removed)) continue;
+            if(instr.opcode == (ut_BYTE) Instruction::SIvar_or_label || instr.opcode == (ut_BYTE) Instruction::SIsection ||
+                instr.opcode == (ut_BYTE) Instruction::SIalign)
+            { previous = nullptr; continue; }
+            if(instr.opcode == (ut_BYTE) Instruction::SIrepeat)
+            {
+                previous = nullptr;
+                repeat_end = i + 1 + instr.values[1];
+                continue;
+            }
+
+            redundant_mov(instr, previous);
+            if(instr.flags & IRF_removed) continue;
+
+            bool flags_dead = !flags_live[i] && i >= repeat_end;
+            xor_zero(instr, flags_dead);
+            inc_dec(instr, flags_dead);
+            imm8(instr);
+            accumulator(instr);
+            moffs(instr);
+
+            previous = &instr;
+        }
+    }
+
+    void report()
+    {
+        ut_DWORD total_applied = 0;
+        ut_LLBYTE total_saved = 0;
+
+        MASM_report("\n%s[PEEPHOLE]%s\n", yellow, white);
+        MASM_report("\t%-24s %10s %12s\n", "rule", "applied", "bytes saved");
+
+        for(ut_BYTE i = 0; i < (ut_BYTE) PeepholeRule::PR_NONE; i++)
+        {
+            MASM_report("\t%-24s %10u %12llu\n", peephole_rule_names[i], applied[i], bytes_saved[i]);
+            total_applied += applied[i];
+            total_saved += bytes_saved[i];
+        }
+
+        MASM_report("\t%-24s %10u %12llu\n", "total", total_applied, total_saved);
+    }
+
+    ~MocaAsm_peephole()
+    {}
+};
+
+}
+
+#endif
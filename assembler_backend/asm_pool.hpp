@@ -0,0 +1,104 @@
+#ifndef Moca_assembly_pool
+#define Moca_assembly_pool
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Work-stealing thread pool for jobs split into independent, numbered tasks (encoding chunks, linking units).
+ *
+ * Every worker starts with a contiguous share of the task numbers and works through it front to back,
+ * so neighbouring tasks (and the memory they touch) stay on one core. A worker that runs out takes
+ * the last task of another worker's share; the tasks are never re-split, so a steal is a single lock.
+ * The calling thread is worker 0.
+ * */
+namespace masm_pool
+{
+
+/* `[front, back)` of the task numbers a worker still has. */
+struct task_queue
+{
+    std::mutex      lock;
+    ut_DWORD        front = 0;
+    ut_DWORD        back = 0;
+};
+
+/* Workers to use for `amnt_of_tasks` tasks; `amnt_of_threads` of 0 means one per core. */
+inline ut_DWORD workers_for(ut_DWORD amnt_of_tasks, ut_DWORD amnt_of_threads = 0)
+{
+    ut_DWORD amnt_of_workers = amnt_of_threads != 0 ? amnt_of_threads : std::thread::hardware_concurrency();
+
+    if(amnt_of_workers > amnt_of_tasks) amnt_of_workers = amnt_of_tasks;
+    return amnt_of_workers != 0 ? amnt_of_workers : 1;
+}
+
+/* Run `task(i, worker)` for every `i` in `[0, amnt_of_tasks)`; returns how many tasks were stolen. */
+template<typename F>
+ut_DWORD run_parallel(ut_DWORD amnt_of_tasks, ut_DWORD amnt_of_workers, const nt_BYTE *name, F &&task)
+{
+    /* No reason to start a thread for a single worker. */
+    if(amnt_of_workers <= 1)
+    {
+        for(ut_DWORD i = 0; i < amnt_of_tasks; i++) task(i, 0);
+        return 0;
+    }
+
+    std::vector<struct task_queue> queues(amnt_of_workers);
+    for(ut_DWORD worker = 0; worker < amnt_of_workers; worker++)
+    {
+        queues[worker].front = (ut_DWORD) ((ut_LLBYTE) amnt_of_tasks * worker / amnt_of_workers);
+        queues[worker].back = (ut_DWORD) ((ut_LLBYTE) amnt_of_tasks * (worker + 1) / amnt_of_workers);
+    }
+
+    std::atomic<ut_DWORD> amnt_of_steals{0};
+
+    auto work = [&queues, &task, &amnt_of_steals, amnt_of_workers, name](ut_DWORD worker) {
+        if(worker != 0) masm_trace::tracer.name_thread(name);
+
+        while(true)
+        {
+            ut_DWORD i = 0;
+            bool found = false;
+
+            {
+                std::lock_guard<std::mutex> guard(queues[worker].lock);
+                if(queues[worker].front < queues[worker].back)
+                {
+                    i = queues[worker].front++;
+                    found = true;
+                }
+            }
+
+            /* Nothing left of our own; steal from the back of the next worker that has something. */
+            for(ut_DWORD other = 1; other < amnt_of_workers && !found; other++)
+            {
+                struct task_queue &victim = queues[(worker + other) % amnt_of_workers];
+                std::lock_guard<std::mutex> guard(victim.lock);
+
+                if(victim.front < victim.back)
+                {
+                    i = --victim.back;
+                    found = true;
+                    amnt_of_steals++;
+                }
+            }
+
+            /* Tasks are never added, so once every queue is empty there is nothing left to wait for. */
+            if(!found) return;
+            task(i, worker);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for(ut_DWORD worker = 1; worker < amnt_of_workers; worker++)
+        workers.emplace_back(work, worker);
+
+    work(0);
+    for(std::thread &worker : workers) worker.join();
+
+    return amnt_of_steals.load();
+}
+
+}
+
+#endif
@@ -1,5 +1,8 @@
 #ifndef Moca_assembly_assembler_response
 #define Moca_assembly_assembler_response
+#include <array>
+#include "asm_mode.hpp"
+using namespace masm_mode;
 
 namespace MocaAsm_assembler_response
 {
@@ -73,26 +76,6 @@ enum class InstructionPlace
     RVAL
 };
 
-/* What type of operand to expect after the lval. */
-enum class OperandToExpect
-{
-    OPR_reg,    // reg8, reg16, reg32
-    OPR_imm,    // imm8, imm16, imm32
-    OPR_mem,    // mem8, mem16, mem32
-
-    /* Other things to expect.
-     * If the assembler received `KW_special` token, then it will expect either a grammatic
-     * value (colon) or a datatype (db, dw, dd, dbarr, dwarr, ddarr).
-     * */
-    datatype,
-    grammar,
-
-    /* If `assembler_check_in_new_instruction` recieves a datatype (db, dw, dd or dbarr, dwarr, ddarr),
-     * it will then expect some sort of decimal/hexadecimal value.
-     * */
-    common,
-};
-
 /* What instruction is it? */
 enum class Instruction
 {
@@ -128,6 +111,18 @@ enum class Instruction
     Icall,
     Icli,
     Isti,
+    Iclc,
+    Icld,
+    Icmc,
+    Icmp,
+    Icmpsb,
+    Icwd,
+    Iin,
+    Iout,
+    Ilea,
+    Ilock,
+    Ilodsb,
+    Ilodsw,
     SIvar_or_label, // SI - Special Instruction
     SIdb,           // assembler received a db
     SIdw,           // assembler received a dw
@@ -135,118 +130,407 @@ enum class Instruction
     SIdbarr,        // assembler received a dbarr
     SIdwarr,        // assembler received a dwarr
     SIddarr,        // assembler received a ddarr
+    SIsection,      // `.text`, `.data`, ...; only exists in the IR
+    SIrepeat,       // `times`/`pad`; only exists in the IR
+    SIalign,        // `align`; only exists in the IR
     INONE
 };
 
 #define is_mov_instr(i)  (i == Instruction::Imov || i == Instruction::Imovb || i == Instruction::Imovd || i == Instruction::Imovw) ? true : false
 #define is_bit_operation(i) (i == Instruction::Ior || i == Instruction::Iand || i == Instruction::Inand || i == Instruction::Inor || i == Instruction::Ixor || i == Instruction::Ishl || i == Instruction::Ishr) ? true : false
 #define is_jmp_instr(i) (i == Instruction::Ijmp || i == Instruction::Ijne || i == Instruction::Ijg || i == Instruction::Ijl || i == Instruction::Ijge || i == Instruction::Ijle || i == Instruction::Ijc || i == Instruction::Ijz) ? true : false
-#define is_arith_operation(i) (i == Instruction::Idiv || i == Instruction::Imul || i == Instruction::Idec || i == Instruction::Iinc || i == Instruction::Iadd || i == Instruction::Isub) ? true : false
+#define is_arith_operation(i) (i == Instruction::Idiv || i == Instruction::Imul || i == Instruction::Idec || i == Instruction::Iinc || i == Instruction::Iadc || i == Instruction::Iadd || i == Instruction::Isub) ? true : false
 #define is_cli_or_hlt(i) (i == Instruction::Icli || i == Instruction::Isti) ? true : false
 #define is_int_or_call(i) (i == Instruction::Iint || i == Instruction::Icall) ? true : false
 
+/* What an operand turned out to be once parsed. */
+enum class OperandKind
+{
+    OK_none,
+    OK_reg,     // any register; `register_table` tells general purpose from segment registers
+    OK_imm,     // immediate value, or the address of a label/variable (`symbol_id`)
+    OK_mem      // `[address]`
+};
+
+struct instruction_operand
+{
+    OperandKind         kind;
+    AsmRegisterTokens   reg;
+
+    /* The immediate value/address. If `symbol_id` is not `no_symbol`, the symbol's value gets added to it. */
+    nt_LLBYTE           value;
+    ut_DWORD            symbol_id;
+
+    /* How many times `$` gets added to the value (-1 if it is subtracted); resolved once the statement has an address. */
+    nt_BYTE             here;
+};
+
+/* Is the value of `op` known while parsing? */
+inline bool is_constant(struct instruction_operand &op)
+{ return op.symbol_id == no_symbol && op.here == 0; }
+
+/* `InstructionData::hints`; shorter encodings the encoder may use. Set by the layout and the `-O` pass, never by the parser. */
+constexpr ut_BYTE EH_short_branch   = 1 << 0;   // `jmp`/`jcc` rel8 (EB/7x)
+constexpr ut_BYTE EH_imm8           = 1 << 1;   // ALU with a sign-extended imm8 (83 /x ib)
+constexpr ut_BYTE EH_accumulator    = 1 << 2;   // ALU on al/ax with an immediate (04/05, 0C/0D, ...)
+constexpr ut_BYTE EH_moffs          = 1 << 3;   // `mov al/ax, [address]` and back (A0-A3)
+
 /* Data over the instruction being worked with. */
 struct InstructionData
 {
     Instruction     instruction;
+    const nt_BYTE   *mnemonic;
+    ut_DWORD        position;   // source position of the statement (see `MocaAsm_source_map`)
+
+    /* The parsed operands; `operands[0]` is the lval, `operands[1]` the rval. */
+    struct instruction_operand  operands[2];
+    ut_BYTE                     amnt_of_operands;
+
+    /* Size, in bytes, the instruction operates on (1, 2 or 4); decided by `validate_operands`. */
+    ut_BYTE                     operand_size;
+
+    /* `EH_*`. */
+    ut_BYTE                     hints;
+};
+
+/* Operand forms.
+ * One bit per kind of operand; a register operand has the bit of its size plus, for the registers
+ * some instructions single out (`in al, dx`, `shl ax, cl`), the bit of the register itself.
+ * */
+typedef ut_WORD form_mask;
+
+constexpr form_mask OF_reg8     = 1 << 0;
+constexpr form_mask OF_reg16    = 1 << 1;
+constexpr form_mask OF_sreg     = 1 << 2;   // segment register
+constexpr form_mask OF_al       = 1 << 3;
+constexpr form_mask OF_ax       = 1 << 4;
+constexpr form_mask OF_cl       = 1 << 5;
+constexpr form_mask OF_dx       = 1 << 6;
+constexpr form_mask OF_imm      = 1 << 7;   // constant immediate value
+constexpr form_mask OF_symbol   = 1 << 8;   // immediate value depending on a label/variable
+constexpr form_mask OF_mem      = 1 << 9;   // `[address]`
+
+constexpr form_mask OF_reg      = OF_reg8 | OF_reg16;
+constexpr form_mask OF_value    = OF_imm | OF_symbol;
+constexpr form_mask OF_anyreg   = OF_reg | OF_sreg | OF_al | OF_ax | OF_cl | OF_dx;
+
+constexpr ut_BYTE amnt_of_registers = sizeof(register_table) / sizeof(register_table[0]);
+
+/* Form of every register, indexed by `AsmRegisterTokens`. `ip` has none, so it matches nothing. */
+constexpr std::array<form_mask, amnt_of_registers> register_forms = []() {
+    std::array<form_mask, amnt_of_registers> forms = {};
+
+    for(ut_BYTE i = 0; i < amnt_of_registers; i++)
+    {
+        if(register_table[i].rclass == RegisterClass::RC_segment) forms[i] = OF_sreg;
+        if(register_table[i].rclass == RegisterClass::RC_general) forms[i] = register_table[i].size == 1 ? OF_reg8 : OF_reg16;
+    }
+
+    forms[(ut_BYTE) AsmRegisterTokens::R_al] |= OF_al;
+    forms[(ut_BYTE) AsmRegisterTokens::R_ax] |= OF_ax;
+    forms[(ut_BYTE) AsmRegisterTokens::R_cl] |= OF_cl;
+    forms[(ut_BYTE) AsmRegisterTokens::R_dx] |= OF_dx;
+
+    return forms;
+}();
 
-    /* Is the lval or rval going to end up being treated as an immediate value? */
-    bool            treat_lval_as_imm;
-    bool            treat_rval_as_imm;
-
-    /* The lval can only be reg8/reg16/reg32 or a mem8/mem16/mem32. */
-    union {
-        RegisterOperands    lvalreg_operand;
-        MemOperands         lvalmem_operand;
-    } lval;
-
-    /* What should we expect following the instruction? (lval) */
-    OperandToExpect     lvaloperand_expected[5];
-    ut_BYTE             lvalamount;
-
-    /* What should we expect after the lval? */
-    OperandToExpect     rvaloperand_expected[5];
-    ut_BYTE             rvalamount;
-
-    /* The rval can be a reg8/reg16/reg32, a mem8/mem16/mem32 or an imm8, imm16 or imm32. */
-    union {
-        RegisterOperands    rvalreg_operand;
-        MemOperands         rvalmem_operand;
-        ImmediateOperands   rvalimm_operand;
-    } rval;
+/* What an instruction accepts, and what the tokenizer should expect after its mnemonic.
+ * `lval`/`rval` only say which kinds of operands are legal; rules relating the two operands
+ * (matching sizes, no memory to memory) are left to `AssemblerAPI::validate_operands`.
+ * */
+struct instruction_form
+{
+    ut_BYTE     amnt_of_operands;
+    form_mask   lval;
+    form_mask   rval;
+    token_mask  tokens_to_expect;
 };
 
+constexpr struct instruction_form operand_form(ut_BYTE amnt_of_operands, form_mask lval, form_mask rval)
+{
+    /* Registers are only lexed when the instruction can take one. */
+    token_mask TTE = token_bit(TypeOfTokens::TT_common);
+    if((lval | rval) & OF_anyreg) TTE |= token_bit(TypeOfTokens::TT_register);
+
+    return {amnt_of_operands, lval, rval, TTE};
+}
+
+constexpr struct instruction_form expect_only(token_mask TTE)
+{ return {0, 0, 0, TTE}; }
+
+/* Indexed by `Instruction`. */
+constexpr std::array<struct instruction_form, (ut_BYTE) Instruction::INONE + 1> instruction_forms = []() {
+    std::array<struct instruction_form, (ut_BYTE) Instruction::INONE + 1> forms = {};
+    auto set = [&forms](std::initializer_list<Instruction> instrs, struct instruction_form form) {
+        for(Instruction instr : instrs) forms[(ut_BYTE) instr] = form;
+    };
+
+    /* Everything not listed takes no operands (`hlt`, `cli`, `lodsb`, ...). */
+    for(struct instruction_form &form : forms) form = operand_form(0, 0, 0);
+
+    set({Instruction::Imov, Instruction::Imovb, Instruction::Imovw, Instruction::Imovd},
+        operand_form(2, OF_reg | OF_sreg | OF_mem, OF_reg | OF_sreg | OF_value | OF_mem));
+    set({Instruction::Iadc, Instruction::Iadd, Instruction::Isub, Instruction::Icmp,
+        Instruction::Iand, Instruction::Ior, Instruction::Ixor, Instruction::Inand, Instruction::Inor},
+        operand_form(2, OF_reg | OF_mem, OF_reg | OF_value | OF_mem));
+    set({Instruction::Ishl, Instruction::Ishr}, operand_form(2, OF_reg, OF_imm | OF_cl));
+    set({Instruction::Idiv, Instruction::Imul, Instruction::Idec, Instruction::Iinc}, operand_form(1, OF_reg, 0));
+    set({Instruction::Ijmp, Instruction::Ijne, Instruction::Ijg, Instruction::Ijl, Instruction::Ijge,
+        Instruction::Ijle, Instruction::Ijc, Instruction::Ijz, Instruction::Icall}, operand_form(1, OF_value, 0));
+    set({Instruction::Iint}, operand_form(1, OF_imm, 0));
+    set({Instruction::Iin}, operand_form(2, OF_al | OF_ax, OF_imm | OF_dx));
+    set({Instruction::Iout}, operand_form(2, OF_imm | OF_dx, OF_al | OF_ax));
+    set({Instruction::Ilea}, operand_form(2, OF_reg16, OF_mem));
+
+    /* Names either become a label (`:`) or a variable (datatype); datatypes expect a value of their size. */
+    set({Instruction::SIvar_or_label}, expect_only(token_bit(TypeOfTokens::TT_datatype) | token_bit(TypeOfTokens::TT_grammar)));
+    set({Instruction::SIdb, Instruction::SIdbarr}, expect_only(token_bit(TypeOfTokens::ETT_imm8)));
+    set({Instruction::SIdw, Instruction::SIdwarr}, expect_only(token_bit(TypeOfTokens::ETT_imm16)));
+    set({Instruction::SIdd, Instruction::SIddarr}, expect_only(token_bit(TypeOfTokens::ETT_imm32)));
+
+    return forms;
+}();
+
+template<AsmBitMode M>
 class AssemblerAPI
 {
 private:
     struct InstructionData *idata = nullptr;
 
-    Instruction decipher_instruction(ut_BYTE token_id)
+    Instruction decipher_instruction(struct MocaAsm_TD *tdata)
     {
-        switch(token_id)
+        if(tdata->token_type == TypeOfTokens::TT_datatype)
+        {
+            switch(tdata->token_id)
+            {
+                /* Normal DataTypes. */
+                case (ut_BYTE)AsmDataTypeTokens::DT_db: return Instruction::SIdb;break;
+                case (ut_BYTE)AsmDataTypeTokens::DT_dw: return Instruction::SIdw;break;
+                case (ut_BYTE)AsmDataTypeTokens::DT_dd: return Instruction::SIdd;break;
+                /* MocAsm "special" datatypes. All assemble back down to db, dw or dd. */
+                case (ut_BYTE)AsmDataTypeTokens::DT_dbarr: return Instruction::SIdbarr;break;
+                case (ut_BYTE)AsmDataTypeTokens::DT_dwarr: return Instruction::SIdwarr;break;
+                case (ut_BYTE)AsmDataTypeTokens::DT_ddarr: return Instruction::SIddarr;break;
+                default: break;
+            }
+
+            return Instruction::INONE;
+        }
+
+        switch(tdata->token_id)
         {
             /* Keywords. */
             case (ut_BYTE)AsmKeywordTokens::KW_mov: return Instruction::Imov;break;
             case (ut_BYTE)AsmKeywordTokens::KW_movw: return Instruction::Imovw;break;
             case (ut_BYTE)AsmKeywordTokens::KW_movd: return Instruction::Imovd;break;
             case (ut_BYTE)AsmKeywordTokens::KW_movb: return Instruction::Imovb;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_or: return Instruction::Ior;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_and: return Instruction::Iand;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_xor: return Instruction::Ixor;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_nand: return Instruction::Inand;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_nor: return Instruction::Inor;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_shl: return Instruction::Ishl;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_shr: return Instruction::Ishr;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_clc: return Instruction::Iclc;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_cld: return Instruction::Icld;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_cli: return Instruction::Icli;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_sti: return Instruction::Isti;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_cmc: return Instruction::Icmc;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_cmp: return Instruction::Icmp;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_cmpsb: return Instruction::Icmpsb;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_cwd: return Instruction::Icwd;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_div: return Instruction::Idiv;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_mul: return Instruction::Imul;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_dec: return Instruction::Idec;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_inc: return Instruction::Iinc;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_adc: return Instruction::Iadc;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_add: return Instruction::Iadd;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_sub: return Instruction::Isub;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_call: return Instruction::Icall;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_hlt: return Instruction::Ihlt;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_int: return Instruction::Iint;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_in: return Instruction::Iin;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_out: return Instruction::Iout;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_lea: return Instruction::Ilea;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_lock: return Instruction::Ilock;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_lodsb: return Instruction::Ilodsb;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_lodsw: return Instruction::Ilodsw;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_jmp: return Instruction::Ijmp;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_jne: return Instruction::Ijne;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_jge: return Instruction::Ijge;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_jle: return Instruction::Ijle;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_jz: return Instruction::Ijz;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_jc: return Instruction::Ijc;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_jg: return Instruction::Ijg;break;
+            case (ut_BYTE)AsmKeywordTokens::KW_jl: return Instruction::Ijl;break;
             case (ut_BYTE)AsmKeywordTokens::KW_special: return Instruction::SIvar_or_label;break;
-            /* Normal DataTypes. */
-            case (ut_BYTE)AsmDataTypeTokens::DT_db: return Instruction::SIdb;break;
-            case (ut_BYTE)AsmDataTypeTokens::DT_dw: return Instruction::SIdw;break;
-            case (ut_BYTE)AsmDataTypeTokens::DT_dd: return Instruction::SIdd;break;
-            /* MocAsm "special" datatypes. All assemble back down to db, dw or dd. */
-            case (ut_BYTE)AsmDataTypeTokens::DT_dbarr: return Instruction::SIdbarr;break;
-            case (ut_BYTE)AsmDataTypeTokens::DT_dwarr: return Instruction::SIdwarr;break;
-            case (ut_BYTE)AsmDataTypeTokens::DT_ddarr: return Instruction::SIddarr;break;
             default: break;
         }
 
         return Instruction::INONE;
     }
 
-    RegisterOperands decipher_register_operand(ut_BYTE token_id)
+    /* Operand helpers for `validate_operands`. */
+    static bool is_general(struct instruction_operand &op)
+    { return op.kind == OperandKind::OK_reg && register_table[(ut_BYTE) op.reg].rclass == RegisterClass::RC_general; }
+
+    static bool is_segment(struct instruction_operand &op)
+    { return op.kind == OperandKind::OK_reg && register_table[(ut_BYTE) op.reg].rclass == RegisterClass::RC_segment; }
+
+    static ut_BYTE reg_size(struct instruction_operand &op)
+    { return register_table[(ut_BYTE) op.reg].size; }
+
+    static form_mask form_of(struct instruction_operand &op)
     {
-        switch(token_id)
+        switch(op.kind)
         {
-            /* 16-bit registers (reg16). */
-            case (ut_BYTE)AsmRegisterTokens::R_ax:
-            case (ut_BYTE)AsmRegisterTokens::R_bx:
-            case (ut_BYTE)AsmRegisterTokens::R_cx:
-            case (ut_BYTE)AsmRegisterTokens::R_dx:
-            case (ut_BYTE)AsmRegisterTokens::R_ds:
-            case (ut_BYTE)AsmRegisterTokens::R_sp:
-            case (ut_BYTE)AsmRegisterTokens::R_bp:
-            case (ut_BYTE)AsmRegisterTokens::R_ss:
-            case (ut_BYTE)AsmRegisterTokens::R_ip:
-            case (ut_BYTE)AsmRegisterTokens::R_es:
-            case (ut_BYTE)AsmRegisterTokens::R_si:
-            case (ut_BYTE)AsmRegisterTokens::R_di:
-            case (ut_BYTE)AsmRegisterTokens::R_cs:
-            case (ut_BYTE)AsmRegisterTokens::R_fs:
-            case (ut_BYTE)AsmRegisterTokens::R_gs: return RegisterOperands::reg16;break;
+            case OperandKind::OK_reg: return register_forms[(ut_BYTE) op.reg];break;
+            case OperandKind::OK_imm: return is_constant(op) ? OF_imm : OF_symbol;break;
+            case OperandKind::OK_mem: return OF_mem;break;
             default: break;
         }
 
-        /* If we have a register and the above switch statement did not return, it's a 8-bit register.
-         * Return reg8.
-         * */
-        return RegisterOperands::reg8;
+        return 0;
+    }
+
+    void invalid_operands()
+    {
+        MASM_error("\n%s[INVALID OPERANDS, LINE %d]%s\tThe operands given to %s`%s`%s are not valid in %d-bit mode.\n",
+            red, source_line(idata->position), white,
+            yellow, idata->mnemonic, white,
+            (nt_DWORD) M)
+    }
+
+    void check_fits(nt_LLBYTE value, ut_BYTE size)
+    {
+        nt_LLBYTE lowest = size == 1 ? -0x80 : size == 2 ? -0x8000 : -0x80000000LL;
+        nt_LLBYTE highest = size == 1 ? 0xFF : size == 2 ? 0xFFFF : 0xFFFFFFFFLL;
+
+        MASM_assert(value >= lowest && value <= highest,
+            "\n%s[VALUE TOO LARGE, LINE %d]%s\tThe value %s`%lld`%s does not fit in %d byte(s).\n",
+            red, source_line(idata->position), white,
+            yellow, value, white,
+            size)
     }
 
-    ut_BYTE *instruction_name(Instruction instr)
+    /* Absolute addresses have to be reachable with the mode's displacement. */
+    void check_address(struct instruction_operand &op)
     {
-        switch(instr)
+        if(op.kind != OperandKind::OK_mem || !is_constant(op)) return;
+
+        MASM_assert(op.value >= 0 && (ut_LLBYTE) op.value <= mode_traits<M>::max_address,
+            "\n%s[INVALID ADDRESS, LINE %d]%s\tThe address %s`0x%llX`%s can not be reached in %d-bit mode.\n",
+            red, source_line(idata->position), white,
+            yellow, op.value, white,
+            (nt_DWORD) M)
+    }
+
+    /* Operand size `mov`-style instructions end up using; `hint` comes from `movb`/`movw`/`movd`. */
+    ut_BYTE size_from_register(struct instruction_operand &reg, ut_BYTE hint)
+    {
+        MASM_assert(hint == 0 || hint == reg_size(reg),
+            "\n%s[SIZE MISMATCH, LINE %d]%s\t%s`%s`%s operates on %d byte(s), but the register is %d byte(s).\n",
+            red, source_line(idata->position), white,
+            yellow, idata->mnemonic, white,
+            hint, reg_size(reg))
+
+        return reg_size(reg);
+    }
+
+    void validate_mov(ut_BYTE hint)
+    {
+        struct instruction_operand &lval = idata->operands[0];
+        struct instruction_operand &rval = idata->operands[1];
+
+        /* Nothing can be moved into `cs`. */
+        MASM_assert(!(lval.kind == OperandKind::OK_reg && lval.reg == AsmRegisterTokens::R_cs),
+            "\n%s[INVALID OPERANDS, LINE %d]%s\t%s`cs`%s can not be the lval of %s`%s`%s; use a far jump instead.\n",
+            red, source_line(idata->position), white,
+            yellow, white,
+            yellow, idata->mnemonic, white)
+
+        if(is_general(lval) && is_general(rval))
         {
-            case Instruction::Imov: return ut_BYTE_PTR "mov";break;
-            case Instruction::Imovw: return ut_BYTE_PTR "movw";break;
-            case Instruction::Imovd: return ut_BYTE_PTR "movd";break;
-            case Instruction::Imovb: return ut_BYTE_PTR "movb";break;
-            case Instruction::SIvar_or_label: return ut_BYTE_PTR "Variable/Label";break;
-            default: break;
+            MASM_assert(reg_size(lval) == reg_size(rval),
+                "\n%s[SIZE MISMATCH, LINE %d]%s\tBoth registers given to %s`%s`%s have to be the same size.\n",
+                red, source_line(idata->position), white,
+                yellow, idata->mnemonic, white)
+
+            idata->operand_size = size_from_register(lval, hint);
+            return;
+        }
+
+        if(is_general(lval) && (rval.kind == OperandKind::OK_imm || rval.kind == OperandKind::OK_mem))
+        { idata->operand_size = size_from_register(lval, hint); return; }
+
+        if(lval.kind == OperandKind::OK_mem && is_general(rval))
+        { idata->operand_size = size_from_register(rval, hint); return; }
+
+        /* Segment registers only move to/from 16-bit registers and memory. */
+        if((is_segment(lval) && ((is_general(rval) && reg_size(rval) == 2) || rval.kind == OperandKind::OK_mem)) ||
+            (is_segment(rval) && ((is_general(lval) && reg_size(lval) == 2) || lval.kind == OperandKind::OK_mem)))
+        { idata->operand_size = size_from_register(is_segment(lval) ? lval : rval, hint); return; }
+
+        if(lval.kind == OperandKind::OK_mem && rval.kind == OperandKind::OK_imm)
+        {
+            MASM_assert(hint != 0,
+                "\n%s[AMBIGUOUS SIZE, LINE %d]%s\tThe size of the memory being written to is unknown; use %s`movb`%s, %s`movw`%s or %s`movd`%s.\n",
+                red, source_line(idata->position), white,
+                green, white,
+                green, white,
+                green, white)
+
+            idata->operand_size = hint;
+            return;
         }
 
-        return ut_BYTE_PTR "INONE";
+        invalid_operands();
+    }
+
+    /* `add`, `sub`, `adc`, `and`, `or`, `xor`, `cmp`, `nand`, `nor`. */
+    void validate_alu()
+    {
+        struct instruction_operand &lval = idata->operands[0];
+        struct instruction_operand &rval = idata->operands[1];
+
+        /* Memory can only be combined with a register. */
+        if(lval.kind == OperandKind::OK_mem)
+        {
+            if(rval.kind != OperandKind::OK_reg) invalid_operands();
+
+            idata->operand_size = reg_size(rval);
+            return;
+        }
+
+        MASM_assert(rval.kind != OperandKind::OK_reg || reg_size(lval) == reg_size(rval),
+            "\n%s[SIZE MISMATCH, LINE %d]%s\tBoth registers given to %s`%s`%s have to be the same size.\n",
+            red, source_line(idata->position), white,
+            yellow, idata->mnemonic, white)
+
+        idata->operand_size = reg_size(lval);
+    }
+
+    /* See `MASM KW_shl` in `NOTE`. */
+    void validate_shift()
+    {
+        struct instruction_operand &lval = idata->operands[0];
+        struct instruction_operand &rval = idata->operands[1];
+
+        idata->operand_size = reg_size(lval);
+        if(idata->operand_size == 1)
+        {
+            MASM_warning("\n%s[IGNORED, LINE %d]%s\t%s`%s`%s on a byte-sized register is ignored (see `MASM KW_shl` in `NOTE`).\n",
+                yellow, source_line(idata->position), white,
+                yellow, idata->mnemonic, white)
+            return;
+        }
+        if(rval.kind != OperandKind::OK_imm) return;
+
+        ut_BYTE max_bits = idata->operand_size == 2 ? 8 : 24;
+        MASM_assert(rval.value >= 0 && rval.value <= max_bits,
+            "\n%s[INVALID SHIFT, LINE %d]%s\tA %d-byte lval can only be shifted by 0 to %d bits.\n",
+            red, source_line(idata->position), white,
+            idata->operand_size, max_bits)
     }
 
 public:
@@ -257,126 +541,118 @@ public:
 
     void assembler_check_in_new_instruction(struct MocaAsm_TD *tdata, MocaAsm_tokenizer *masm_tokenizer)
     {
-        idata->instruction = decipher_instruction(tdata->token_id);
+        idata->instruction = decipher_instruction(tdata);
+        /* `tdata` gets deleted once the parser moves on; keep a name that outlives it for diagnostics. */
+        if(tdata->token_type == TypeOfTokens::TT_datatype)
+            idata->mnemonic = data_type_token_values[tdata->token_id - (ut_BYTE) AsmDataTypeTokens::DT_db];
+        else if(tdata->symbol_id != no_symbol)
+            idata->mnemonic = masm_tokenizer->get_symbol_table()->name_of(tdata->symbol_id);
+        else
+            idata->mnemonic = keyword_token_values[tdata->token_id];
+        idata->amnt_of_operands = 0;
+        idata->operand_size = 0;
+
+        masm_tokenizer->assign_tokens_to_expect(instruction_forms[(ut_BYTE) idata->instruction].tokens_to_expect);
+    }
+
+    /* How many operands an instruction takes. */
+    ut_BYTE operand_count(Instruction instr)
+    { return instruction_forms[(ut_BYTE) instr].amnt_of_operands; }
 
-        switch(tdata->token_type)
+    /* Make sure the parsed operands are valid for the instruction in this mode and decide the operand size.
+     * Everything the encoder relies on is checked here.
+     * */
+    void validate_operands()
+    {
+        struct instruction_operand &lval = idata->operands[0];
+        struct instruction_operand &rval = idata->operands[1];
+        const struct instruction_form &form = instruction_forms[(ut_BYTE) idata->instruction];
+
+        MASM_assert(idata->amnt_of_operands == form.amnt_of_operands,
+            "\n%s[INVALID OPERANDS, LINE %d]%s\t%s`%s`%s expects %d operand(s), but got %d.\n",
+            red, source_line(idata->position), white,
+            yellow, idata->mnemonic, white,
+            form.amnt_of_operands, idata->amnt_of_operands)
+
+        for(ut_BYTE i = 0; i < idata->amnt_of_operands; i++)
         {
-            case TypeOfTokens::TT_keyword: {
-                if(is_mov_instr(idata->instruction))
-                {
-                    idata->lvaloperand_expected[0] = OperandToExpect::OPR_reg;
-                    idata->lvaloperand_expected[1] = OperandToExpect::OPR_mem;
-                    idata->lvalamount = 2;
-
-                    TypeOfTokens TTE[5] = {TypeOfTokens::TT_register, TypeOfTokens::TT_common, TypeOfTokens::TT_NONE, TypeOfTokens::TT_NONE, TypeOfTokens::TT_NONE};
-                    masm_tokenizer->assign_tokens_to_expect(TTE);
-                    return;
-                }
-
-                if(is_bit_operation(idata->instruction))
-                {
-                    idata->lvaloperand_expected[0] = OperandToExpect::OPR_reg;
-                    idata->lvalamount = 1;
-
-                    TypeOfTokens TTE[5] = {TypeOfTokens::TT_register, TypeOfTokens::TT_NONE, TypeOfTokens::TT_NONE, TypeOfTokens::TT_NONE, TypeOfTokens::TT_NONE};
-                    masm_tokenizer->assign_tokens_to_expect(TTE);
-                    return;
-                }
-
-                if(is_arith_operation(idata->instruction))
-                {
-                    switch(tdata->token_id)
-                    {
-                        case (ut_BYTE)AsmKeywordTokens::KW_dec:
-                        case (ut_BYTE)AsmKeywordTokens::KW_inc:
-                        case (ut_BYTE)AsmKeywordTokens::KW_div:
-                        case (ut_BYTE)AsmKeywordTokens::KW_mul: {
-                            idata->lvaloperand_expected[0] = OperandToExpect::OPR_reg;
-                            idata->lvalamount = 1;
-
-                            TypeOfTokens TTE[5] = {TypeOfTokens::TT_register, TypeOfTokens::TT_NONE, TypeOfTokens::TT_NONE, TypeOfTokens::TT_NONE, TypeOfTokens::TT_NONE};
-                            masm_tokenizer->assign_tokens_to_expect(TTE);
-
-                            return;
-                        }
-                        case (ut_BYTE)AsmKeywordTokens::KW_add:
-                        case (ut_BYTE)AsmKeywordTokens::KW_sub: {
-                            idata->lvaloperand_expected[0] = OperandToExpect::OPR_reg;
-                            idata->lvalamount = 1;
-
-                            TypeOfTokens TTE[5] = {TypeOfTokens::TT_register, TypeOfTokens::TT_NONE, TypeOfTokens::TT_NONE, TypeOfTokens::TT_NONE, TypeOfTokens::TT_NONE};
-                            masm_tokenizer->assign_tokens_to_expect(TTE);
-
-                            return;
-                        }
-                        default: {
-                            MASM_error("\n%s[UNKNOWN ERROR]%s\tAn unknown error occurred when checking in a new instruction.\n",
-                                red, white)
-                        }
-                    }
-                }
-
-                if(tdata->token_id == (ut_BYTE) AsmKeywordTokens::KW_special)
-                {
-                    /* Variable/Label (function). */
-                    idata->rvaloperand_expected[0] = OperandToExpect::datatype;
-                    idata->rvaloperand_expected[1] = OperandToExpect::grammar;
-                    idata->rvalamount = 2;
-
-                    TypeOfTokens TTE[5] = {TypeOfTokens::TT_datatype, TypeOfTokens::TT_grammar, TypeOfTokens::TT_NONE, TypeOfTokens::TT_NONE, TypeOfTokens::TT_NONE};
-                    masm_tokenizer->assign_tokens_to_expect(TTE);
-                }
-
-                return;
+            MASM_assert(!(idata->operands[i].kind == OperandKind::OK_reg && idata->operands[i].reg == AsmRegisterTokens::R_ip),
+                "\n%s[INVALID OPERANDS, LINE %d]%s\t%s`ip`%s can not be used as an operand.\n",
+                red, source_line(idata->position), white,
+                yellow, white)
+
+            if(!(form_of(idata->operands[i]) & (i == 0 ? form.lval : form.rval))) invalid_operands();
+            check_address(idata->operands[i]);
+        }
+
+        switch(idata->instruction)
+        {
+            case Instruction::Imov: validate_mov(0);break;
+            case Instruction::Imovb: validate_mov(1);break;
+            case Instruction::Imovw: validate_mov(2);break;
+            case Instruction::Imovd: validate_mov(4);break;
+            case Instruction::Iadc:
+            case Instruction::Iadd:
+            case Instruction::Isub:
+            case Instruction::Icmp:
+            case Instruction::Iand:
+            case Instruction::Ior:
+            case Instruction::Ixor:
+            case Instruction::Inand:
+            case Instruction::Inor: validate_alu();break;
+            case Instruction::Ishl:
+            case Instruction::Ishr: validate_shift();break;
+            case Instruction::Idiv:
+            case Instruction::Imul:
+            case Instruction::Idec:
+            case Instruction::Iinc: idata->operand_size = reg_size(lval);break;
+            case Instruction::Iint: {
+                if(lval.value < 0 || lval.value > 0xFF) invalid_operands();
+                idata->operand_size = 1;
+                break;
             }
-            case TypeOfTokens::TT_datatype: {
-                switch(tdata->token_id)
-                {
-                    case (ut_BYTE)AsmDataTypeTokens::DT_db: {
-                        idata->rvaloperand_expected[0] = OperandToExpect::OPR_imm;
-                        idata->rvalamount = 1;
-
-                        TypeOfTokens TTE[5] = {TypeOfTokens::ETT_imm8, TypeOfTokens::TT_NONE, TypeOfTokens::TT_NONE, TypeOfTokens::TT_NONE, TypeOfTokens::TT_NONE};
-                        masm_tokenizer->assign_tokens_to_expect(TTE);
-                        return;
-                    }
-                    case (ut_BYTE)AsmDataTypeTokens::DT_dw: {
-                        std::cout << "DW" << std::endl;
-                        return;
-                    }
-                    case (ut_BYTE)AsmDataTypeTokens::DT_dd: {
-                        std::cout << "DD" << std::endl;
-                        return;
-                    }
-                    case (ut_BYTE)AsmDataTypeTokens::DT_dbarr: {
-                        std::cout << "DBARR" << std::endl;
-                        return;
-                    }
-                    case (ut_BYTE)AsmDataTypeTokens::DT_dwarr: {
-                        std::cout << "DWARR" << std::endl;
-                        return;
-                    }
-                    case (ut_BYTE)AsmDataTypeTokens::DT_ddarr: {
-                        std::cout << "DDARR" << std::endl;
-                        return;
-                    }
-                    default: break;
-                }
-                return;
+            case Instruction::Iin:
+            case Instruction::Iout: {
+                /* `in al/ax, imm8/dx` and `out imm8/dx, al/ax`. */
+                struct instruction_operand &acc = idata->instruction == Instruction::Iin ? lval : rval;
+                struct instruction_operand &port = idata->instruction == Instruction::Iin ? rval : lval;
+
+                if(port.kind == OperandKind::OK_imm && (port.value < 0 || port.value > 0xFF)) invalid_operands();
+                idata->operand_size = reg_size(acc);
+                break;
             }
-            case TypeOfTokens::TT_common: printf("Common");break;
-            default: break;
+            case Instruction::Ilea: idata->operand_size = 2;break;
+            case Instruction::Ijmp:
+            case Instruction::Ijne:
+            case Instruction::Ijg:
+            case Instruction::Ijl:
+            case Instruction::Ijge:
+            case Instruction::Ijle:
+            case Instruction::Ijc:
+            case Instruction::Ijz:
+            case Instruction::Icall: idata->operand_size = mode_traits<M>::near_branch_size;break;
+            case Instruction::Icwd:
+            case Instruction::Ilodsw: idata->operand_size = 2;break;
+            default: idata->operand_size = 1;break;
         }
+
+        if(idata->amnt_of_operands == 2 && rval.kind == OperandKind::OK_imm && is_constant(rval))
+            check_fits(rval.value, idata->operand_size);
     }
 
-    void assembler_done_with_instruction(MocaAsm_tokenizer *masm_tokenizer)
+    /* Values given to db/dw/dd (and the array versions) have to fit in the datatype. */
+    void validate_data(nt_LLBYTE value, ut_BYTE size, ut_DWORD position)
     {
-        masm_tokenizer->delete_instance<struct MocaAsm_TTE> (masm_tokenizer->get_tte());
+        idata->position = position;
+        check_fits(value, size);
     }
 
     Instruction get_current_instruction()
     { return idata->instruction; }
 
+    struct InstructionData *get_instruction_data()
+    { return idata; }
+
     template<typename T>
         requires std::is_same<T, AssemblerAPI>::value ||
             std::is_same<T, struct InstructionData>::value
@@ -394,7 +670,6 @@ public:
         idata = nullptr;
     }
 };
-
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,796 @@
+#ifndef Moca_assembly_simulator
+#define Moca_assembly_simulator
+#include <algorithm>
+#include <array>
+#include <string>
+#include <vector>
+#include "asm_symbols.hpp"
+
+namespace masm_sim
+{
+
+using namespace masm_symbols;
+
+/* Where the BIOS loads a boot sector. The image is run from `load_segment:0000`, the same physical address,
+ * so the value of a label (its offset from the start of the image) is the `IP` it runs at.
+ * */
+constexpr ut_DWORD load_address = 0x7C00;
+constexpr ut_WORD load_segment = load_address >> 4;
+
+/* 1 MB, plus the 64 KB - 16 bytes above it that `FFFF:xxxx` reaches (A20 on). */
+constexpr ut_DWORD memory_size = 0x10FFF0;
+
+/* `--simulate` without a limit. */
+constexpr ut_LLBYTE default_instruction_limit = 10000000;
+
+/* Registers by their encoding (see `register_table`); the byte registers use the same numbers (al, cl, dl, bl, ah, ...). */
+constexpr ut_BYTE enc_ax = 0, enc_cx = 1, enc_dx = 2, enc_bx = 3, enc_sp = 4, enc_bp = 5, enc_si = 6, enc_di = 7;
+constexpr ut_BYTE seg_es = 0, seg_cs = 1, seg_ss = 2, seg_ds = 3, seg_fs = 4, seg_gs = 5;
+constexpr ut_BYTE no_segment_override = 0xFF;
+
+constexpr ut_WORD FL_carry      = 1 << 0;
+constexpr ut_WORD FL_parity     = 1 << 2;
+constexpr ut_WORD FL_zero       = 1 << 6;
+constexpr ut_WORD FL_sign       = 1 << 7;
+constexpr ut_WORD FL_interrupt  = 1 << 9;
+constexpr ut_WORD FL_direction  = 1 << 10;
+constexpr ut_WORD FL_overflow   = 1 << 11;
+
+enum class StopReason
+{
+    SR_running,
+    SR_halted,          // `hlt`
+    SR_idle_loop,       // a jump to itself (`jmp $`); nothing is ever going to change
+    SR_limit,           // ran the amount of instructions it was given
+    SR_unsupported,     // an opcode outside of what the assembler emits
+    SR_divide_error     // `div` by 0, or a quotient too large
+};
+
+class MocaAsm_simulator;
+
+/* A BIOS service behind `int vector`; gets the whole machine (`AH` is usually the function). */
+typedef void (*interrupt_handler)(MocaAsm_simulator &sim);
+
+/* A label and how many instructions ran from it up to the next label. */
+struct label_profile
+{
+    ut_DWORD    symbol_id;      // `no_symbol` for whatever comes before the first label
+    ut_DWORD    address;
+    ut_LLBYTE   executed;
+};
+
+/* Interpreter for the real mode x86-16 code this assembler emits: every encoding `MocaAsm_encoder<bit16>` produces,
+ * with the full 16-bit ModRM addressing and `66` operand size prefix, plus `nop`/`ret`/`stc`/`std` for `db`-built code.
+ * BIOS calls go through `interrupt_handlers`; every instruction executed is counted against the label it falls under.
+ * */
+class MocaAsm_simulator
+{
+private:
+    std::vector<ut_BYTE>    memory;
+    ut_DWORD                image_size = 0;
+
+    /* Sorted by address; `label_of[offset]` is the label every byte of the image falls under. */
+    std::vector<struct label_profile>   labels;
+    std::vector<ut_DWORD>               label_of;
+    ut_LLBYTE                           executed_outside = 0;
+
+    std::array<interrupt_handler, 256>  interrupt_handlers = {};
+    std::array<ut_LLBYTE, 256>          unhandled_interrupts = {};
+    ut_LLBYTE                           amnt_of_interrupts = 0;
+
+    ut_LLBYTE   amnt_executed = 0;
+    StopReason  stop_reason = StopReason::SR_running;
+    ut_WORD     stop_cs = 0;
+    ut_WORD     stop_ip = 0;
+    ut_BYTE     stop_opcode = 0;
+
+    /* Of the instruction being executed. */
+    ut_BYTE     segment_override = no_segment_override;
+
+    struct modrm_operand
+    {
+        ut_BYTE     mod;
+        ut_BYTE     reg;
+        ut_BYTE     rm;
+        ut_WORD     offset;     // effective address; `lea`
+        ut_DWORD    address;    // physical
+    };
+
+    static ut_LLBYTE mask_of(ut_BYTE size)
+    { return (1ULL << (size * 8)) - 1; }
+
+    static bool parity_of(ut_DWORD value)
+    { return !(__builtin_popcount(value & 0xFF) & 1); }
+
+    ut_BYTE fetch()
+    { return (ut_BYTE) read(physical(sregs[seg_cs], ip++), 1); }
+
+    ut_DWORD fetch(ut_BYTE size)
+    {
+        ut_DWORD value = read(physical(sregs[seg_cs], ip), size);
+        ip += size;
+        return value;
+    }
+
+    ut_BYTE data_segment(ut_BYTE default_segment = seg_ds)
+    { return segment_override != no_segment_override ? segment_override : default_segment; }
+
+    void decode_modrm(struct modrm_operand &m)
+    {
+        ut_BYTE byte = fetch();
+        m.mod = byte >> 6;
+        m.reg = (byte >> 3) & 7;
+        m.rm = byte & 7;
+        if(m.mod == 3) return;
+
+        ut_WORD bx = (ut_WORD) regs[enc_bx], bp = (ut_WORD) regs[enc_bp], si = (ut_WORD) regs[enc_si], di = (ut_WORD) regs[enc_di];
+        ut_BYTE segment = seg_ds;
+
+        switch(m.rm)
+        {
+            case 0: m.offset = bx + si;break;
+            case 1: m.offset = bx + di;break;
+            case 2: m.offset = bp + si; segment = seg_ss;break;
+            case 3: m.offset = bp + di; segment = seg_ss;break;
+            case 4: m.offset = si;break;
+            case 5: m.offset = di;break;
+            case 6: {
+                if(m.mod == 0) m.offset = (ut_WORD) fetch(2);
+                else { m.offset = bp; segment = seg_ss; }
+                break;
+            }
+            default: m.offset = bx;break;
+        }
+
+        if(m.mod == 1) m.offset += (st_BYTE) fetch();
+        else if(m.mod == 2) m.offset += (ut_WORD) fetch(2);
+
+        m.address = physical(sregs[data_segment(segment)], m.offset);
+    }
+
+    ut_DWORD read_rm(struct modrm_operand &m, ut_BYTE size)
+    { return m.mod == 3 ? get_reg(m.rm, size) : read(m.address, size); }
+
+    void write_rm(struct modrm_operand &m, ut_BYTE size, ut_DWORD value)
+    {
+        if(m.mod == 3) set_reg(m.rm, size, value);
+        else write(m.address, value, size);
+    }
+
+    void push(ut_WORD value)
+    {
+        regs[enc_sp] = (regs[enc_sp] & 0xFFFF0000) | (ut_WORD) (regs[enc_sp] - 2);
+        write(physical(sregs[seg_ss], (ut_WORD) regs[enc_sp]), value, 2);
+    }
+
+    ut_WORD pop()
+    {
+        ut_WORD value = (ut_WORD) read(physical(sregs[seg_ss], (ut_WORD) regs[enc_sp]), 2);
+        regs[enc_sp] = (regs[enc_sp] & 0xFFFF0000) | (ut_WORD) (regs[enc_sp] + 2);
+        return value;
+    }
+
+    void set_result_flags(ut_LLBYTE result, ut_BYTE size)
+    {
+        set_flag(FL_zero, (result & mask_of(size)) == 0);
+        set_flag(FL_sign, (result >> (size * 8 - 1)) & 1);
+        set_flag(FL_parity, parity_of((ut_DWORD) result));
+    }
+
+    /* add/or/adc/sbb/and/sub/xor/cmp, by their number in the ModRM reg field/opcode row; `a` and `b` are `size` bytes. */
+    ut_DWORD alu(ut_BYTE operation, ut_DWORD a, ut_DWORD b, ut_BYTE size)
+    {
+        ut_LLBYTE sign = 1ULL << (size * 8 - 1);
+        ut_LLBYTE carry = (operation == 2 || operation == 3) && (flags & FL_carry) ? 1 : 0;
+        ut_LLBYTE result = 0;
+
+        switch(operation)
+        {
+            case 0:
+            case 2: {
+                result = (ut_LLBYTE) a + b + carry;
+                set_flag(FL_carry, result > mask_of(size));
+                set_flag(FL_overflow, ((a ^ result) & (b ^ result) & sign) != 0);
+                break;
+            }
+            case 3:
+            case 5:
+            case 7: {
+                result = (ut_LLBYTE) a - b - carry;
+                set_flag(FL_carry, (ut_LLBYTE) a < (ut_LLBYTE) b + carry);
+                set_flag(FL_overflow, ((a ^ b) & (a ^ result) & sign) != 0);
+                break;
+            }
+            case 1: result = a | b;break;
+            case 4: result = a & b;break;
+            default: result = a ^ b;break;
+        }
+
+        if(operation == 1 || operation == 4 || operation == 6)
+        {
+            set_flag(FL_carry, false);
+            set_flag(FL_overflow, false);
+        }
+
+        set_result_flags(result, size);
+        return (ut_DWORD) (result & mask_of(size));
+    }
+
+    /* `inc`/`dec` leave the carry alone. */
+    ut_DWORD inc_dec(ut_BYTE ext, ut_DWORD value, ut_BYTE size)
+    {
+        bool carry = flags & FL_carry;
+        value = alu(ext == 0 ? 0 : 5, value, 1, size);
+        set_flag(FL_carry, carry);
+        return value;
+    }
+
+    /* shl (4), shr (5) and sar (7). */
+    bool shift(struct modrm_operand &m, ut_BYTE size, ut_BYTE count)
+    {
+        ut_LLBYTE value = read_rm(m, size);
+        ut_BYTE bits = size * 8;
+
+        count &= 0x1F;
+        if(count == 0) return true;
+
+        ut_LLBYTE result = 0;
+        switch(m.reg)
+        {
+            case 4: {
+                set_flag(FL_carry, count <= bits && ((value >> (bits - count)) & 1));
+                result = (value << count) & mask_of(size);
+                set_flag(FL_overflow, ((result >> (bits - 1)) & 1) != (ut_LLBYTE) (flags & FL_carry ? 1 : 0));
+                break;
+            }
+            case 5: {
+                set_flag(FL_carry, (value >> (count - 1)) & 1);
+                set_flag(FL_overflow, (value >> (bits - 1)) & 1);
+                result = value >> count;
+                break;
+            }
+            case 7: {
+                nt_LLBYTE signed_value = (nt_LLBYTE) (value << (64 - bits)) >> (64 - bits);
+                set_flag(FL_carry, (signed_value >> (count - 1)) & 1);
+                set_flag(FL_overflow, false);
+                result = (ut_LLBYTE) (signed_value >> count) & mask_of(size);
+                break;
+            }
+            default: return false;
+        }
+
+        set_result_flags(result, size);
+        write_rm(m, size, (ut_DWORD) result);
+        return true;
+    }
+
+    /* `F6`/`F7`: not, neg, mul and div. */
+    bool group3(ut_BYTE size)
+    {
+        struct modrm_operand m;
+        decode_modrm(m);
+        ut_LLBYTE value = read_rm(m, size);
+
+        switch(m.reg)
+        {
+            case 2: write_rm(m, size, (ut_DWORD) (~value & mask_of(size)));return true;
+            case 3: {
+                write_rm(m, size, alu(5, 0, (ut_DWORD) value, size));
+                set_flag(FL_carry, value != 0);
+                return true;
+            }
+            case 4: {
+                ut_LLBYTE product = (ut_LLBYTE) get_reg(enc_ax, size) * value;
+                ut_LLBYTE high = product >> (size * 8);
+
+                if(size == 1) set_reg(enc_ax, 2, (ut_DWORD) product);
+                else
+                {
+                    set_reg(enc_ax, size, (ut_DWORD) product);
+                    set_reg(enc_dx, size, (ut_DWORD) high);
+                }
+                set_flag(FL_carry, high != 0);
+                set_flag(FL_overflow, high != 0);
+                return true;
+            }
+            case 6: {
+                ut_LLBYTE dividend = size == 1 ? get_reg(enc_ax, 2) : ((ut_LLBYTE) get_reg(enc_dx, size) << (size * 8)) | get_reg(enc_ax, size);
+                if(value == 0 || dividend / value > mask_of(size))
+                {
+                    stop_reason = StopReason::SR_divide_error;
+                    return true;
+                }
+
+                if(size == 1) set_reg(enc_ax, 2, (ut_DWORD) ((dividend % value) << 8 | dividend / value));
+                else
+                {
+                    set_reg(enc_ax, size, (ut_DWORD) (dividend / value));
+                    set_reg(enc_dx, size, (ut_DWORD) (dividend % value));
+                }
+                return true;
+            }
+            default: break;
+        }
+
+        return false;
+    }
+
+    /* `cc` is the low nibble of `7x`/`0F 8x`. */
+    bool condition(ut_BYTE cc)
+    {
+        bool carry = flags & FL_carry, zero = flags & FL_zero, sign = flags & FL_sign, overflow = flags & FL_overflow;
+        bool result = false;
+
+        switch(cc >> 1)
+        {
+            case 0: result = overflow;break;
+            case 1: result = carry;break;
+            case 2: result = zero;break;
+            case 3: result = carry || zero;break;
+            case 4: result = sign;break;
+            case 5: result = flags & FL_parity;break;
+            case 6: result = sign != overflow;break;
+            default: result = zero || sign != overflow;break;
+        }
+
+        return cc & 1 ? !result : result;
+    }
+
+    /* A branch back to the instruction it is part of never gets anywhere else; stop there. */
+    void jump(ut_WORD start_ip, nt_DWORD displacement)
+    {
+        ip += displacement;
+        if(ip == start_ip) stop_reason = StopReason::SR_idle_loop;
+    }
+
+    void interrupt(ut_BYTE vector)
+    {
+        amnt_of_interrupts++;
+
+        if(interrupt_handlers[vector]) interrupt_handlers[vector](*this);
+        else unhandled_interrupts[vector]++;
+    }
+
+    /* Execute the instruction at `CS:IP`; false if it is not one the simulator knows. */
+    bool step()
+    {
+        ut_WORD start_ip = ip;
+        ut_BYTE size = 2;
+        ut_BYTE opcode = fetch();
+
+        segment_override = no_segment_override;
+        while(true)
+        {
+            if(opcode == 0x66) size = 4;
+            else if(opcode == 0x26 || opcode == 0x2E || opcode == 0x36 || opcode == 0x3E) segment_override = (opcode >> 3) & 3;
+            else if(opcode == 0x64 || opcode == 0x65) segment_override = opcode - 0x64 + seg_fs;
+            else if(opcode != 0xF0) break;      // `lock` changes nothing on one core
+
+            opcode = fetch();
+        }
+
+        stop_opcode = opcode;
+
+        /* add/or/adc/sbb/and/sub/xor/cmp: 00-05, 08-0D, ... 38-3D. */
+        if(opcode < 0x40 && (opcode & 7) < 6)
+        {
+            ut_BYTE operation = opcode >> 3;
+            ut_BYTE operand_size = opcode & 1 ? size : 1;
+
+            if((opcode & 7) >= 4)
+            {
+                ut_DWORD value = alu(operation, get_reg(enc_ax, operand_size), fetch(operand_size), operand_size);
+                if(operation != 7) set_reg(enc_ax, operand_size, value);
+                return true;
+            }
+
+            struct modrm_operand m;
+            decode_modrm(m);
+
+            /* `02`/`03`: the register is the lval. */
+            if(opcode & 2)
+            {
+                ut_DWORD value = alu(operation, get_reg(m.reg, operand_size), read_rm(m, operand_size), operand_size);
+                if(operation != 7) set_reg(m.reg, operand_size, value);
+                return true;
+            }
+
+            ut_DWORD value = alu(operation, read_rm(m, operand_size), get_reg(m.reg, operand_size), operand_size);
+            if(operation != 7) write_rm(m, operand_size, value);
+            return true;
+        }
+
+        if(opcode >= 0x40 && opcode <= 0x4F)
+        {
+            set_reg(opcode & 7, size, inc_dec(opcode >= 0x48, get_reg(opcode & 7, size), size));
+            return true;
+        }
+
+        if(opcode >= 0x70 && opcode <= 0x7F)
+        {
+            nt_DWORD displacement = (st_BYTE) fetch();
+            if(condition(opcode & 0xF)) jump(start_ip, displacement);
+            return true;
+        }
+
+        if(opcode >= 0xB0 && opcode <= 0xBF)
+        {
+            ut_BYTE operand_size = opcode >= 0xB8 ? size : 1;
+            set_reg(opcode & 7, operand_size, fetch(operand_size));
+            return true;
+        }
+
+        switch(opcode)
+        {
+            case 0x0F: {
+                ut_BYTE second = fetch();
+                if(second < 0x80 || second > 0x8F) { stop_opcode = second;return false; }
+
+                nt_DWORD displacement = size == 4 ? (nt_DWORD) fetch(4) : (nt_WORD) fetch(2);
+                if(condition(second & 0xF)) jump(start_ip, displacement);
+                return true;
+            }
+            case 0x80:
+            case 0x81:
+            case 0x82:
+            case 0x83: {
+                ut_BYTE operand_size = opcode & 1 ? size : 1;
+                struct modrm_operand m;
+                decode_modrm(m);
+
+                ut_DWORD immediate = opcode == 0x83 ? (ut_DWORD) ((nt_DWORD) (st_BYTE) fetch() & mask_of(size)) : fetch(operand_size);
+                ut_DWORD value = alu(m.reg, read_rm(m, operand_size), immediate, operand_size);
+                if(m.reg != 7) write_rm(m, operand_size, value);
+                return true;
+            }
+            case 0x88:
+            case 0x89:
+            case 0x8A:
+            case 0x8B: {
+                ut_BYTE operand_size = opcode & 1 ? size : 1;
+                struct modrm_operand m;
+                decode_modrm(m);
+
+                if(opcode & 2) set_reg(m.reg, operand_size, read_rm(m, operand_size));
+                else write_rm(m, operand_size, get_reg(m.reg, operand_size));
+                return true;
+            }
+            case 0x8C: {
+                struct modrm_operand m;
+                decode_modrm(m);
+                write_rm(m, m.mod == 3 ? size : 2, sregs[m.reg % 6]);
+                return true;
+            }
+            case 0x8D: {
+                struct modrm_operand m;
+                decode_modrm(m);
+                set_reg(m.reg, size, m.offset);
+                return true;
+            }
+            case 0x8E: {
+                struct modrm_operand m;
+                decode_modrm(m);
+                sregs[m.reg % 6] = (ut_WORD) read_rm(m, 2);
+                return true;
+            }
+            case 0x90: return true;break;
+            case 0x99: {
+                set_reg(enc_dx, size, (get_reg(enc_ax, size) >> (size * 8 - 1)) & 1 ? (ut_DWORD) mask_of(size) : 0);
+                return true;
+            }
+            case 0xA0:
+            case 0xA1:
+            case 0xA2:
+            case 0xA3: {
+                ut_BYTE operand_size = opcode & 1 ? size : 1;
+                ut_DWORD address = physical(sregs[data_segment()], (ut_WORD) fetch(2));
+
+                if(opcode & 2) write(address, get_reg(enc_ax, operand_size), operand_size);
+                else set_reg(enc_ax, operand_size, read(address, operand_size));
+                return true;
+            }
+            case 0xA6: {
+                ut_WORD si = (ut_WORD) regs[enc_si], di = (ut_WORD) regs[enc_di];
+                nt_WORD step = flags & FL_direction ? -1 : 1;
+
+                alu(7, read(physical(sregs[data_segment()], si), 1), read(physical(sregs[seg_es], di), 1), 1);
+                set_reg(enc_si, 2, (ut_WORD) (si + step));
+                set_reg(enc_di, 2, (ut_WORD) (di + step));
+                return true;
+            }
+            case 0xAC:
+            case 0xAD: {
+                ut_BYTE operand_size = opcode & 1 ? size : 1;
+                ut_WORD si = (ut_WORD) regs[enc_si];
+
+                set_reg(enc_ax, operand_size, read(physical(sregs[data_segment()], si), operand_size));
+                set_reg(enc_si, 2, (ut_WORD) (flags & FL_direction ? si - operand_size : si + operand_size));
+                return true;
+            }
+            case 0xC0:
+            case 0xC1:
+            case 0xD0:
+            case 0xD1:
+            case 0xD2:
+            case 0xD3: {
+                ut_BYTE operand_size = opcode & 1 ? size : 1;
+                struct modrm_operand m;
+                decode_modrm(m);
+
+                ut_BYTE count = opcode <= 0xC1 ? fetch() : opcode <= 0xD1 ? 1 : (ut_BYTE) get_reg(enc_cx, 1);
+                return shift(m, operand_size, count);
+            }
+            case 0xC3: ip = pop();return true;break;
+            case 0xC6:
+            case 0xC7: {
+                ut_BYTE operand_size = opcode & 1 ? size : 1;
+                struct modrm_operand m;
+                decode_modrm(m);
+
+                write_rm(m, operand_size, fetch(operand_size));
+                return true;
+            }
+            case 0xCD: interrupt(fetch());return true;break;
+            case 0xE4:
+            case 0xE5:
+            case 0xEC:
+            case 0xED: {
+                /* Nothing is behind any port; a device polled for "ready" looks ready. */
+                if(opcode <= 0xE5) fetch();
+                set_reg(enc_ax, opcode & 1 ? size : 1, 0);
+                return true;
+            }
+            case 0xE6:
+            case 0xE7:
+            case 0xEE:
+            case 0xEF: {
+                if(opcode <= 0xE7) fetch();
+                return true;
+            }
+            case 0xE8: {
+                nt_DWORD displacement = (nt_WORD) fetch(2);
+                push(ip);
+                ip += displacement;
+                return true;
+            }
+            case 0xE9: jump(start_ip, (nt_WORD) fetch(2));return true;break;
+            case 0xEB: jump(start_ip, (st_BYTE) fetch());return true;break;
+            case 0xF4: stop_reason = StopReason::SR_halted;return true;break;
+            case 0xF5: flags ^= FL_carry;return true;break;
+            case 0xF6: return group3(1);break;
+            case 0xF7: return group3(size);break;
+            case 0xF8: set_flag(FL_carry, false);return true;break;
+            case 0xF9: set_flag(FL_carry, true);return true;break;
+            case 0xFA: set_flag(FL_interrupt, false);return true;break;
+            case 0xFB: set_flag(FL_interrupt, true);return true;break;
+            case 0xFC: set_flag(FL_direction, false);return true;break;
+            case 0xFD: set_flag(FL_direction, true);return true;break;
+            case 0xFE:
+            case 0xFF: {
+                ut_BYTE operand_size = opcode & 1 ? size : 1;
+                struct modrm_operand m;
+                decode_modrm(m);
+                if(m.reg > 1) return false;
+
+                write_rm(m, operand_size, inc_dec(m.reg, read_rm(m, operand_size), operand_size));
+                return true;
+            }
+            default: break;
+        }
+
+        return false;
+    }
+
+public:
+    /* General purpose registers by encoding (`enc_ax`, ...), segment registers by encoding (`seg_es`, ...). */
+    ut_DWORD    regs[8] = {};
+    ut_WORD     sregs[6] = {};
+    ut_WORD     ip = 0;
+    ut_WORD     flags = 0x0002;
+
+    /* What `int 0x10, AH = 0x0E` printed. */
+    std::string console;
+
+    /* `image` goes to `load_address`, and runs from `load_segment:0000` with DS = ES = `load_segment`, SS:SP = 0000:7C00
+     * and DL = 0x80 (the drive booted from). `symtab` gives the labels instructions are counted against.
+     * */
+    MocaAsm_simulator(std::vector<ut_BYTE> &image, MocaAsm_symtab &symtab)
+        : memory(memory_size, 0)
+    {
+        image_size = (ut_DWORD) std::min<ut_LSIZE>(image.size(), memory_size - load_address);
+        std::copy(image.begin(), image.begin() + image_size, memory.begin() + load_address);
+
+        sregs[seg_cs] = sregs[seg_ds] = sregs[seg_es] = load_segment;
+        regs[enc_sp] = load_address;
+        regs[enc_dx] = 0x80;
+
+        labels.push_back({no_symbol, 0, 0});
+        for(ut_DWORD id = 0; id < symtab.amnt_of_symbols(); id++)
+            if(symtab.get(id).kind == SymbolKind::SK_label && symtab.get(id).value < image_size)
+                labels.push_back({id, symtab.get(id).value, 0});
+
+        std::stable_sort(labels.begin() + 1, labels.end(),
+            [](const struct label_profile &a, const struct label_profile &b) { return a.address < b.address; });
+
+        label_of.assign(image_size, 0);
+        for(ut_DWORD i = 1; i < labels.size(); i++)
+            std::fill(label_of.begin() + labels[i].address, label_of.end(), i);
+
+        set_default_interrupt_handlers();
+    }
+
+    static ut_DWORD physical(ut_WORD segment, ut_WORD offset)
+    { return ((ut_DWORD) segment << 4) + offset; }
+
+    ut_DWORD read(ut_DWORD address, ut_BYTE size)
+    {
+        ut_DWORD value = 0;
+        for(ut_BYTE i = 0; i < size; i++)
+            value |= (ut_DWORD) memory[(address + i) % memory_size] << (i * 8);
+        return value;
+    }
+
+    void write(ut_DWORD address, ut_DWORD value, ut_BYTE size)
+    {
+        for(ut_BYTE i = 0; i < size; i++)
+            memory[(address + i) % memory_size] = (value >> (i * 8)) & 0xFF;
+    }
+
+    ut_DWORD get_reg(ut_BYTE encoding, ut_BYTE size)
+    {
+        if(size == 1) return encoding < 4 ? regs[encoding] & 0xFF : (regs[encoding - 4] >> 8) & 0xFF;
+        return size == 2 ? regs[encoding] & 0xFFFF : regs[encoding];
+    }
+
+    void set_reg(ut_BYTE encoding, ut_BYTE size, ut_DWORD value)
+    {
+        switch(size)
+        {
+            case 1: {
+                if(encoding < 4) regs[encoding] = (regs[encoding] & ~0xFFu) | (value & 0xFF);
+                else regs[encoding - 4] = (regs[encoding - 4] & ~0xFF00u) | ((value & 0xFF) << 8);
+                break;
+            }
+            case 2: regs[encoding] = (regs[encoding] & 0xFFFF0000) | (value & 0xFFFF);break;
+            default: regs[encoding] = value;break;
+        }
+    }
+
+    void set_flag(ut_WORD flag, bool set)
+    { flags = set ? flags | flag : flags & ~flag; }
+
+    /* `handler` of `nullptr` leaves `int vector` doing nothing (it still gets counted as unhandled). */
+    void set_interrupt_handler(ut_BYTE vector, interrupt_handler handler)
+    { interrupt_handlers[vector] = handler; }
+
+    /* Stubs for the BIOS services boot code uses; enough for it to carry on as if the call worked. */
+    void set_default_interrupt_handlers()
+    {
+        /* Video: teletype output goes to `console`. */
+        set_interrupt_handler(0x10, [](MocaAsm_simulator &sim) {
+            if(sim.get_reg(enc_ax, 2) >> 8 == 0x0E) sim.console.push_back((nt_BYTE) sim.get_reg(enc_ax, 1));
+        });
+
+        /* Conventional memory, in KB. */
+        set_interrupt_handler(0x12, [](MocaAsm_simulator &sim) { sim.set_reg(enc_ax, 2, 639); });
+
+        /* Disk: every function succeeds (reads leave memory as it is; AL keeps the amount of sectors asked for). */
+        set_interrupt_handler(0x13, [](MocaAsm_simulator &sim) {
+            sim.set_reg(enc_ax + 4, 1, 0);
+            sim.set_flag(FL_carry, false);
+        });
+
+        /* Extended services (A20, memory maps, ...): "not supported". */
+        set_interrupt_handler(0x15, [](MocaAsm_simulator &sim) {
+            sim.set_reg(enc_ax + 4, 1, 0x86);
+            sim.set_flag(FL_carry, true);
+        });
+
+        /* Keyboard: no key is waiting, and waiting for one returns Enter. */
+        set_interrupt_handler(0x16, [](MocaAsm_simulator &sim) {
+            ut_BYTE function = (ut_BYTE) (sim.get_reg(enc_ax, 2) >> 8);
+
+            if(function == 0x01 || function == 0x11) sim.set_flag(FL_zero, true);
+            else sim.set_reg(enc_ax, 2, 0x1C0D);
+        });
+
+        /* Time: midnight, and it stays that way. */
+        set_interrupt_handler(0x1A, [](MocaAsm_simulator &sim) {
+            sim.set_reg(enc_cx, 2, 0);
+            sim.set_reg(enc_dx, 2, 0);
+            sim.set_flag(FL_carry, false);
+        });
+    }
+
+    /* Run until `hlt`, a jump to itself, something the simulator does not know or `instruction_limit` instructions. */
+    StopReason run(ut_LLBYTE instruction_limit = default_instruction_limit)
+    {
+        while(stop_reason == StopReason::SR_running)
+        {
+            if(amnt_executed == instruction_limit)
+            {
+                stop_reason = StopReason::SR_limit;
+                stop_cs = sregs[seg_cs];
+                stop_ip = ip;
+                break;
+            }
+
+            stop_cs = sregs[seg_cs];
+            stop_ip = ip;
+
+            ut_DWORD at = physical(stop_cs, stop_ip) - load_address;
+            if(at < image_size) labels[label_of[at]].executed++;
+            else executed_outside++;
+
+            amnt_executed++;
+            if(!step())
+            {
+                stop_reason = StopReason::SR_unsupported;
+                amnt_executed--;
+                if(at < image_size) labels[label_of[at]].executed--;
+                else executed_outside--;
+            }
+        }
+
+        return stop_reason;
+    }
+
+    /* `--simulate`: why it stopped, and the labels instructions ran under, the most executed first. */
+    void report(MocaAsm_symtab &symtab)
+    {
+        static const nt_BYTE *reasons[] = {"running", "hlt", "jump to itself", "instruction limit", "unsupported opcode", "divide error"};
+        constexpr ut_DWORD amnt_shown = 32;
+        constexpr ut_LSIZE amnt_of_console_shown = 256;
+
+        MASM_report("\n%s[SIMULATION]%s\n", yellow, white);
+        MASM_report("\t%-24s %s at %04X:%04X", "stopped", reasons[(ut_BYTE) stop_reason], stop_cs, stop_ip);
+        if(stop_reason == StopReason::SR_unsupported) MASM_report(" (0x%02X)", stop_opcode);
+        MASM_report("\n");
+        MASM_report("\t%-24s %12llu\n", "instructions", amnt_executed);
+        MASM_report("\t%-24s %12llu\n", "interrupts", amnt_of_interrupts);
+
+        for(ut_WORD vector = 0; vector < 256; vector++)
+            if(unhandled_interrupts[vector])
+                MASM_report("\t%-24s %12llu (int 0x%02X)\n", "unhandled interrupts", unhandled_interrupts[vector], vector);
+
+        if(!console.empty())
+        {
+            std::string printable;
+            for(ut_LSIZE i = 0; i < console.size() && i < amnt_of_console_shown; i++)
+                printable += console[i] == '\r' ? std::string("\\r") : console[i] == '\n' ? std::string("\\n") : std::string(1, console[i]);
+
+            MASM_report("\t%-24s \"%s\"", "console", printable.c_str());
+            if(console.size() > amnt_of_console_shown) MASM_report(" (and %llu more characters)", console.size() - amnt_of_console_shown);
+            MASM_report("\n");
+        }
+
+        std::vector<struct label_profile> by_count(labels);
+        std::stable_sort(by_count.begin(), by_count.end(),
+            [](const struct label_profile &a, const struct label_profile &b) { return a.executed > b.executed; });
+
+        MASM_report("\n\t%-24s %12s %8s\n", "label", "executed", "share");
+        for(ut_DWORD i = 0; i < by_count.size() && i < amnt_shown && by_count[i].executed; i++)
+            MASM_report("\t%-24s %12llu %7.2f%%\n",
+                by_count[i].symbol_id == no_symbol ? "(image start)" : symtab.name_of(by_count[i].symbol_id),
+                by_count[i].executed,
+                100.0 * by_count[i].executed / amnt_executed);
+
+        if(by_count.size() > amnt_shown && by_count[amnt_shown].executed)
+            MASM_report("\t... and more labels\n");
+        if(executed_outside)
+            MASM_report("\t%-24s %12llu %7.2f%%\n", "(outside the image)", executed_outside, 100.0 * executed_outside / amnt_executed);
+    }
+
+    std::vector<struct label_profile> &get_labels()
+    { return labels; }
+
+    ut_LLBYTE get_amnt_executed()
+    { return amnt_executed; }
+
+    ~MocaAsm_simulator()
+    {}
+};
+
+}
+
+#endif
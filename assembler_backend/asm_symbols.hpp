@@ -0,0 +1,198 @@
+#ifndef Moca_assembly_symbols
+#define Moca_assembly_symbols
+#include <string>
+#include <vector>
+#include "../asm_lines.hpp"
+
+namespace masm_symbols
+{
+
+/* Every label/variable name (`KW_special`) gets a dense id the first time it is seen.
+ * Everything after the tokenizer (fixups, `-SAN`, expressions) works on ids instead of strings.
+ * */
+constexpr ut_DWORD no_symbol = 0xFFFFFFFF;
+
+/* FNV-1a; the one hash of a name, used by the symbol table, the `-SAN` index, the linker and the reserved names of the lexer,
+ * so what one of them hashes always matches the others. `constexpr`, so the reserved names get hashed at compile time.
+ * */
+constexpr ut_DWORD hash_name(const nt_BYTE *name, ut_LSIZE length)
+{
+    ut_DWORD hash = 0x811C9DC5;
+
+    for(ut_LSIZE i = 0; i < length; i++)
+    {
+        hash ^= (ut_BYTE) name[i];
+        hash *= 0x01000193;
+    }
+
+    return hash;
+}
+
+/* Up to the NUL. */
+constexpr ut_DWORD hash_name(const nt_BYTE *name)
+{ return hash_name(name, std::char_traits<nt_BYTE>::length(name)); }
+
+enum class SymbolKind
+{
+    SK_undefined,   // referenced, but not (yet) defined
+    SK_label,       // `name:`
+    SK_variable,    // `name db/dw/dd/dbarr/dwarr/ddarr ...`
+    SK_removed      // defined, but dropped along with everything else nothing could reach (`-EFBP adasm`)
+};
+
+struct symbol_entry
+{
+    const nt_BYTE   *name;      // interned; lives in the symbol table's arena, NUL-terminated
+    ut_DWORD        hash;
+    ut_WORD         length;
+    SymbolKind      kind;
+    ut_WORD         section;
+    ut_DWORD        value;
+    ut_DWORD        size;       // `name db ...`: bytes of every value it was given
+    ut_DWORD        position;   // source position of the definition (see `MocaAsm_source_map`)
+};
+
+/* Flat open-addressing hash map (linear probing) over a string arena.
+ * The index only stores `id + 1` (0 is an empty slot) and is kept at most half full,
+ * and each entry keeps its hash, so a lookup is a slot or two plus one `memcmp`, no matter how many symbols there are.
+ * */
+class MocaAsm_symtab
+{
+private:
+    static constexpr ut_DWORD arena_block_size = 64 * 1024;
+
+    std::vector<struct symbol_entry>    symbols;
+    std::vector<ut_DWORD>               index;
+
+    /* Names are copied into large blocks that never move, so `symbol_entry::name` stays valid. */
+    std::vector<nt_BYTE *>              arena_blocks;
+    ut_DWORD                            arena_used = arena_block_size;
+
+    const nt_BYTE *arena_copy(const nt_BYTE *name, ut_LSIZE length)
+    {
+        if(arena_used + length + 1 > arena_block_size)
+        {
+            /* Names too big for a block get one to themselves. */
+            arena_blocks.push_back(new nt_BYTE[length + 1 > arena_block_size ? length + 1 : arena_block_size]);
+            arena_used = 0;
+        }
+
+        nt_BYTE *copy = arena_blocks.back() + arena_used;
+        memcpy(copy, name, length);
+        copy[length] = '\0';
+
+        arena_used = length + 1 > arena_block_size ? arena_block_size : arena_used + (ut_DWORD) length + 1;
+        return copy;
+    }
+
+    ut_DWORD find_slot(const nt_BYTE *name, ut_LSIZE length, ut_DWORD hash)
+    {
+        ut_DWORD mask = (ut_DWORD) index.size() - 1;
+        ut_DWORD slot = hash & mask;
+
+        while(index[slot] != 0)
+        {
+            struct symbol_entry &entry = symbols[index[slot] - 1];
+            if(entry.hash == hash && entry.length == length && memcmp(entry.name, name, length) == 0)
+                break;
+
+            slot = (slot + 1) & mask;
+        }
+
+        return slot;
+    }
+
+    void grow()
+    {
+        std::vector<ut_DWORD> old_index;
+        old_index.swap(index);
+        index.assign(old_index.size() * 2, 0);
+
+        ut_DWORD mask = (ut_DWORD) index.size() - 1;
+        for(ut_DWORD id_plus_1 : old_index)
+        {
+            if(id_plus_1 == 0) continue;
+
+            ut_DWORD slot = symbols[id_plus_1 - 1].hash & mask;
+            while(index[slot] != 0) slot = (slot + 1) & mask;
+            index[slot] = id_plus_1;
+        }
+    }
+
+public:
+    MocaAsm_symtab()
+    {
+        index.assign(1024, 0);
+    }
+
+    /* Get the id of `name`, adding it (as `SK_undefined`) if this is the first time it is seen. */
+    ut_DWORD intern(const nt_BYTE *name, ut_LSIZE length)
+    {
+        MASM_assert(length <= 0xFFFF,
+            "\n%s[SYMBOL ERROR]%s\tThe name `%.32s...` is too long.\n",
+            red, white,
+            name)
+
+        ut_DWORD hash = hash_name(name, length);
+        ut_DWORD slot = find_slot(name, length, hash);
+
+        if(index[slot] != 0) return index[slot] - 1;
+
+        struct symbol_entry entry = {arena_copy(name, length), hash, (ut_WORD) length, SymbolKind::SK_undefined, 0, 0, 0, 0};
+        symbols.push_back(entry);
+        index[slot] = (ut_DWORD) symbols.size();
+
+        if(symbols.size() * 2 > index.size()) grow();
+        return (ut_DWORD) symbols.size() - 1;
+    }
+
+    ut_DWORD intern(const nt_BYTE *name)
+    { return intern(name, strlen(name)); }
+
+    /* Same as `intern`, but never adds `name`; returns `no_symbol` if it has not been seen. */
+    ut_DWORD find(const nt_BYTE *name, ut_LSIZE length)
+    {
+        ut_DWORD slot = find_slot(name, length, hash_name(name, length));
+        return index[slot] != 0 ? index[slot] - 1 : no_symbol;
+    }
+
+    ut_DWORD find(const nt_BYTE *name)
+    { return find(name, strlen(name)); }
+
+    /* Turn a referenced name into a label/variable. Defining a symbol twice is an error. */
+    void define(ut_DWORD id, SymbolKind kind, ut_DWORD size, ut_DWORD position)
+    {
+        struct symbol_entry &entry = symbols[id];
+
+        MASM_assert(entry.kind == SymbolKind::SK_undefined,
+            "\n%s[SYMBOL ERROR, LINE %d]%s\t%s`%s`%s was already defined on line %d.\n",
+            red, masm_lines::source_line(position), white,
+            yellow, entry.name, white,
+            masm_lines::source_line(entry.position))
+
+        entry.kind = kind;
+        entry.size = size;
+        entry.position = position;
+    }
+
+    struct symbol_entry &get(ut_DWORD id)
+    { return symbols[id]; }
+
+    const nt_BYTE *name_of(ut_DWORD id)
+    { return symbols[id].name; }
+
+    ut_DWORD amnt_of_symbols()
+    { return (ut_DWORD) symbols.size(); }
+
+    ~MocaAsm_symtab()
+    {
+        for(nt_BYTE *block : arena_blocks)
+            delete[] block;
+
+        arena_blocks.clear();
+    }
+};
+
+}
+
+#endif
@@ -5,6 +5,9 @@
 #include <limits>
 #include <stdlib.h>
 #include <unistd.h>
+/* Pulled in before the color macros below (`reset`) can clash with them. */
+#include <algorithm>
+#include <thread>
 
 extern "C"
 {
@@ -86,18 +89,18 @@ extern "C"
 #define white				ut_BYTE_CPTR "\e[0;97m"
 #define reset				white
 
-/* Custom asserts/printing.
+#include "asm_diag.hpp"
+
+/* Custom asserts/printing; all of it goes through `masm_diag::sink`.
  * `dot_doc_assert_NERR` means assert, but warn rather than error and exit.
  * */
 #define MASM_error(msg, ...)			\
 {						\
-	fprintf(stderr, msg, ##__VA_ARGS__);	\
-	exit(EXIT_FAILURE);			\
+	masm_diag::sink.emit(masm_diag::DiagSeverity::DS_error, nt_BYTE_CPTR msg, ##__VA_ARGS__);	\
+	masm_diag::sink.fail();			\
 }
 #define MASM_warning(msg, ...)       \
-{                                       \
-    fprintf(stderr, msg, ##__VA_ARGS__);\
-}
+    MASM_DIAG_EMIT(masm_diag::DiagSeverity::DS_warning, msg, ##__VA_ARGS__)
 #define MASM_assert(cond, msg, ...)		\
 	if(!(cond)) 				\
 		MASM_error(msg, ##__VA_ARGS__)
@@ -5,7 +5,7 @@ int main(int args, char *argv[])
 {
 	/* First argument should be the file to work with. */
 	MASM_assert(args > 1, 
-		"\n%sInvalid Amount Of Arguments:%s\n\tMASM expects an assembly file as the first argument always.\n\tHere are two ways to pass the file as the first argument:\n\t\t%s`masm -f [file] [other arguments]`%s or %s`masm [file] [other_arguments]`%s.\n\n\t%s`[other arguments]`%s can be:\n\n\t1. -AT: AT stands for Assembly Type. Following -AT will be `bit16`, `bit32` or `bit64`.\n\t\tExample: %s`masm -f [file] -AT bit16`%s\n\n\t2. -ED: ED stands for Explicit Debug. This argument does not require anything following it like -AT does. -ED tells the assembler to display explicit debug info to the terminal.\n\t\tExample: %s`masm -f [file] -ED`%s\n\n\t3. -EDL: EDL stands for Explicit Debug Logs. This argument does not require anything following it like -AT does.\n\t   -EDL tells the assembler to write explicit debug information to a \"log\" file.\n\t\tExample: %s`masm -f [file] -EDL`%s\n\n\t4. -EFBP: EFAMP stands for Enforce Famp Boot Protocol. Moca Assember is a part of the FAMP boot protocol.\n\t   -EFBP tells the assembler to enforce needed information that the FAMP boot protocol would need. With -EFBP, you will be required to pass `mbr`, `ssboot` or `adasm`.\n\t   `-EFBP mbr` tells the assembler to enforece specification for the Master Boot Record (MBR).\n\t   `-EFBP ssboot` tells the assembler to enforece specification for second-stage bootloader.\n\t   `-EFBP adasm` tells the assembler that the assembly file being passed will be a \"add-on\" assembly library.\n\t\tExample for MBR:\t\t\t%s`masm -f [file] -EFBP mbr`%s\n\t\tExample for Second Stage Bootloader:\t%s`masm -f [file] -EFBP ssboot`%s\n\t\tExample for \"Add-On\" Assembly Library:  %s`masm -f [file] -EFBP adasm`%s\n\n\t5. -SAN: SAN stand for Store All Names. -SAN tells the assembler to take all variable/\"structure\" names and save them in another binary file for reference later on.\n\t   This will be useful if you are planning on using MocaLink, a custom linker written for MocaAsm.\n\t\tExample: %s`masm -f [file] -SAN`%s\n\n\n",
+		"\n%sInvalid Amount Of Arguments:%s\n\tMASM expects an assembly file as the first argument always.\n\tHere are two ways to pass the file as the first argument:\n\t\t%s`masm -f [file] [other arguments]`%s or %s`masm [file] [other_arguments]`%s.\n\n\t%s`[other arguments]`%s can be:\n\n\t1. -AT: AT stands for Assembly Type. Following -AT will be `bit16`, `bit32` or `bit64`.\n\t   Defaults to `bit16`.\n\t\tExample: %s`masm -f [file] -AT bit16`%s\n\n\t2. -ED: ED stands for Explicit Debug. This argument does not require anything following it like -AT does. -ED tells the assembler to display explicit debug info to the terminal.\n\t\tExample: %s`masm -f [file] -ED`%s\n\n\t3. -EDL: EDL stands for Explicit Debug Logs. This argument does not require anything following it like -AT does.\n\t   -EDL tells the assembler to write explicit debug information to a \"log\" file.\n\t\tExample: %s`masm -f [file] -EDL`%s\n\n\t4. -EFBP: EFAMP stands for Enforce Famp Boot Protocol. Moca Assember is a part of the FAMP boot protocol.\n\t   -EFBP tells the assembler to enforce needed information that the FAMP boot protocol would need. With -EFBP, you will be required to pass `mbr`, `ssboot` or `adasm`.\n\t   `-EFBP mbr` tells the assembler to enforece specification for the Master Boot Record (MBR).\n\t   `-EFBP ssboot` tells the assembler to enforece specification for second-stage bootloader.\n\t   `-EFBP adasm` tells the assembler that the assembly file being passed will be a \"add-on\" assembly library.\n\t   With `-EFBP mbr` and `-EFBP ssboot`, the bytes of code, data and padding every label puts into the binary are listed (see `--budget=`),\n\t   and with `-EFBP mbr` the binary has to fit in 510 bytes followed by the `0xAA55` signature.\n\t   With `-EFBP adasm`, every routine and piece of data that can not be reached from the start of a section or from a name given with `--export=` is left out,\n\t   and what was left out is listed along with the bytes it saved. Addresses written as numbers are not followed.\n\t\tExample for MBR:\t\t\t%s`masm -f [file] -EFBP mbr`%s\n\t\tExample for Second Stage Bootloader:\t%s`masm -f [file] -EFBP ssboot`%s\n\t\tExample for \"Add-On\" Assembly Library:  %s`masm -f [file] -EFBP adasm`%s\n\n\t5. -SAN: SAN stand for Store All Names. -SAN tells the assembler to take all variable/\"structure\" names and save them in another binary file for reference later on.\n\t   This will be useful if you are planning on using MocaLink, a custom linker written for MocaAsm. `file.masm` gets its names written to `file.san`; `mocasan file.san` verifies and lists it.\n\t\tExample: %s`masm -f [file] -SAN`%s\n\n\t6. --trace=[out]: writes a Chrome/Perfetto trace-event JSON file to `[out]` with a span for each file, `incsrc` and assembler phase.\n\t   Load it in `chrome://tracing` or `ui.perfetto.dev`.\n\t\tExample: %s`masm -f [file] --trace=out.json`%s\n\n\t7. --alloc-gate=[N]: only in builds made with `make alloc-profile`. Prints allocation counts, bytes and peak live memory per phase and per source line range,\n\t   and fails if the assembler made more than `[N]` allocations per KB of source.\n\t\tExample: %s`masm -f [file] --alloc-gate=200`%s\n\n\t8. -o: the file to write the assembled binary to. Defaults to `[file]` with a `.bin` extension.\n\t\tExample: %s`masm -f [file] -o boot.bin`%s\n\n\t9. --ir-stats: prints how many IR records/expressions the program turned into and how much memory each record takes,\n\t   and how many macro expansions were copied from an earlier expansion with the same arguments.\n\t\tExample: %s`masm -f [file] --ir-stats`%s\n\n\t10. -O: rewrites instructions into shorter forms that do the same thing (`mov ax, 0` -> `xor ax, ax` when the flags are not used, `add ax, 1` -> `inc ax`, ...)\n\t    and drops redundant moves. Prints how many bytes each rule saved.\n\t\tExample: %s`masm -f [file] -O`%s\n\n\t11. -OF: OF stands for Output Format. Following -OF will be `bin` (flat binary) or `elf32` (ELF32 relocatable object, written to `[file].o`).\n\t    Labels used but not defined in `[file]` become relocations for the linker; every label/variable is exported.\n\t\tExample: %s`masm -f [file] -AT bit32 -OF elf32`%s\n\n\t12. --link: links objects made with `-OF elf32` into one flat binary, instead of assembling a file. It goes first, followed by the objects, in the order\n\t    their sections should be placed. `-o` names the binary (defaults to the first object with a `.bin` extension), `--base=` is the address it is loaded at\n\t    (defaults to 0), `-SAN` writes every global with its final address next to it and `--ir-stats` prints what was linked.\n\t\tExample: %s`masm --link mbr.o ssboot.o lib.o -o boot.bin --base=0x7C00`%s\n\n\t13. --threads=[N]: how many threads encode the program (defaults to one per core). Encoding is split into chunks of records that get spread over the threads.\n\t    `--check-determinism` encodes everything a second time on one thread and fails if the output is not the same.\n\t\tExample: %s`masm -f [file] --threads=4 --check-determinism`%s\n\n\t14. --lexer=: `serial` lexes a token whenever the parser needs one, `pipelined` lexes the file on a thread of its own, ahead of the parser.\n\t    `parallel` splits the file into chunks of about 1 MB (at the end of a line) and lexes them on `--threads=` threads, ahead of the parser.\n\t    `auto` (the default) lexes files of 4 MB or more in parallel on machines with more than two cores, and pipelines files of 256 KB or more on machines with more than one core.\n\t\tExample: %s`masm -f [file] --lexer=pipelined`%s\n\n\t15. --max-errors=[N]: reports up to `[N]` errors in one run instead of stopping at the first one (the default is 1). After an error, assembling carries on with the next line\n\t    (the rest of the line with the error is skipped); nothing gets written if there was any error. Files get lexed serially with it.\n\t\tExample: %s`masm -f [file] --max-errors=50`%s\n\n\t16. --simulate[=N]: runs the binary as a boot sector after assembling it (loaded at 0x7C00, with CS = DS = ES = 0x07C0), for at most `[N]` instructions\n\t    (defaults to 10000000), and prints how many instructions ran under each label. BIOS calls are stubbed; `int 0x10` teletype output is printed.\n\t    It stops at `hlt`, at a jump to itself (`jmp $`) or at an instruction it does not know. Needs %s`-AT bit16`%s and %s`-OF bin`%s.\n\t\tExample: %s`masm -f [file] --simulate`%s\n\n\t17. --cycles=[model]: estimates how many cycles every instruction takes on `[model]` (`8086`, `286`, `386` or `modern`), from the table in `cycles/[model].cyc`\n\t    next to the assembler's `bin/` (or a table of your own, given by a path with a `/` in it or ending in `.cyc`). `[file]` gets its instructions written to `[file].cycles` with their address, size and cycles,\n\t    and the labels, basic blocks and loops that take the most cycles are printed.\n\t\tExample: %s`masm -f [file] --cycles=8086`%s\n\n\t18. --align-loops=[N][,budget]: pads every loop head (a label a later `jmp`/`jcc` branches back to) with NOPs so it starts on a multiple of `[N]`,\n\t    spending at most `[budget]` bytes of padding per section (defaults to 32); loop heads past the budget are left where they are.\n\t    Padding only ever goes where the budget allows, so a boot sector ending in %s`pad 510 - $ db 0x0`%s keeps fitting as long as the budget does.\n\t    `align [N][, fill]` in the source always pads, with NOPs or with `fill` bytes.\n\t\tExample: %s`masm -f [file] --align-loops=16,24`%s\n\n\t19. --export=[name,...]: names (separated by commas) that `-EFBP adasm` keeps, along with everything they use, even if nothing in `[file]` uses them.\n\t\tExample: %s`masm -f [file] -EFBP adasm --export=print_string,read_sector`%s\n\n\t20. --budget=[name:bytes,...]: the most bytes a label (and everything up to the next label of its section) may put into the binary.\n\t    Lists what every label puts into the binary (as with `-EFBP mbr`/`ssboot`), and fails without writing anything if a label goes over its budget.\n\t\tExample: %s`masm -f [file] -EFBP mbr --budget=load_stage2:64,print:24`%s\n\n\n",
 		red, white,
 		green, white,
 		green, white,
@@ -16,10 +16,82 @@ int main(int args, char *argv[])
 		green, white,
 		green, white,
 		green, white,
+		green, white,
+		green, white,
+		green, white,
+		green, white,
+		green, white,
+		green, white,
+		green, white,
+		green, white,
+		green, white,
+		green, white,
+		green, white,
+		green, white,
+		green, white,
+		green, white,
+		green, white,
+		green, white,
+		green, white,
+		green, white,
 		green, white)
 	
 	ut_BYTE arg_index = 1;
-    masm_assembler *massembler = nullptr;
+	nt_BYTE *filename = nullptr;
+	double alloc_gate = 0.0;
+	struct assembler_options options;
+	
+	/* `masm --link [unit.o ...] [-o out] [--base=address] [-SAN] [--ir-stats] [--trace=out]`. */
+	if(strcmp(argv[1], "--link") == 0)
+	{
+		std::vector<const nt_BYTE *> inputs;
+		ut_DWORD base = 0;
+
+		for(nt_DWORD i = 2; i < args; i++)
+		{
+			if(strcmp(argv[i], "-o") == 0)
+			{
+				MASM_assert(i + 1 < args,
+					"\n%sArgument Error:%s\n\tMissing `[out]` following `-o`.\n",
+					red, white)
+
+				options.output_filename = argv[++i];
+			}
+			else if(strncmp(argv[i], "--base=", 7) == 0)
+			{
+				nt_BYTE *end = nullptr;
+				base = (ut_DWORD) strtoul(&argv[i][7], &end, 0);
+
+				MASM_assert(argv[i][7] != '\0' && *end == '\0',
+					"\n%sArgument Error:%s\n\t`--base=` expects an address, like %s`--base=0x7C00`%s.\n",
+					red, white,
+					green, white)
+			}
+			else if(strcmp(argv[i], "-SAN") == 0) options.store_all_names = true;
+			else if(strcmp(argv[i], "--ir-stats") == 0) options.ir_stats = true;
+			else if(strncmp(argv[i], "--trace=", 8) == 0 && argv[i][8] != '\0') masm_trace::tracer.enable(&argv[i][8]);
+			else
+			{
+				MASM_assert(argv[i][0] != '-',
+					"\n%sArgument Error:%s\n\t`%s` can not be used with `--link`.\n",
+					red, white,
+					argv[i])
+
+				inputs.push_back(argv[i]);
+			}
+		}
+
+		MASM_assert(!inputs.empty(),
+			"\n%sArgument Error:%s\n\t`--link` expects at least one object file assembled with %s`-OF elf32`%s.\n",
+			red, white,
+			green, white)
+
+		link(inputs, base, options);
+		masm_trace::tracer.write();
+
+		masm_diag::sink.flush();
+		return 0;
+	}
 	
 	reloop:
 	if(arg_index == 1)
@@ -43,13 +115,221 @@ int main(int args, char *argv[])
 				argv[arg_index])
 		}
 
-        massembler = new masm_assembler(argv[arg_index]);
+        filename = argv[arg_index];
         arg_index++;
 
 		goto reloop;
 	}
 
-    massembler->delete_instance<masm_assembler> (massembler);
-	
+	if(arg_index < args)
+	{
+		if(strcmp(argv[arg_index], "-SAN") == 0)
+			options.store_all_names = true;
+
+		if(strcmp(argv[arg_index], "--ir-stats") == 0)
+			options.ir_stats = true;
+
+		if(strcmp(argv[arg_index], "-O") == 0)
+			options.optimize = true;
+
+		if(strncmp(argv[arg_index], "--lexer=", 8) == 0)
+		{
+			MASM_assert(strcmp(&argv[arg_index][8], "serial") == 0 || strcmp(&argv[arg_index][8], "pipelined") == 0 || strcmp(&argv[arg_index][8], "parallel") == 0 || strcmp(&argv[arg_index][8], "auto") == 0,
+				"\n%sArgument Error:%s\n\t`--lexer=` expects %s`serial`%s, %s`pipelined`%s, %s`parallel`%s or %s`auto`%s.\n",
+				red, white,
+				green, white,
+				green, white,
+				green, white,
+				green, white)
+
+			if(strcmp(&argv[arg_index][8], "serial") == 0) options.lexer_mode = LexerMode::LM_serial;
+			else if(strcmp(&argv[arg_index][8], "pipelined") == 0) options.lexer_mode = LexerMode::LM_pipelined;
+			else if(strcmp(&argv[arg_index][8], "parallel") == 0) options.lexer_mode = LexerMode::LM_parallel;
+			else options.lexer_mode = LexerMode::LM_auto;
+		}
+
+		if(strcmp(argv[arg_index], "--check-determinism") == 0)
+			options.check_determinism = true;
+
+		if(strncmp(argv[arg_index], "--max-errors=", 13) == 0)
+		{
+			options.max_errors = (ut_DWORD) atoi(&argv[arg_index][13]);
+			MASM_assert(options.max_errors > 0,
+				"\n%sArgument Error:%s\n\t`--max-errors=` expects a positive amount of errors.\n",
+				red, white)
+		}
+
+		if(strcmp(argv[arg_index], "--simulate") == 0)
+			options.simulate = default_instruction_limit;
+
+		if(strncmp(argv[arg_index], "--simulate=", 11) == 0)
+		{
+			options.simulate = strtoull(&argv[arg_index][11], nullptr, 0);
+			MASM_assert(options.simulate > 0,
+				"\n%sArgument Error:%s\n\t`--simulate=` expects a positive amount of instructions.\n",
+				red, white)
+		}
+
+		if(strncmp(argv[arg_index], "--cycles=", 9) == 0)
+		{
+			MASM_assert(argv[arg_index][9] != '\0',
+				"\n%sArgument Error:%s\n\tMissing `[model]` following `--cycles=`.\n",
+				red, white)
+
+			options.cycle_model = &argv[arg_index][9];
+		}
+
+		if(strncmp(argv[arg_index], "--align-loops=", 14) == 0)
+		{
+			nt_BYTE *end = nullptr;
+			options.loop_alignment = (ut_DWORD) strtoul(&argv[arg_index][14], &end, 0);
+			if(*end == ',') options.loop_budget = (ut_DWORD) strtoul(end + 1, &end, 0);
+
+			MASM_assert(*end == '\0' && options.loop_alignment > 1 && options.loop_alignment <= max_alignment && (options.loop_alignment & (options.loop_alignment - 1)) == 0,
+				"\n%sArgument Error:%s\n\t`--align-loops=` expects a power of two up to %u, optionally followed by a budget in bytes; %s`--align-loops=16,24`%s.\n",
+				red, white,
+				max_alignment,
+				green, white)
+		}
+
+		if(strncmp(argv[arg_index], "--threads=", 10) == 0)
+		{
+			options.amnt_of_threads = (ut_DWORD) atoi(&argv[arg_index][10]);
+			MASM_assert(options.amnt_of_threads > 0,
+				"\n%sArgument Error:%s\n\t`--threads=` expects a positive amount of threads.\n",
+				red, white)
+		}
+
+		if(strcmp(argv[arg_index], "-AT") == 0)
+		{
+			arg_index++;
+			MASM_assert(arg_index < args && (strcmp(argv[arg_index], "bit16") == 0 || strcmp(argv[arg_index], "bit32") == 0 || strcmp(argv[arg_index], "bit64") == 0),
+				"\n%sArgument Error:%s\n\t`-AT` expects %s`bit16`%s, %s`bit32`%s or %s`bit64`%s.\n",
+				red, white,
+				green, white,
+				green, white,
+				green, white)
+
+			if(strcmp(argv[arg_index], "bit32") == 0) options.mode = AsmBitMode::bit32;
+			else if(strcmp(argv[arg_index], "bit64") == 0) options.mode = AsmBitMode::bit64;
+			else options.mode = AsmBitMode::bit16;
+		}
+
+		if(strcmp(argv[arg_index], "-EFBP") == 0)
+		{
+			arg_index++;
+			MASM_assert(arg_index < args && (strcmp(argv[arg_index], "mbr") == 0 || strcmp(argv[arg_index], "ssboot") == 0 || strcmp(argv[arg_index], "adasm") == 0),
+				"\n%sArgument Error:%s\n\t`-EFBP` expects %s`mbr`%s, %s`ssboot`%s or %s`adasm`%s.\n",
+				red, white,
+				green, white,
+				green, white,
+				green, white)
+
+			if(strcmp(argv[arg_index], "mbr") == 0) options.boot_profile = BootProfile::BP_mbr;
+			else if(strcmp(argv[arg_index], "ssboot") == 0) options.boot_profile = BootProfile::BP_ssboot;
+			else options.boot_profile = BootProfile::BP_adasm;
+		}
+
+		if(strncmp(argv[arg_index], "--export=", 9) == 0)
+		{
+			MASM_assert(argv[arg_index][9] != '\0',
+				"\n%sArgument Error:%s\n\tMissing `[name,...]` following `--export=`.\n",
+				red, white)
+
+			options.exports = &argv[arg_index][9];
+		}
+
+		if(strncmp(argv[arg_index], "--budget=", 9) == 0)
+		{
+			MASM_assert(argv[arg_index][9] != '\0',
+				"\n%sArgument Error:%s\n\tMissing `[name:bytes,...]` following `--budget=`.\n",
+				red, white)
+
+			options.budgets = &argv[arg_index][9];
+		}
+
+		if(strcmp(argv[arg_index], "-OF") == 0)
+		{
+			arg_index++;
+			MASM_assert(arg_index < args && (strcmp(argv[arg_index], "bin") == 0 || strcmp(argv[arg_index], "elf32") == 0),
+				"\n%sArgument Error:%s\n\t`-OF` expects %s`bin`%s or %s`elf32`%s.\n",
+				red, white,
+				green, white,
+				green, white)
+
+			options.format = strcmp(argv[arg_index], "elf32") == 0 ? OutputFormat::OF_elf32 : OutputFormat::OF_bin;
+		}
+
+		if(strcmp(argv[arg_index], "-o") == 0)
+		{
+			arg_index++;
+			MASM_assert(arg_index < args,
+				"\n%sArgument Error:%s\n\tMissing `[out]` following `-o`.\n",
+				red, white)
+
+			options.output_filename = argv[arg_index];
+		}
+
+		if(strncmp(argv[arg_index], "--trace=", 8) == 0)
+		{
+			MASM_assert(argv[arg_index][8] != '\0',
+				"\n%sArgument Error:%s\n\tMissing `[out]` following `--trace=`.\n",
+				red, white)
+
+			masm_trace::tracer.enable(&argv[arg_index][8]);
+		}
+
+		if(strncmp(argv[arg_index], "--alloc-gate=", 13) == 0)
+		{
+			alloc_gate = atof(&argv[arg_index][13]);
+			MASM_assert(alloc_gate > 0.0,
+				"\n%sArgument Error:%s\n\t`--alloc-gate=` expects a positive amount of allocations per KB of source.\n",
+				red, white)
+
+			#ifndef MASM_ALLOC_PROFILE
+			MASM_warning("\n%sArgument Warning:%s\n\t`--alloc-gate` is ignored; this build does not count allocations. Build with %s`make alloc-profile`%s.\n",
+				yellow, white,
+				green, white)
+			#endif
+		}
+
+		arg_index++;
+		goto reloop;
+	}
+
+	MASM_assert(options.format != OutputFormat::OF_elf32 || options.mode != AsmBitMode::bit64,
+		"\n%sArgument Error:%s\n\t`-OF elf32` can only be used with %s`-AT bit16`%s or %s`-AT bit32`%s.\n",
+		red, white,
+		green, white,
+		green, white)
+
+	MASM_assert(!options.simulate || (options.mode == AsmBitMode::bit16 && options.format == OutputFormat::OF_bin),
+		"\n%sArgument Error:%s\n\t`--simulate` runs real mode boot code; it needs %s`-AT bit16`%s and %s`-OF bin`%s.\n",
+		red, white,
+		green, white,
+		green, white)
+
+	masm_diag::sink.set_error_limit(options.max_errors);
+
+	/* The mode is a template parameter of the whole assembler; pick the instantiation once. */
+	switch(options.mode)
+	{
+		case AsmBitMode::bit16: assemble<AsmBitMode::bit16> (filename, options);break;
+		case AsmBitMode::bit32: assemble<AsmBitMode::bit32> (filename, options);break;
+		case AsmBitMode::bit64: assemble<AsmBitMode::bit64> (filename, options);break;
+	}
+
+	masm_trace::tracer.write();
+
+	#ifdef MASM_ALLOC_PROFILE
+	masm_alloc::report();
+	if(alloc_gate > 0.0)
+		MASM_assert(masm_alloc::allocs_per_KB() <= alloc_gate,
+			"\n%s[ALLOCATION GATE]%s\t%.2f allocations per KB of source exceeds the gate of %.2f.\n",
+			red, white,
+			masm_alloc::allocs_per_KB(), alloc_gate)
+	#endif
+
+	masm_diag::sink.flush();
 	return 0;
 }
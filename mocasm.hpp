@@ -1,6 +1,9 @@
 #ifndef Moca_assembly
 #define Moca_assembly
 #include "common.hpp"
+#include "asm_trace.hpp"
+#include "asm_san.hpp"
+using namespace masm_san;
 
 #include "asm_lexer.hpp"
 using namespace masm_lexer;
@@ -8,27 +11,206 @@ using namespace masm_lexer;
 #include "asm_parser.hpp"
 using namespace masm_parser;
 
+#include "asm_elf.hpp"
+using namespace masm_elf;
+
+#include "asm_link.hpp"
+using namespace masm_link;
+
+#include "assembler_backend/asm_simulator.hpp"
+using namespace masm_sim;
+
+#include "assembler_backend/asm_cycles.hpp"
+using namespace masm_cycles;
+
+#include "assembler_backend/asm_budget.hpp"
+using namespace masm_budget;
+
 namespace moca_assembler
 {
 
+/* `-OF`. */
+enum class OutputFormat
+{
+	OF_bin,		// flat binary
+	OF_elf32	// ELF32 relocatable object
+};
+
+/* `-EFBP`: which part of the FAMP boot protocol the file is. */
+enum class BootProfile
+{
+	BP_none,
+	BP_mbr,		// Master Boot Record
+	BP_ssboot,	// second-stage bootloader
+	BP_adasm	// "add-on" assembly library
+};
+
+/* Everything given on the command line that changes how a file gets assembled. */
+struct assembler_options
+{
+	AsmBitMode		mode = AsmBitMode::bit16;
+	OutputFormat	format = OutputFormat::OF_bin;
+	BootProfile		boot_profile = BootProfile::BP_none;
+	const nt_BYTE	*exports = nullptr;		// `--export=`; names separated by commas
+	const nt_BYTE	*budgets = nullptr;		// `--budget=`; `name:bytes` separated by commas
+	bool			store_all_names = false;
+	bool			ir_stats = false;
+	bool			optimize = false;
+	bool			check_determinism = false;
+	ut_DWORD		amnt_of_threads = 0;	// 0: one per core
+	LexerMode		lexer_mode = LexerMode::LM_auto;
+	ut_DWORD		max_errors = 1;			// `--max-errors=`
+	ut_LLBYTE		simulate = 0;			// `--simulate`: instruction limit; 0 for no simulation
+	const nt_BYTE	*cycle_model = nullptr;	// `--cycles=`
+	ut_DWORD		loop_alignment = 0;		// `--align-loops=`; 0 leaves loop heads alone
+	ut_DWORD		loop_budget = 32;		// bytes of loop head padding per section
+	const nt_BYTE	*output_filename = nullptr;
+};
+
+/* `file.masm` -> `file[extension]`. */
+inline std::string replace_extension(const nt_BYTE *filename, const nt_BYTE *extension)
+{
+	std::string new_filename = filename;
+	ut_LSIZE dot = new_filename.rfind('.');
+
+	if(dot != std::string::npos && new_filename.find('/', dot) == std::string::npos)
+		new_filename.erase(dot);
+
+	return new_filename + extension;
+}
+
+/* Trailing zeros (`pad` up to the end of a disk image) are not written; the file is extended with `ftruncate`,
+ * which leaves a hole on filesystems that support them.
+ * */
+inline void write_image(std::string output_filename, std::vector<ut_BYTE> &code)
+{
+	FILE *out = fopen(output_filename.c_str(), "wb");
+	MASM_assert(out,
+		"\n%s[FILE ERROR]%s\tThere was an error opening the output file `%s`.\n",
+		red, white,
+		output_filename.c_str())
+
+	ut_LSIZE length = code.size();
+	while(length > 0 && code[length - 1] == 0) length--;
+
+	/* Not worth a hole. */
+	if(code.size() - length < 4096) length = code.size();
+
+	fwrite(code.data(), sizeof(ut_BYTE), length, out);
+	fflush(out);
+	MASM_assert(length == code.size() || ftruncate(fileno(out), code.size()) == 0,
+		"\n%s[FILE ERROR]%s\tThere was an error extending the output file `%s`.\n",
+		red, white,
+		output_filename.c_str())
+	fclose(out);
+}
+
+template<AsmBitMode M>
 class masm_assembler
 {
 private:
 	MocaAsm_lexer *mlex = nullptr;
-	MocaAsm_parser *mpars = nullptr;
+	MocaAsm_parser<M> *mpars = nullptr;
+	MocaAsm_symtab *symtab = nullptr;
 
 public:
-	masm_assembler(nt_BYTE *filename)
+	masm_assembler(nt_BYTE *filename, struct assembler_options &options)
 	{
-		mlex = new MocaAsm_lexer(filename);
-		mpars = new MocaAsm_parser(mlex, mlex->get_instance());
+		MASM_TRACE_SPAN("file", "assemble", filename);
+
+		{
+			MASM_TRACE_SPAN("lexer", "open", filename);
+			mlex = new MocaAsm_lexer(filename);
+		}
+
+		symtab = new MocaAsm_symtab;
+		mlex->get_instance()->set_symbol_table(symtab);
+		/* Recovering from an error skips the rest of the line in the lexer; that only works with the serial one. */
+		mlex->start(options.max_errors > 1 ? LexerMode::LM_serial : options.lexer_mode, options.amnt_of_threads);
+
+		mpars = new MocaAsm_parser<M>(mlex, mlex->get_instance());
 		mpars->start_assembler();
-		mpars->parse();
+		if(options.boot_profile == BootProfile::BP_adasm) mpars->eliminate_dead_code(options.exports);
+		bool account_sizes = options.boot_profile == BootProfile::BP_mbr || options.boot_profile == BootProfile::BP_ssboot || options.budgets;
+		if(account_sizes) mpars->get_ir().count_sizes();
+		if(options.loop_alignment) mpars->get_ir().align_loops(options.loop_alignment, options.loop_budget);
+		mpars->parse(options.optimize, options.format == OutputFormat::OF_elf32, options.amnt_of_threads, options.check_determinism);
+		if(options.ir_stats)
+		{
+			mpars->get_ir().report();
+			mpars->get_macros().report();
+		}
+		if(account_sizes) check_sizes(options);
+
+		if(options.format == OutputFormat::OF_elf32)
+			write_object(options.output_filename ? std::string(options.output_filename) : replace_extension(filename, ".o"));
+		else
+			write_output(options.output_filename ? std::string(options.output_filename) : replace_extension(filename, ".bin"));
+		if(options.store_all_names) write_names(filename);
+		if(options.cycle_model) estimate_cycles(filename, options.cycle_model);
+		if(options.simulate) simulate(options.simulate);
+	}
+
+	/* `-EFBP mbr`/`ssboot` and `--budget=`; before anything is written, so a build over budget leaves nothing behind. */
+	void check_sizes(struct assembler_options &options)
+	{
+		MASM_TRACE_SPAN("output", "check_sizes");
+
+		MocaAsm_size_budget budget(mpars->get_ir(), *symtab, options.budgets);
+		budget.report();
+		budget.enforce(options.format == OutputFormat::OF_bin ? &mpars->get_code() : nullptr, options.boot_profile == BootProfile::BP_mbr);
+	}
+
+	/* `--cycles=`; `file.masm` gets its annotated listing written to `file.cycles`. */
+	void estimate_cycles(nt_BYTE *filename, const nt_BYTE *model)
+	{
+		MASM_TRACE_SPAN("output", "estimate_cycles", model);
+
+		MocaAsm_cycle_table table(find_cycle_table(model).c_str());
+		MocaAsm_cycle_estimator estimator(mpars->get_ir(), *symtab, table);
+
+		estimator.write_listing(replace_extension(filename, ".cycles").c_str(), filename);
+		estimator.report();
+	}
+
+	/* `--simulate`; runs the image as a boot sector and reports where the instructions went. */
+	void simulate(ut_LLBYTE instruction_limit)
+	{
+		MASM_TRACE_SPAN("output", "simulate");
+
+		MocaAsm_simulator simulator(mpars->get_code(), *symtab);
+		simulator.run(instruction_limit);
+		simulator.report(*symtab);
+	}
+
+	/* Flat binary; `file.masm` gets written to `file.bin` unless `-o` says otherwise. */
+	void write_output(std::string output_filename)
+	{
+		MASM_TRACE_SPAN("output", "write_output", output_filename.c_str());
+		write_image(output_filename, mpars->get_code());
+	}
+
+	/* `-OF elf32`; `file.masm` gets written to `file.o` unless `-o` says otherwise. */
+	void write_object(std::string output_filename)
+	{
+		MASM_TRACE_SPAN("output", "write_object", output_filename.c_str());
+
+		MocaAsm_elf_writer elf_writer;
+		elf_writer.write(output_filename.c_str(), mpars->get_ir(), mpars->get_objects(), *symtab);
+	}
+
+	/* `-SAN`; `file.masm` gets its names written to `file.san`. */
+	void write_names(nt_BYTE *filename)
+	{
+		MASM_TRACE_SPAN("output", "write_names", filename);
+
+		MocaAsm_san_writer san_writer;
+		san_writer.write(replace_extension(filename, ".san").c_str(), *symtab);
 	}
 
 	template<typename T>
 		requires std::is_same<T, MocaAsm_lexer>::value || 
-			std::is_same<T, MocaAsm_parser>::value ||
+			std::is_same<T, MocaAsm_parser<M>>::value ||
 			std::is_same<T, masm_assembler>::value
 	void delete_instance(T *instance)
 	{
@@ -41,17 +223,51 @@ public:
 	{
 		if(mlex) delete mlex;
 		if(mpars) delete mpars;
+		if(symtab) delete symtab;
 
 		mlex = nullptr;
 		mpars = nullptr;
+		symtab = nullptr;
 
-		/* Debug. */
-		std::cout << "\n[DEBUG]\tDeleted `MocaAsm_parser` instance." << std::endl;
-		std::cout << "[DEBUG]\tDeleted `MocaAsm_lexer` instance." << std::endl;
-		std::cout << "[DEBUG]\tDeleted `masm_assembler` instance." << std::endl;
+		/* Every source position of this file has been reported by now. */
+		sources.clear();
+
+		MASM_debug("\n[DEBUG]\tDeleted `MocaAsm_parser` instance.\n");
+		MASM_debug("[DEBUG]\tDeleted `MocaAsm_lexer` instance.\n");
+		MASM_debug("[DEBUG]\tDeleted `masm_assembler` instance.\n");
 	}
 };
 
+/* Assemble `filename` with the instantiation for mode `M`. */
+template<AsmBitMode M>
+void assemble(nt_BYTE *filename, struct assembler_options &options)
+{
+	masm_diag::file_scope diagnostics;
+	masm_assembler<M> *massembler = new masm_assembler<M>(filename, options);
+	massembler->template delete_instance<masm_assembler<M>> (massembler);
+}
+
+/* `masm --link`; `inputs` are `-OF elf32` objects, linked in the order given. */
+inline void link(std::vector<const nt_BYTE *> &inputs, ut_DWORD base, struct assembler_options &options)
+{
+	masm_diag::file_scope diagnostics;
+	MASM_TRACE_SPAN("file", "link", inputs[0]);
+
+	std::string output_filename = options.output_filename ? std::string(options.output_filename) : replace_extension(inputs[0], ".bin");
+	MocaAsm_linker *linker = new MocaAsm_linker(base);
+
+	for(const nt_BYTE *input : inputs) linker->add_unit(input);
+	linker->link();
+	if(options.ir_stats) linker->report();
+
+	{
+		MASM_TRACE_SPAN("output", "write_output", output_filename.c_str());
+		write_image(output_filename, linker->get_image());
+	}
+	if(options.store_all_names) linker->write_names(replace_extension(output_filename.c_str(), ".san").c_str());
+
+	delete linker;
+}
 }
 
 #endif
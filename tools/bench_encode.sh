@@ -0,0 +1,79 @@
+#!/bin/sh
+# Encoding benchmark: `make bench-encode [LINES=N] [THREADS="1 2 4 8"] [DENSE_LINES=N] [BASELINE=commit] [COMMIT=commit]`.
+#
+# Generates a dense 32-bit source of `LINES` instructions (`tools/gen_source.sh`; it has labels, branches, `times`
+# and section switches, so chunks are cut everywhere they can be), then assembles it with every thread count in `THREADS`.
+# Every run uses `--check-determinism`, and the outputs of all runs have to be identical.
+#
+# Then times an instruction-dense source of `DENSE_LINES` lines (the 16-instruction mix only) with a `-O2` build,
+# best of 5, and counts the parser-phase allocations of a `-DMASM_ALLOC_PROFILE` build on it.
+# `COMMIT` measures that commit instead of the working tree; with `BASELINE`, that commit is measured the same way first,
+# and the two outputs are compared (later changes such as branch relaxation change the bytes, so a mismatch is only reported).
+# The instruction-form table commit against its parent: `make bench-encode THREADS=1 BASELINE=8ce57ef COMMIT=3f07e2c`.
+
+LINES=${LINES:-1000000}
+THREADS=${THREADS:-"1 2 4 8"}
+DENSE_LINES=${DENSE_LINES:-400000}
+SOURCE=bin/bench_encode.masm
+
+sh tools/gen_source.sh $LINES $SOURCE
+
+for threads in $THREADS
+do
+	printf "%s thread(s):" "$threads"
+	./bin/main.o $SOURCE -AT bit32 -o bin/bench_encode.$threads.bin --threads=$threads --check-determinism --ir-stats 2>bin/bench_encode.log >/dev/null || { cat bin/bench_encode.log; exit 1; }
+	grep -E "encoding (chunks|time)" bin/bench_encode.log | tr -s ' \t' ' ' | tr -d '\n'
+	echo
+	cmp -s bin/bench_encode.$threads.bin bin/bench_encode.$(echo $THREADS | cut -d' ' -f1).bin || { echo "output differs from the first run"; exit 1; }
+done
+
+# `dense <name> <tree>`: builds `tree` with -O2 and with the allocation profile, then measures both on the dense source.
+dense()
+{
+	g++ $2/main.cpp -std=c++20 -O2 -o bin/bench_encode.O2.o || exit 1
+	g++ $2/main.cpp -std=c++20 -O2 -DMASM_ALLOC_PROFILE -o bin/bench_encode.alloc.o || exit 1
+
+	best=
+	for run in 1 2 3 4 5
+	do
+		start=$(date +%s%N)
+		./bin/bench_encode.O2.o $SOURCE -AT bit32 -o bin/bench_encode.$1.bin 2>bin/bench_encode.log >/dev/null || { cat bin/bench_encode.log; exit 1; }
+		end=$(date +%s%N)
+		[ -n "$best" ] && [ $best -le $(( end - start )) ] || best=$(( end - start ))
+	done
+
+	./bin/bench_encode.alloc.o $SOURCE -AT bit32 -o /dev/null 2>bin/bench_encode.log >/dev/null || { cat bin/bench_encode.log; exit 1; }
+	allocs=$(grep -E "^\s*parser\s" bin/bench_encode.log | awk '{ print $2 }') # phases without allocations have no row
+
+	echo "$1: $(( best / 1000000 )) ms (best of 5), ${allocs:-0} parser-phase allocs"
+}
+
+sh tools/gen_source.sh $DENSE_LINES $SOURCE dense
+echo "instruction-dense, $DENSE_LINES lines:"
+
+# `checkout <commit>`: measures the tree of `commit`.
+checkout()
+{
+	tree=$(mktemp -d)
+	git archive "$1" | tar -x -C $tree || exit 1
+	dense "$1" $tree
+	rm -rf $tree
+}
+
+[ -z "$BASELINE" ] || checkout "$BASELINE"
+
+if [ -n "$COMMIT" ]
+then
+	checkout "$COMMIT"
+	tested=$COMMIT
+else
+	dense tree .
+	tested=tree
+fi
+
+if [ -n "$BASELINE" ]
+then
+	cmp -s "bin/bench_encode.$tested.bin" "bin/bench_encode.$BASELINE.bin" && echo "output identical to $BASELINE" || echo "output differs from $BASELINE"
+fi
+
+rm -f $SOURCE bin/bench_encode.*.bin bin/bench_encode.*.o bin/bench_encode.log
@@ -0,0 +1,58 @@
+#!/bin/sh
+# Lexer benchmark: `make bench-lexer [LINES=N] [MODES="serial pipelined parallel"] [BASELINE=commit] [MACRO_LINES=N]`.
+#
+# Assembles a generated source (`tools/gen_source.sh`) once with every `--lexer=` mode in `MODES`
+# and prints the wall time of each run; the outputs of all runs have to be identical.
+# With `BASELINE`, the assembler of that commit assembles it first (with its default lexer), to compare against.
+#
+# Then assembles a macro-heavy source of `MACRO_LINES` lines and the same program with every invocation written out,
+# prints both times and what `--ir-stats` says about the expansions; both outputs have to be identical.
+
+LINES=${LINES:-2000000}
+MODES=${MODES:-"serial pipelined parallel"}
+MACRO_LINES=${MACRO_LINES:-1000000}
+SOURCE=bin/bench_lexer.masm
+
+sh tools/gen_source.sh $LINES $SOURCE
+echo "$(wc -c < $SOURCE) bytes, $(nproc) core(s)"
+
+if [ -n "$BASELINE" ]
+then
+	tree=$(mktemp -d)
+	git archive "$BASELINE" | tar -x -C $tree || exit 1
+	g++ $tree/main.cpp -std=c++20 -Wall -fsanitize=leak -o bin/bench_baseline.o || exit 1
+	rm -rf $tree
+
+	start=$(date +%s%N)
+	./bin/bench_baseline.o $SOURCE -AT bit32 -o bin/bench_lexer.baseline.bin 2>bin/bench_lexer.log >/dev/null || { cat bin/bench_lexer.log; exit 1; }
+	end=$(date +%s%N)
+
+	echo "$BASELINE: $(( (end - start) / 1000000 )) ms"
+fi
+
+for mode in $MODES
+do
+	start=$(date +%s%N)
+	./bin/main.o $SOURCE -AT bit32 -o bin/bench_lexer.$mode.bin --lexer=$mode 2>bin/bench_lexer.log >/dev/null || { cat bin/bench_lexer.log; exit 1; }
+	end=$(date +%s%N)
+
+	echo "$mode: $(( (end - start) / 1000000 )) ms"
+	cmp -s bin/bench_lexer.$mode.bin bin/bench_lexer.$(echo $MODES | cut -d' ' -f1).bin || { echo "output differs from the first run"; exit 1; }
+	[ -z "$BASELINE" ] || cmp -s bin/bench_lexer.$mode.bin bin/bench_lexer.baseline.bin || { echo "output differs from $BASELINE"; exit 1; }
+done
+
+for kind in expanded macros
+do
+	sh tools/gen_source.sh $MACRO_LINES $SOURCE $kind
+
+	start=$(date +%s%N)
+	./bin/main.o $SOURCE -AT bit32 -o bin/bench_lexer.$kind.bin --ir-stats 2>bin/bench_lexer.log >/dev/null || { cat bin/bench_lexer.log; exit 1; }
+	end=$(date +%s%N)
+
+	echo "$kind, $MACRO_LINES lines: $(( (end - start) / 1000000 )) ms"
+done
+
+grep -E "expansions|cache hits|replayed from the IR|tokens spliced" bin/bench_lexer.log
+cmp -s bin/bench_lexer.macros.bin bin/bench_lexer.expanded.bin || { echo "macros assemble differently from the same program written out"; exit 1; }
+
+rm -f $SOURCE bin/bench_lexer.*.bin bin/bench_lexer.log bin/bench_baseline.o
@@ -0,0 +1,41 @@
+#!/bin/sh
+# `sh tools/gen_source.sh [lines] [out] [kind]`: a dense 32-bit source of `lines` instructions for the benchmarks.
+#	`mixed` (the default) has labels, branches, `times` and section switches every so often.
+#	`dense` is nothing but the 16-instruction mix, so the time goes to operand check-in, validation and encoding.
+#	`macros` invokes three macros on most lines: one with a handful of repeated constant arguments (the expansion cache
+#	and IR replay), one with a different constant every time (a cache miss each), one with a label (never cached).
+#	`expanded` is the same program with every invocation written out, so both have to assemble to the same bytes.
+
+awk -v lines="$1" -v kind="${3:-mixed}" 'BEGIN {
+	split("mov ax, 0x10|mov bx, ax|add ax, bx|sub cx, 0x2|and dx, ax|or al, bl|xor ax, ax|shl bx, 0x3|inc cx|dec dx|cmp ax, 0x5|mov [0x7C00], ax|jne start|int 0x10|call start|cli", body, "|")
+
+	if(kind == "macros")
+	{
+		print "%macro bios_print 1\n\tmov ah, 0x0E\n\tmov al, %1\n\tint 0x10\n%endmacro"
+		print "%macro load 2\n\tmov %1, %2\n\tadd %1, 0x1\n%endmacro"
+		print "%macro call_at 1\n\tcall %1\n\tcli\n%endmacro"
+	}
+
+	print "start:"
+	for(i = 0; i < lines; i++)
+	{
+		if(kind == "macros" || kind == "expanded")
+		{
+			char = sprintf("0x%X", 65 + int(i / 4) % 4)
+			value = sprintf("0x%X", i % 65536)
+
+			if(i % 4 == 0) print kind == "macros" ? "bios_print " char : "mov ah, 0x0E\nmov al, " char "\nint 0x10"
+			if(i % 4 == 1) print kind == "macros" ? "load bx, " value : "mov bx, " value "\nadd bx, 0x1"
+			if(i % 4 == 2) print kind == "macros" ? "call_at start" : "call start\ncli"
+			if(i % 4 != 3) continue
+		}
+		else if(kind == "mixed")
+		{
+			if(i % 1000 == 0) printf "l%d:\n", i
+			if(i % 5000 == 4999) { print ".data"; printf "d%d dd l%d\n", i, i - i % 1000; print ".text" }
+			if(i % 3000 == 2999) print "times 4 db 0x90"
+			if(i % 700 == 699) printf "jmp l%d\n", i - i % 1000
+		}
+		print body[i % 16 + 1]
+	}
+}' > "$2"
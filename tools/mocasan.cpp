@@ -0,0 +1,53 @@
+#include "../common.hpp"
+#include "../asm_san.hpp"
+using namespace masm_san;
+
+/* Reads and verifies a `-SAN` symbol file.
+ *      `mocasan [file.san]`            verify the file and list every symbol
+ *      `mocasan [file.san] [name]`     verify the file and look `name` up through the hash index
+ * */
+int main(int args, char *argv[])
+{
+	MASM_assert(args > 1,
+		"\n%sInvalid Amount Of Arguments:%s\n\tUsage: %s`mocasan [file.san] [name]`%s; `[name]` is optional.\n",
+		red, white,
+		green, white)
+
+	MocaAsm_san_reader *reader = new MocaAsm_san_reader(argv[1]);
+
+	const nt_BYTE *problem = reader->verify();
+	MASM_assert(!problem,
+		"\n%s[SAN ERROR]%s\t`%s` failed verification: %s.\n",
+		red, white,
+		argv[1], problem)
+
+	if(args > 2)
+	{
+		const struct san_record *record = reader->lookup(argv[2]);
+		MASM_assert(record,
+			"\n%s[SAN ERROR]%s\t`%s` is not in `%s`.\n",
+			red, white,
+			argv[2], argv[1])
+
+		printf("%s\t%s\tsection %u\tvalue 0x%X\tsize %u\n",
+			reader->name_of(record),
+			record->kind == (ut_BYTE) SanSymbolKind::SK_label ? "label" : "variable",
+			record->section, record->value, record->size);
+
+		delete reader;
+		return 0;
+	}
+
+	printf("%s: %u symbols, verified.\n", argv[1], reader->amnt_of_symbols());
+	for(ut_DWORD i = 0; i < reader->amnt_of_symbols(); i++)
+	{
+		const struct san_record *record = reader->get_record(i);
+		printf("\t%-32s %-8s section %u\tvalue 0x%X\tsize %u\n",
+			reader->name_of(record),
+			record->kind == (ut_BYTE) SanSymbolKind::SK_label ? "label" : "variable",
+			record->section, record->value, record->size);
+	}
+
+	delete reader;
+	return 0;
+}
@@ -0,0 +1,43 @@
+#!/bin/sh
+# Lexer diagnostics test: `make test-lexer [LINES=N] [MODES="pipelined parallel"]`.
+#
+# Puts errors into a generated source (`tools/gen_source.sh`) and assembles it serially and with every `--lexer=` mode
+# in `MODES`; every mode has to report exactly what the serial lexer reports, byte for byte. Lexing ahead finds an error
+# further down the file before the parser gets to one further up; the one further up still has to be the one reported.
+
+LINES=${LINES:-300000}
+MODES=${MODES:-"pipelined parallel"}
+SOURCE=bin/test_lexer.masm
+CLEAN=bin/test_lexer.clean.masm
+
+# LeakSanitizer reports whatever is still allocated when an error exits, with addresses that differ from run to run.
+export LSAN_OPTIONS=detect_leaks=0
+
+sh tools/gen_source.sh $LINES $CLEAN
+
+# `check <name> <awk program>`: the clean source edited by the program, assembled by every mode.
+check()
+{
+	awk "$2" $CLEAN > $SOURCE
+
+	./bin/main.o $SOURCE -AT bit32 -o bin/test_lexer.bin --lexer=serial >/dev/null 2>bin/test_lexer.serial.log
+	[ -s bin/test_lexer.serial.log ] || { echo "$1: the serial lexer reports nothing"; exit 1; }
+
+	for mode in $MODES
+	do
+		./bin/main.o $SOURCE -AT bit32 -o bin/test_lexer.bin --lexer=$mode >/dev/null 2>bin/test_lexer.$mode.log
+		cmp -s bin/test_lexer.serial.log bin/test_lexer.$mode.log || { echo "$1: $mode reports something else than serial:"; diff bin/test_lexer.serial.log bin/test_lexer.$mode.log; exit 1; }
+	done
+
+	echo "$1: ok"
+}
+
+last=$(( LINES * 9 / 10 ))
+
+check "parse error, then a bad number" "NR == $LINES / 2 { print \"mov ax,, bx\"; next } NR == $last { print \"mov ax, 0xZZ\"; next } { print }"
+check "parse error, bad number right after" "NR == $last { print \"mov ax,, bx\"; next } NR == $last + 2 { print \"mov ax, 0xZZ\"; next } { print }"
+check "bad number, then a parse error" "NR == $LINES / 2 { print \"mov ax, 1F\"; next } NR == $last { print \"mov ax,, bx\"; next } { print }"
+check "unexpected character" "NR == $last { print \"mov ax, @\"; next } { print }"
+check "unterminated string" "NR == $last { print \"incsrc \\\"missing.masm\"; next } { print }"
+
+rm -f $SOURCE $CLEAN bin/test_lexer.bin bin/test_lexer.*.log